@@ -87,8 +87,8 @@ struct irati_msg_layout irati_ker_numtables[] = {
     },
     [RINA_C_IPCM_QUERY_RIB_REQUEST] = {
         .copylen = sizeof(struct irati_kmsg_ipcm_query_rib)
-		   - 3 * sizeof(char *),
-        .strings = 3,
+		   - 4 * sizeof(char *),
+        .strings = 4,
     },
     [RINA_C_IPCM_QUERY_RIB_RESPONSE] = {
         .copylen = sizeof(struct irati_kmsg_ipcm_query_rib_resp) -
@@ -2877,7 +2877,7 @@ void serialize_dif_config(void **pptr, const struct dif_config *dif_config)
 
 int deserialize_dif_config(const void **pptr, struct dif_config ** dif_config)
 {
-	int ret;
+	int ret = 0;
 	struct ipcp_config * pos;
 	uint16_t size;
 	int i;
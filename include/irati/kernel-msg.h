@@ -414,9 +414,13 @@ struct irati_kmsg_ipcm_query_rib {
 
         uint64_t   object_instance;
         uint32_t   scope;
+        /* Maximum objects per response (0 = no limit) */
+        uint32_t   page_size;
         string_t * filter;
         string_t * object_class;
         string_t * object_name;
+        /* Name of the last object of the previous page ("" = first) */
+        string_t * cursor;
 } __attribute__((packed));
 
 /* 19 RINA_C_IPCM_QUERY_RIB_RESPONSE */
@@ -429,6 +433,8 @@ struct irati_kmsg_ipcm_query_rib_resp {
 	uint32_t event_id;
 
 	int8_t result;
+	/* More objects are pending after this page */
+	uint8_t more;
         struct query_rib_resp * rib_entries;
 } __attribute__((packed));
 
@@ -19,8 +19,6 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
-#include <linux/bitmap.h>
-
 #define RINA_PREFIX "cidm"
 
 #include "logs.h"
@@ -28,17 +26,13 @@
 #include "utils.h"
 #include "cidm.h"
 #include "common.h"
+#include "rds/rbmp.h"
 
-#define MAX_CEP_ID (((2 << BITS_PER_BYTE) * sizeof(cep_id_t)) - 1)
+/* Cep-ids 1 .. MAX_CEP_ID, as many as a 2 bytes cep-id field holds */
+#define MAX_CEP_ID ((1 << 16) - 1)
 
 struct cidm {
-	struct list_head allocated_cep_ids;
-	cep_id_t last_allocated;
-};
-
-struct alloc_cepid {
-        struct list_head       list;
-        cep_id_t cep_id;
+	struct rbmp * bitmap;
 };
 
 struct cidm * cidm_create(void)
@@ -49,10 +43,13 @@ struct cidm * cidm_create(void)
 	if (!instance)
 		return NULL;
 
-	INIT_LIST_HEAD(&(instance->allocated_cep_ids));
-	instance->last_allocated = 0;
+	instance->bitmap = rbmp_create(MAX_CEP_ID, 1);
+	if (!instance->bitmap) {
+		rkfree(instance);
+		return NULL;
+	}
 
-	LOG_INFO("Instance initialized successfully (%zd cep-ids)",
+	LOG_INFO("Instance initialized successfully (%d cep-ids)",
 			MAX_CEP_ID);
 
 	return instance;
@@ -60,17 +57,12 @@ struct cidm * cidm_create(void)
 
 int cidm_destroy(struct cidm * instance)
 {
-	struct alloc_cepid * pos, * next;
-
         if (!instance) {
                 LOG_ERR("Bogus instance passed, bailing out");
                 return -1;
         }
 
-        list_for_each_entry_safe(pos, next, &instance->allocated_cep_ids, list) {
-                rkfree(pos);
-        }
-
+        rbmp_destroy(instance->bitmap);
         rkfree(instance);
 
         return 0;
@@ -78,56 +70,29 @@ int cidm_destroy(struct cidm * instance)
 
 int cidm_allocated(struct cidm * instance, cep_id_t cep_id)
 {
-	struct alloc_cepid * pos, * next;
-
         if (!instance) {
                 LOG_ERR("Bogus instance passed, bailing out");
                 return -1;
         }
 
-        list_for_each_entry_safe(pos, next, &instance->allocated_cep_ids, list) {
-                if (pos->cep_id == cep_id) {
-                	return 1;
-                }
-        }
-
-        return 0;
+        return rbmp_is_allocated(instance->bitmap, cep_id) ? 1 : 0;
 }
 
 cep_id_t cidm_allocate(struct cidm * instance)
 {
-	struct alloc_cepid * new_cep_id;
         cep_id_t cep_id;
 
         if (!instance) {
                 LOG_ERR("Bogus instance passed, bailing out");
-                return port_id_bad();
+                return cep_id_bad();
         }
 
-        if (instance->last_allocated == MAX_CEP_ID) {
-        	cep_id = 1;
-        } else {
-        	cep_id = instance->last_allocated + 1;
+        cep_id = rbmp_allocate(instance->bitmap);
+        if (!rbmp_is_id_ok(instance->bitmap, cep_id)) {
+                LOG_ERR("No cep-ids left");
+                return cep_id_bad();
         }
 
-        while (cidm_allocated(instance, cep_id)) {
-        	if (cep_id == MAX_CEP_ID) {
-        		cep_id = 1;
-        	} else {
-        		cep_id ++;
-        	}
-        }
-
-        new_cep_id = rkmalloc(sizeof(*new_cep_id), GFP_ATOMIC);
-        if (!new_cep_id)
-        	return cep_id_bad();
-
-        INIT_LIST_HEAD(&(new_cep_id->list));
-        new_cep_id->cep_id = cep_id;
-        list_add(&(new_cep_id->list), &(instance->allocated_cep_ids));
-
-        instance->last_allocated = cep_id;
-
         LOG_DBG("Cep-id allocation completed successfully (id = %d)", cep_id);
 
         return cep_id;
@@ -136,9 +101,7 @@ cep_id_t cidm_allocate(struct cidm * instance)
 int cidm_release(struct cidm * instance,
                  cep_id_t      id)
 {
-	struct alloc_cepid * pos, * next;
-
-       if (!is_port_id_ok(id)) {
+       if (!is_cep_id_ok(id)) {
                LOG_ERR("Bad cep-id passed, bailing out");
                return -1;
        }
@@ -147,17 +110,12 @@ int cidm_release(struct cidm * instance,
                return -1;
        }
 
-       list_for_each_entry_safe(pos, next, &instance->allocated_cep_ids, list) {
-               if (pos->cep_id == id) {
-               	list_del(&pos->list);
-               	rkfree(pos);
-               	LOG_DBG("Cep-id release completed successfully (cep_id: %d)", id);
-
-               	return 0;
-               }
+       if (rbmp_release(instance->bitmap, id)) {
+               LOG_ERR("Didn't find cep-id %d, returning error", id);
+               return 0;
        }
 
-       LOG_ERR("Didn't find cep-id %d, returning error", id);
+       LOG_DBG("Cep-id release completed successfully (cep_id: %d)", id);
 
        return 0;
 }
@@ -30,6 +30,8 @@ struct cidm * cidm_create(void);
 int           cidm_destroy(struct cidm * instance);
 
 cep_id_t      cidm_allocate(struct cidm * instance);
+int           cidm_allocated(struct cidm * instance,
+                             cep_id_t      cep_id);
 int           cidm_release(struct cidm * instance,
                            cep_id_t      cep_id);
 
@@ -28,6 +28,7 @@
 #include "kipcm.h"
 #include "utils.h"
 #include "rds/robjects.h"
+#include "rds/rds.h"
 #include "iodev.h"
 #include "ctrldev.h"
 
@@ -65,6 +66,15 @@ static int __init mod_init(void)
 {
         LOG_DBG("IRATI RINA implementation initializing");
 
+#ifdef CONFIG_RINA_RDS_REGRESSION_TESTS
+        LOG_DBG("Starting RDS regression tests");
+        if (!regression_tests_rds()) {
+                LOG_ERR("RDS regression tests failed, bailing out");
+                return -1;
+        }
+        LOG_DBG("RDS regression tests completed successfully");
+#endif
+
         LOG_DBG("Creating root rset");
         if (robject_init_and_add(&core_object, &core_rtype, NULL, "rina")) {
                 LOG_ERR("Cannot initialize root rset, bailing out");
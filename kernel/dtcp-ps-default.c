@@ -260,6 +260,7 @@ static int rtt_calculation(struct dtcp_ps * ps, timeout_t start_time)
 		return -1;
 
 	new_sample = jiffies_to_msecs(jiffies - start_time);
+	rstats_hist_add(dtcp->rstats, (u64) new_sample * USEC_PER_MSEC);
 
 	spin_lock_bh(&dtcp->parent->sv_lock);
 
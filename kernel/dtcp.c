@@ -98,6 +98,9 @@ static ssize_t dtcp_attr_show(struct robject *		     robj,
 	if (strcmp(robject_attr_name(attr), "rttvar") == 0) {
 		return sprintf(buf, "%u\n", instance->sv->rttvar);
 	}
+	if (strcmp(robject_attr_name(attr), "rtt_hist") == 0) {
+		return rstats_hist_show(instance->rstats, buf);
+	}
 	/* Flow control */
 	if (strcmp(robject_attr_name(attr), "closed_win_q_length") == 0) {
 		return sprintf(buf, "%zu\n", cwq_size(instance->parent->cwq));
@@ -168,7 +171,7 @@ static ssize_t dtcp_attr_show(struct robject *		     robj,
 	return 0;
 }
 RINA_SYSFS_OPS(dtcp);
-RINA_ATTRS(dtcp, rtt, srtt, rttvar, ps_name);
+RINA_ATTRS(dtcp, rtt, srtt, rttvar, rtt_hist, ps_name);
 RINA_KTYPE(dtcp);
 
 int ctrl_pdu_send(struct dtcp * dtcp, pdu_type_t type, bool direct)
@@ -1148,6 +1151,13 @@ struct dtcp * dtcp_create(struct dtp *         dtp,
 
         tmp->parent = dtp;
 
+        tmp->rstats = rstats_create_ni();
+        if (!tmp->rstats) {
+                LOG_ERR("Cannot create DTCP statistics");
+                dtcp_destroy(tmp);
+                return NULL;
+        }
+
 	if (robject_init_and_add(&tmp->robj,
 				 &dtcp_rtype,
 				 parent,
@@ -1232,6 +1242,7 @@ int dtcp_destroy(struct dtcp * instance)
         rtimer_destroy(&instance->rendezvous_rcv);
         rina_component_fini(&instance->base);
         robject_del(&instance->robj);
+        rstats_destroy(instance->rstats);
         rkfree(instance);
 
         LOG_DBG("Instance %pK destroyed successfully", instance);
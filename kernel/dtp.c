@@ -56,13 +56,6 @@ static struct dtp_sv default_sv = {
         .max_seq_nr_sent               = 0,
         .seq_number_rollover_threshold = 0,
         .max_seq_nr_rcv                = 0,
-	.stats = {
-		.drop_pdus = 0,
-		.err_pdus = 0,
-		.tx_pdus = 0,
-		.tx_bytes = 0,
-		.rx_pdus = 0,
-		.rx_bytes = 0 },
         .rexmsn_ctrl                   = false,
         .rate_based                    = false,
         .window_based                  = false,
@@ -79,30 +72,17 @@ static struct dtp_sv default_sv = {
         .drf_flag             = true,
 };
 
-#define stats_get(name, sv, retval)				\
-        ASSERT(sv);						\
-        retval = sv->stats.name;				\
+#define stats_inc(name, dtp)					\
+        rstats_inc(dtp->rstats, RSTATS_##name##_PDUS)
 
-#define stats_inc(name, sv)					\
-        ASSERT(sv);						\
-        sv->stats.name##_pdus++;				\
-        LOG_DBG("PDUs __STRINGIFY(name) %u",			\
-		sv->stats.name##_pdus);				\
-
-#define stats_inc_bytes(name, sv, bytes)			\
-        ASSERT(sv);						\
-        sv->stats.name##_pdus++;				\
-	sv->stats.name##_bytes += (unsigned long) bytes;	\
-        LOG_DBG("PDUs __STRINGIFY(name) %u (%u)",		\
-		sv->stats.name##_pdus,				\
-		sv->stats.name##_bytes);			\
+#define stats_inc_bytes(name, dtp, bytes)			\
+        rstats_inc_bytes(dtp->rstats, RSTATS_##name##_PDUS, bytes)
 
 static ssize_t dtp_attr_show(struct robject *		     robj,
                          	     struct robj_attribute * attr,
                                      char *		     buf)
 {
 	struct dtp * instance;
-	unsigned int stats_ret;
 
 	instance = container_of(robj, struct dtp, robj);
 	if (!instance || !instance->cfg || !instance->sv)
@@ -132,42 +112,24 @@ static ssize_t dtp_attr_show(struct robject *		     robj,
 		return sprintf(buf, "%d\n",
 			dtp_conf_seq_num_ro_th(instance->cfg));
 	}
-	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(drop_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "err_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(err_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(tx_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(tx_bytes, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(rx_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(rx_bytes, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
+	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(instance->rstats, RSTATS_DROP_PDUS));
+	if (strcmp(robject_attr_name(attr), "err_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(instance->rstats, RSTATS_ERR_PDUS));
+	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(instance->rstats, RSTATS_TX_PDUS));
+	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(instance->rstats, RSTATS_TX_BYTES));
+	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(instance->rstats, RSTATS_RX_PDUS));
+	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(instance->rstats, RSTATS_RX_BYTES));
 	if (strcmp(robject_attr_name(attr), "ps_name") == 0) {
 		return sprintf(buf, "%s\n", instance->base.ps_factory->name);
 	}
@@ -842,12 +804,6 @@ int dtp_sv_init(struct dtp * dtp,
         ASSERT(dtp);
         ASSERT(dtp->sv);
 
-	dtp->sv->stats.drop_pdus = 0;
-	dtp->sv->stats.err_pdus = 0;
-	dtp->sv->stats.tx_pdus = 0;
-	dtp->sv->stats.tx_bytes = 0;
-	dtp->sv->stats.rx_pdus = 0;
-	dtp->sv->stats.rx_bytes = 0;
         dtp->sv->rexmsn_ctrl  = rexmsn_ctrl;
         dtp->sv->window_based = window_based;
         dtp->sv->rate_based   = rate_based;
@@ -1037,6 +993,13 @@ struct dtp * dtp_create(struct efcp *       efcp,
 
         dtp->efcp = efcp;
 
+        dtp->rstats = rstats_create();
+        if (!dtp->rstats) {
+                LOG_ERR("Cannot create DTP statistics");
+                dtp_destroy(dtp);
+                return NULL;
+        }
+
 	if (robject_init_and_add(&dtp->robj,
 				 &dtp_rtype,
 				 parent,
@@ -1194,6 +1157,7 @@ int dtp_destroy(struct dtp * instance)
         rina_component_fini(&instance->base);
 
 	robject_del(&instance->robj);
+        rstats_destroy(instance->rstats);
         rkfree(instance);
 
         LOG_DBG("DTP %pK destroyed successfully", instance);
@@ -1429,9 +1393,7 @@ int dtp_write(struct dtp * instance,
                 }
 
                 rcu_read_unlock();
-                spin_lock_bh(&instance->sv_lock);
-                stats_inc_bytes(tx, instance->sv, sbytes);
-                spin_unlock_bh(&instance->sv_lock);
+                stats_inc_bytes(TX, instance, sbytes);
 
                 /* Start SenderInactivityTimer */
                 if (rtimer_restart(&instance->timers.sender_inactivity,
@@ -1448,9 +1410,7 @@ int dtp_write(struct dtp * instance,
                          instance->rmt,
                          du))
 		return -1;
-        spin_lock_bh(&instance->sv_lock);
-	stats_inc_bytes(tx, instance->sv, sbytes);
-	spin_unlock_bh(&instance->sv_lock);
+        stats_inc_bytes(TX, instance, sbytes);
 	return 0;
 
 pdu_err_exit:
@@ -1462,9 +1422,7 @@ pdu_stats_err_exit:
 stats_err_exit:
         rcu_read_unlock();
 stats_nounlock_err_exit:
-	spin_lock_bh(&instance->sv_lock);
-	stats_inc(err, instance->sv);
-	spin_unlock_bh(&instance->sv_lock);
+	stats_inc(ERR, instance);
 	return -1;
 }
 
@@ -1599,7 +1557,7 @@ int dtp_receive(struct dtp * instance,
 
                         dtp_send_pending_ctrl_pdus(instance);
                         pdu_post(instance, du);
-			stats_inc_bytes(rx, instance->sv, sbytes);
+			stats_inc_bytes(RX, instance, sbytes);
 
                         return 0;
                 }
@@ -1607,7 +1565,7 @@ int dtp_receive(struct dtp * instance,
                 LOG_ERR("Expecting DRF but not present, dropping PDU %d...",
                         seq_num);
 
-		stats_inc(drop, instance->sv);
+		stats_inc(DROP, instance);
 		spin_unlock_bh(&instance->sv_lock);
 
                 du_destroy(du);
@@ -1624,7 +1582,7 @@ int dtp_receive(struct dtp * instance,
         	/* Duplicate PDU or flow control overrun */
         	LOG_ERR("Duplicate PDU or flow control overrun.SN: %u, LWE:%u",
         		 seq_num, LWE);
-                stats_inc(drop, instance->sv);
+                stats_inc(DROP, instance);
 
                 spin_unlock_bh(&instance->sv_lock);
 
@@ -1694,9 +1652,7 @@ int dtp_receive(struct dtp * instance,
                 if (pdu_post(instance, du))
                         return -1;
 
-                spin_lock_bh(&instance->sv_lock);
-		stats_inc_bytes(rx, instance->sv, sbytes);
-		spin_unlock_bh(&instance->sv_lock);
+                stats_inc_bytes(RX, instance, sbytes);
                 return 0;
 
         fail:
@@ -1744,9 +1700,7 @@ int dtp_receive(struct dtp * instance,
                 if (du) {
                 	sbytes = du_data_len(du);
                         pdu_post(instance, du);
-                        spin_lock_bh(&instance->sv_lock);
-			stats_inc_bytes(rx, instance->sv, sbytes);
-			spin_unlock_bh(&instance->sv_lock);
+                        stats_inc_bytes(RX, instance, sbytes);
 		}
         }
 
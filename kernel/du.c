@@ -203,6 +203,7 @@ static struct du *du_dup_gfp(gfp_t flags,
 	tmp->pci.h = du->pci.h;
 	tmp->pci.len = du->pci.len;
 	tmp->cfg = du->cfg;
+	tmp->tstamp = ktime_set(0, 0);
 
 	return tmp;
 }
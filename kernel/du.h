@@ -23,6 +23,7 @@
 
 #include <linux/list.h>
 #include <linux/skbuff.h>
+#include <linux/ktime.h>
 
 #include "pci.h"
 
@@ -31,6 +32,7 @@ struct du {
 	struct pci pci;
 	void *sdup_head; /* opaque used by SDU protection policy (TTL)*/
 	void *sdup_tail; /* opaque used by SDU protection policy (error check) */
+	ktime_t tstamp; /* set by the RMT when queued, for the queueing delay */
 	struct sk_buff *skb;
 };
 
@@ -29,6 +29,7 @@
 #include "rmt.h"
 #include "ps-factory.h"
 #include "rds/robjects.h"
+#include "rds/rstats.h"
 
 /*
  * IMAPs
@@ -136,15 +137,6 @@ struct dtp_sv {
         bool         drf_flag;
 
         uint_t     seq_number_rollover_threshold;
-	/* FIXME: we need to control rollovers...*/
-	struct {
-		unsigned int drop_pdus;
-		unsigned int err_pdus;
-		unsigned int tx_pdus;
-		unsigned int tx_bytes;
-		unsigned int rx_pdus;
-		unsigned int rx_bytes;
-	} stats;
         seq_num_t  max_seq_nr_rcv;
         seq_num_t  seq_nr_to_send;
         seq_num_t  max_seq_nr_sent;
@@ -186,6 +178,7 @@ struct dtp {
                 struct timer_list rendezvous;
         } timers;
         struct robject	robj;
+        struct rstats *	rstats; /* per-CPU PDU counters, no lock needed */
 
         spinlock_t		lock;
 };
@@ -325,6 +318,7 @@ struct dtcp {
 
         atomic_t               cpdus_in_transit;
         struct robject         robj;
+        struct rstats *        rstats; /* RTT histogram */
 };
 
 
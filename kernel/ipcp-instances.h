@@ -122,6 +122,13 @@ struct ipcp_instance_ops {
                                 port_id_t                   id,
                                 struct du *                 du);
 
+        /* Optional, enqueues count DUs received in a burst from the same
+         * port-id. Takes the ownership of all of them */
+        int      (* du_enqueue_batch)(struct ipcp_instance_data * data,
+                                      port_id_t                   id,
+                                      struct du **                dus,
+                                      unsigned int                count);
+
         /* Takes the ownership of the passed sdu */
         int (* mgmt_du_write)(struct ipcp_instance_data * data,
                               port_id_t                   port_id,
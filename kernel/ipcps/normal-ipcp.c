@@ -187,6 +187,19 @@ static int normal_du_enqueue(struct ipcp_instance_data * data,
         return 0;
 }
 
+static int normal_du_enqueue_batch(struct ipcp_instance_data * data,
+                                   port_id_t                   id,
+                                   struct du **                dus,
+                                   unsigned int                count)
+{
+        if (rmt_receive_batch(data->rmt, dus, count, id)) {
+                LOG_ERR("Could not enqueue SDUs into the RMT");
+                return -1;
+        }
+
+        return 0;
+}
+
 static int normal_du_write(struct ipcp_instance_data * data,
                            port_id_t                   id,
                            struct du *                 du,
@@ -1240,6 +1253,7 @@ static struct ipcp_instance_ops normal_instance_ops = {
 	.connection_modify 	   = connection_modify_request,
 
         .du_enqueue               = normal_du_enqueue,
+        .du_enqueue_batch         = normal_du_enqueue_batch,
         .du_write                 = normal_du_write,
 
         .mgmt_du_write            = normal_mgmt_du_write,
@@ -34,6 +34,9 @@
 #include <linux/if_packet.h>
 #include <linux/workqueue.h>
 #include <linux/notifier.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/version.h>
 #include <net/pkt_sched.h>
 #include <net/sch_generic.h>
 
@@ -83,9 +86,16 @@ enum port_id_state {
         PORT_STATE_ALLOCATED
 };
 
+/* Flows are also indexed by the peer MAC, for the receive path */
+#define FLOWS_HA_HASH_BITS 7
+
+/* Max DUs handed to the user IPCP in one call, see eth_vlan_rcv_list() */
+#define ETH_VLAN_RX_BATCH 16
+
 /* Holds the information related to one flow */
 struct shim_eth_flow {
         struct list_head       list;
+        struct hlist_node      ha_node;
 
         struct gha *           dest_ha;
         struct gpa *           dest_pa;
@@ -123,6 +133,7 @@ struct ipcp_instance_data {
         /* Stores the state of flows indexed by port_id */
         spinlock_t             lock;
         struct list_head       flows;
+        DECLARE_HASHTABLE(flows_by_ha, FLOWS_HA_HASH_BITS);
 
         /* FIXME: Remove it as soon as the kipcm_kfa gets removed */
         struct kfa *           kfa;
@@ -138,14 +149,6 @@ struct ipcp_instance_data {
 	unsigned int tx_busy;
 };
 
-/* Needed for eth_vlan_rcv function */
-struct interface_data_mapping {
-        struct list_head            list;
-
-        struct net_device *         dev;
-        struct ipcp_instance_data * data;
-};
-
 static ssize_t eth_vlan_ipcp_attr_show(struct robject *        robj,
                          	       struct robj_attribute * attr,
                                        char *                  buf)
@@ -187,30 +190,6 @@ RINA_SYSFS_OPS(eth_vlan_ipcp);
 RINA_ATTRS(eth_vlan_ipcp, name, type, dif, address, vlan_id, iface, tx_busy);
 RINA_KTYPE(eth_vlan_ipcp);
 
-static DEFINE_SPINLOCK(data_instances_lock);
-static struct list_head data_instances_list;
-
-static struct interface_data_mapping *
-inst_data_mapping_get(struct net_device * dev)
-{
-        struct interface_data_mapping * mapping;
-
-	ASSERT(dev);
-
-        spin_lock(&data_instances_lock);
-
-        list_for_each_entry(mapping, &data_instances_list, list) {
-                if (mapping->dev == dev) {
-                        spin_unlock(&data_instances_lock);
-                        return mapping;
-                }
-        }
-
-        spin_unlock(&data_instances_lock);
-
-        return NULL;
-}
-
 static struct ipcp_instance_data *
 find_instance(struct ipcp_factory_data * data,
               ipc_process_id_t           id)
@@ -273,19 +252,31 @@ static struct gpa * name_to_gpa(const struct name * name)
         return gpa;
 }
 
+static inline u32 flow_ha_hash(const uint8_t * addr)
+{ return jhash(addr, ETH_ALEN, 0); }
+
+/* Must be called with data->lock held */
+static void flow_ha_hash_add(struct ipcp_instance_data * data,
+                             struct shim_eth_flow *      flow)
+{
+        hash_add(data->flows_by_ha, &flow->ha_node,
+                 flow_ha_hash(gha_address(flow->dest_ha)));
+}
+
+/* Must be called with data->lock held */
 static struct shim_eth_flow *
-find_flow_by_gha(struct ipcp_instance_data * data,
-                 const struct gha *          addr)
+find_flow_by_mac(struct ipcp_instance_data * data,
+                 const uint8_t *             addr)
 {
         struct shim_eth_flow * flow;
 
 	ASSERT(data);
-        ASSERT(gha_is_ok(addr));
+        ASSERT(addr);
 
-        list_for_each_entry(flow, &data->flows, list) {
-                if (gha_is_equal(addr, flow->dest_ha)) {
+        hash_for_each_possible(data->flows_by_ha, flow, ha_node,
+                               flow_ha_hash(addr)) {
+                if (!memcmp(gha_address(flow->dest_ha), addr, ETH_ALEN))
                         return flow;
-                }
         }
 
         return NULL;
@@ -378,6 +369,8 @@ static int flow_destroy(struct ipcp_instance_data * data,
         	LOG_DBG("Deleting flow %d from list and destroying it", flow->port_id);
                 list_del(&flow->list);
         }
+        if (!hlist_unhashed(&flow->ha_node))
+                hash_del(&flow->ha_node);
         spin_unlock(&data->lock);
 
         if (flow->dest_pa) gpa_destroy(flow->dest_pa);
@@ -468,9 +461,10 @@ static void rinarp_resolve_handler(void *             opaque,
 
         if (flow->port_id_state == PORT_STATE_PENDING) {
                 flow->port_id_state = PORT_STATE_ALLOCATED;
-                spin_unlock_bh(&data->lock);
-
                 flow->dest_ha = gha_dup_ni(dest_ha);
+                if (flow->dest_ha)
+                        flow_ha_hash_add(data, flow);
+                spin_unlock_bh(&data->lock);
 
                 user_ipcp = flow->user_ipcp;
                 ASSERT(user_ipcp);
@@ -1193,13 +1187,63 @@ static int eth_vlan_rcv_worker(void * o)
         return 0;
 }
 
-static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
-					struct net_device * dev)
+/* DUs received in a row for the same allocated flow */
+struct eth_vlan_rx_batch {
+        struct ipcp_instance * user_ipcp;
+        port_id_t              port_id;
+        unsigned int           count;
+        struct du *            dus[ETH_VLAN_RX_BATCH];
+};
+
+static void eth_vlan_rx_batch_flush(struct eth_vlan_rx_batch * batch)
+{
+        struct ipcp_instance * user_ipcp = batch->user_ipcp;
+        unsigned int           i;
+
+        if (!batch->count)
+                return;
+
+        if (user_ipcp->ops->du_enqueue_batch) {
+                if (user_ipcp->ops->du_enqueue_batch(user_ipcp->data,
+                                                     batch->port_id,
+                                                     batch->dus,
+                                                     batch->count))
+                        LOG_ERR("Couldn't enqueue SDUs to user IPCP");
+        } else {
+                for (i = 0; i < batch->count; i++)
+                        if (user_ipcp->ops->du_enqueue(user_ipcp->data,
+                                                       batch->port_id,
+                                                       batch->dus[i]))
+                                LOG_ERR("Couldn't enqueue SDU to user IPCP");
+        }
+
+        batch->count = 0;
+}
+
+static void eth_vlan_rx_batch_add(struct eth_vlan_rx_batch * batch,
+                                  struct shim_eth_flow *     flow,
+                                  struct du *                du)
+{
+        if (batch->count && (batch->user_ipcp != flow->user_ipcp ||
+                             batch->port_id != flow->port_id))
+                eth_vlan_rx_batch_flush(batch);
+
+        batch->user_ipcp           = flow->user_ipcp;
+        batch->port_id             = flow->port_id;
+        batch->dus[batch->count++] = du;
+
+        if (batch->count == ETH_VLAN_RX_BATCH)
+                eth_vlan_rx_batch_flush(batch);
+}
+
+/* With a batch, DUs for allocated flows are only added to it */
+static int eth_vlan_recv_process_packet(struct sk_buff *            skb,
+					struct net_device *         dev,
+					struct ipcp_instance_data * data,
+					struct eth_vlan_rx_batch *  batch)
 {
         struct ethhdr *                 mh;
         unsigned char *                 saddr;
-        struct ipcp_instance_data *     data;
-        struct interface_data_mapping * mapping;
         struct shim_eth_flow *          flow;
         struct gha *                    ghaddr;
         struct du *                     du;
@@ -1219,14 +1263,6 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
 		return -1;
 	}
 
-        mapping = inst_data_mapping_get(dev);
-        if (!mapping) {
-                LOG_ERR("Failed to get mapping");
-                kfree_skb(skb);
-                return -1;
-        }
-
-        data = mapping->data;
         if (!data) {
                 kfree_skb(skb);
                 return -1;
@@ -1252,14 +1288,6 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
                 return -1;
         }
 
-        /* Get correct flow based on hwaddr */
-        ghaddr = gha_create_ni(MAC_ADDR_802_3, saddr);
-        if (!ghaddr) {
-                kfree_skb(skb);
-                return -1;
-        }
-        ASSERT(gha_is_ok(ghaddr));
-
 	/* FIXME: If skb is not linear we need to make a copy... */
 	linear_skb = skb;
 	if (skb_is_nonlinear(skb)) {
@@ -1281,10 +1309,20 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
                 return -1;
         }
 
+        /* Get correct flow based on hwaddr */
         spin_lock(&data->lock);
-        flow = find_flow_by_gha(data, ghaddr);
+        flow = find_flow_by_mac(data, saddr);
         if (!flow) {
                 spin_unlock(&data->lock);
+
+                /* Only new flows need their own copy of the address */
+                ghaddr = gha_create_ni(MAC_ADDR_802_3, saddr);
+                if (!ghaddr) {
+                        du_destroy(du);
+                        return -1;
+                }
+                ASSERT(gha_is_ok(ghaddr));
+
                 /* Create flow and its queue to handle next packets */
                 flow = rkzalloc(sizeof(*flow), GFP_ATOMIC);
                 if (!flow) {
@@ -1319,6 +1357,7 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
 
                 spin_lock(&data->lock);
                 list_add(&flow->list, &data->flows);
+                flow_ha_hash_add(data, flow);
                 spin_unlock(&data->lock);
 
                 /*FIXME: add checks */
@@ -1333,7 +1372,6 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
 
                 LOG_DBG("eth_vlan_recv_process_packet added work");
         } else {
-                gha_destroy(ghaddr);
                 LOG_DBG("Flow exists, queueing or delivering or dropping");
                 if (flow->port_id_state == PORT_STATE_ALLOCATED) {
                         if (!flow->user_ipcp) {
@@ -1345,6 +1383,11 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
 
                         spin_unlock(&data->lock);
 
+                        if (batch) {
+                                eth_vlan_rx_batch_add(batch, flow, du);
+                                return 0;
+                        }
+
                         ASSERT(flow->user_ipcp->ops);
                         ASSERT(flow->user_ipcp->ops->sdu_enqueue);
                         if (flow->user_ipcp->ops->
@@ -1381,7 +1424,7 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
 
 static int eth_vlan_rcv(struct sk_buff *     skb,
                         struct net_device *  dev,
-                        struct packet_type * pt,       /* not used */
+                        struct packet_type * pt,
                         struct net_device *  orig_dev) /* not used */
 {
 	ASSERT(skb);
@@ -1394,13 +1437,47 @@ static int eth_vlan_rcv(struct sk_buff *     skb,
                 return 0;
         }
 
-        if (eth_vlan_recv_process_packet(skb, dev))
+        /* The packet type is private to the instance bound to dev */
+        if (eth_vlan_recv_process_packet(skb, dev, pt->af_packet_priv, NULL))
                 LOG_DBG("Failed to process packet");
 
         LOG_DBG("eth_vlan_rcv ends");
         return 0;
 };
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+/*
+ * Called with the frames of a NAPI poll or a GRO flush, GRO-style: the
+ * flow lookup is still per frame, but the DUs of consecutive frames of
+ * the same flow go to the user IPCP (the RMT for normal IPCPs) in one
+ * call, which looks up the N-1 port once for all of them.
+ */
+static void eth_vlan_rcv_list(struct list_head *   head,
+                              struct packet_type * pt,
+                              struct net_device *  orig_dev) /* not used */
+{
+        struct eth_vlan_rx_batch batch;
+        struct sk_buff *         skb;
+        struct sk_buff *         next;
+
+        batch.count = 0;
+        list_for_each_entry_safe(skb, next, head, list) {
+                skb_list_del_init(skb);
+                skb = skb_share_check(skb, GFP_ATOMIC);
+                if (!skb) {
+                        LOG_ERR("Couldn't obtain ownership of the skb");
+                        continue;
+                }
+
+                if (eth_vlan_recv_process_packet(skb, skb->dev,
+                                                 pt->af_packet_priv, &batch))
+                        LOG_DBG("Failed to process packet");
+        }
+
+        eth_vlan_rx_batch_flush(&batch);
+}
+#endif
+
 static int eth_vlan_assign_to_dif(struct ipcp_instance_data * data,
                 		  const struct name * dif_name,
 				  const string_t * type,
@@ -1409,7 +1486,6 @@ static int eth_vlan_assign_to_dif(struct ipcp_instance_data * data,
         struct eth_vlan_info *          info;
         struct ipcp_config *            tmp;
         string_t *                      complete_interface;
-        struct interface_data_mapping * mapping;
         int                             result;
         unsigned int                    temp;
 
@@ -1484,6 +1560,9 @@ static int eth_vlan_assign_to_dif(struct ipcp_instance_data * data,
 
         data->eth_vlan_packet_type->type = cpu_to_be16(ETH_P_RINA);
         data->eth_vlan_packet_type->func = eth_vlan_rcv;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+        data->eth_vlan_packet_type->list_func = eth_vlan_rcv_list;
+#endif
 
         if (info->vlan_id != 0) {
                 complete_interface =
@@ -1527,25 +1606,7 @@ static int eth_vlan_assign_to_dif(struct ipcp_instance_data * data,
         LOG_DBG("Got device '%s', trying to register handler",
                 complete_interface);
 
-        /* Store in list for retrieval later on */
-        mapping = rkmalloc(sizeof(*mapping), GFP_ATOMIC);
-        if (!mapping) {
-                name_destroy(data->dif_name);
-                data->dif_name = NULL;
-                rkfree(info->interface_name);
-                info->interface_name = NULL;
-                rkfree(complete_interface);
-                return -1;
-        }
-
-        mapping->dev  = data->dev;
-        mapping->data = data;
-        INIT_LIST_HEAD(&mapping->list);
-
-        spin_lock(&data_instances_lock);
-        list_add(&mapping->list, &data_instances_list);
-        spin_unlock(&data_instances_lock);
-
+        data->eth_vlan_packet_type->af_packet_priv = data;
         data->eth_vlan_packet_type->dev = data->dev;
         dev_add_pack(data->eth_vlan_packet_type);
         rkfree(complete_interface);
@@ -1562,7 +1623,6 @@ static int eth_vlan_update_dif_config(struct ipcp_instance_data * data,
         struct ipcp_config *            tmp;
         string_t *                      old_interface_name;
         string_t *                      complete_interface;
-        struct interface_data_mapping * mapping;
 
 	if (!data) {
 		LOG_ERR("Bogus data passed, bailing out");
@@ -1597,19 +1657,11 @@ static int eth_vlan_update_dif_config(struct ipcp_instance_data * data,
 
 	dev_remove_pack(data->eth_vlan_packet_type);
 
-	if (data->dev) {
-		/* Remove from list */
-		mapping = inst_data_mapping_get(data->dev);
-		if (mapping) {
-			spin_lock(&data_instances_lock);
-			list_del(&mapping->list);
-			spin_unlock(&data_instances_lock);
-			rkfree(mapping);
-		}
-	}
-
         data->eth_vlan_packet_type->type = cpu_to_be16(ETH_P_RINA);
         data->eth_vlan_packet_type->func = eth_vlan_rcv;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+        data->eth_vlan_packet_type->list_func = eth_vlan_rcv_list;
+#endif
 
         if (info->vlan_id != 0) {
                 complete_interface =
@@ -1637,19 +1689,7 @@ static int eth_vlan_update_dif_config(struct ipcp_instance_data * data,
                 return -1;
         }
 
-        /* Store in list for retrieval later on */
-        mapping = rkmalloc(sizeof(*mapping), GFP_KERNEL);
-        if (!mapping)
-                return -1;
-
-        mapping->dev = data->dev;
-        mapping->data = data;
-        INIT_LIST_HEAD(&mapping->list);
-
-        spin_lock(&data_instances_lock);
-        list_add(&mapping->list, &data_instances_list);
-        spin_unlock(&data_instances_lock);
-
+        data->eth_vlan_packet_type->af_packet_priv = data;
         data->eth_vlan_packet_type->dev = data->dev;
         dev_add_pack(data->eth_vlan_packet_type);
         rkfree(complete_interface);
@@ -1728,6 +1768,7 @@ static struct ipcp_instance_ops eth_vlan_instance_ops = {
 	.connection_modify 	   = NULL,
 
         .du_enqueue               = NULL,
+        .du_enqueue_batch         = NULL,
         .du_write                 = eth_vlan_du_write,
 
         .mgmt_du_write            = NULL,
@@ -1826,8 +1867,6 @@ static int eth_vlan_init(struct ipcp_factory_data * data)
 	bzero(data, sizeof(*data));
 	INIT_LIST_HEAD(&(data->instances));
 
-	INIT_LIST_HEAD(&data_instances_list);
-
 	memset(&data->ntfy, 0, sizeof(data->ntfy));
 	data->ntfy.notifier_call = eth_vlan_netdev_notify;
 	register_netdevice_notifier(&data->ntfy);
@@ -1977,6 +2016,7 @@ static struct ipcp_instance * eth_vlan_create(struct ipcp_factory_data * data,
         spin_lock_init(&inst->data->lock);
 
         INIT_LIST_HEAD(&(inst->data->flows));
+        hash_init(inst->data->flows_by_ha);
 
         /*
          * Bind the shim-instance to the shims set, to keep all our data
@@ -1991,7 +2031,6 @@ static struct ipcp_instance * eth_vlan_create(struct ipcp_factory_data * data,
 static int eth_vlan_destroy(struct ipcp_factory_data * data,
                             struct ipcp_instance *     instance)
 {
-        struct interface_data_mapping * mapping;
         struct ipcp_instance_data * pos, * next;
         struct shim_eth_flow * flow, * nflow;
 
@@ -2009,9 +2048,12 @@ static int eth_vlan_destroy(struct ipcp_factory_data * data,
                                 unbind_and_destroy_flow(pos, flow);
                         }
 
-                        /* Remove packet handler if there is one */
+                        /*
+                         * Remove packet handler if there is one, waiting
+                         * for receivers since they use the instance data
+                         */
                         if (pos->eth_vlan_packet_type->dev)
-                                __dev_remove_pack(pos->eth_vlan_packet_type);
+                                dev_remove_pack(pos->eth_vlan_packet_type);
 
                         /* Unbind from the instances set */
                         list_del(&pos->list);
@@ -2054,25 +2096,8 @@ static int eth_vlan_destroy(struct ipcp_factory_data * data,
                                 }
                         }
 
-                        if (pos->dev) {
-                        	mapping = inst_data_mapping_get(pos->dev);
-                        	if (mapping) {
-                        		LOG_DBG("removing mapping from list");
-                        		spin_lock(&data_instances_lock);
-                        		list_del(&mapping->list);
-                        		spin_unlock(&data_instances_lock);
-                        		rkfree(mapping);
-                        	}
-                        }
-
                         robject_del(&instance->robj);
 
-                        /*
-                         * Might cause problems:
-                         * The packet type might still be in use by receivers
-                         * and must not be freed until after all
-                         * the CPU's have gone through a quiescent state.
-                         */
                         if (pos->eth_vlan_packet_type)
                                 rkfree(pos->eth_vlan_packet_type);
 
@@ -2249,8 +2274,6 @@ static int __init mod_init(void)
                 return -1;
         }
 
-        spin_lock_init(&data_instances_lock);
-
         return 0;
 }
 
@@ -31,6 +31,10 @@
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
 #include <linux/inet.h>
+#include <linux/udp.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/rculist.h>
 #include <net/sock.h>
 #include <linux/version.h>
 
@@ -54,23 +58,45 @@
 #define CUBE_RELIABLE   1
 #define SEND_WQ_MAX_SIZE 1000
 
+/* Max messages read from a socket before yielding the receive worker */
+#define RCV_BUDGET       64
+/* Max SDUs of the same flow coalesced into a single send */
+#define SND_BATCH        32
+/* Max payload of a single UDP GSO send */
+#define SND_GSO_MAX      65507
+
+#define FLOW_HASH_BITS   8
+#define NAME_HASH_BITS   5
+
 static struct workqueue_struct * rcv_wq;
 static struct workqueue_struct * snd_wq;
-static struct work_struct        rcv_work;
 static struct work_struct        snd_work;
-static struct list_head          rcv_wq_data;
 static struct list_head          snd_wq_data;
 static int snd_wq_size;
-static DEFINE_SPINLOCK(rcv_wq_lock);
 static DEFINE_SPINLOCK(snd_wq_lock);
 
 static int parse_assign_conf(struct ipcp_instance_data * data,
                              const struct dif_config *   config);
+static void rcv_ctx_detach(struct socket * sock, bool from_worker);
+
+/*
+ * Receive context of a socket, hangs from sk_user_data. Each socket
+ * has its own work item, so sockets are served in parallel and a
+ * burst of callbacks on the same socket coalesces into a single run
+ */
+struct rcv_ctx {
+        struct work_struct          work;
+        struct sock *               sk;
+        void                        (* data_ready)(struct sock * sk);
+        struct ipcp_instance_data * data;
+        /* Owner of a registration socket, NULL for flow sockets */
+        struct reg_app_data *       app;
+
+        /* Spare buffer the next UDP datagram is read into */
+        struct du *                 du;
 
-/* Structure for the workqueue */
-struct rcv_data {
-        struct list_head list;
-        struct sock *    sk;
+        /* Set when detached from within its own worker */
+        bool                        detached;
 };
 
 struct snd_data {
@@ -106,7 +132,7 @@ enum port_id_state {
 
 /* Data for registered applications */
 struct reg_app_data {
-        struct list_head list;
+        struct hlist_node hlist;
 
         struct socket *  tcpsock;
         struct socket *  udpsock;
@@ -117,6 +143,9 @@ struct reg_app_data {
 
 struct shim_tcp_udp_flow {
         struct list_head       list;
+        /* UDP flows only, in the receive path lookup table */
+        struct hlist_node      hlist;
+        struct rcu_head        rcu;
 
         port_id_t              port_id;
         enum port_id_state     port_id_state;
@@ -128,6 +157,9 @@ struct shim_tcp_udp_flow {
         struct socket *        sock;
         union address          addr;
 
+        /* UDP GSO refused by the stack, send one datagram at a time */
+        bool                   gso_off;
+
         struct rfifo *         sdu_queue;
 
         int                    bytes_left;
@@ -152,11 +184,18 @@ struct ipcp_instance_data {
         /* Stores the state of flows indexed by port_id */
         struct list_head    flows;
 
+        /*
+         * UDP flows by remote address and local socket, read under RCU
+         * for every received datagram, written under lock
+         */
+        DECLARE_HASHTABLE(udp_flows, FLOW_HASH_BITS);
+
         /* Holds reg_app_data, e.g. the registered applications */
-        struct list_head    reg_apps;
+        DECLARE_HASHTABLE(reg_apps, NAME_HASH_BITS);
 
-        struct list_head    directory;
-        struct list_head    exp_regs;
+        /* Both hashed by application name */
+        DECLARE_HASHTABLE(directory, NAME_HASH_BITS);
+        DECLARE_HASHTABLE(exp_regs, NAME_HASH_BITS);
 
         spinlock_t          lock;
         /* FIXME: Remove it as soon as the kipcm_kfa gets removed */
@@ -165,7 +204,7 @@ struct ipcp_instance_data {
 
 /* Directory entry */
 struct dir_entry {
-        struct list_head list;
+        struct hlist_node hlist;
 
         struct name *    app_name;
 
@@ -174,7 +213,7 @@ struct dir_entry {
 
 /* Expected application registration */
 struct exp_reg {
-        struct list_head list;
+        struct hlist_node hlist;
 
         struct name *    app_name;
         int              port;
@@ -186,22 +225,6 @@ static struct ipcp_factory_data {
 } tcp_udp_data;
 
 
-static void hostname_init(struct hostname *     host_name,
-			  const union address * sa)
-{
-	host_name->family = sa->family;
-	switch (host_name->family) {
-	case AF_INET:
-		host_name->in = sa->in.sin_addr;
-		break;
-	case AF_INET6:
-		host_name->in6 = sa->in6.sin6_addr;
-		break;
-	default:
-		unreachable();
-	}
-}
-
 static bool hostname_is_equal(const struct hostname * a,
 			      const struct hostname * b)
 {
@@ -272,6 +295,43 @@ static unsigned sockaddr_copy(union address * src, union address * dst)
 	unreachable();
 }
 
+/* Key of a UDP flow: remote address plus the local socket it arrives to */
+static u32 udp_flow_hash(const union address * addr,
+                         const struct socket * sock)
+{
+        u32 hash;
+
+        switch (addr->family) {
+        case AF_INET:
+                hash = jhash_2words(addr->in.sin_addr.s_addr,
+                                    addr->in.sin_port, 0);
+                break;
+        case AF_INET6:
+                hash = jhash2(addr->in6.sin6_addr.s6_addr32, 4,
+                              addr->in6.sin6_port);
+                break;
+        default:
+                hash = 0;
+        }
+
+        return hash ^ hash_ptr(sock, 32);
+}
+
+/* Consistent with name_cmp(NAME_CMP_APN | NAME_CMP_AEN, ...) */
+static u32 app_name_hash(const struct name * name)
+{
+        u32 hash = 0;
+
+        if (name->process_name)
+                hash = jhash(name->process_name,
+                             strlen(name->process_name), hash);
+        if (name->entity_name)
+                hash = jhash(name->entity_name,
+                             strlen(name->entity_name), hash);
+
+        return hash;
+}
+
 static ssize_t shim_tcp_udp_ipcp_sysfs_show(struct kobject *   kobj,
 					    struct attribute * attr,
 					    char *             buf)
@@ -337,7 +397,7 @@ static ssize_t shim_tcp_udp_ipcp_sysfs_store(struct kobject *   kobj,
 		config.entry = &entry;
 		for (; p < q; p++) {
 			if (!strcmp(p, "hostname")
-			 && !list_empty(&data->reg_apps)) {
+			 && !hash_empty(data->reg_apps)) {
 				LOG_ERR("Applications are already registered");
 			} else if (!(entry.name = (char *) p,
 				   p = memchr(p, '\0', q - p))
@@ -408,7 +468,8 @@ static struct dir_entry * find_dir_entry(struct ipcp_instance_data * data,
 
         spin_lock(&data->lock);
 
-        list_for_each_entry(entry, &data->directory, list) {
+        hash_for_each_possible(data->directory, entry, hlist,
+                               app_name_hash(app_name)) {
                 if (name_cmp(NAME_CMP_APN | NAME_CMP_AEN,
                              entry->app_name, app_name)) {
                         spin_unlock(&data->lock);
@@ -431,7 +492,8 @@ static struct exp_reg * find_exp_reg(struct ipcp_instance_data * data,
 
         spin_lock(&data->lock);
 
-        list_for_each_entry(exp, &data->exp_regs, list) {
+        hash_for_each_possible(data->exp_regs, exp, hlist,
+                               app_name_hash(app_name)) {
                 if (name_cmp(NAME_CMP_APN | NAME_CMP_AEN,
                              exp->app_name, app_name)) {
                         spin_unlock(&data->lock);
@@ -489,7 +551,7 @@ find_flow_by_socket(struct ipcp_instance_data * data,
         return NULL;
 }
 
-/* No lock needed here, called only when already holding a lock */
+/* Call holding either the RCU read lock or the lock of the instance */
 static struct shim_tcp_udp_flow *
 find_udp_flow(struct ipcp_instance_data * data,
               const union address *       addr,
@@ -501,7 +563,8 @@ find_udp_flow(struct ipcp_instance_data * data,
         ASSERT(addr);
         ASSERT(sock);
 
-        list_for_each_entry(flow, &data->flows, list) {
+        hash_for_each_possible_rcu(data->udp_flows, flow, hlist,
+                                   udp_flow_hash(addr, sock)) {
                 if (flow->sock == sock &&
                     sockaddr_is_equal(addr, &flow->addr)) {
                         return flow;
@@ -516,26 +579,17 @@ find_app_by_socket(struct ipcp_instance_data * data,
                    const struct socket *       sock)
 {
         struct reg_app_data * app;
+        int                   bucket;
 
         ASSERT(data);
         ASSERT(sock);
 
         spin_lock_bh(&data->lock);
 
-        /* FIXME: Shrink this code */
-        if (sock->type == SOCK_DGRAM) {
-                list_for_each_entry(app, &data->reg_apps, list) {
-                        if (app->udpsock == sock) {
-                                spin_unlock_bh(&data->lock);
-                                return app;
-                        }
-                }
-        } else {
-                list_for_each_entry(app, &data->reg_apps, list) {
-                        if (app->tcpsock == sock) {
-                                spin_unlock_bh(&data->lock);
-                                return app;
-                        }
+        hash_for_each(data->reg_apps, bucket, app, hlist) {
+                if (app->udpsock == sock || app->tcpsock == sock) {
+                        spin_unlock_bh(&data->lock);
+                        return app;
                 }
         }
 
@@ -554,7 +608,8 @@ static struct reg_app_data * find_app_by_name(struct ipcp_instance_data * data,
 
         spin_lock(&data->lock);
 
-        list_for_each_entry(app, &data->reg_apps, list) {
+        hash_for_each_possible(data->reg_apps, app, hlist,
+                               app_name_hash(name)) {
                 if (name_cmp(NAME_CMP_APN | NAME_CMP_AEN,
                              app->app_name, name)) {
                         spin_unlock(&data->lock);
@@ -567,6 +622,11 @@ static struct reg_app_data * find_app_by_name(struct ipcp_instance_data * data,
         return NULL;
 }
 
+static void flow_free_rcu(struct rcu_head * head)
+{
+        rkfree(container_of(head, struct shim_tcp_udp_flow, rcu));
+}
+
 static int flow_destroy(struct ipcp_instance_data * data,
                         struct shim_tcp_udp_flow *  flow)
 {
@@ -576,12 +636,16 @@ static int flow_destroy(struct ipcp_instance_data * data,
         spin_lock(&data->lock);
         if (!list_empty(&flow->list))
                 list_del(&flow->list);
+        if (!hlist_unhashed(&flow->hlist))
+                hash_del_rcu(&flow->hlist);
         spin_unlock(&data->lock);
 
         /* FIXME: Check for leaks */
         if (flow->sdu_queue)
                 rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
-        rkfree(flow);
+
+        /* The receive path may still be looking at it */
+        call_rcu(&flow->rcu, flow_free_rcu);
 
         return 0;
 }
@@ -633,6 +697,7 @@ static int tcp_unbind_and_destroy_flow(struct ipcp_instance_data * data,
         ASSERT(data);
         ASSERT(flow);
 
+        rcv_ctx_detach(flow->sock, false);
         sock_release(flow->sock);
 
         return unbind_and_destroy_flow(data, flow);
@@ -640,7 +705,7 @@ static int tcp_unbind_and_destroy_flow(struct ipcp_instance_data * data,
 
 static void tcp_udp_rcv(struct sock * sk)
 {
-        struct rcv_data * recvd;
+        struct rcv_ctx * ctx;
 
         if (!sk) {
                 LOG_ERR("Bad socket passed to callback, bailing out");
@@ -648,20 +713,80 @@ static void tcp_udp_rcv(struct sock * sk)
         }
         LOG_DBG("Callback on socket %pK", sk->sk_socket);
 
-        recvd = rkmalloc(sizeof(struct rcv_data), GFP_ATOMIC);
-        if (!recvd) {
-                LOG_ERR("Could not allocate rcv_data");
-                return;
+        read_lock_bh(&sk->sk_callback_lock);
+        ctx = sk->sk_user_data;
+        if (ctx)
+                queue_work(rcv_wq, &ctx->work);
+        read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void tcp_udp_rcv_worker(struct work_struct * work);
+
+static int rcv_ctx_attach(struct ipcp_instance_data * data,
+                          struct reg_app_data *       app,
+                          struct socket *             sock)
+{
+        struct rcv_ctx * ctx;
+
+        ASSERT(data);
+        ASSERT(sock);
+
+        ctx = rkzalloc(sizeof(*ctx), GFP_KERNEL);
+        if (!ctx) {
+                LOG_ERR("Could not allocate receive context");
+                return -1;
         }
 
-        recvd->sk = sk;
-        INIT_LIST_HEAD(&recvd->list);
+        INIT_WORK(&ctx->work, tcp_udp_rcv_worker);
+        ctx->sk   = sock->sk;
+        ctx->data = data;
+        ctx->app  = app;
 
-        spin_lock(&rcv_wq_lock);
-        list_add_tail(&recvd->list, &rcv_wq_data);
-        spin_unlock(&rcv_wq_lock);
+        write_lock_bh(&sock->sk->sk_callback_lock);
+        ctx->data_ready         = sock->sk->sk_data_ready;
+        sock->sk->sk_user_data  = ctx;
+        sock->sk->sk_data_ready = tcp_udp_rcv;
+        write_unlock_bh(&sock->sk->sk_callback_lock);
 
-        queue_work(rcv_wq, &rcv_work);
+        return 0;
+}
+
+static void rcv_ctx_destroy(struct rcv_ctx * ctx)
+{
+        if (ctx->du)
+                du_destroy(ctx->du);
+        rkfree(ctx);
+}
+
+/*
+ * Restores the original callback of the socket. From the worker of the
+ * socket itself the context cannot be waited for, it is released by the
+ * worker once it is done with it
+ */
+static void rcv_ctx_detach(struct socket * sock, bool from_worker)
+{
+        struct rcv_ctx * ctx;
+
+        ASSERT(sock);
+
+        write_lock_bh(&sock->sk->sk_callback_lock);
+        ctx = sock->sk->sk_user_data;
+        if (ctx) {
+                sock->sk->sk_data_ready = ctx->data_ready;
+                sock->sk->sk_user_data  = NULL;
+        }
+        write_unlock_bh(&sock->sk->sk_callback_lock);
+
+        if (!ctx)
+                return;
+
+        if (from_worker) {
+                ctx->detached = true;
+                return;
+        }
+
+        cancel_work_sync(&ctx->work);
+        rcv_ctx_destroy(ctx);
 }
 
 static int
@@ -742,12 +867,16 @@ tcp_udp_flow_allocate_request(struct ipcp_instance_data * data,
                                 return -1;
                         }
 
-                        write_lock_bh(&flow->sock->sk->sk_callback_lock);
-                        flow->sock->sk->sk_user_data  =
-                                flow->sock->sk->sk_data_ready;
-                        flow->sock->sk->sk_data_ready =
-                                tcp_udp_rcv;
-                        write_unlock_bh(&flow->sock->sk->sk_callback_lock);
+                        if (rcv_ctx_attach(data, NULL, flow->sock)) {
+                                sock_release(flow->sock);
+                                unbind_and_destroy_flow(data, flow);
+                                return -1;
+                        }
+
+                        spin_lock_bh(&data->lock);
+                        hash_add_rcu(data->udp_flows, &flow->hlist,
+                                     udp_flow_hash(&flow->addr, flow->sock));
+                        spin_unlock_bh(&data->lock);
                 } else {
                         LOG_DBG("Reliable flow requested");
                         flow->fspec_id = 1;
@@ -774,18 +903,19 @@ tcp_udp_flow_allocate_request(struct ipcp_instance_data * data,
                                 return -1;
                         }
 
-                        write_lock_bh(&flow->sock->sk->sk_callback_lock);
-                        flow->sock->sk->sk_user_data  =
-                                flow->sock->sk->sk_data_ready;
-                        flow->sock->sk->sk_data_ready =
-                                tcp_udp_rcv;
-                        write_unlock_bh(&flow->sock->sk->sk_callback_lock);
+                        if (rcv_ctx_attach(data, NULL, flow->sock)) {
+                                kernel_sock_shutdown(flow->sock, SHUT_RDWR);
+                                sock_release(flow->sock);
+                                unbind_and_destroy_flow(data, flow);
+                                return -1;
+                        }
                 }
 
                 flow->port_id_state = PORT_STATE_ALLOCATED;
                 ipcp = kipcm_find_ipcp(default_kipcm, data->id);
                 if (!ipcp) {
                         LOG_ERR("KIPCM could not retrieve this IPCP");
+                        rcv_ctx_detach(flow->sock, false);
                         if (fspec->ordered_delivery) {
                                 kernel_sock_shutdown(flow->sock, SHUT_RDWR);
                                 sock_release(flow->sock);
@@ -802,6 +932,7 @@ tcp_udp_flow_allocate_request(struct ipcp_instance_data * data,
                                                       flow->port_id,
                                                       ipcp)) {
                         LOG_ERR("Could not bind flow with user_ipcp");
+                        rcv_ctx_detach(flow->sock, false);
                         if (fspec->ordered_delivery) {
                                 kernel_sock_shutdown(flow->sock, SHUT_RDWR);
                                 sock_release(flow->sock);
@@ -819,6 +950,7 @@ tcp_udp_flow_allocate_request(struct ipcp_instance_data * data,
                 if (kipcm_notify_flow_alloc_req_result(default_kipcm, data->id,
                                                        flow->port_id, 0)) {
                         LOG_ERR("Couldn't tell flow is allocated to KIPCM");
+                        rcv_ctx_detach(flow->sock, false);
                         if (fspec->ordered_delivery) {
                                 kernel_sock_shutdown(flow->sock, SHUT_RDWR);
                                 sock_release(flow->sock);
@@ -945,8 +1077,10 @@ tcp_udp_flow_allocate_response(struct ipcp_instance_data * data,
                  * UDP flows on server side use the application socket, so we
                  * don't want to close this socket
                  */
-                if (!app)
+                if (!app) {
+                        rcv_ctx_detach(flow->sock, false);
                         sock_release(flow->sock);
+                }
 
                 /*
                  *  If we would destroy the flow, the application
@@ -967,26 +1101,18 @@ static int flow_deallocate(struct ipcp_instance_data * data,
 			   struct shim_tcp_udp_flow * flow)
 {
         struct reg_app_data *      app;
-        struct rcv_data *          recvd;
 
 	ASSERT(data);
 	ASSERT(flow);
 
         app = find_app_by_socket(data, flow->sock);
 
+        /* Server side UDP flows share the socket of the application */
+        if (!app)
+                rcv_ctx_detach(flow->sock, false);
+
         if ( (flow->fspec_id == 1 || (flow->fspec_id == 0 && !app)) &&
             flow->port_id_state == PORT_STATE_ALLOCATED) {
-
-                /* FIXME: better cleanup (= removing from list) */
-                spin_lock_bh(&rcv_wq_lock);
-                list_for_each_entry(recvd, &rcv_wq_data, list) {
-                        if (recvd->sk->sk_socket == flow->sock) {
-                                LOG_DBG("Setting socket to NULL");
-                                recvd->sk = NULL;
-                        }
-                }
-                spin_unlock_bh(&rcv_wq_lock);
-
                 LOG_DBG("Closing socket");
                 kernel_sock_shutdown(flow->sock, SHUT_RDWR);
         }
@@ -1078,9 +1204,10 @@ int send_msg(struct socket *      sock,
         return size;
 }
 
-static int udp_process_msg(struct ipcp_instance_data * data,
-                           struct socket *             sock)
+static int udp_process_msg(struct rcv_ctx * ctx,
+                           struct socket *  sock)
 {
+        struct ipcp_instance_data * data;
         struct shim_tcp_udp_flow *  flow;
         union address               addr;
         struct reg_app_data *       app;
@@ -1090,11 +1217,21 @@ static int udp_process_msg(struct ipcp_instance_data * data,
         struct ipcp_instance      * ipcp, * user_ipcp;
         char			    api_string[12];
 
-	/* Create SDU with max allowable size removing PCI and TAIL room */
-	du = du_create_ni(CONFIG_RINA_SHIM_TCP_UDP_BUFFER_SIZE);
+        data = ctx->data;
+
+        /*
+         * Read into the spare SDU of the socket, with max allowable size
+         * removing PCI and TAIL room. It is only replaced once handed over,
+         * so draining the socket until EAGAIN does not cost an allocation
+         */
+        du = ctx->du;
         if (!du) {
-                LOG_ERR("Couldn't create sdu");
-                return -1;
+                du = du_create(CONFIG_RINA_SHIM_TCP_UDP_BUFFER_SIZE);
+                if (!du) {
+                        LOG_ERR("Couldn't create sdu");
+                        return -1;
+                }
+                ctx->du = du;
         }
 
         if ((size = recv_msg(sock, &addr, sizeof(addr),
@@ -1102,9 +1239,9 @@ static int udp_process_msg(struct ipcp_instance_data * data,
 			     CONFIG_RINA_SHIM_TCP_UDP_BUFFER_SIZE)) < 0) {
                 if (size != -EAGAIN)
                         LOG_ERR("Error during UDP recv: %d", size);
-                du_destroy(du);
                 return -1;
         }
+        ctx->du = NULL;
 
         LOG_DBG("Received message of %d bytes", size);
 
@@ -1114,13 +1251,38 @@ static int udp_process_msg(struct ipcp_instance_data * data,
 		return -1;
 	}
 
+        /* Fast path, datagram of an allocated flow */
+        rcu_read_lock();
+        flow = find_udp_flow(data, &addr, sock);
+        if (flow && flow->port_id_state == PORT_STATE_ALLOCATED) {
+                user_ipcp = READ_ONCE(flow->user_ipcp);
+                if (!user_ipcp) {
+                        rcu_read_unlock();
+                        LOG_ERR("Flow is being deallocated, dropping PDU");
+                        du_destroy(du);
+                        return -1;
+                }
+
+                if (user_ipcp->ops->du_enqueue(user_ipcp->data,
+                                               flow->port_id,
+                                               du)) {
+                        rcu_read_unlock();
+                        LOG_ERR("Couldn't enqueue SDU to user IPCP");
+                        return -1;
+                }
+                rcu_read_unlock();
+
+                return size;
+        }
+        rcu_read_unlock();
+
         spin_lock_bh(&data->lock);
         flow = find_udp_flow(data, &addr, sock);
         if (!flow) {
                 spin_unlock_bh(&data->lock);
                 LOG_DBG("No flow found, creating it");
 
-                app = find_app_by_socket(data, sock);
+                app = ctx->app;
                 if (!app) {
                         LOG_ERR("No app registered yet! "
                                 "Someone is doing something bad "
@@ -1167,6 +1329,8 @@ static int udp_process_msg(struct ipcp_instance_data * data,
                 spin_lock_bh(&data->lock);
                 INIT_LIST_HEAD(&flow->list);
                 list_add(&flow->list, &data->flows);
+                hash_add_rcu(data->udp_flows, &flow->hlist,
+                             udp_flow_hash(&flow->addr, sock));
                 spin_unlock_bh(&data->lock);
                 LOG_DBG("Added UDP flow");
 
@@ -1480,7 +1644,6 @@ static int tcp_process_msg(struct ipcp_instance_data * data,
                            struct socket *             sock)
 {
         struct shim_tcp_udp_flow * flow;
-        struct rcv_data *          recvd;
         int                        size;
 
         ASSERT(data);
@@ -1509,19 +1672,8 @@ static int tcp_process_msg(struct ipcp_instance_data * data,
                         LOG_DBG("Port was PENDING");
                 }
 
-                write_lock_bh(&flow->sock->sk->sk_callback_lock);
-                flow->sock->sk->sk_data_ready = flow->sock->sk->sk_user_data;
-                flow->sock->sk->sk_user_data  = NULL;
-                write_unlock_bh(&flow->sock->sk->sk_callback_lock);
-
-                /* FIXME: better cleanup */
-                spin_lock_bh(&rcv_wq_lock);
-                list_for_each_entry(recvd, &rcv_wq_data, list) {
-                        if (recvd->sk->sk_socket == flow->sock)
-                                recvd->sk = NULL;
-                }
-                spin_unlock_bh(&rcv_wq_lock);
-
+                /* We are running in the worker of this very socket */
+                rcv_ctx_detach(flow->sock, true);
                 sock_release(flow->sock);
 
                 /* FIXME: remove the msleep */
@@ -1543,26 +1695,34 @@ static int tcp_process_msg(struct ipcp_instance_data * data,
         return size;
 }
 
-static int tcp_process(struct ipcp_instance_data * data, struct socket * sock)
+static int tcp_process(struct rcv_ctx * ctx, struct socket * sock)
 {
-        struct shim_tcp_udp_flow * flow;
-        struct reg_app_data *      app;
-        struct socket *            acsock;
-        struct name *              sname;
-        int                        err;
-        struct ipcp_instance     * ipcp, * user_ipcp;
-        char	   		   api_string[12];
+        struct ipcp_instance_data * data;
+        struct shim_tcp_udp_flow *  flow;
+        struct reg_app_data *       app;
+        struct socket *             acsock;
+        struct name *               sname;
+        int                         err, budget;
+        struct ipcp_instance      * ipcp, * user_ipcp;
+        char	   		    api_string[12];
 
+        ASSERT(ctx);
         ASSERT(sock);
 
+        data = ctx->data;
+
         LOG_DBG("Processing TCP socket %pK", sock);
 
-        app = find_app_by_socket(data, sock);
+        app = ctx->app;
         if (!app) {
                 /* connection exists */
-                err = tcp_process_msg(data, sock);
-                while (err > 0)
-                        err = tcp_process_msg(data, sock);
+                budget = RCV_BUDGET;
+                do err = tcp_process_msg(data, sock);
+                while (err > 0 && --budget);
+
+                /* Budget exhausted, let the other sockets in */
+                if (err > 0)
+                        queue_work(rcv_wq, &ctx->work);
                 return err;
         } else {
                 /* accept connection */
@@ -1573,15 +1733,16 @@ static int tcp_process(struct ipcp_instance_data * data, struct socket * sock)
                 }
                 LOG_DBG("Socket accepted");
 
-                write_lock_bh(&acsock->sk->sk_callback_lock);
-                acsock->sk->sk_user_data  = acsock->sk->sk_data_ready;
-                acsock->sk->sk_data_ready = tcp_udp_rcv;
-                write_unlock_bh(&acsock->sk->sk_callback_lock);
+                if (rcv_ctx_attach(data, NULL, acsock)) {
+                        sock_release(acsock);
+                        return -1;
+                }
 
                 flow = rkzalloc(sizeof(*flow), GFP_KERNEL);
                 if (!flow) {
                         LOG_ERR("Could not allocate flow");
 
+                        rcv_ctx_detach(acsock, false);
                         sock_release(acsock);
                         return -1;
                 }
@@ -1609,6 +1770,7 @@ static int tcp_process(struct ipcp_instance_data * data, struct socket * sock)
                         flow->port_id_state = PORT_STATE_NULL;
                         LOG_ERR("Port id is not ok");
 
+                        rcv_ctx_detach(acsock, false);
                         sock_release(acsock);
                         if (flow_destroy(data, flow))
                                 LOG_ERR("Problems destroying flow");
@@ -1679,80 +1841,51 @@ static int tcp_process(struct ipcp_instance_data * data, struct socket * sock)
         }
 }
 
-static int tcp_udp_rcv_process_msg(struct sock * sk)
+static int tcp_udp_rcv_process_msg(struct rcv_ctx * ctx)
 {
-        struct ipcp_instance_data *         data;
-        struct hostname                     host_name;
-        union address                       own;
-        struct socket *                     sock;
-        int                                 res, len;
+        struct socket * sock;
+        int             res, budget;
 
-        ASSERT(sk);
+        ASSERT(ctx);
 
-        sock = sk->sk_socket;
+        sock = ctx->sk->sk_socket;
         if (!sock) {
                 LOG_ERR("BUG: sk->sk_socket is NULL");
                 return -1;
         }
 
-        len = sizeof own;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,17,0)
-        if (kernel_getsockname(sock, &own.sa, &len)) {
-#else
-	if (kernel_getsockname(sock, &own.sa)) {
-#endif
-                LOG_ERR("Couldn't retrieve hostname");
-                return -1;
-        }
-        switch (own.family) {
-        case AF_INET:
-                LOG_DBG("Found sockname (%pI4)", &own.in.sin_addr);
-                break;
-        case AF_INET6:
-                LOG_DBG("Found sockname (%pI6c)", &own.in6.sin6_addr);
-                break;
-        default:
-                unreachable();
-        }
+        if (sock->type != SOCK_DGRAM)
+                return tcp_process(ctx, sock);
 
-        hostname_init(&host_name, &own);
-        data = find_instance_by_hostname(&host_name);
-        if (!data) {
-                LOG_ERR("BUG: failed to map hostname");
-                return -1;
-        }
+        budget = RCV_BUDGET;
+        do res = udp_process_msg(ctx, sock);
+        while (res > 0 && --budget);
 
-        if (sk->sk_socket->type == SOCK_DGRAM) {
-                do res = udp_process_msg(data, sock);
-                while (res > 0);
-                return res;
-        } else
-                return tcp_process(data, sock);
+        /* Budget exhausted, let the other sockets in */
+        if (res > 0)
+                queue_work(rcv_wq, &ctx->work);
+
+        return res;
 }
 
 static void tcp_udp_rcv_worker(struct work_struct * work)
 {
-        struct rcv_data * recvd, * next;
-
-        /* FIXME: more efficient locking and better cleanup */
-        spin_lock_bh(&rcv_wq_lock);
-        list_for_each_entry_safe(recvd, next, &rcv_wq_data, list) {
-                list_del(&recvd->list);
-                spin_unlock_bh(&rcv_wq_lock);
+        struct rcv_ctx * ctx;
+        int              res;
 
-                LOG_DBG("Worker on %pK", recvd->sk);
-
-                if (recvd->sk != NULL) {
-                        int res = tcp_udp_rcv_process_msg(recvd->sk);
-                        if (res <= 0)
-                                LOG_DBG("TCP/UDP processing returned %d", res);
-                }
+        ctx = container_of(work, struct rcv_ctx, work);
 
-                rkfree(recvd);
+        LOG_DBG("Worker on %pK", ctx->sk);
 
-                spin_lock_bh(&rcv_wq_lock);
+        if (!ctx->detached) {
+                res = tcp_udp_rcv_process_msg(ctx);
+                if (res <= 0)
+                        LOG_DBG("TCP/UDP processing returned %d", res);
         }
-        spin_unlock_bh(&rcv_wq_lock);
+
+        /* The last run after a detach from the worker releases it */
+        if (ctx->detached && !work_pending(work))
+                rcv_ctx_destroy(ctx);
 
         LOG_DBG("Worker finished for now");
 }
@@ -1827,10 +1960,12 @@ static int tcp_udp_application_register(struct ipcp_instance_data * data,
                 return -1;
         }
 
-        write_lock_bh(&app->udpsock->sk->sk_callback_lock);
-        app->udpsock->sk->sk_user_data = app->udpsock->sk->sk_data_ready;
-        app->udpsock->sk->sk_data_ready = tcp_udp_rcv;
-        write_unlock_bh(&app->udpsock->sk->sk_callback_lock);
+        if (rcv_ctx_attach(data, app, app->udpsock)) {
+                sock_release(app->udpsock);
+                name_destroy(app->app_name);
+                rkfree(app);
+                return -1;
+        }
 
         LOG_DBG("UDP socket ready");
 
@@ -1843,6 +1978,7 @@ static int tcp_udp_application_register(struct ipcp_instance_data * data,
 #endif
         if (err < 0) {
                 LOG_ERR("could not create TCP socket for registration");
+                rcv_ctx_detach(app->udpsock, false);
                 sock_release(app->udpsock);
                 name_destroy(app->app_name);
                 rkfree(app);
@@ -1853,6 +1989,7 @@ static int tcp_udp_application_register(struct ipcp_instance_data * data,
         if (err < 0) {
                 LOG_ERR("Could not bind TCP socket for registration");
                 sock_release(app->tcpsock);
+                rcv_ctx_detach(app->udpsock, false);
                 sock_release(app->udpsock);
                 name_destroy(app->app_name);
                 rkfree(app);
@@ -1863,23 +2000,26 @@ static int tcp_udp_application_register(struct ipcp_instance_data * data,
         if (err < 0) {
                 LOG_ERR("Could not listen on TCP socket for registration");
                 sock_release(app->tcpsock);
+                rcv_ctx_detach(app->udpsock, false);
                 sock_release(app->udpsock);
                 name_destroy(app->app_name);
                 rkfree(app);
                 return -1;
         }
 
-        write_lock_bh(&app->tcpsock->sk->sk_callback_lock);
-        app->tcpsock->sk->sk_user_data  = app->tcpsock->sk->sk_data_ready;
-        app->tcpsock->sk->sk_data_ready = tcp_udp_rcv;
-        write_unlock_bh(&app->tcpsock->sk->sk_callback_lock);
+        if (rcv_ctx_attach(data, app, app->tcpsock)) {
+                sock_release(app->tcpsock);
+                rcv_ctx_detach(app->udpsock, false);
+                sock_release(app->udpsock);
+                name_destroy(app->app_name);
+                rkfree(app);
+                return -1;
+        }
 
         LOG_DBG("TCP socket ready");
 
-        INIT_LIST_HEAD(&(app->list));
-
         spin_lock(&data->lock);
-        list_add(&(app->list), &(data->reg_apps));
+        hash_add(data->reg_apps, &app->hlist, app_name_hash(app->app_name));
         spin_unlock(&data->lock);
 
         return 0;
@@ -1891,36 +2031,25 @@ static int application_unregister(struct ipcp_instance_data * data,
 	ASSERT(data);
         ASSERT(app);
 
-	lock_sock(app->udpsock->sk);
-	write_lock_bh(&app->udpsock->sk->sk_callback_lock);
-	app->udpsock->sk->sk_data_ready = app->udpsock->sk->sk_user_data;
-	app->udpsock->sk->sk_user_data  = NULL;
-	write_unlock_bh(&app->udpsock->sk->sk_callback_lock);
-	release_sock(app->udpsock->sk);
+	rcv_ctx_detach(app->udpsock, false);
 
 	kernel_sock_shutdown(app->udpsock, SHUT_RDWR);
 	sock_release(app->udpsock);
 
 	LOG_DBG("UDP socket destroyed");
 
-	lock_sock(app->tcpsock->sk);
-	write_lock_bh(&app->tcpsock->sk->sk_callback_lock);
-	app->tcpsock->sk->sk_data_ready = app->tcpsock->sk->sk_user_data;
-	app->tcpsock->sk->sk_user_data  = NULL;
-	write_unlock_bh(&app->tcpsock->sk->sk_callback_lock);
-	release_sock(app->tcpsock->sk);
+	rcv_ctx_detach(app->tcpsock, false);
 
 	kernel_sock_shutdown(app->tcpsock, SHUT_RDWR);
 	sock_release(app->tcpsock);
 
 	LOG_DBG("TCP socket destroyed");
 
-	name_destroy(app->app_name);
-
 	spin_lock(&data->lock);
-	list_del(&app->list);
+	hash_del(&app->hlist);
 	spin_unlock(&data->lock);
 
+	name_destroy(app->app_name);
 	rkfree(app);
 
 	return 0;
@@ -2030,12 +2159,14 @@ static int get_nxt_val(char ** dst,
 
 static void clear_directory(struct ipcp_instance_data * data)
 {
-        struct dir_entry * entry, * next;
+        struct dir_entry *  entry;
+        struct hlist_node * next;
+        int                 bucket;
 
         ASSERT(data);
 
-        list_for_each_entry_safe(entry, next, &data->directory, list) {
-                list_del(&entry->list);
+        hash_for_each_safe(data->directory, bucket, next, entry, hlist) {
+                hash_del(&entry->hlist);
                 name_destroy(entry->app_name);
                 rkfree(entry);
         }
@@ -2043,12 +2174,14 @@ static void clear_directory(struct ipcp_instance_data * data)
 
 static void clear_exp_reg(struct ipcp_instance_data * data)
 {
-        struct exp_reg * entry, * next;
+        struct exp_reg *    entry;
+        struct hlist_node * next;
+        int                 bucket;
 
         ASSERT(data);
 
-        list_for_each_entry_safe(entry, next, &data->exp_regs, list) {
-                list_del(&entry->list);
+        hash_for_each_safe(data->exp_regs, bucket, next, entry, hlist) {
+                hash_del(&entry->hlist);
                 name_destroy(entry->app_name);
                 rkfree(entry);
         }
@@ -2069,6 +2202,7 @@ static int parse_dir_entry(struct ipcp_instance_data * data, char **blob, int sy
         struct dir_entry * dir_entry;
         struct dir_entry * entry;
         union address    * addr;
+        u32                hash;
 
         ASSERT(*blob);
 
@@ -2114,8 +2248,10 @@ static int parse_dir_entry(struct ipcp_instance_data * data, char **blob, int sy
 
         name_init_with(dir_entry->app_name, pn, pi, en, ei);
 
+        hash = app_name_hash(dir_entry->app_name);
+
         spin_lock(&data->lock);
-        list_for_each_entry(entry, &data->directory, list)
+        hash_for_each_possible(data->directory, entry, hlist, hash)
                 if (name_cmp(NAME_CMP_APN | NAME_CMP_AEN,
                              entry->app_name, dir_entry->app_name)) {
                         if (addr) {
@@ -2123,14 +2259,13 @@ static int parse_dir_entry(struct ipcp_instance_data * data, char **blob, int sy
                                 LOG_DBG("Updated an existing dir entry");
                                 addr = 0;
                         } else {
-                                list_del(&entry->list);
+                                hash_del(&entry->hlist);
                                 LOG_DBG("Removed a dir entry");
                         }
                         break;
                 }
         if (addr) {
-                INIT_LIST_HEAD(&dir_entry->list);
-                list_add(&dir_entry->list, &data->directory);
+                hash_add(data->directory, &dir_entry->hlist, hash);
                 LOG_DBG("Added a new dir entry");
         } else {
                 name_destroy(dir_entry->app_name);
@@ -2191,11 +2326,11 @@ static int parse_exp_reg_entry(struct ipcp_instance_data * data, char ** blob, i
                 goto out;
         }
 
-        INIT_LIST_HEAD(&exp_reg->list);
         name_init_with(exp_reg->app_name, pn, pi, en, ei);
 
         spin_lock(&data->lock);
-        list_add(&exp_reg->list, &data->exp_regs);
+        hash_add(data->exp_regs, &exp_reg->hlist,
+                 app_name_hash(exp_reg->app_name));
         spin_unlock(&data->lock);
 
         LOG_DBG("Added a new exp reg entry");
@@ -2406,38 +2541,181 @@ static int tcp_udp_update_dif_config(struct ipcp_instance_data * data,
         return 0;
 }
 
-static int tcp_sdu_write(struct shim_tcp_udp_flow * flow,
-                         int                        len,
-                         char *                     sbuf)
+/* Sends the whole vector, moving past what partial sends took */
+static int send_kvecs(struct socket * sock,
+                      union address * other,
+                      int             lother,
+                      struct kvec *   vec,
+                      size_t          nvec,
+                      size_t          len)
 {
-        uint16_t length;
-        int    size, total;
-
-        ASSERT(flow);
-        ASSERT(len);
-        ASSERT(sbuf);
+        struct msghdr msg;
+        int           size;
 
-        length = htons((short)len);
+        while (len > 0) {
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_name    = other;
+                msg.msg_namelen = lother;
 
-        total = 0;
-        while (total < sizeof(uint16_t)) {
-                size = send_msg(flow->sock, NULL, 0, (char*)(&length+total),
-                                sizeof(uint16_t) - total);
-                if (size < 0) {
-                        LOG_ERR("error during sdu write (tcp): %d", size);
+                size = kernel_sendmsg(sock, &msg, vec, nvec, len);
+                if (size <= 0) {
+                        LOG_ERR("Problems sending message (%d)", size);
                         return -1;
                 }
-                total += size;
+                len -= size;
+
+                while (nvec > 0 && size >= vec->iov_len) {
+                        size -= vec->iov_len;
+                        vec++;
+                        nvec--;
+                }
+                if (size) {
+                        vec->iov_base  = (char *) vec->iov_base + size;
+                        vec->iov_len  -= size;
+                }
         }
+
+        return 0;
+}
+
+/* Frames the SDUs and pushes them to the stream in a single send */
+static int tcp_sdu_write(struct shim_tcp_udp_flow * flow,
+                         struct du **               dus,
+                         int                        count)
+{
+        __be16      lengths[SND_BATCH];
+        struct kvec vec[2 * SND_BATCH];
+        size_t      total;
+        int         i;
+
+        ASSERT(flow);
+        ASSERT(dus);
+        ASSERT(count > 0 && count <= SND_BATCH);
+
         total = 0;
-        while (total < len) {
-                size = send_msg(flow->sock, NULL, 0, sbuf+total,
-                                len - total);
-                if (size < 0) {
-                        LOG_ERR("error during sdu write (tcp): %d", size);
-                        return -1;
+        for (i = 0; i < count; i++) {
+                lengths[i] = htons((u16) du_len(dus[i]));
+
+                vec[2 * i].iov_base     = &lengths[i];
+                vec[2 * i].iov_len      = sizeof(__be16);
+                vec[2 * i + 1].iov_base = du_buffer(dus[i]);
+                vec[2 * i + 1].iov_len  = du_len(dus[i]);
+
+                total += sizeof(__be16) + du_len(dus[i]);
+        }
+
+        if (send_kvecs(flow->sock, NULL, 0, vec, 2 * count, total)) {
+                LOG_ERR("error during sdu write (tcp)");
+                return -1;
+        }
+
+        return 0;
+}
+
+#ifdef UDP_SEGMENT
+/* Hands a run of datagrams to the stack at once, it segments them */
+static int udp_gso_write(struct shim_tcp_udp_flow * flow,
+                         struct kvec *              vec,
+                         size_t                     nvec,
+                         size_t                     len,
+                         u16                        gso_size)
+{
+        char             control[CMSG_SPACE(sizeof(u16))];
+        struct msghdr    msg;
+        struct cmsghdr * cmsg;
+        int              size;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+
+        msg.msg_name       = &flow->addr;
+        msg.msg_namelen    = sizeof(flow->addr);
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsg             = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type  = UDP_SEGMENT;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(u16));
+        *(u16 *) CMSG_DATA(cmsg) = gso_size;
+
+        size = kernel_sendmsg(flow->sock, &msg, vec, nvec, len);
+        if (size < 0)
+                return size;
+
+        return size == len ? 0 : -EIO;
+}
+#endif
+
+static int udp_sdu_write(struct shim_tcp_udp_flow * flow,
+                         struct du **               dus,
+                         int                        count)
+{
+        struct kvec vec[SND_BATCH];
+        size_t      seg, len, total;
+        int         i, j, n, size;
+
+        ASSERT(flow);
+        ASSERT(dus);
+        ASSERT(count > 0 && count <= SND_BATCH);
+
+        for (i = 0; i < count; i += n) {
+                seg   = du_len(dus[i]);
+                total = seg;
+                n     = 1;
+
+                vec[0].iov_base = du_buffer(dus[i]);
+                vec[0].iov_len  = seg;
+
+#ifdef UDP_SEGMENT
+                /*
+                 * The stack cuts GSO payloads in segments of the size of
+                 * the first one, so a run only takes SDUs of that very
+                 * size, but for a shorter one closing it
+                 */
+                while (!flow->gso_off && i + n < count) {
+                        len = du_len(dus[i + n]);
+                        if (len > seg || total + len > SND_GSO_MAX)
+                                break;
+
+                        vec[n].iov_base = du_buffer(dus[i + n]);
+                        vec[n].iov_len  = len;
+                        total += len;
+                        n++;
+
+                        if (len < seg)
+                                break;
+                }
+
+                if (n > 1) {
+                        size = udp_gso_write(flow, vec, n, total, seg);
+                        if (!size)
+                                continue;
+                        if (size != -EINVAL && size != -EIO) {
+                                LOG_ERR("Error during SDU write (udp): %d",
+                                        size);
+                                return -1;
+                        }
+
+                        LOG_DBG("UDP GSO refused (%d), disabling it", size);
+                        flow->gso_off = true;
+                }
+#endif
+
+                for (j = i; j < i + n; j++) {
+                        len  = du_len(dus[j]);
+                        size = send_msg(flow->sock, &flow->addr,
+                                        sizeof(flow->addr),
+                                        du_buffer(dus[j]), len);
+                        if (size < 0) {
+                                LOG_ERR("Error during SDU write (udp): %d",
+                                        size);
+                                return -1;
+                        } else if (size < len) {
+                                LOG_ERR("Could not completely send SDU");
+                                return -1;
+                        }
                 }
-                total += size;
         }
 
         return 0;
@@ -2461,6 +2739,7 @@ static int tcp_udp_du_write(struct ipcp_instance_data * data,
 
         snd_data = rkmalloc(sizeof(*snd_data), GFP_ATOMIC);
         if (!snd_data) {
+                spin_unlock_bh(&snd_wq_lock);
                 LOG_ERR("Could not allocate snd_data");
                 return -1;
         }
@@ -2478,61 +2757,50 @@ static int tcp_udp_du_write(struct ipcp_instance_data * data,
         return 0;
 }
 
+/* Writes a batch of SDUs of the same flow, in order, and consumes them */
 static int __tcp_udp_sdu_write(struct ipcp_instance_data * data,
                                port_id_t                   id,
-                               struct du *                 du)
+                               struct du **                dus,
+                               int                         count)
 {
         struct shim_tcp_udp_flow * flow;
-        int                        size;
-	ssize_t                    slen;
+        int                        i, ret;
 
+        ret  = -1;
         flow = find_flow_by_port(data, id);
         if (!flow) {
                 LOG_ERR("Could not find flow with specified port-id");
-                du_destroy(du);
-                return -1;
+                goto out;
         }
 
         spin_lock_bh(&data->lock);
         if (flow->port_id_state != PORT_STATE_ALLOCATED) {
-                du_destroy(du);
                 spin_unlock_bh(&data->lock);
 
                 LOG_ERR("Flow is not in the right state to call this");
 
-                return -1;
+                goto out;
         }
         spin_unlock_bh(&data->lock);
 
-	slen = du_len(du);
         if (flow->fspec_id == 0) {
-                /* We are sending an UDP message */
-                size = send_msg(flow->sock, &flow->addr, sizeof(flow->addr),
-                                du_buffer(du),
-                                slen);
-                if (size < 0) {
-                        LOG_ERR("Error during SDU write (udp): %d", size);
-                        du_destroy(du);
-                        return -1;
-                } else if (size < slen) {
-                        LOG_ERR("Could not completely send SDU");
-                        du_destroy(du);
-                        return -1;
-                }
+                /* We are sending UDP messages */
+                ret = udp_sdu_write(flow, dus, count);
         } else {
-                /* We are sending a TCP message */
-                if (tcp_sdu_write(flow, slen,
-                                  du_buffer(du))) {
-                        LOG_ERR("Could not send SDU on TCP flow");
-                        du_destroy(du);
-                        return -1;
-                }
+                /* We are sending TCP messages */
+                ret = tcp_sdu_write(flow, dus, count);
+                if (ret)
+                        LOG_ERR("Could not send SDUs on TCP flow");
         }
 
-        LOG_DBG("SDU sent");
-        du_destroy(du);
+        if (!ret)
+                LOG_DBG("%d SDU(s) sent", count);
 
-        return 0;
+ out:
+        for (i = 0; i < count; i++)
+                du_destroy(dus[i]);
+
+        return ret;
 }
 
 static void enable_all_flows(void)
@@ -2553,30 +2821,48 @@ static void enable_all_flows(void)
 
 static void tcp_udp_write_worker(struct work_struct * w)
 {
-        struct snd_data           * snd_data, * next;
+        struct snd_data  * snd_data, * next, * first;
+        struct du        * dus[SND_BATCH];
+        struct list_head   batch;
+        int                count;
+        bool               enable;
+
+        INIT_LIST_HEAD(&batch);
 
-        /* FIXME: more efficient locking and better cleanup */
+        /* Take all that is queued at once, writers go on meanwhile */
         spin_lock_bh(&snd_wq_lock);
+        list_splice_init(&snd_wq_data, &batch);
+        spin_unlock_bh(&snd_wq_lock);
 
-        list_for_each_entry_safe(snd_data, next, &snd_wq_data, list) {
-                list_del(&snd_data->list);
-                snd_wq_size --;
-                if (snd_wq_size == SEND_WQ_MAX_SIZE - 1) {
-                	spin_unlock_bh(&snd_wq_lock);
-                	enable_all_flows();
-                	spin_lock_bh(&snd_wq_lock);
+        while (!list_empty(&batch)) {
+                /* Gather the SDUs of the first flow, keeping their order */
+                first = list_first_entry(&batch, struct snd_data, list);
+                count = 0;
+                list_for_each_entry_safe(snd_data, next, &batch, list) {
+                        if (snd_data->data != first->data ||
+                            snd_data->id != first->id)
+                                continue;
+
+                        list_del(&snd_data->list);
+                        dus[count++] = snd_data->du;
+                        if (snd_data != first)
+                                rkfree(snd_data);
+
+                        if (count == SND_BATCH)
+                                break;
                 }
-                spin_unlock_bh(&snd_wq_lock);
 
-                __tcp_udp_sdu_write(snd_data->data,
-                                    snd_data->id,
-                                    snd_data->du);
-
-                rkfree(snd_data);
+                __tcp_udp_sdu_write(first->data, first->id, dus, count);
+                rkfree(first);
 
                 spin_lock_bh(&snd_wq_lock);
+                enable = (snd_wq_size == SEND_WQ_MAX_SIZE);
+                snd_wq_size -= count;
+                spin_unlock_bh(&snd_wq_lock);
+
+                if (enable)
+                        enable_all_flows();
         }
-        spin_unlock_bh(&snd_wq_lock);
 
         LOG_DBG("Writer worker finished for now");
 }
@@ -2678,12 +2964,10 @@ static int tcp_udp_init(struct ipcp_factory_data * data)
         bzero(&tcp_udp_data, sizeof(tcp_udp_data));
         INIT_LIST_HEAD(&(data->instances));
 
-        INIT_LIST_HEAD(&rcv_wq_data);
         INIT_LIST_HEAD(&snd_wq_data);
 
         spin_lock_init(&data->lock);
 
-        INIT_WORK(&rcv_work, tcp_udp_rcv_worker);
         INIT_WORK(&snd_work, tcp_udp_write_worker);
 
         snd_wq_size = 0;
@@ -2860,9 +3144,10 @@ static struct ipcp_instance * tcp_udp_create(struct ipcp_factory_data * data,
         spin_lock_init(&inst->data->lock);
 
         INIT_LIST_HEAD(&(inst->data->flows));
-        INIT_LIST_HEAD(&(inst->data->reg_apps));
-        INIT_LIST_HEAD(&(inst->data->directory));
-        INIT_LIST_HEAD(&(inst->data->exp_regs));
+        hash_init(inst->data->udp_flows);
+        hash_init(inst->data->reg_apps);
+        hash_init(inst->data->directory);
+        hash_init(inst->data->exp_regs);
 
         /*
          * Bind the shim-instance to the shims set, to keep all our data
@@ -2881,7 +3166,9 @@ static int tcp_udp_destroy(struct ipcp_factory_data * data,
 {
         struct ipcp_instance_data         * pos, * next;
         struct shim_tcp_udp_flow 	  * flow, * nflow;
-        struct reg_app_data	 	  * reg_app, *nreg_app;
+        struct reg_app_data	 	  * reg_app;
+        struct hlist_node                 * nreg_app;
+        int                                 bucket;
 
         ASSERT(data);
         ASSERT(instance);
@@ -2899,8 +3186,8 @@ static int tcp_udp_destroy(struct ipcp_factory_data * data,
                         }
 
                         /* Unregister existing applications */
-                        list_for_each_entry_safe(reg_app, nreg_app,
-                        			 &pos->reg_apps, list) {
+                        hash_for_each_safe(pos->reg_apps, bucket, nreg_app,
+                                           reg_app, hlist) {
                         	application_unregister(pos, reg_app);
                         }
 
@@ -2951,8 +3238,9 @@ static int __init mod_init(void)
 {
         BUILD_BUG_ON(CONFIG_RINA_SHIM_TCP_UDP_BUFFER_SIZE <= 0);
 
+        /* Sockets have their own work items, let them run in parallel */
         rcv_wq = alloc_workqueue(SHIM_NAME_RWQ,
-                                 WQ_MEM_RECLAIM | WQ_HIGHPRI | WQ_UNBOUND, 1);
+                                 WQ_MEM_RECLAIM | WQ_HIGHPRI | WQ_UNBOUND, 0);
         if (!rcv_wq) {
                 LOG_CRIT("Cannot create the receiver-wq");
                 return -1;
@@ -2980,17 +3268,11 @@ static int __init mod_init(void)
 
 static void __exit mod_exit(void)
 {
-        struct rcv_data * recvd, * nxt_r;
-        struct rcv_data * sendd, * nxt_s;
+        struct snd_data * sendd, * nxt_s;
 
         LOG_DBG("Disposing receiver-wq");
         flush_workqueue(rcv_wq);
         destroy_workqueue(rcv_wq);
-        list_for_each_entry_safe(recvd, nxt_r, &rcv_wq_data, list) {
-                LOG_DBG("Disposing stale data in receiver-wq");
-                list_del(&recvd->list);
-                rkfree(recvd);
-        }
 
         LOG_DBG("Disposing sender-wq");
         flush_workqueue(snd_wq);
@@ -3003,6 +3285,9 @@ static void __exit mod_exit(void)
 
         kipcm_ipcp_factory_unregister(default_kipcm, shim);
 
+        /* Flows are released after an RCU grace period */
+        rcu_barrier();
+
 	LOG_INFO("IRATI shim-tcp-udp module removed successfully");
 }
 
@@ -20,6 +20,7 @@
 
 #include <linux/hashtable.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
 
 #define RINA_PREFIX "kfa-utils"
 
@@ -31,6 +32,9 @@
 
 /*
  * PMAPs
+ *
+ * Updates are serialized by the caller, lookups can run concurrently under
+ * rcu_read_lock()
  */
 
 #define PMAP_HASH_BITS 7
@@ -41,9 +45,10 @@ struct kfa_pmap {
 
 struct kfa_pmap_entry {
         port_id_t          key;
-        struct ipcp_flow * value_flow;
+        struct ipcp_flow __rcu * value_flow;
 
         struct hlist_node  hlist;
+        struct rcu_head    rcu;
 };
 
 struct kfa_pmap * kfa_pmap_create(void)
@@ -83,18 +88,14 @@ int kfa_pmap_empty(struct kfa_pmap * map)
         return hash_empty(map->table);
 }
 
-#define pmap_hash(T, K) hash_min(K, HASH_BITS(T))
-
 static struct kfa_pmap_entry * pmap_entry_find(struct kfa_pmap * map,
                                                port_id_t         key)
 {
         struct kfa_pmap_entry * entry;
-        struct hlist_head *     head;
 
         ASSERT(map);
 
-        head = &map->table[pmap_hash(map->table, key)];
-        hlist_for_each_entry(entry, head, hlist) {
+        hash_for_each_possible_rcu(map->table, entry, hlist, key) {
                 if (entry->key == key)
                         return entry;
         }
@@ -113,7 +114,7 @@ struct ipcp_flow * kfa_pmap_find(struct kfa_pmap * map,
         if (!entry)
                 return NULL;
 
-        return entry->value_flow;
+        return rcu_dereference(entry->value_flow);
 }
 
 int kfa_pmap_update(struct kfa_pmap *   map,
@@ -128,7 +129,7 @@ int kfa_pmap_update(struct kfa_pmap *   map,
         if (!cur)
                 return -1;
 
-        cur->value_flow = value;
+        rcu_assign_pointer(cur->value_flow, value);
 
         return 0;
 }
@@ -147,10 +148,10 @@ static int kfa_pmap_add_gfp(gfp_t              flags,
                 return -1;
 
         tmp->key        = key;
-        tmp->value_flow = value_flow;
+        RCU_INIT_POINTER(tmp->value_flow, value_flow);
         INIT_HLIST_NODE(&tmp->hlist);
 
-        hash_add(map->table, &tmp->hlist, key);
+        hash_add_rcu(map->table, &tmp->hlist, key);
 
         return 0;
 }
@@ -165,6 +166,11 @@ int kfa_pmap_add_ni(struct kfa_pmap *  map,
                     struct ipcp_flow * value_flow)
 { return kfa_pmap_add_gfp(GFP_ATOMIC, map, key, value_flow); }
 
+static void pmap_entry_free_rcu(struct rcu_head * head)
+{
+        rkfree(container_of(head, struct kfa_pmap_entry, rcu));
+}
+
 int kfa_pmap_remove(struct kfa_pmap * map,
                     port_id_t         key)
 {
@@ -176,8 +182,8 @@ int kfa_pmap_remove(struct kfa_pmap * map,
         if (!cur)
                 return -1;
 
-        hash_del(&cur->hlist);
-        rkfree(cur);
+        hash_del_rcu(&cur->hlist);
+        call_rcu(&cur->rcu, pmap_entry_free_rcu);
 
         return 0;
 }
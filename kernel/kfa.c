@@ -25,6 +25,7 @@
 #include <linux/kfifo.h>
 #include <linux/sched.h>
 #include <linux/poll.h>
+#include <linux/rcupdate.h>
 #include <linux/version.h>
 
 #define RINA_PREFIX "kfa"
@@ -39,6 +40,13 @@
 
 #define RINA_IP_FLOW_ENT_NAME "RINA_IP"
 
+/*
+ * The instance lock only serializes the control path: port-id management and
+ * the updates of the flows map. The data path looks flows up under RCU and
+ * then only takes the lock of the flow, so I/O on different flows never
+ * contends. A flow is not destroyed while it has readers, writers or posters,
+ * and its memory is released after a grace period.
+ */
 struct kfa {
 	spinlock_t		 lock;
 	struct pidm             *pidm;
@@ -58,6 +66,8 @@ enum flow_state {
 
 struct ipcp_flow {
 	port_id_t	       port_id;
+	/* Protects the fields below, the wait conditions peek at them */
+	spinlock_t	       lock;
 	enum flow_state	       state;
 	struct ipcp_instance * ipc_process;
 	struct rfifo         * sdu_ready;
@@ -67,6 +77,9 @@ struct ipcp_flow {
 	atomic_t	       posters;
 	bool		       msg_boundaries;
 	struct rina_device   * ip_dev;
+	/* Set by whoever is going to destroy the flow */
+	bool		       dying;
+	struct rcu_head	       rcu;
 };
 
 struct flowdel_data {
@@ -82,6 +95,65 @@ struct ipcp_instance_data {
 //Fwd dec
 static int kfa_flow_deallocate_worker(void *data);
 
+/*
+ * Returns the flow bound to id with its lock held, or NULL if there is none
+ * or it is being destroyed. Release it with kfa_flow_unlock()
+ */
+static struct ipcp_flow *kfa_flow_lock(struct kfa *instance, port_id_t id)
+{
+	struct ipcp_flow *flow;
+
+	rcu_read_lock();
+	flow = kfa_pmap_find(instance->flows, id);
+	if (!flow) {
+		rcu_read_unlock();
+		return NULL;
+	}
+
+	spin_lock_bh(&flow->lock);
+	if (flow->dying) {
+		spin_unlock_bh(&flow->lock);
+		rcu_read_unlock();
+		return NULL;
+	}
+
+	return flow;
+}
+
+static void kfa_flow_unlock(struct ipcp_flow *flow)
+{
+	spin_unlock_bh(&flow->lock);
+	rcu_read_unlock();
+}
+
+/*
+ * Called with the flow lock held. Returns true if the flow is deallocated and
+ * unused, and then the caller has to destroy it once the lock is released
+ */
+static bool kfa_flow_unused(struct ipcp_flow *flow)
+{
+	if (flow->dying || flow->state != PORT_STATE_DEALLOCATED ||
+	    atomic_read(&flow->readers) ||
+	    atomic_read(&flow->writers) ||
+	    atomic_read(&flow->posters))
+		return false;
+
+	flow->dying = true;
+
+	return true;
+}
+
+static void kfa_flow_free_rcu(struct rcu_head *head)
+{
+	struct ipcp_flow *flow = container_of(head, struct ipcp_flow, rcu);
+
+	if (flow->sdu_ready &&
+	    rfifo_destroy(flow->sdu_ready, (void (*) (void *)) du_destroy))
+		LOG_ERR("Flow %d FIFO has not been destroyed", flow->port_id);
+
+	rkfree(flow);
+}
+
 port_id_t kfa_port_id_reserve(struct kfa      * instance,
 			      ipc_process_id_t  id)
 {
@@ -113,7 +185,10 @@ port_id_t kfa_port_id_reserve(struct kfa      * instance,
 }
 EXPORT_SYMBOL(kfa_port_id_reserve);
 
-/* NOTE: Add instance-locking IFF exporting to API */
+/*
+ * Takes the instance lock, the flow must have been marked as dying and must
+ * not be locked by the caller
+ */
 static int kfa_flow_destroy(struct kfa       *instance,
 			    struct ipcp_flow *flow,
 			    port_id_t	      id)
@@ -124,19 +199,15 @@ static int kfa_flow_destroy(struct kfa       *instance,
 	struct flowdel_data  * wqdata;
 
 	ASSERT(flow);
+	ASSERT(flow->dying);
 
 	LOG_DBG("We are destroying flow %d", id);
 
 	/* FIXME: Should we ASSERT() here ? */
-	if (!flow->sdu_ready) {
+	if (!flow->sdu_ready)
 		LOG_WARN("Instance %pK SDU-ready FIFO is NULL", instance);
-	} else {
-		if (rfifo_destroy(flow->sdu_ready,
-				  (void (*) (void *)) du_destroy)) {
-			LOG_ERR("Flow %d FIFO has not been destroyed", id);
-			retval = -1;
-		}
-	}
+
+	spin_lock_bh(&instance->lock);
 
 	if (kfa_pmap_remove(instance->flows, id)) {
 		LOG_ERR("Could not remove pending flow with port-id %d", id);
@@ -148,20 +219,27 @@ static int kfa_flow_destroy(struct kfa       *instance,
 		retval = -1;
 	}
 
+	spin_unlock_bh(&instance->lock);
+
+	spin_lock_bh(&flow->lock);
 	if (flow->wqs) {
 		wake_up_interruptible_all(&flow->wqs->read_wqueue);
 		wake_up_interruptible_all(&flow->wqs->write_wqueue);
 	}
-
 	ip_dev = flow->ip_dev;
 	flow->ip_dev = NULL;
-	rkfree(flow);
+	spin_unlock_bh(&flow->lock);
+
+	/* Lockless lookups may still be looking at it */
+	call_rcu(&flow->rcu, kfa_flow_free_rcu);
 
 	if(!ip_dev)
 		return retval;
 
 	//the net device can not be unregistered in atomic, postpone it...
 	wqdata	       = rkzalloc(sizeof(*wqdata), GFP_ATOMIC);
+	if (!wqdata)
+		return -1;
 	wqdata->kfa    = NULL;
 	wqdata->id     = 0;
 	wqdata->ip_dev = ip_dev;
@@ -200,7 +278,9 @@ int  kfa_port_id_release(struct kfa *instance,
 	 * are 0. This avoids allocating the freed port again before the KFA
 	 * finally destroys everything.
 	 */
+	rcu_read_lock();
 	flow = kfa_pmap_find(instance->flows, port_id);
+	rcu_read_unlock();
 	if (flow) {
 		spin_unlock_bh(&instance->lock);
 		return 0;
@@ -258,37 +338,32 @@ static int kfa_flow_deallocate_worker(void *data)
 		return -1;
 	}
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("The flow with port-id %d was already destroyed", id);
 		return 0;
 	}
 
 	if (flow->state != PORT_STATE_DEALLOCATED) {
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		LOG_ERR("Port %u should be deallocated but it is not...", id);
 		return 0;
 	}
 
-	if ((atomic_read(&flow->readers) == 0) &&
-	    (atomic_read(&flow->writers) == 0) &&
-	    (atomic_read(&flow->posters) == 0)) {
+	if (kfa_flow_unused(flow)) {
+		kfa_flow_unlock(flow);
 		if (kfa_flow_destroy(instance, flow, id))
 			LOG_ERR("Could not destroy the flow correctly");
-		spin_unlock_bh(&instance->lock);
 		return 0;
 	}
 
-	spin_unlock_bh(&instance->lock);
-
 	if (flow->wqs) {
 		wake_up_interruptible_all(&flow->wqs->read_wqueue);
 		wake_up_interruptible_all(&flow->wqs->write_wqueue);
 	}
 
+	kfa_flow_unlock(flow);
+
 	return 0;
 }
 
@@ -315,28 +390,27 @@ static int kfa_flow_deallocate(struct ipcp_instance_data *data,
 		return -1;
 	}
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow created with port-id %d", id);
 		return -1;
 	}
 
 	flow->state = PORT_STATE_DEALLOCATED;
 
-	if ((atomic_read(&flow->readers) == 0) &&
-	    (atomic_read(&flow->writers) == 0) &&
-	    (atomic_read(&flow->posters) == 0)) {
+	if (kfa_flow_unused(flow)) {
+		kfa_flow_unlock(flow);
 		LOG_DBG("Destroying kfa flow now...");
 		if (kfa_flow_destroy(instance, flow, id))
 			LOG_ERR("Could not destroy the flow correctly");
-		spin_unlock_bh(&instance->lock);
 		return 0;
 	}
 
+	kfa_flow_unlock(flow);
+
 	wqdata	       = rkzalloc(sizeof(*wqdata), GFP_ATOMIC);
+	if (!wqdata)
+		return -1;
 	wqdata->kfa    = instance;
 	wqdata->id     = id;
 	wqdata->ip_dev = NULL;
@@ -348,7 +422,6 @@ static int kfa_flow_deallocate(struct ipcp_instance_data *data,
 	}
 
 	rwq_work_post(data->kfa->flowdelq, item);
-	spin_unlock_bh(&instance->lock);
 
 	return 0;
 }
@@ -360,10 +433,6 @@ static bool ok_write(struct ipcp_flow *flow)
 		 flow->state == PORT_STATE_DEALLOCATED);
 }
 
-/*
- * NOTE: This function does NOT take the mutex, because it will be called only
- *	 during a write operation and then the mutex will be already taken.
- */
 static int disable_write(struct ipcp_instance_data *data, port_id_t id)
 {
 	struct ipcp_flow *flow;
@@ -385,23 +454,21 @@ static int disable_write(struct ipcp_instance_data *data, port_id_t id)
 	}
 	LOG_DBG("DISABLED write op");
 
-	spin_lock_bh(&instance->lock);
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow bound to port-id %d", id);
 		return -1;
 	}
 
 	if (flow->state == PORT_STATE_DEALLOCATED) {
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		LOG_DBG("Flow with port-id %d is already deallocated", id);
 		return 0;
 	}
 
 	flow->state = PORT_STATE_DISABLED;
 	LOG_DBG("Disabled write in port id %d", id);
-	spin_unlock_bh(&instance->lock);
+	kfa_flow_unlock(flow);
 
 	LOG_DBG("IPCP notified CWQ exhausted");
 
@@ -412,7 +479,6 @@ static int enable_write(struct ipcp_instance_data *data, port_id_t id)
 {
 	struct ipcp_flow  *flow;
 	struct kfa        *instance;
-	wait_queue_head_t *wq;
 
 	if (!data) {
 		LOG_ERR("Bogus ipcp data instance passed, can't enable pid");
@@ -431,34 +497,29 @@ static int enable_write(struct ipcp_instance_data *data, port_id_t id)
 
 	LOG_DBG("ENABLED write op");
 
-	spin_lock_bh(&instance->lock);
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow bound to port-id %d", id);
 		return -1;
 	}
 
 	if (flow->state == PORT_STATE_DEALLOCATED) {
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		LOG_DBG("Flow with port-id %d is already deallocated", id);
 		return 0;
 	}
 	if (flow->state == PORT_STATE_DISABLED) {
 		flow->state = PORT_STATE_ALLOCATED;
 		if (flow->wqs) {
-			wq = &flow->wqs->write_wqueue;
-			spin_unlock_bh(&instance->lock);
 			LOG_DBG("IPCP notified CWQ is now enabled");
 			LOG_DBG("Enabled write in port id %d", id);
-			wake_up_interruptible(wq);
-			return 0;
+			wake_up_interruptible(&flow->wqs->write_wqueue);
 		}
 	} else {
 		LOG_DBG("IPCP notified CWQ already enabled");
 	}
 
-	spin_unlock_bh(&instance->lock);
+	kfa_flow_unlock(flow);
 
 	return 0;
 }
@@ -490,20 +551,18 @@ int kfa_flow_ub_write(struct kfa * instance,
 	size_t max_sdu_size = 0;
 	size_t copylen = 0;
 	size_t data_written = 0;
+	bool   destroy;
 
 	LOG_DBG("Trying to write SDU to port-id %d", id);
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow bound to port-id %d", id);
 		if (skb) kfree_skb(skb);
 		return -EBADF;
 	}
 	if (flow->state == PORT_STATE_DEALLOCATED) {
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		LOG_ERR("Flow with port-id %d is already deallocated", id);
 		if (skb) kfree_skb(skb);
 		return -ESHUTDOWN;
@@ -512,18 +571,18 @@ int kfa_flow_ub_write(struct kfa * instance,
 	ipcp = flow->ipc_process;
 	max_sdu_size = ipcp->ops->max_sdu_size(ipcp->data);
 	if (flow->msg_boundaries && left > max_sdu_size) {
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		LOG_ERR("SDU is larger than the max SDU handled by "
 				"the IPCP: %zd, %zd", max_sdu_size, left);
 		if (skb) kfree_skb(skb);
 	        return -EMSGSIZE;
 	}
 
+	/* From now on the flow is not destroyed under our feet */
 	atomic_inc(&flow->writers);
+	kfa_flow_unlock(flow);
 
 	while (left) {
-		spin_unlock_bh(&instance->lock);
-
 		copylen = min(left, max_sdu_size);
 
 		if (skb) {
@@ -561,20 +620,19 @@ int kfa_flow_ub_write(struct kfa * instance,
 			}
 		}
 
-		spin_lock_bh(&instance->lock);
+		spin_lock_bh(&flow->lock);
 
 		if (blocking) { /* blocking I/O */
 			if (flow->wqs == 0) {
 				LOG_ERR("Waitqueues are null, flow %d is being deallocated", id);
 				retval = -EBADF;
-				du_destroy(du);
-				goto finish;
+				goto drop;
 			} else {
 				wqs = flow->wqs;
 			}
 
 			while (!ok_write(flow)) {
-				spin_unlock_bh(&instance->lock);
+				spin_unlock_bh(&flow->lock);
 
 				LOG_DBG("Going to sleep on wait queue %pK (writing)",
 						&wqs->write_wqueue);
@@ -599,97 +657,71 @@ int kfa_flow_ub_write(struct kfa * instance,
 					}
 				}
 
-				spin_lock_bh(&instance->lock);
-
-				flow = kfa_pmap_find(instance->flows, id);
-				if (!flow) {
-					spin_unlock_bh(&instance->lock);
-					du_destroy(du);
-					LOG_ERR("No more flow bound to port-id %d", id);
-					retval = -EBADF;
-					goto finish;
-				}
+				spin_lock_bh(&flow->lock);
 
 				if (flow->wqs == 0) {
 					LOG_ERR("Waitqueues are null, flow %d is being deallocated", id);
 					retval = -EBADF;
-					du_destroy(du);
-					goto finish;
+					goto drop;
 				}
 
-				if (retval < 0) {
-					du_destroy(du);
-					goto finish;
-				}
+				if (retval < 0)
+					goto drop;
 
 				if (flow->state == PORT_STATE_DEALLOCATED) {
-					du_destroy(du);
 					retval = -ESHUTDOWN;
-					goto finish;
+					goto drop;
 				}
 			}
-
-			ipcp = flow->ipc_process;
-			if (!ipcp) {
-				retval = -EBADF;
-				du_destroy(du);
-				goto finish;
-			}
-
-			spin_unlock_bh(&instance->lock);
-			if (ipcp->ops->du_write(ipcp->data, id, du, blocking)) {
-				spin_lock_bh(&instance->lock);
-				LOG_ERR("Couldn't write SDU on port-id %d", id);
-				retval = -EIO;
-				goto finish;
-			}
-			spin_lock_bh(&instance->lock);
 		} else { /* non-blocking I/O */
 			if (flow->state == PORT_STATE_PENDING
 					|| flow->state == PORT_STATE_DISABLED) {
 				LOG_DBG("Flow %d is not ready for writing", id);
 				retval = -EAGAIN;
-				goto finish;
+				goto drop;
 			}
 
 			if (flow->state == PORT_STATE_DEALLOCATED) {
 				LOG_ERR("Flow %d has been deallocated", id);
 				retval = -ESHUTDOWN;
-				goto finish;
+				goto drop;
 			}
+		}
 
-			ipcp = flow->ipc_process;
-			if (!ipcp) {
-				retval = -EBADF;
-				du_destroy(du);
-				goto finish;
-			}
+		ipcp = flow->ipc_process;
+		if (!ipcp) {
+			retval = -EBADF;
+			goto drop;
+		}
 
-			spin_unlock_bh(&instance->lock);
-			if (ipcp->ops->du_write(ipcp->data, id, du, blocking)) {
-				spin_lock_bh(&instance->lock);
-				LOG_ERR("Couldn't write SDU on port-id %d", id);
-				retval = -EIO;
-				goto finish;
-			}
-			spin_lock_bh(&instance->lock);
+		spin_unlock_bh(&flow->lock);
+
+		if (ipcp->ops->du_write(ipcp->data, id, du, blocking)) {
+			LOG_ERR("Couldn't write SDU on port-id %d", id);
+			retval = -EIO;
+			goto finish;
 		}
 
 		left -= copylen;
 		data_written += copylen;
 	}
 
+	goto finish;
+
+ drop:
+	spin_unlock_bh(&flow->lock);
+	du_destroy(du);
+
  finish:
 	LOG_DBG("Finishing (write)");
 
-	if (atomic_dec_and_test(&flow->writers) &&
-	    (atomic_read(&flow->readers) == 0)	&&
-	    (atomic_read(&flow->posters) == 0)	&&
-	    (flow->state == PORT_STATE_DEALLOCATED))
-		if (kfa_flow_destroy(instance, flow, id))
-			LOG_ERR("Could not destroy the flow correctly");
+	spin_lock_bh(&flow->lock);
+	atomic_dec(&flow->writers);
+	destroy = kfa_flow_unused(flow);
+	spin_unlock_bh(&flow->lock);
 
-	spin_unlock_bh(&instance->lock);
+	if (destroy && kfa_flow_destroy(instance, flow, id))
+		LOG_ERR("Could not destroy the flow correctly");
 
 	if (data_written == 0)
 		return retval;
@@ -727,6 +759,7 @@ int kfa_flow_readable(struct kfa       *instance,
                       poll_table       *wait)
 {
         struct ipcp_flow *flow;
+        struct iowaitqs  *wqs;
 
 	if (!instance) {
 		LOG_ERR("Bogus instance passed, bailing out");
@@ -740,25 +773,32 @@ int kfa_flow_readable(struct kfa       *instance,
 		return -1;
 	}
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow bound to port-id %d", id);
 		*mask |= POLLIN | POLLRDNORM;
 		return 0;
 	}
+	wqs = flow->wqs;
+	kfa_flow_unlock(flow);
 
-        poll_wait(f, &flow->wqs->read_wqueue, wait);
+	/* The wait queues belong to the file, poll_wait() may sleep */
+	if (wqs)
+		poll_wait(f, &wqs->read_wqueue, wait);
 
         /* We set a POLLIN event if there is something in the receive queue
          * or if the flow has been deallocated, which is our EOF condition. */
+	flow = kfa_flow_lock(instance, id);
+	if (!flow) {
+		*mask |= POLLIN | POLLRDNORM;
+		return 0;
+	}
+
         if (queue_ready(flow)) {
                 *mask |= POLLIN | POLLRDNORM;
         }
 
-	spin_unlock_bh(&instance->lock);
+	kfa_flow_unlock(flow);
 
 	return 0;
 }
@@ -779,18 +819,15 @@ int kfa_flow_set_iowqs(struct kfa * instance,
 		return -1;
 	}
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, pid);
+	flow = kfa_flow_lock(instance, pid);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow bound to port-id %d", pid);
 		return -1;
 	}
 
 	flow->wqs = wqs;
 
-	spin_unlock_bh(&instance->lock);
+	kfa_flow_unlock(flow);
 
 	return 0;
 }
@@ -807,18 +844,14 @@ int kfa_flow_cancel_iowqs(struct kfa      * instance,
 	if (!is_port_id_ok(pid))
 		return -1;
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, pid);
-	if (!flow) {
-		spin_unlock_bh(&instance->lock);
+	flow = kfa_flow_lock(instance, pid);
+	if (!flow)
 		return -1;
-	}
 
 	wqs = flow->wqs;
 	flow->wqs = 0;
 
-	spin_unlock_bh(&instance->lock);
+	kfa_flow_unlock(flow);
 
 	if (wqs) {
 		wake_up_interruptible_all(&wqs->read_wqueue);
@@ -850,6 +883,7 @@ int kfa_flow_du_read(struct kfa  *instance,
 	struct ipcp_flow *flow;
 	int		  retval = 0;
 	struct iowaitqs * wqs = 0;
+	bool		  destroy;
 
 	if (!instance) {
 		LOG_ERR("Bogus instance passed, bailing out");
@@ -866,21 +900,21 @@ int kfa_flow_du_read(struct kfa  *instance,
 
 	LOG_DBG("Trying to read SDU from port-id %d", id);
 
-	spin_lock_bh(&instance->lock);
-
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
 		LOG_ERR("There is no flow bound to port-id %d", id);
-		spin_unlock_bh(&instance->lock);
 		return -EBADF;
 	}
 	if (flow->state == PORT_STATE_DEALLOCATED) {
 		LOG_ERR("Flow with port-id %d is already deallocated", id);
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		return -ESHUTDOWN;
 	}
 
+	/* From now on the flow is not destroyed under our feet, and it can be
+	 * used out of the RCU read side section */
 	atomic_inc(&flow->readers);
+	rcu_read_unlock();
 
 	if (blocking) { /* blocking I/O */
 		if (flow->wqs == 0) {
@@ -893,7 +927,7 @@ int kfa_flow_du_read(struct kfa  *instance,
 
 		while (flow->state == PORT_STATE_PENDING ||
 				rfifo_is_empty(flow->sdu_ready)) {
-			spin_unlock_bh(&instance->lock);
+			spin_unlock_bh(&flow->lock);
 
 			LOG_DBG("Going to sleep on wait queue %pK (reading)",
 					&wqs->read_wqueue);
@@ -916,13 +950,7 @@ int kfa_flow_du_read(struct kfa  *instance,
 				}
 			}
 
-			spin_lock_bh(&instance->lock);
-			flow = kfa_pmap_find(instance->flows, id);
-			if (!flow) {
-				spin_unlock_bh(&instance->lock);
-				LOG_ERR("No more flow bound to port-id %d", id);
-				return 0;
-			}
+			spin_lock_bh(&flow->lock);
 
 			if (flow->wqs == 0) {
 				LOG_ERR("Waitqueues are null, flow %d is being deallocated", id);
@@ -977,14 +1005,12 @@ int kfa_flow_du_read(struct kfa  *instance,
  finish:
 	LOG_DBG("Finishing (read)");
 
-	if (atomic_dec_and_test(&flow->readers) &&
-	    (atomic_read(&flow->writers) == 0)	&&
-	    (atomic_read(&flow->posters) == 0)	&&
-	    (flow->state == PORT_STATE_DEALLOCATED))
-		if (kfa_flow_destroy(instance, flow, id))
-			LOG_ERR("Could not destroy the flow correctly");
+	atomic_dec(&flow->readers);
+	destroy = kfa_flow_unused(flow);
+	spin_unlock_bh(&flow->lock);
 
-	spin_unlock_bh(&instance->lock);
+	if (destroy && kfa_flow_destroy(instance, flow, id))
+		LOG_ERR("Could not destroy the flow correctly");
 
 	return retval;
 }
@@ -993,11 +1019,12 @@ static int kfa_du_post(struct ipcp_instance_data *data,
 		       port_id_t		   id,
 		       struct du                * du)
 {
-	struct ipcp_flow  * flow;
-	wait_queue_head_t * wq;
-	struct kfa        * instance;
-	struct sk_buff	  * skb;
-	int		    retval = 0;
+	struct ipcp_flow   * flow;
+	struct kfa         * instance;
+	struct rina_device * ip_dev;
+	struct sk_buff	   * skb;
+	int		     retval = 0;
+	bool		     destroy;
 
 	if (!data || !is_port_id_ok(id) || !is_du_ok(du)) {
 		LOG_ERR("Bogus ipcp data instance passed, cannot post SDU");
@@ -1014,57 +1041,60 @@ static int kfa_du_post(struct ipcp_instance_data *data,
 
 	LOG_DBG("Posting DU to port-id %d ", id);
 
-	spin_lock_bh(&instance->lock);
-	flow = kfa_pmap_find(instance->flows, id);
+	flow = kfa_flow_lock(instance, id);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("There is no flow bound to port-id %d", id);
 		du_destroy(du);
 		return -1;
 	}
 
 	if (flow->state == PORT_STATE_DEALLOCATED) {
-		spin_unlock_bh(&instance->lock);
+		kfa_flow_unlock(flow);
 		LOG_ERR("Flow with port-id %d is already deallocated", id);
 		du_destroy(du);
 		return -1;
 	}
 
-	if (flow->ip_dev) {
-		/* SDU will be consumed through IP networking stack */
-		skb = du_detach_skb(du);
-		du_destroy(du);
-		retval = rina_dev_rcv(skb, flow->ip_dev);
-	} else {
+	if (!flow->ip_dev) {
 		/* SDU will be consumed through I/O dev */
 		if (rfifo_push_ni(flow->sdu_ready, du)) {
 			LOG_ERR("Could not write %zd bytes into port-id %d",
 				sizeof(struct du *), id);
 			retval = -1;
+		} else if (flow->wqs != 0) {
+			/* set_tsk_need_resched(current); */
+			wake_up_interruptible_poll(&flow->wqs->read_wqueue,
+						   POLLIN | POLLRDNORM
+						   | POLLRDBAND);
+			LOG_DBG("SDU posted");
 		}
+		kfa_flow_unlock(flow);
+
+		return retval;
 	}
 
+	/* SDU will be consumed through IP networking stack */
+	ip_dev = flow->ip_dev;
 	atomic_inc(&flow->posters);
-	if (atomic_dec_and_test(&flow->posters) &&
-	    (atomic_read(&flow->writers) == 0)	&&
-	    (atomic_read(&flow->readers) == 0)	&&
-	    (flow->state == PORT_STATE_DEALLOCATED)) {
-		if (kfa_flow_destroy(instance, flow, id))
-			LOG_ERR("Could not destroy the flow correctly");
-		flow = NULL;
-	}
+	kfa_flow_unlock(flow);
 
-	spin_unlock_bh(&instance->lock);
+	skb = du_detach_skb(du);
+	du_destroy(du);
 
-	if (flow && (retval == 0) && (flow->wqs != 0)) {
-		wq = &flow->wqs->read_wqueue;
-		ASSERT(wq);
+	/* Posters may run in process context, e.g. the shim-tcp-udp receive
+	 * workers: with BH disabled the NET_RX softirq raised by the device
+	 * runs at local_bh_enable() instead of at the next interrupt */
+	local_bh_disable();
+	retval = rina_dev_rcv(skb, ip_dev);
+	local_bh_enable();
 
-		/* set_tsk_need_resched(current); */
-		wake_up_interruptible_poll(wq, POLLIN | POLLRDNORM
-                                                | POLLRDBAND);
-		LOG_DBG("SDU posted");
-	}
+	spin_lock_bh(&flow->lock);
+	atomic_dec(&flow->posters);
+	destroy = kfa_flow_unused(flow);
+	spin_unlock_bh(&flow->lock);
+
+	if (destroy && kfa_flow_destroy(instance, flow, id))
+		LOG_ERR("Could not destroy the flow correctly");
 
 	return retval;
 }
@@ -1102,10 +1132,12 @@ int kfa_flow_create(struct kfa           *instance,
 		LOG_ERR("Failed to created flow, bailing out");
 		return -1;
 	}
+	spin_lock_init(&flow->lock);
 	atomic_set(&flow->readers, 0);
 	atomic_set(&flow->writers, 0);
 	atomic_set(&flow->posters, 0);
 	flow->wqs = 0;
+	flow->port_id = pid;
 
 	flow->ipc_process = ipcp;
 
@@ -1118,7 +1150,9 @@ int kfa_flow_create(struct kfa           *instance,
 			   RINA_IP_FLOW_ENT_NAME));
 	if (ip_flow) {
 		sprintf(name, "rina.%u.%u", ipc_id, pid);
-		flow->ip_dev = rina_dev_create(name, instance->ipcp, pid);
+		flow->ip_dev = rina_dev_create(name, instance->ipcp, pid,
+					       ipcp && ipcp->ops->max_sdu_size ?
+					       ipcp->ops->max_sdu_size(ipcp->data) : 0);
 		if (!flow->ip_dev) {
 			LOG_ERR("Could not allocate memory for RINA IP virtual device");
 			rkfree(flow);
@@ -1176,10 +1210,8 @@ static int kfa_flow_ipcp_bind(struct ipcp_instance_data *data,
 		return -1;
 	}
 
-	spin_lock_bh(&instance->lock);
-	flow = kfa_pmap_find(instance->flows, pid);
+	flow = kfa_flow_lock(instance, pid);
 	if (!flow) {
-		spin_unlock_bh(&instance->lock);
 		LOG_ERR("Cannot bind IPCP %pK, missing flow on port %d",
 			ipcp,
 			pid);
@@ -1190,13 +1222,16 @@ static int kfa_flow_ipcp_bind(struct ipcp_instance_data *data,
 	flow->state	  = PORT_STATE_ALLOCATED;
 	flow->sdu_ready	  = rfifo_create_ni();
 	if (!flow->sdu_ready) {
+		flow->dying = true;
+		kfa_flow_unlock(flow);
+		spin_lock_bh(&instance->lock);
 		kfa_pmap_remove(instance->flows, pid);
-		rkfree(flow);
 		spin_unlock_bh(&instance->lock);
+		call_rcu(&flow->rcu, kfa_flow_free_rcu);
 		return -1;
 	}
 
-	spin_unlock_bh(&instance->lock);
+	kfa_flow_unlock(flow);
 
 	LOG_DBG("Flow bound to port-id %d", pid);
 
@@ -1321,6 +1356,9 @@ int kfa_destroy(struct kfa *instance)
 	kfa_ipcp_instance_destroy(instance->ipcp);
 	rwq_destroy(instance->flowdelq);
 
+	/* Wait for the flows that are still being released */
+	rcu_barrier();
+
 	rkfree(instance);
 
 	return 0;
@@ -1330,10 +1368,10 @@ bool kfa_flow_exists(struct kfa *kfa, port_id_t port_id)
 {
         struct ipcp_flow *flow;
 
-        spin_lock_bh(&kfa->lock);
+        rcu_read_lock();
         flow = kfa_pmap_find(kfa->flows, port_id);
         /* XXX check flow->state ? */
-        spin_unlock_bh(&kfa->lock);
+        rcu_read_unlock();
 
         return flow != NULL;
 }
@@ -1344,15 +1382,14 @@ size_t kfa_flow_max_sdu_size(struct kfa * kfa, port_id_t port_id)
 	size_t result;
 	struct ipcp_flow *flow;
 
-        spin_lock_bh(&kfa->lock);
-        flow = kfa_pmap_find(kfa->flows, port_id);
+        flow = kfa_flow_lock(kfa, port_id);
         if (!flow) {
         	result = 0;
         } else {
         	result = flow->ipc_process->
         			ops->max_sdu_size(flow->ipc_process->data);
+        	kfa_flow_unlock(flow);
         }
-        spin_unlock_bh(&kfa->lock);
 
         return result;
 }
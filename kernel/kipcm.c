@@ -1103,6 +1103,7 @@ static int ipcm_query_rib_reply(irati_msg_port_t ctrl_port,
 	resp_msg.src_ipcp_id = ipc_id;
 	resp_msg.dest_ipcp_id = 0;
 	resp_msg.result = result;
+	resp_msg.more = 0;
 	resp_msg.event_id = seq_num;
 
 	resp_msg.rib_entries = rkzalloc(sizeof(struct query_rib_resp), GFP_KERNEL);
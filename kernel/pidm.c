@@ -17,8 +17,6 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
-#include <linux/list.h>
-
 #define RINA_PREFIX "pidm"
 
 #include "logs.h"
@@ -26,17 +24,13 @@
 #include "utils.h"
 #include "pidm.h"
 #include "common.h"
+#include "rds/rbmp.h"
 
-#define MAX_PORT_ID (((2 << BITS_PER_BYTE) * sizeof(port_id_t)) - 1)
+/* Port-ids 1 .. MAX_PORT_ID, as many as a 2 bytes port-id field holds */
+#define MAX_PORT_ID ((1 << 16) - 1)
 
 struct pidm {
-	struct list_head allocated_ports;
-	port_id_t last_allocated;
-};
-
-struct alloc_pid {
-        struct list_head       list;
-        port_id_t pid;
+	struct rbmp * bitmap;
 };
 
 struct pidm * pidm_create(void)
@@ -47,10 +41,13 @@ struct pidm * pidm_create(void)
         if (!instance)
                 return NULL;
 
-        INIT_LIST_HEAD(&(instance->allocated_ports));
-        instance->last_allocated = 0;
+        instance->bitmap = rbmp_create(MAX_PORT_ID, 1);
+        if (!instance->bitmap) {
+                rkfree(instance);
+                return NULL;
+        }
 
-        LOG_INFO("Instance initialized successfully (%zd port-ids)",
+        LOG_INFO("Instance initialized successfully (%d port-ids)",
         	MAX_PORT_ID);
 
         return instance;
@@ -58,17 +55,12 @@ struct pidm * pidm_create(void)
 
 int pidm_destroy(struct pidm * instance)
 {
-	struct alloc_pid * pos, * next;
-
         if (!instance) {
                 LOG_ERR("Bogus instance passed, bailing out");
                 return -1;
         }
 
-        list_for_each_entry_safe(pos, next, &instance->allocated_ports, list) {
-                rkfree(pos);
-        }
-
+        rbmp_destroy(instance->bitmap);
         rkfree(instance);
 
         return 0;
@@ -76,25 +68,16 @@ int pidm_destroy(struct pidm * instance)
 
 int pidm_allocated(struct pidm * instance, port_id_t port_id)
 {
-	struct alloc_pid * pos, * next;
-
         if (!instance) {
                 LOG_ERR("Bogus instance passed, bailing out");
                 return -1;
         }
 
-        list_for_each_entry_safe(pos, next, &instance->allocated_ports, list) {
-                if (pos->pid == port_id) {
-                	return 1;
-                }
-        }
-
-        return 0;
+        return rbmp_is_allocated(instance->bitmap, port_id) ? 1 : 0;
 }
 
 port_id_t pidm_allocate(struct pidm * instance)
 {
-	struct alloc_pid * new_port_id;
         port_id_t pid;
 
         if (!instance) {
@@ -102,30 +85,12 @@ port_id_t pidm_allocate(struct pidm * instance)
                 return port_id_bad();
         }
 
-        if (instance->last_allocated == MAX_PORT_ID) {
-        	pid = 1;
-        } else {
-        	pid = instance->last_allocated + 1;
-        }
-
-        while (pidm_allocated(instance, pid)) {
-        	if (pid == MAX_PORT_ID) {
-        		pid = 1;
-        	} else {
-        		pid ++;
-        	}
+        pid = rbmp_allocate(instance->bitmap);
+        if (!rbmp_is_id_ok(instance->bitmap, pid)) {
+                LOG_ERR("No port-ids left");
+                return port_id_bad();
         }
 
-        new_port_id = rkmalloc(sizeof(*new_port_id), GFP_ATOMIC);
-        if (!new_port_id)
-        	return port_id_bad();
-
-        INIT_LIST_HEAD(&(new_port_id->list));
-        new_port_id->pid = pid;
-        list_add(&(new_port_id->list), &(instance->allocated_ports));
-
-        instance->last_allocated = pid;
-
         LOG_DBG("Port-id allocation completed successfully (id = %d)", pid);
 
         return pid;
@@ -134,8 +99,6 @@ port_id_t pidm_allocate(struct pidm * instance)
 int pidm_release(struct pidm * instance,
                  port_id_t     id)
 {
-	 struct alloc_pid * pos, * next;
-
         if (!is_port_id_ok(id)) {
                 LOG_ERR("Bad flow-id passed, bailing out");
                 return -1;
@@ -145,17 +108,12 @@ int pidm_release(struct pidm * instance,
                 return -1;
         }
 
-        list_for_each_entry_safe(pos, next, &instance->allocated_ports, list) {
-                if (pos->pid == id) {
-                	list_del(&pos->list);
-                	rkfree(pos);
-                	LOG_DBG("Port-id release completed successfully (port_id: %d)", id);
-
-                	return 0;
-                }
+        if (rbmp_release(instance->bitmap, id)) {
+                LOG_ERR("Didn't find port-id %d, returning error", id);
+                return 0;
         }
 
-        LOG_ERR("Didn't find port-id %d, returning error", id);
+        LOG_DBG("Port-id release completed successfully (port_id: %d)", id);
 
         return 0;
 }
@@ -29,6 +29,8 @@ struct pidm * pidm_create(void);
 int           pidm_destroy(struct pidm * instance);
 
 port_id_t     pidm_allocate(struct pidm * instance);
+int           pidm_allocated(struct pidm * instance,
+                             port_id_t     port_id);
 int           pidm_release(struct pidm * instance,
                            port_id_t     id);
 
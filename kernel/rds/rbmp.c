@@ -21,6 +21,8 @@
 #include <linux/export.h>
 #include <linux/types.h>
 #include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
 
 #define RINA_PREFIX "rbmp"
 
@@ -29,13 +31,23 @@
 #include "rmem.h"
 #include "rbmp.h"
 
-#define BITS_IN_BITMAP ((2 << BITS_PER_BYTE) * sizeof(size_t))
-
+/*
+ * Ids are allocated next-fit, starting after the last allocated one, so
+ * that a released id is not handed out again right away. A second
+ * level bitmap, with a bit per word of the first one, marks the words
+ * without free ids so that they are skipped. All the operations use
+ * atomic bitops and can be called from any context without external
+ * locking. The second level is only a hint: when it races with a
+ * release and claims that everything is full, the first level is
+ * scanned.
+ */
 struct rbmp {
-        ssize_t offset;
-        size_t  size;
-
-        DECLARE_BITMAP(bitmap, BITS_IN_BITMAP);
+        ssize_t         offset;
+        size_t          size;
+        size_t          words;
+        size_t          last; /* hint, bit of the last allocated id */
+        unsigned long * bitmap;
+        unsigned long * full;
 };
 
 static struct rbmp * rbmp_create_gfp(gfp_t flags, size_t bits, ssize_t offset)
@@ -49,9 +61,28 @@ static struct rbmp * rbmp_create_gfp(gfp_t flags, size_t bits, ssize_t offset)
         if (!tmp)
                 return NULL;
 
+        tmp->words  = BITS_TO_LONGS(bits);
+        tmp->bitmap = rkzalloc(tmp->words * sizeof(unsigned long), flags);
+        tmp->full   = rkzalloc(BITS_TO_LONGS(tmp->words) *
+                               sizeof(unsigned long), flags);
+        if (!tmp->bitmap || !tmp->full) {
+                if (tmp->bitmap)
+                        rkfree(tmp->bitmap);
+                if (tmp->full)
+                        rkfree(tmp->full);
+                rkfree(tmp);
+                return NULL;
+        }
+
+        /* The bits past the end are never free, so the last word can be
+         * full too */
+        if (tmp->words * BITS_PER_LONG > bits)
+                bitmap_set(tmp->bitmap, bits,
+                           tmp->words * BITS_PER_LONG - bits);
+
         tmp->size   = bits;
         tmp->offset = offset;
-        bitmap_zero(tmp->bitmap, BITS_IN_BITMAP);
+        tmp->last   = bits - 1;
 
         return tmp;
 }
@@ -69,6 +100,8 @@ int rbmp_destroy(struct rbmp * b)
         if (!b)
                 return -1;
 
+        rkfree(b->full);
+        rkfree(b->bitmap);
         rkfree(b);
 
         return 0;
@@ -82,22 +115,59 @@ static ssize_t bad_id(struct rbmp * b)
         return b->offset - 1;
 }
 
+/* Takes the first free bit from start on, returns b->size if none */
+static size_t take_from(struct rbmp * b, size_t start)
+{
+        size_t w, end, bit;
+
+        w = start / BITS_PER_LONG;
+        while ((w = find_next_zero_bit(b->full, b->words, w)) < b->words) {
+                end = (w + 1) * BITS_PER_LONG;
+                bit = find_next_zero_bit(b->bitmap, end,
+                                         max(start, w * BITS_PER_LONG));
+                if (bit >= end) {
+                        if (b->bitmap[w] == ~0UL)
+                                set_bit(w, b->full);
+                        w++;
+                        continue;
+                }
+
+                if (test_and_set_bit(bit, b->bitmap))
+                        /* Lost a race for this bit, look again */
+                        continue;
+
+                if (b->bitmap[w] == ~0UL)
+                        set_bit(w, b->full);
+
+                return bit;
+        }
+
+        return b->size;
+}
+
 ssize_t rbmp_allocate(struct rbmp * b)
 {
-        ssize_t id;
+        size_t bit;
 
         if (!b)
-                return bad_id(b);
-
-        id = (ssize_t) bitmap_find_next_zero_area(b->bitmap,
-                                                  BITS_IN_BITMAP,
-                                                  0, 1, 0);
-        if (id < 0)
-                return bad_id(b);
-
-        bitmap_set(b->bitmap, id, 1);
+                return -1;
 
-        return id + b->offset;
+        bit = take_from(b, b->last + 1 < b->size ? b->last + 1 : 0);
+        if (bit >= b->size)
+                bit = take_from(b, 0);
+        while (bit >= b->size) {
+                /* The second level may be stale */
+                bit = find_first_zero_bit(b->bitmap, b->size);
+                if (bit >= b->size)
+                        return bad_id(b);
+                if (!test_and_set_bit(bit, b->bitmap))
+                        break;
+                bit = b->size;
+        }
+
+        b->last = bit;
+
+        return bit + b->offset;
 }
 EXPORT_SYMBOL(rbmp_allocate);
 
@@ -105,7 +175,7 @@ static bool is_id_ok(struct rbmp * b, ssize_t id)
 {
         ASSERT(b);
 
-        if ((id < b->offset) || (id > (b->offset + b->size)))
+        if ((id < b->offset) || (id >= (b->offset + (ssize_t) b->size)))
                 return false;
 
         return true;
@@ -120,21 +190,106 @@ bool rbmp_is_id_ok(struct rbmp * b, ssize_t id)
 }
 EXPORT_SYMBOL(rbmp_is_id_ok);
 
+bool rbmp_is_allocated(struct rbmp * b, ssize_t id)
+{
+        if (!b || !is_id_ok(b, id))
+                return false;
+
+        return test_bit(id - b->offset, b->bitmap);
+}
+EXPORT_SYMBOL(rbmp_is_allocated);
+
 int rbmp_release(struct rbmp * b,
                  ssize_t       id)
 {
-        ssize_t rid;
-
         if (!b)
                 return -1;
 
         if (!is_id_ok(b, id))
                 return -1;
 
-        rid = id - b->offset;
-
-        bitmap_clear(b->bitmap, id, 1);
+        if (!test_and_clear_bit(id - b->offset, b->bitmap))
+                return -1;
+        clear_bit((id - b->offset) / BITS_PER_LONG, b->full);
 
         return 0;
 }
 EXPORT_SYMBOL(rbmp_release);
+
+#ifdef CONFIG_RINA_RBMP_REGRESSION_TESTS
+#define RBMP_TEST_BITS   65535
+#define RBMP_TEST_ROUNDS 1000000
+
+bool regression_tests_rbmp(void)
+{
+        struct rbmp * b;
+        ssize_t       id, prev;
+        size_t        i;
+        ktime_t       start;
+        bool          ret = false;
+
+        LOG_DBG("RBMP regression tests");
+
+        b = rbmp_create(RBMP_TEST_BITS, 1);
+        if (!b)
+                return false;
+
+        LOG_DBG("Regression test #1, fill the bitmap");
+        start = ktime_get();
+        for (i = 0; i < RBMP_TEST_BITS; i++) {
+                id = rbmp_allocate(b);
+                if (id != (ssize_t) i + 1 || !rbmp_is_allocated(b, id))
+                        goto out;
+        }
+        LOG_INFO("%d ids allocated in %lld us", RBMP_TEST_BITS,
+                 ktime_to_us(ktime_sub(ktime_get(), start)));
+
+        if (rbmp_is_id_ok(b, rbmp_allocate(b)))
+                goto out;
+
+        LOG_DBG("Regression test #2, release and next-fit reuse");
+        if (rbmp_release(b, 10) || !rbmp_release(b, 10) ||
+            rbmp_release(b, 100) || rbmp_is_allocated(b, 10))
+                goto out;
+        if (rbmp_allocate(b) != 10 || rbmp_allocate(b) != 100)
+                goto out;
+        if (rbmp_release(b, 0) == 0 ||
+            rbmp_release(b, RBMP_TEST_BITS + 1) == 0)
+                goto out;
+
+        LOG_DBG("Regression test #3, churn with a full bitmap but one");
+        if (rbmp_release(b, RBMP_TEST_BITS / 2))
+                goto out;
+        prev  = RBMP_TEST_BITS / 2;
+        start = ktime_get();
+        for (i = 0; i < RBMP_TEST_BITS; i++) {
+                /* The only free id is the one just released */
+                id = rbmp_allocate(b);
+                if (id != prev)
+                        goto out;
+                prev = (id * 7919) % RBMP_TEST_BITS + 1;
+                if (rbmp_release(b, prev))
+                        goto out;
+        }
+        LOG_INFO("%d allocate/release pairs on a full bitmap in %lld us",
+                 RBMP_TEST_BITS, ktime_to_us(ktime_sub(ktime_get(), start)));
+
+        LOG_DBG("Regression test #4, churn with a half full bitmap");
+        for (i = 1; i <= RBMP_TEST_BITS; i += 2)
+                rbmp_release(b, i);
+        start = ktime_get();
+        for (i = 0; i < RBMP_TEST_ROUNDS; i++) {
+                id = rbmp_allocate(b);
+                if (!rbmp_is_id_ok(b, id) || rbmp_release(b, id))
+                        goto out;
+        }
+        LOG_INFO("%d allocate/release pairs on a half full bitmap in %lld us",
+                 RBMP_TEST_ROUNDS, ktime_to_us(ktime_sub(ktime_get(), start)));
+
+        ret = true;
+ out:
+        rbmp_destroy(b);
+
+        return ret;
+}
+#endif
@@ -31,5 +31,6 @@ ssize_t       rbmp_allocate(struct rbmp * instance);
 int           rbmp_release(struct rbmp * instance,
                            ssize_t       id);
 bool          rbmp_is_id_ok(struct rbmp * b, ssize_t id);
+bool          rbmp_is_allocated(struct rbmp * b, ssize_t id);
 
 #endif
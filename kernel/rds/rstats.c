@@ -0,0 +1,195 @@
+/*
+ * RINA per-CPU statistics
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/bottom_half.h>
+#include <linux/u64_stats_sync.h>
+
+#define RINA_PREFIX "rstats"
+
+#include "logs.h"
+#include "debug.h"
+#include "rmem.h"
+#include "rstats.h"
+
+struct rstats_cpu {
+        u64                   cnt[RSTATS_COUNTERS];
+        u64                   hist[RSTATS_HIST_BUCKETS];
+        struct u64_stats_sync syncp;
+};
+
+struct rstats {
+        struct rstats_cpu __percpu * cpu;
+};
+
+static struct rstats * rstats_create_gfp(gfp_t flags)
+{
+        struct rstats * tmp;
+        int             i;
+
+        tmp = rkzalloc(sizeof(*tmp), flags);
+        if (!tmp)
+                return NULL;
+
+        tmp->cpu = alloc_percpu_gfp(struct rstats_cpu, flags);
+        if (!tmp->cpu) {
+                rkfree(tmp);
+                return NULL;
+        }
+
+        for_each_possible_cpu(i)
+                u64_stats_init(&per_cpu_ptr(tmp->cpu, i)->syncp);
+
+        return tmp;
+}
+
+struct rstats * rstats_create(void)
+{ return rstats_create_gfp(GFP_KERNEL); }
+EXPORT_SYMBOL(rstats_create);
+
+struct rstats * rstats_create_ni(void)
+{ return rstats_create_gfp(GFP_ATOMIC); }
+EXPORT_SYMBOL(rstats_create_ni);
+
+void rstats_destroy(struct rstats * s)
+{
+        if (!s)
+                return;
+
+        free_percpu(s->cpu);
+        rkfree(s);
+}
+EXPORT_SYMBOL(rstats_destroy);
+
+/*
+ * Updates run with bottom halves disabled, so that a softirq can't
+ * interleave with a process context update of the same CPU counters.
+ */
+void rstats_inc(struct rstats * s, enum rstats_counter c)
+{
+        struct rstats_cpu * sc;
+
+        ASSERT(s);
+        ASSERT(c < RSTATS_COUNTERS);
+
+        local_bh_disable();
+        sc = this_cpu_ptr(s->cpu);
+        u64_stats_update_begin(&sc->syncp);
+        sc->cnt[c]++;
+        u64_stats_update_end(&sc->syncp);
+        local_bh_enable();
+}
+EXPORT_SYMBOL(rstats_inc);
+
+void rstats_inc_bytes(struct rstats * s, enum rstats_counter c, size_t bytes)
+{
+        struct rstats_cpu * sc;
+
+        ASSERT(s);
+        ASSERT(c + 1 < RSTATS_COUNTERS);
+
+        local_bh_disable();
+        sc = this_cpu_ptr(s->cpu);
+        u64_stats_update_begin(&sc->syncp);
+        sc->cnt[c]++;
+        sc->cnt[c + 1] += bytes;
+        u64_stats_update_end(&sc->syncp);
+        local_bh_enable();
+}
+EXPORT_SYMBOL(rstats_inc_bytes);
+
+void rstats_hist_add(struct rstats * s, u64 usecs)
+{
+        struct rstats_cpu * sc;
+        int                 b;
+
+        ASSERT(s);
+
+        b = fls64(usecs);
+        if (b >= RSTATS_HIST_BUCKETS)
+                b = RSTATS_HIST_BUCKETS - 1;
+
+        local_bh_disable();
+        sc = this_cpu_ptr(s->cpu);
+        u64_stats_update_begin(&sc->syncp);
+        sc->hist[b]++;
+        u64_stats_update_end(&sc->syncp);
+        local_bh_enable();
+}
+EXPORT_SYMBOL(rstats_hist_add);
+
+u64 rstats_get(struct rstats * s, enum rstats_counter c)
+{
+        struct rstats_cpu * sc;
+        unsigned int        start;
+        u64                 val, sum = 0;
+        int                 i;
+
+        if (!s || c >= RSTATS_COUNTERS)
+                return 0;
+
+        for_each_possible_cpu(i) {
+                sc = per_cpu_ptr(s->cpu, i);
+                do {
+                        start = u64_stats_fetch_begin(&sc->syncp);
+                        val   = sc->cnt[c];
+                } while (u64_stats_fetch_retry(&sc->syncp, start));
+                sum += val;
+        }
+
+        return sum;
+}
+EXPORT_SYMBOL(rstats_get);
+
+/* One "<upper bound in usecs> <samples>" line per bucket */
+ssize_t rstats_hist_show(struct rstats * s, char * buf)
+{
+        struct rstats_cpu * sc;
+        unsigned int        start;
+        u64                 hist[RSTATS_HIST_BUCKETS];
+        u64                 val;
+        ssize_t             len = 0;
+        int                 i, b;
+
+        if (!s)
+                return 0;
+
+        memset(hist, 0, sizeof(hist));
+        for_each_possible_cpu(i) {
+                sc = per_cpu_ptr(s->cpu, i);
+                for (b = 0; b < RSTATS_HIST_BUCKETS; b++) {
+                        do {
+                                start = u64_stats_fetch_begin(&sc->syncp);
+                                val   = sc->hist[b];
+                        } while (u64_stats_fetch_retry(&sc->syncp, start));
+                        hist[b] += val;
+                }
+        }
+
+        for (b = 0; b < RSTATS_HIST_BUCKETS - 1; b++)
+                len += sprintf(buf + len, "%llu %llu\n",
+                               1ULL << b, (unsigned long long) hist[b]);
+        len += sprintf(buf + len, "inf %llu\n",
+                       (unsigned long long) hist[b]);
+
+        return len;
+}
+EXPORT_SYMBOL(rstats_hist_show);
@@ -0,0 +1,56 @@
+/*
+ * RINA per-CPU statistics
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef RINA_RSTATS_H
+#define RINA_RSTATS_H
+
+#include <linux/types.h>
+
+/* Each bytes counter follows its PDUs counter */
+enum rstats_counter {
+        RSTATS_TX_PDUS = 0,
+        RSTATS_TX_BYTES,
+        RSTATS_RX_PDUS,
+        RSTATS_RX_BYTES,
+        RSTATS_DROP_PDUS,
+        RSTATS_ERR_PDUS,
+        RSTATS_COUNTERS
+};
+
+/* Bucket i of a latency histogram counts samples below 2^i usecs */
+#define RSTATS_HIST_BUCKETS 24
+
+struct rstats;
+
+struct rstats * rstats_create(void);
+struct rstats * rstats_create_ni(void);
+void            rstats_destroy(struct rstats * s);
+
+/* Writers never take a lock, readers sum up all the CPUs */
+void            rstats_inc(struct rstats *     s,
+                           enum rstats_counter c);
+void            rstats_inc_bytes(struct rstats *     s,
+                                 enum rstats_counter c,
+                                 size_t              bytes);
+void            rstats_hist_add(struct rstats * s, u64 usecs);
+
+u64             rstats_get(struct rstats *     s,
+                           enum rstats_counter c);
+ssize_t         rstats_hist_show(struct rstats * s, char * buf);
+
+#endif
@@ -23,7 +23,14 @@
 #include <linux/if_arp.h>
 #include <linux/ip.h>
 #include <linux/if.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/version.h>
+#include <net/ip.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+#include <net/gso.h>
+#endif
 
 #define RINA_PREFIX "rina-device"
 
@@ -36,15 +43,41 @@
 
 #define RINA_EXTRA_HEADER_LENGTH 50
 
+/* Default MTU, lowered to the max SDU size of the flow if needed */
+#define RINA_DEV_DEFAULT_MTU	1400
+
+/* Packets handed to the stack per NAPI poll */
+#define RINA_DEV_NAPI_WEIGHT	64
+
+/* Packets waiting for the NAPI poll, beyond that they are dropped */
+#define RINA_DEV_RX_QUEUE_LEN	1000
+
+struct rina_dev_pcpu_stats {
+	u64			rx_packets;
+	u64			rx_bytes;
+	u64			tx_packets;
+	u64			tx_bytes;
+	struct u64_stats_sync	syncp;
+};
+
 struct rina_device {
-	struct net_device_stats stats;
+	struct rina_dev_pcpu_stats __percpu * stats;
+	atomic_long_t rx_dropped;
+	atomic_long_t tx_dropped;
 	struct ipcp_instance* kfa_ipcp;
 	port_id_t port;
 	struct net_device* dev;
+
+	/* Received SDUs, delivered to the stack from the NAPI poll */
+	struct napi_struct napi;
+	struct sk_buff_head rx_queue;
 };
 
 static int rina_dev_open(struct net_device *dev)
 {
+	struct rina_device* rina_dev = netdev_priv(dev);
+
+	napi_enable(&rina_dev->napi);
 	netif_tx_start_all_queues(dev);
 	LOG_DBG("RINA IP device %s opened...", dev->name);
 
@@ -53,91 +86,214 @@ static int rina_dev_open(struct net_device *dev)
 
 static int rina_dev_close(struct net_device *dev)
 {
+	struct rina_device* rina_dev = netdev_priv(dev);
+
 	netif_tx_stop_all_queues(dev);
+	napi_disable(&rina_dev->napi);
+	skb_queue_purge(&rina_dev->rx_queue);
 	LOG_DBG("RINA IP device %s closed...", dev->name);
 
 	return 0;
 }
 
-static struct net_device_stats *rina_dev_get_stats(struct net_device *dev)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+static struct rtnl_link_stats64 *
+rina_dev_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *tot)
+#else
+static void
+rina_dev_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *tot)
+#endif
 {
 	struct rina_device* rina_dev = netdev_priv(dev);
-	if(!rina_dev)
-		return NULL;
-	
-	return &rina_dev->stats;
+	struct rina_dev_pcpu_stats * stats;
+	u64 rx_packets, rx_bytes, tx_packets, tx_bytes;
+	unsigned int start;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(rina_dev->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&stats->syncp);
+			rx_packets = stats->rx_packets;
+			rx_bytes = stats->rx_bytes;
+			tx_packets = stats->tx_packets;
+			tx_bytes = stats->tx_bytes;
+		} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+		tot->rx_packets += rx_packets;
+		tot->rx_bytes += rx_bytes;
+		tot->tx_packets += tx_packets;
+		tot->tx_bytes += tx_bytes;
+	}
+
+	tot->rx_dropped = atomic_long_read(&rina_dev->rx_dropped);
+	tot->tx_dropped = atomic_long_read(&rina_dev->tx_dropped);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+	return tot;
+#endif
 }
 
+/* Called by the KFA when an SDU arrives on the flow, possibly with its
+ * lock held: just queue the packet, the NAPI poll hands it to the stack.
+ * The skb is always consumed, packets dropped here are only accounted in
+ * rx_dropped and are not an error for the flow */
 int rina_dev_rcv(struct sk_buff *skb, struct rina_device *rina_dev)
 {
-	ssize_t len;
-
-	if(!(skb->data[0] & 0xf0)) {
+	switch (skb->data[0] & 0xf0) {
+	case 0x40:
+		skb->protocol = htons(ETH_P_IP);
+		break;
+	case 0x60:
+		skb->protocol = htons(ETH_P_IPV6);
+		break;
+	default:
 		LOG_INFO("RINA IP device %s rcv a non IP packet, dropping...",
 			  rina_dev->dev->name);
-		rina_dev->stats.rx_dropped++;
+		atomic_long_inc(&rina_dev->rx_dropped);
 		kfree_skb(skb);
-		return -1;
+		return 0;
+	}
+
+	if (unlikely(skb_queue_len(&rina_dev->rx_queue) >=
+		     RINA_DEV_RX_QUEUE_LEN)) {
+		atomic_long_inc(&rina_dev->rx_dropped);
+		kfree_skb(skb);
+		return 0;
 	}
 
-	skb->protocol = htons(ETH_P_IP);
 	skb->dev = rina_dev->dev;
-	len = skb->len;
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+
+	skb_queue_tail(&rina_dev->rx_queue, skb);
+	napi_schedule(&rina_dev->napi);
+
+	return 0;
+}
+
+static int rina_dev_poll(struct napi_struct *napi, int budget)
+{
+	struct rina_device* rina_dev;
+	struct rina_dev_pcpu_stats * stats;
+	struct sk_buff * skb;
+	u64 bytes = 0;
+	int work = 0;
+
+	rina_dev = container_of(napi, struct rina_device, napi);
+
+	while (work < budget &&
+	       (skb = skb_dequeue(&rina_dev->rx_queue)) != NULL) {
+		bytes += skb->len;
+		napi_gro_receive(napi, skb);
+		work++;
+	}
+
+	stats = this_cpu_ptr(rina_dev->stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->rx_packets += work;
+	stats->rx_bytes += bytes;
+	u64_stats_update_end(&stats->syncp);
+
+	if (work < budget) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
+		napi_complete_done(napi, work);
+		if (!skb_queue_empty(&rina_dev->rx_queue))
+			napi_schedule(napi);
+#else
+		if (napi_complete_done(napi, work) &&
+		    !skb_queue_empty(&rina_dev->rx_queue))
+			napi_schedule(napi);
+#endif
+	}
 
-	if(likely(netif_rx(skb) == NET_RX_SUCCESS)) {
-		rina_dev->stats.rx_packets++;
-		rina_dev->stats.rx_bytes += len;
-	} else {
-		rina_dev->stats.rx_dropped++;
+	return work;
+}
+
+/* Writes a single packet into the flow, consumes the skb */
+static int rina_dev_xmit_one(struct rina_device * rina_dev,
+			     struct sk_buff * skb)
+{
+	struct rina_dev_pcpu_stats * stats;
+	ssize_t data_sent;
+
+	/* The SDU protection policies work on linear buffers */
+	if (unlikely(skb_linearize(skb))) {
+		kfree_skb(skb);
+		return -ENOMEM;
 	}
 
-	LOG_DBG("RINA IP device %s rcv a IP packet...",
-		rina_dev->dev->name);
+	data_sent = kfa_flow_skb_write(rina_dev->kfa_ipcp->data,
+				       rina_dev->port, skb, skb->len, false);
+	if (data_sent < 0)
+		return data_sent;
+
+	stats = this_cpu_ptr(rina_dev->stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->tx_packets++;
+	stats->tx_bytes += data_sent;
+	u64_stats_update_end(&stats->syncp);
 
 	return 0;
 }
 
-static int rina_dev_start_xmit(struct sk_buff * skb, struct net_device *dev)
+static netdev_tx_t rina_dev_start_xmit(struct sk_buff * skb,
+				       struct net_device *dev)
 {
-	struct iphdr* iph = NULL;
 	struct rina_device* rina_dev = netdev_priv(dev);
-	ssize_t data_sent;
+	struct sk_buff * segs, * next;
 	ASSERT(rina_dev);
 
 	skb_orphan(skb);
-	//skb_dst_force(skb);
-
-	iph = ip_hdr(skb);
-	ASSERT(iph);
 
 	LOG_DBG("Device %s about to send a packet of length %u via port %d",
 		dev->name, skb->len, rina_dev->port);
 
-	data_sent = kfa_flow_skb_write(rina_dev->kfa_ipcp->data,
-				       rina_dev->port, skb, skb->len, false);
-	if (data_sent < 0) {
-		rina_dev->stats.tx_dropped++;
-		LOG_ERR("Could not xmit IP packet, unable to send to KFA...");
-		return NET_XMIT_DROP;
+	if (!skb_is_gso(skb)) {
+		if (rina_dev_xmit_one(rina_dev, skb)) {
+			atomic_long_inc(&rina_dev->tx_dropped);
+			LOG_ERR("Could not xmit IP packet, unable to send to KFA...");
+		}
+		return NETDEV_TX_OK;
 	}
 
-	rina_dev->stats.tx_packets++;
-	rina_dev->stats.tx_bytes += data_sent;
-
-	LOG_DBG("RINA IP device %s sent a packet of %zd bytes via port %d",
-		dev->name, data_sent, rina_dev->port);
+	/* Split into MTU sized packets, each one fits in a flow SDU */
+	segs = skb_gso_segment(skb, dev->features & ~NETIF_F_GSO_MASK);
+	if (IS_ERR_OR_NULL(segs)) {
+		atomic_long_inc(&rina_dev->tx_dropped);
+		kfree_skb(skb);
+		return NETDEV_TX_OK;
+	}
+	consume_skb(skb);
+
+	while (segs) {
+		next = segs->next;
+		segs->next = NULL;
+		if (rina_dev_xmit_one(rina_dev, segs))
+			atomic_long_inc(&rina_dev->tx_dropped);
+		segs = next;
+	}
 
 	return NETDEV_TX_OK;
 }
 
 static void rina_dev_free(struct net_device *dev)
-{ return free_netdev(dev); }
+{
+	struct rina_device* rina_dev = netdev_priv(dev);
+
+	skb_queue_purge(&rina_dev->rx_queue);
+	free_percpu(rina_dev->stats);
+	rina_dev->stats = NULL;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,9)
+	free_netdev(dev);
+#endif
+}
 
 static const struct net_device_ops rina_dev_ops = {
-	.ndo_start_xmit	= rina_dev_start_xmit,
-	.ndo_get_stats	= rina_dev_get_stats,
-	.ndo_open	= rina_dev_open,
-	.ndo_stop	= rina_dev_close,
+	.ndo_start_xmit	 = rina_dev_start_xmit,
+	.ndo_get_stats64 = rina_dev_get_stats64,
+	.ndo_open	 = rina_dev_open,
+	.ndo_stop	 = rina_dev_close,
 };
 
 static void rina_dev_setup(struct net_device *dev)
@@ -146,8 +302,8 @@ static void rina_dev_setup(struct net_device *dev)
          * for the moment an upper bound is provided */
 	dev->needed_headroom += RINA_EXTRA_HEADER_LENGTH;
 	dev->needed_tailroom += RINA_EXTRA_HEADER_LENGTH;
-	/* This should be set depending on supporting DIF */
-	dev->mtu = 1400;
+	/* Lowered to the max SDU size of the flow in rina_dev_create */
+	dev->mtu = RINA_DEV_DEFAULT_MTU;
 	dev->hard_header_len = 0;
 	dev->addr_len = 0;
 	dev->type = ARPHRD_NONE;
@@ -163,10 +319,13 @@ static void rina_dev_setup(struct net_device *dev)
 		| IFF_DONT_BRIDGE | IFF_PHONY_HEADROOM;
 #endif
 	netif_keep_dst(dev);
-	dev->features = NETIF_F_HW_CSUM;
+	/* Let the stack build GSO packets, they are segmented at xmit */
+	dev->features = NETIF_F_HW_CSUM | NETIF_F_SG | NETIF_F_GSO_SOFTWARE;
+	dev->hw_features = dev->features;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,9)
 	dev->destructor	= rina_dev_free;
 #else
+	dev->needs_free_netdev = true;
 	dev->priv_destructor = rina_dev_free;
 #endif
 	dev->netdev_ops	= &rina_dev_ops;
@@ -176,7 +335,8 @@ static void rina_dev_setup(struct net_device *dev)
 
 struct rina_device* rina_dev_create(string_t* name,
 				    struct ipcp_instance* kfa_ipcp,
-				    port_id_t port)
+				    port_id_t port,
+				    size_t max_sdu_size)
 {
 	int rv;
 	struct net_device *dev;
@@ -191,6 +351,8 @@ struct rina_device* rina_dev_create(string_t* name,
 		return NULL;
 	}
 
+	/* A single TX queue: all the packets go to the same flow, more
+	 * queues would only move the contention to the flow lock */
 	dev = alloc_netdev(sizeof(struct rina_device), name,
 			   NET_NAME_UNKNOWN, rina_dev_setup);
 	if (!dev) {
@@ -202,11 +364,38 @@ struct rina_device* rina_dev_create(string_t* name,
 	rina_dev->dev = dev;
 	rina_dev->kfa_ipcp = kfa_ipcp;
 	rina_dev->port = port;
-	memset(&rina_dev->stats, 0x00, sizeof(struct net_device_stats));
+	atomic_long_set(&rina_dev->rx_dropped, 0);
+	atomic_long_set(&rina_dev->tx_dropped, 0);
+	skb_queue_head_init(&rina_dev->rx_queue);
+
+	rina_dev->stats = netdev_alloc_pcpu_stats(struct rina_dev_pcpu_stats);
+	if (!rina_dev->stats) {
+		LOG_ERR("Could not allocate stats of RINA IP device %s", name);
+		free_netdev(dev);
+		return NULL;
+	}
+
+	/* Every packet, and every GSO segment, must fit in one SDU */
+	if (max_sdu_size && max_sdu_size < dev->mtu)
+		dev->mtu = max_sdu_size;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	dev->min_mtu = IPV4_MIN_MTU;
+	dev->max_mtu = max_sdu_size ? max_sdu_size : ETH_MAX_MTU;
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,1,0)
+	netif_napi_add(dev, &rina_dev->napi, rina_dev_poll,
+		       RINA_DEV_NAPI_WEIGHT);
+#else
+	netif_napi_add_weight(dev, &rina_dev->napi, rina_dev_poll,
+			      RINA_DEV_NAPI_WEIGHT);
+#endif
 
 	rv = register_netdev(dev);
 	if(rv) {
 		LOG_ERR("Could not register RINA IP device %s: %d", name, rv);
+		/* NULL if the core already ran the destructor */
+		free_percpu(rina_dev->stats);
 		free_netdev(dev);
 		return NULL;
 	}
@@ -25,6 +25,7 @@
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/hashtable.h>
+#include <linux/list.h>
 
 #define RINA_PREFIX "rmt-ps-default"
 
@@ -37,18 +38,63 @@
 #include "rmt-ps-default.h"
 #include "rds/robjects.h"
 
-#define DEFAULT_Q_MAX 1000
-#define rmap_hash(T, K) hash_min(K, HASH_BITS(T))
+#define DEFAULT_Q_MAX	 1000
+#define DEFAULT_QUANTUM	 1500
+#define RMT_Q_PRIOS	 8
+#define QOS_HASH_BITS	 4
+#define QOS_PARAM_PREFIX "qos."
+
+/*
+ * Queue of a QoS cube, set through the "qos.<qos_id>" parameter with
+ * value "<priority>:<quantum>:<max_bytes>:<ecn_bytes>". Priority 0 is
+ * served first, queues with the same priority share the link by
+ * Deficit Round Robin. A 0 max_bytes or ecn_bytes disables the byte
+ * limit or the ECN marking respectively.
+ */
+struct rmt_qos_conf {
+	struct list_head list;
+	qos_id_t	 qos_id;
+	unsigned int	 prio;
+	unsigned int	 quantum;
+	unsigned int	 max_bytes;
+	unsigned int	 ecn_bytes;
+};
+
+struct rmt_qos_queue {
+	struct rfifo	  *queue;
+	struct hlist_node hlist;
+	struct list_head  active;
+	qos_id_t	  qos_id;
+	unsigned int	  prio;
+	unsigned int	  quantum;
+	unsigned int	  max_bytes;
+	unsigned int	  ecn_bytes;
+	unsigned int	  deficit;
+	unsigned int	  qbytes;
+	unsigned int	  drop_pdus;
+	unsigned int	  ecn_pdus;
+	unsigned int	  tx_pdus;
+	unsigned int	  tx_bytes;
+	struct robject	  robj;
+};
 
 struct rmt_queue {
-	struct rfifo *dt_queue;
-	struct rfifo *mgt_queue;
-	port_id_t    pid;
+	struct rfifo	     *mgt_queue;
+	/* PDUs of QoS cubes without a queue of their own */
+	struct rmt_qos_queue *def_queue;
+	DECLARE_HASHTABLE(qos_queues, QOS_HASH_BITS);
+	/* Backlogged queues, per priority, in DRR order */
+	struct list_head     active[RMT_Q_PRIOS];
+	struct rset	     *rset;
+	port_id_t	     pid;
 };
 
 struct rmt_ps_default_data {
-	unsigned int q_max;
-	struct robject robj;
+	unsigned int	 q_max;
+	unsigned int	 quantum;
+	spinlock_t	 lock;
+	struct list_head qos_confs;
+	struct robject	 robj;
 };
 
 static ssize_t rmt_ps_attr_show(struct robject *        robj,
@@ -64,56 +110,234 @@ static ssize_t rmt_ps_attr_show(struct robject *        robj,
 	if (strcmp(robject_attr_name(attr), "q_max") == 0) {
 		return sprintf(buf, "%u\n", data->q_max);
 	}
+	if (strcmp(robject_attr_name(attr), "quantum") == 0) {
+		return sprintf(buf, "%u\n", data->quantum);
+	}
 	return 0;
 }
 RINA_SYSFS_OPS(rmt_ps);
-RINA_ATTRS(rmt_ps, q_max);
+RINA_ATTRS(rmt_ps, q_max, quantum);
 RINA_KTYPE(rmt_ps);
 
-static struct rmt_queue *rmt_queue_create(port_id_t port)
+static ssize_t rmt_qos_queue_attr_show(struct robject *        robj,
+				       struct robj_attribute * attr,
+				       char *                  buf)
 {
-	struct rmt_queue *tmp;
+	struct rmt_qos_queue * q;
+
+	q = container_of(robj, struct rmt_qos_queue, robj);
+	if (!q)
+		return 0;
+
+	if (strcmp(robject_attr_name(attr), "priority") == 0)
+		return sprintf(buf, "%u\n", q->prio);
+	if (strcmp(robject_attr_name(attr), "drr_quantum") == 0)
+		return sprintf(buf, "%u\n", q->quantum);
+	if (strcmp(robject_attr_name(attr), "max_bytes") == 0)
+		return sprintf(buf, "%u\n", q->max_bytes);
+	if (strcmp(robject_attr_name(attr), "ecn_bytes") == 0)
+		return sprintf(buf, "%u\n", q->ecn_bytes);
+	if (strcmp(robject_attr_name(attr), "queued_pdus") == 0)
+		return sprintf(buf, "%zd\n", rfifo_length(q->queue));
+	if (strcmp(robject_attr_name(attr), "queued_bytes") == 0)
+		return sprintf(buf, "%u\n", q->qbytes);
+	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0)
+		return sprintf(buf, "%u\n", q->drop_pdus);
+	if (strcmp(robject_attr_name(attr), "ecn_pdus") == 0)
+		return sprintf(buf, "%u\n", q->ecn_pdus);
+	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0)
+		return sprintf(buf, "%u\n", q->tx_pdus);
+	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0)
+		return sprintf(buf, "%u\n", q->tx_bytes);
+	return 0;
+}
+RINA_SYSFS_OPS(rmt_qos_queue);
+RINA_ATTRS(rmt_qos_queue, priority, drr_quantum, max_bytes, ecn_bytes,
+	   queued_pdus, queued_bytes, drop_pdus, ecn_pdus, tx_pdus, tx_bytes);
+RINA_KTYPE(rmt_qos_queue);
+
+static struct rmt_qos_conf *qos_conf_find(struct rmt_ps_default_data *data,
+					  qos_id_t		      qos_id)
+{
+	struct rmt_qos_conf *pos;
+
+	list_for_each_entry(pos, &data->qos_confs, list) {
+		if (pos->qos_id == qos_id)
+			return pos;
+	}
+
+	return NULL;
+}
+
+static void rmt_qos_queue_destroy(struct rmt_qos_queue *q)
+{
+	if (!q)
+		return;
+
+	robject_del(&q->robj);
+
+	if (q->queue)
+		rfifo_destroy(q->queue, (void (*)(void *)) du_destroy);
+
+	rkfree(q);
+}
+
+static struct rmt_qos_queue *
+rmt_qos_queue_create(const struct rmt_qos_conf *conf,
+		     struct rset	       *rset)
+{
+	struct rmt_qos_queue *tmp;
+	int ret;
 
 	tmp = rkzalloc(sizeof(*tmp), GFP_ATOMIC);
 	if (!tmp)
 		return NULL;
 
-	tmp->dt_queue = rfifo_create_ni();
-	if (!tmp->dt_queue) {
+	tmp->queue = rfifo_create_ni();
+	if (!tmp->queue) {
 		rkfree(tmp);
 		return NULL;
 	}
 
-	tmp->mgt_queue = rfifo_create_ni();
-	if (!tmp->mgt_queue) {
-		rfifo_destroy(tmp->dt_queue, (void (*)(void *)) du_destroy);
+	INIT_HLIST_NODE(&tmp->hlist);
+	INIT_LIST_HEAD(&tmp->active);
+	tmp->qos_id    = conf->qos_id;
+	tmp->prio      = conf->prio;
+	tmp->quantum   = conf->quantum;
+	tmp->max_bytes = conf->max_bytes;
+	tmp->ecn_bytes = conf->ecn_bytes;
+
+	robject_init(&tmp->robj, &rmt_qos_queue_rtype);
+	if (conf->qos_id < 0)
+		ret = robject_rset_add(&tmp->robj, rset, "default");
+	else
+		ret = robject_rset_add(&tmp->robj, rset, "%d", conf->qos_id);
+	if (ret) {
+		rfifo_destroy(tmp->queue, (void (*)(void *)) du_destroy);
 		rkfree(tmp);
 		return NULL;
 	}
 
-	tmp->pid = port;
-
 	return tmp;
 }
 
 static int rmt_queue_destroy(struct rmt_queue *q)
 {
+	struct rmt_qos_queue *pos;
+	struct hlist_node *next;
+	int bucket;
+
 	if (!q) {
 		LOG_ERR("No RMT Key-queue to destroy...");
 		return -1;
 	}
 
-	if (q->dt_queue)
-		rfifo_destroy(q->dt_queue, (void (*)(void *)) du_destroy);
+	hash_for_each_safe(q->qos_queues, bucket, next, pos, hlist) {
+		hash_del(&pos->hlist);
+		rmt_qos_queue_destroy(pos);
+	}
+
+	rmt_qos_queue_destroy(q->def_queue);
 
 	if (q->mgt_queue)
 		rfifo_destroy(q->mgt_queue, (void (*)(void *)) du_destroy);
 
+	if (q->rset)
+		rset_unregister(q->rset);
+
 	rkfree(q);
 
 	return 0;
 }
 
+static struct rmt_queue *rmt_queue_create(struct rmt_ps_default_data *data,
+					  struct rmt_n1_port	     *n1_port)
+{
+	struct rmt_queue *tmp;
+	struct rmt_qos_queue *qq;
+	struct rmt_qos_conf *conf;
+	struct rmt_qos_conf *confs = NULL;
+	struct rmt_qos_conf def_conf;
+	int n = 0;
+	int i;
+
+	tmp = rkzalloc(sizeof(*tmp), GFP_ATOMIC);
+	if (!tmp)
+		return NULL;
+
+	hash_init(tmp->qos_queues);
+	for (i = 0; i < RMT_Q_PRIOS; i++)
+		INIT_LIST_HEAD(&tmp->active[i]);
+	tmp->pid = n1_port->port_id;
+
+	tmp->mgt_queue = rfifo_create_ni();
+	if (!tmp->mgt_queue) {
+		rmt_queue_destroy(tmp);
+		return NULL;
+	}
+
+	tmp->rset = rset_create_and_add("queues", &n1_port->robj);
+	if (!tmp->rset) {
+		rmt_queue_destroy(tmp);
+		return NULL;
+	}
+
+	memset(&def_conf, 0, sizeof(def_conf));
+	def_conf.qos_id  = -1;
+	def_conf.quantum = data->quantum;
+
+	tmp->def_queue = rmt_qos_queue_create(&def_conf, tmp->rset);
+	if (!tmp->def_queue) {
+		rmt_queue_destroy(tmp);
+		return NULL;
+	}
+
+	/* Snapshot the configuration, sysfs entries can't be added under
+	 * the lock */
+	spin_lock_bh(&data->lock);
+	list_for_each_entry(conf, &data->qos_confs, list)
+		n++;
+	if (n) {
+		confs = rkzalloc(n * sizeof(*confs), GFP_ATOMIC);
+		if (!confs) {
+			spin_unlock_bh(&data->lock);
+			rmt_queue_destroy(tmp);
+			return NULL;
+		}
+		i = 0;
+		list_for_each_entry(conf, &data->qos_confs, list)
+			confs[i++] = *conf;
+	}
+	spin_unlock_bh(&data->lock);
+
+	for (i = 0; i < n; i++) {
+		qq = rmt_qos_queue_create(&confs[i], tmp->rset);
+		if (!qq) {
+			rkfree(confs);
+			rmt_queue_destroy(tmp);
+			return NULL;
+		}
+		hash_add(tmp->qos_queues, &qq->hlist, qq->qos_id);
+	}
+	if (confs)
+		rkfree(confs);
+
+	return tmp;
+}
+
+static struct rmt_qos_queue *rmt_qos_queue_find(struct rmt_queue *q,
+						qos_id_t	  qos_id)
+{
+	struct rmt_qos_queue *pos;
+
+	hash_for_each_possible(q->qos_queues, pos, hlist, qos_id) {
+		if (pos->qos_id == qos_id)
+			return pos;
+	}
+
+	return q->def_queue;
+}
+
 void * default_rmt_q_create_policy(struct rmt_ps      *ps,
 			        struct rmt_n1_port *n1_port)
 {
@@ -127,7 +351,7 @@ void * default_rmt_q_create_policy(struct rmt_ps      *ps,
 
 	data = ps->priv;
 
-	queue = rmt_queue_create(n1_port->port_id);
+	queue = rmt_queue_create(data, n1_port);
 	if (!queue) {
 		LOG_ERR("Could not create queue for n1_port %u",
 			n1_port->port_id);
@@ -171,8 +395,11 @@ int default_rmt_enqueue_policy(struct rmt_ps *      ps,
 			       bool 		    must_enqueue)
 {
 	struct rmt_queue *q;
+	struct rmt_qos_queue *qq;
 	struct rmt_ps_default_data *data = ps->priv;
 	pdu_type_t pdu_type;
+	unsigned long pci_flags;
+	unsigned int len;
 
 	if (!ps || !n1_port || !du) {
 		LOG_ERR("Wrong input parameters");
@@ -197,19 +424,92 @@ int default_rmt_enqueue_policy(struct rmt_ps *      ps,
 		return RMT_PS_ENQ_SCHED;
 	}
 
-	if (!must_enqueue && rfifo_is_empty(q->dt_queue))
+	qq  = rmt_qos_queue_find(q, pci_qos_id(&du->pci));
+	len = du_len(du);
+
+	if (!must_enqueue && rfifo_is_empty(qq->queue)) {
+		qq->tx_pdus++;
+		qq->tx_bytes += len;
 		return RMT_PS_ENQ_SEND;
+	}
 
-	if (rfifo_length(q->dt_queue) >= data->q_max) {
+	if (rfifo_length(qq->queue) >= data->q_max ||
+	    (qq->max_bytes && qq->qbytes + len > qq->max_bytes)) {
+		qq->drop_pdus++;
 		du_destroy(du);
 		return RMT_PS_ENQ_DROP;
 	}
 
-	rfifo_push_ni(q->dt_queue, du);
+	if (qq->ecn_bytes && qq->qbytes >= qq->ecn_bytes) {
+		pci_flags = pci_flags_get(&du->pci);
+		pci_flags_set(&du->pci,
+			      pci_flags | PDU_FLAGS_EXPLICIT_CONGESTION);
+		qq->ecn_pdus++;
+	}
+
+	if (rfifo_is_empty(qq->queue)) {
+		/* Becomes backlogged, joins the round of its priority. The
+		 * head of a round is the one holding the quantum. */
+		qq->deficit = list_empty(&q->active[qq->prio]) ?
+			      qq->quantum : 0;
+		list_add_tail(&qq->active, &q->active[qq->prio]);
+	}
+
+	rfifo_push_ni(qq->queue, du);
+	qq->qbytes += len;
+
 	return RMT_PS_ENQ_SCHED;
 }
 EXPORT_SYMBOL(default_rmt_enqueue_policy);
 
+/* Strict priority among levels, Deficit Round Robin within a level */
+static struct du *rmt_queue_schedule(struct rmt_queue *q)
+{
+	struct rmt_qos_queue *qq;
+	struct list_head *round;
+	struct du *du;
+	unsigned int len;
+	int i;
+
+	for (i = 0; i < RMT_Q_PRIOS; i++) {
+		round = &q->active[i];
+		while (!list_empty(round)) {
+			qq  = list_first_entry(round, struct rmt_qos_queue,
+					       active);
+			du  = rfifo_peek(qq->queue);
+			len = du_len(du);
+			if (qq->deficit < len) {
+				list_move_tail(&qq->active, round);
+				qq = list_first_entry(round,
+						      struct rmt_qos_queue,
+						      active);
+				qq->deficit += qq->quantum;
+				continue;
+			}
+
+			du = rfifo_pop(qq->queue);
+			qq->deficit -= len;
+			qq->qbytes  -= len;
+			qq->tx_pdus++;
+			qq->tx_bytes += len;
+
+			if (rfifo_is_empty(qq->queue)) {
+				list_del_init(&qq->active);
+				qq->deficit = 0;
+				if (!list_empty(round)) {
+					qq = list_first_entry(round,
+						struct rmt_qos_queue, active);
+					qq->deficit += qq->quantum;
+				}
+			}
+
+			return du;
+		}
+	}
+
+	return NULL;
+}
+
 struct du *default_rmt_dequeue_policy(struct rmt_ps	  *ps,
 				      struct rmt_n1_port *n1_port)
 {
@@ -231,7 +531,7 @@ struct du *default_rmt_dequeue_policy(struct rmt_ps	  *ps,
 	if (!rfifo_is_empty(q->mgt_queue))
 		ret_du = rfifo_pop(q->mgt_queue);
 	else
-		ret_du = rfifo_pop(q->dt_queue);
+		ret_du = rmt_queue_schedule(q);
 
 	if (!ret_du) {
 		LOG_ERR("Could not dequeue scheduled pdu");
@@ -242,6 +542,62 @@ struct du *default_rmt_dequeue_policy(struct rmt_ps	  *ps,
 }
 EXPORT_SYMBOL(default_rmt_dequeue_policy);
 
+static int rmt_ps_default_set_qos_param(struct rmt_ps_default_data *data,
+					const char		   *name,
+					const char		   *value)
+{
+	struct rmt_qos_conf *conf;
+	struct rmt_qos_conf tmp;
+	int qos_id;
+
+	if (kstrtoint(name + strlen(QOS_PARAM_PREFIX), 10, &qos_id) ||
+	    qos_id < 0) {
+		LOG_ERR("Bogus QoS id in parameter %s", name);
+		return -1;
+	}
+
+	memset(&tmp, 0, sizeof(tmp));
+	if (sscanf(value, "%u:%u:%u:%u", &tmp.prio, &tmp.quantum,
+		   &tmp.max_bytes, &tmp.ecn_bytes) != 4) {
+		LOG_ERR("Bogus value %s for parameter %s", value, name);
+		return -1;
+	}
+
+	if (tmp.prio >= RMT_Q_PRIOS || !tmp.quantum) {
+		LOG_ERR("Priority must be below %d and quantum not 0 (%s)",
+			RMT_Q_PRIOS, name);
+		return -1;
+	}
+
+	spin_lock_bh(&data->lock);
+	conf = qos_conf_find(data, (qos_id_t) qos_id);
+	if (!conf) {
+		conf = rkzalloc(sizeof(*conf), GFP_ATOMIC);
+		if (!conf) {
+			spin_unlock_bh(&data->lock);
+			return -1;
+		}
+		INIT_LIST_HEAD(&conf->list);
+		conf->qos_id = (qos_id_t) qos_id;
+		list_add_tail(&conf->list, &data->qos_confs);
+	}
+	conf->prio	= tmp.prio;
+	conf->quantum	= tmp.quantum;
+	conf->max_bytes = tmp.max_bytes;
+	conf->ecn_bytes = tmp.ecn_bytes;
+	spin_unlock_bh(&data->lock);
+
+	LOG_DBG("QoS id %d queue: priority %u, quantum %u, max bytes %u, "
+		"ECN bytes %u", qos_id, tmp.prio, tmp.quantum,
+		tmp.max_bytes, tmp.ecn_bytes);
+
+	return 0;
+}
+
+/*
+ * Queue parameters are read when an N-1 port is bound, changing them
+ * only affects the ports bound afterwards. q_max applies right away.
+ */
 static int rmt_ps_default_set_policy_set_param(struct ps_base *bps,
 					       const char *name,
 					       const char *value)
@@ -269,9 +625,25 @@ static int rmt_ps_default_set_policy_set_param(struct ps_base *bps,
 			data->q_max = bool_value;
 	}
 
+	if (strcmp(name, "quantum") == 0) {
+		ret = kstrtoint(value, 10, &bool_value);
+		if (!ret && bool_value > 0)
+			data->quantum = bool_value;
+	}
+
+	if (strncmp(name, QOS_PARAM_PREFIX, strlen(QOS_PARAM_PREFIX)) == 0)
+		return rmt_ps_default_set_qos_param(data, name, value);
+
 	return 0;
 }
 
+static int rmt_ps_default_config_apply(struct policy_parm *param, void *bps)
+{
+	return rmt_ps_default_set_policy_set_param(bps,
+						   policy_param_name(param),
+						   policy_param_value(param));
+}
+
 struct ps_base *rmt_ps_default_create(struct rina_component *component)
 {
 	struct rmt *rmt;
@@ -300,6 +672,10 @@ struct ps_base *rmt_ps_default_create(struct rina_component *component)
 		return NULL;
 	}
 
+	spin_lock_init(&data->lock);
+	INIT_LIST_HEAD(&data->qos_confs);
+	data->quantum = DEFAULT_QUANTUM;
+
 	ps->base.set_policy_set_param = rmt_ps_default_set_policy_set_param;
 	ps->dm = rmt;
 	ps->priv = data;
@@ -309,6 +685,8 @@ struct ps_base *rmt_ps_default_create(struct rina_component *component)
 		/* RMT config is available at assign-to-dif time, but
 		 * not available at set-policy-set time. */
 		parm = policy_param_find(rmt_cfg->policy_set, "q_max");
+		policy_for_each(rmt_cfg->policy_set, &ps->base,
+				rmt_ps_default_config_apply);
 	}
 
 	if (!parm) {
@@ -333,6 +711,7 @@ void rmt_ps_default_destroy(struct ps_base *bps)
 {
 	struct rmt_ps *ps;
 	struct rmt_ps_default_data *data;
+	struct rmt_qos_conf *pos, *next;
 
 	ps = container_of(bps, struct rmt_ps, base);
 	data = ps->priv;
@@ -340,6 +719,11 @@ void rmt_ps_default_destroy(struct ps_base *bps)
 	if (bps) {
 		if (data) {
 			robject_del(&data->robj);
+			list_for_each_entry_safe(pos, next,
+						 &data->qos_confs, list) {
+				list_del(&pos->list);
+				rkfree(pos);
+			}
 			rkfree(data);
                 }
 		rkfree(ps);
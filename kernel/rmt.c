@@ -84,15 +84,6 @@ struct rmt {
 	struct robject robj;
 };
 
-#define stats_get(name, n1_port, retval)				\
-        spin_lock_bh(&n1_port->lock);					\
-        retval = n1_port->stats.name;					\
-        spin_unlock_bh(&n1_port->lock);
-
-#define stats_inc(name, n1_port, bytes)					\
-        n1_port->stats.name##_pdus++;					\
-	n1_port->stats.name##_bytes += (unsigned int) bytes;		\
-
 static ssize_t rmt_attr_show(struct robject *        robj,
                              struct robj_attribute * attr,
                              char *                  buf)
@@ -123,33 +114,29 @@ static ssize_t rmt_n1_port_attr_show(struct robject *        robj,
 		return 0;
 
 	if (strcmp(robject_attr_name(attr), "queued_pdus") == 0) {
-		stats_get(plen, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0) {
-		stats_get(drop_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "err_pdus") == 0) {
-		stats_get(err_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0) {
-		stats_get(tx_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0) {
-		stats_get(rx_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0) {
-		stats_get(tx_bytes, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0) {
-		stats_get(rx_bytes, n1_port, stats_ret);
+		spin_lock_bh(&n1_port->lock);
+		stats_ret = n1_port->stats.plen;
+		spin_unlock_bh(&n1_port->lock);
 		return sprintf(buf, "%u\n", stats_ret);
 	}
+	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->rstats, RSTATS_DROP_PDUS));
+	if (strcmp(robject_attr_name(attr), "err_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->rstats, RSTATS_ERR_PDUS));
+	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->rstats, RSTATS_TX_PDUS));
+	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->rstats, RSTATS_RX_PDUS));
+	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->rstats, RSTATS_TX_BYTES));
+	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->rstats, RSTATS_RX_BYTES));
 	if (strcmp(robject_attr_name(attr), "wbusy") == 0) {
 		spin_lock_bh(&n1_port->lock);
 		wbusy = n1_port->wbusy;
@@ -162,6 +149,22 @@ static ssize_t rmt_n1_port_attr_show(struct robject *        robj,
 		spin_unlock_bh(&n1_port->lock);
 		return sprintf(buf, "%d\n", (int) state);
 	}
+	if (strcmp(robject_attr_name(attr), "queue_delay") == 0)
+		return rstats_hist_show(n1_port->rstats, buf);
+	if (!n1_port->sdup_port)
+		return 0;
+	if (strcmp(robject_attr_name(attr), "crypto_tx_bytes") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->sdup_port->rstats,
+					  RSTATS_TX_BYTES));
+	if (strcmp(robject_attr_name(attr), "crypto_rx_bytes") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->sdup_port->rstats,
+					  RSTATS_RX_BYTES));
+	if (strcmp(robject_attr_name(attr), "crypto_err_pdus") == 0)
+		return sprintf(buf, "%llu\n",
+			       rstats_get(n1_port->sdup_port->rstats,
+					  RSTATS_ERR_PDUS));
 	return 0;
 }
 RINA_SYSFS_OPS(rmt);
@@ -169,7 +172,8 @@ RINA_ATTRS(rmt, ps_name);
 RINA_KTYPE(rmt);
 RINA_SYSFS_OPS(rmt_n1_port);
 RINA_ATTRS(rmt_n1_port, queued_pdus, drop_pdus, err_pdus, tx_pdus,
-	   tx_bytes, rx_pdus, rx_bytes, wbusy, state);
+	   tx_bytes, rx_pdus, rx_bytes, wbusy, state, queue_delay,
+	   crypto_tx_bytes, crypto_rx_bytes, crypto_err_pdus);
 RINA_KTYPE(rmt_n1_port);
 
 static struct rmt_n1_port *n1_port_create(port_id_t id,
@@ -183,6 +187,12 @@ static struct rmt_n1_port *n1_port_create(port_id_t id,
 	if (!tmp)
 		return NULL;
 
+	tmp->rstats = rstats_create_ni();
+	if (!tmp->rstats) {
+		rkfree(tmp);
+		return NULL;
+	}
+
 	robject_init(&tmp->robj, &rmt_n1_port_rtype);
 	INIT_HLIST_NODE(&tmp->hlist);
 
@@ -193,12 +203,6 @@ static struct rmt_n1_port *n1_port_create(port_id_t id,
 	atomic_set(&tmp->refs_c, 0);
 	tmp->wbusy = false;
 	tmp->stats.plen = 0;
-	tmp->stats.drop_pdus = 0;
-	tmp->stats.err_pdus = 0;
-	tmp->stats.tx_pdus = 0;
-	tmp->stats.tx_bytes = 0;
-	tmp->stats.rx_pdus = 0;
-	tmp->stats.rx_bytes = 0;
 	tmp->sdup_port = 0;
 	spin_lock_init(&tmp->lock);
 
@@ -242,6 +246,7 @@ static int n1_port_destroy(struct rmt_n1_port *n1p)
 	if (n1p->wbusy)
 		LOG_WARN("Deleting n1_port with bussy writer... there may be something wrong...");
 
+	rstats_destroy(n1p->rstats);
 	rkfree(n1p);
 
 	return 0;
@@ -675,6 +680,17 @@ int rmt_config_set(struct rmt *instance,
 }
 EXPORT_SYMBOL(rmt_config_set);
 
+static inline void rmt_queue_delay_add(struct rmt_n1_port *n1_port,
+				       struct du *du)
+{
+	if (ktime_to_ns(du->tstamp))
+		rstats_hist_add(n1_port->rstats,
+				(u64) ktime_us_delta(ktime_get(),
+						      du->tstamp));
+	else
+		rstats_hist_add(n1_port->rstats, 0);
+}
+
 static int n1_port_write_du(struct rmt *rmt,
 			    struct rmt_n1_port *n1_port,
 			    struct du * du)
@@ -823,17 +839,21 @@ static void send_worker(unsigned long o)
 			}
 
 			spin_unlock(&n1_port->lock);
-			if (pendu)
+			if (pendu) {
 				ret = n1_port_write_du(rmt, n1_port, pendu);
-			else
+			} else {
+				rmt_queue_delay_add(n1_port, du);
 				ret = n1_port_write(rmt, n1_port, du);
+			}
+			if (ret >= 0)
+				rstats_inc_bytes(n1_port->rstats,
+						 RSTATS_TX_PDUS, ret);
 			spin_lock(&n1_port->lock);
 
 			if (ret < 0)
 				break;
 
 			pdus_sent++;
-			stats_inc(tx, n1_port, ret);
 		}
 
 		if ((n1_port->state == N1_PORT_STATE_ENABLED ||
@@ -900,6 +920,9 @@ int rmt_send_port_id(struct rmt *instance,
 		must_enqueue = true;
 	}
 
+	/* The policy may queue the PDU even if not forced to */
+	du->tstamp = ktime_get();
+
 	ret = ps->rmt_enqueue_policy(ps, n1_port, du, must_enqueue);
 	rcu_read_unlock();
 	switch (ret) {
@@ -909,12 +932,12 @@ int rmt_send_port_id(struct rmt *instance,
 		ret = 0;
 		break;
 	case RMT_PS_ENQ_DROP:
-		n1_port->stats.drop_pdus++;
+		rstats_inc(n1_port->rstats, RSTATS_DROP_PDUS);
 		LOG_ERR("PDU dropped while enqueing");
 		ret = 0;
 		break;
 	case RMT_PS_ENQ_ERR:
-		n1_port->stats.err_pdus++;
+		rstats_inc(n1_port->rstats, RSTATS_ERR_PDUS);
 		LOG_ERR("Some error occurred while enqueuing PDU");
 		ret = 0;
 		break;
@@ -922,7 +945,7 @@ int rmt_send_port_id(struct rmt *instance,
 		if (must_enqueue) {
 			LOG_ERR("Wrong behaviour of the policy");
 			du_destroy(du);
-			n1_port->stats.err_pdus++;
+			rstats_inc(n1_port->rstats, RSTATS_ERR_PDUS);
 			LOG_DBG("Policy should have enqueue, returned SEND");
 			ret = -1;
 			break;
@@ -931,14 +954,14 @@ int rmt_send_port_id(struct rmt *instance,
 		n1_port->wbusy = true;
 		n1_port_unlock(n1_port);
 		LOG_DBG("PDU ready to be sent, no need to enqueue");
+		rstats_hist_add(n1_port->rstats, 0);
 		ret = n1_port_write(instance, n1_port, du);
+		if (ret >= 0)
+			rstats_inc_bytes(n1_port->rstats, RSTATS_TX_PDUS, ret);
 		/*FIXME LB: This is just horrible, needs to be rethinked */
 		n1_port_lock(n1_port);
 		n1_port->wbusy = false;
-		if (ret >= 0) {
-			stats_inc(tx, n1_port, ret);
-			ret = 0;
-		} else if (ret == -EAGAIN)
+		if (ret >= 0 || ret == -EAGAIN)
 			ret = 0;
 		break;
 	default:
@@ -1138,19 +1161,22 @@ int rmt_n1port_bind(struct rmt *instance,
 		return -1;
 	}
 
-	rcu_read_lock();
-	ps = container_of(rcu_dereference(instance->base.ps),
+	/* The policy may add sysfs entries for its queues, so the PS is
+	 * pinned with the mutex instead of an RCU read-side section */
+	mutex_lock(&instance->base.ps_lock);
+	ps = container_of(rcu_dereference_protected(instance->base.ps,
+				lockdep_is_held(&instance->base.ps_lock)),
 			  struct rmt_ps,
 			  base);
 	if (!ps || !ps->rmt_q_create_policy) {
-		rcu_read_unlock();
+		mutex_unlock(&instance->base.ps_lock);
 		LOG_ERR("No PS in the RMT, can't bind");
 		n1_port_destroy(tmp);
 		return -1;
 	}
 
 	tmp->rmt_ps_queues = ps->rmt_q_create_policy(ps, tmp);
-	rcu_read_unlock();
+	mutex_unlock(&instance->base.ps_lock);
 	if (!tmp->rmt_ps_queues) {
 		LOG_ERR("Cannot create structs for scheduling policy");
 		n1_port_destroy(tmp);
@@ -1274,37 +1300,14 @@ int pdu_is_addressed_to_me(struct rmt * rmt, address_t address)
 	return 0;
 }
 
-int rmt_receive(struct rmt *rmt,
-		struct du * du,
-		port_id_t from)
+/* Accounts a PDU received from n1_port and strips its SDU protection,
+ * destroys it on failure */
+static int rmt_receive_unprotect(struct rmt *rmt,
+				 struct rmt_n1_port *n1_port,
+				 struct du *du)
 {
-	pdu_type_t pdu_type;
-	address_t dst_addr;
-	qos_id_t qos_id;
-	struct rmt_n1_port *n1_port;
-	ssize_t bytes;
-
-	if (!rmt) {
-		LOG_ERR("No RMT passed");
-		du_destroy(du);
-		return -1;
-	}
-	if (!is_port_id_ok(from)) {
-		LOG_ERR("Wrong port-id %d", from);
-		du_destroy(du);
-		return -1;
-	}
-
-	bytes = du_len(du);
 	du->cfg = rmt->efcpc->config;
-
-	n1_port = n1pmap_find(rmt, from);
-	if (!n1_port) {
-		LOG_ERR("Could not retrieve N-1 port for the received PDU...");
-                du_destroy(du);
-		return -1;
-	}
-	stats_inc(rx, n1_port, bytes);
+	rstats_inc_bytes(n1_port->rstats, RSTATS_RX_PDUS, du_len(du));
 
 	/* SDU Protection */
 	if (sdup_unprotect_pdu(n1_port->sdup_port, du)) {
@@ -1321,7 +1324,18 @@ int rmt_receive(struct rmt *rmt,
         }
 	/* end SDU Protection */
 
-	n1pmap_release(rmt, n1_port);
+	return 0;
+}
+
+/* Delivers an unprotected PDU to the EFCP or management, or forwards it */
+static int rmt_receive_dispatch(struct rmt *rmt,
+				struct rmt_n1_port *n1_port,
+				struct du *du,
+				port_id_t from)
+{
+	pdu_type_t pdu_type;
+	address_t dst_addr;
+	qos_id_t qos_id;
 
 	if (unlikely(du_decap(du))) { /*Decap PDU */
 		LOG_ERR("Could not decap PDU");
@@ -1388,8 +1402,78 @@ int rmt_receive(struct rmt *rmt,
 		}
 	}
 }
+
+int rmt_receive(struct rmt *rmt,
+		struct du * du,
+		port_id_t from)
+{
+	struct rmt_n1_port *n1_port;
+	int ret;
+
+	if (!rmt) {
+		LOG_ERR("No RMT passed");
+		du_destroy(du);
+		return -1;
+	}
+	if (!is_port_id_ok(from)) {
+		LOG_ERR("Wrong port-id %d", from);
+		du_destroy(du);
+		return -1;
+	}
+
+	n1_port = n1pmap_find(rmt, from);
+	if (!n1_port) {
+		LOG_ERR("Could not retrieve N-1 port for the received PDU...");
+                du_destroy(du);
+		return -1;
+	}
+
+	/* The forwarding path still needs the SDU protection of n1_port */
+	ret = rmt_receive_unprotect(rmt, n1_port, du) ||
+		rmt_receive_dispatch(rmt, n1_port, du, from) ? -1 : 0;
+	n1pmap_release(rmt, n1_port);
+
+	return ret;
+}
 EXPORT_SYMBOL(rmt_receive);
 
+/* Like rmt_receive(), for PDUs received in a burst from the same N-1
+ * port, which is looked up once for all of them */
+int rmt_receive_batch(struct rmt *rmt,
+		      struct du **dus,
+		      unsigned int count,
+		      port_id_t from)
+{
+	struct rmt_n1_port *n1_port;
+	unsigned int i;
+	int ret = 0;
+
+	if (!rmt || !is_port_id_ok(from)) {
+		LOG_ERR("Bogus RMT or port-id %d", from);
+		n1_port = NULL;
+	} else {
+		n1_port = n1pmap_find(rmt, from);
+		if (!n1_port)
+			LOG_ERR("Could not retrieve N-1 port for the received PDUs...");
+	}
+
+	if (!n1_port) {
+		for (i = 0; i < count; i++)
+			du_destroy(dus[i]);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (rmt_receive_unprotect(rmt, n1_port, dus[i]) ||
+		    rmt_receive_dispatch(rmt, n1_port, dus[i], from))
+			ret = -1;
+	}
+	n1pmap_release(rmt, n1_port);
+
+	return ret;
+}
+EXPORT_SYMBOL(rmt_receive_batch);
+
 struct rmt *rmt_create(struct kfa *kfa,
 		       struct efcp_container *efcpc,
 		       struct sdup *sdup,
@@ -33,6 +33,7 @@
 #include "ps-factory.h"
 #include "sdup.h"
 #include "rds/robjects.h"
+#include "rds/rstats.h"
 
 struct rmt;
 
@@ -66,12 +67,6 @@ enum flow_state {
 
 struct n1_port_stats {
 	unsigned int plen; /* port len, all pdus enqueued in PS queue/s */
-	unsigned int drop_pdus;
-	unsigned int err_pdus;
-	unsigned int tx_pdus;
-	unsigned int tx_bytes;
-	unsigned int rx_pdus;
-	unsigned int rx_bytes;
 };
 
 struct rmt_n1_port {
@@ -84,6 +79,7 @@ struct rmt_n1_port {
 	struct du		*pending_du;
 	struct sdup_port 	*sdup_port;
 	struct n1_port_stats	stats;
+	struct rstats		*rstats; /* per-CPU, no lock needed */
 	bool			wbusy;
 	void 			*rmt_ps_queues;
 	struct robject		robj;
@@ -122,6 +118,10 @@ int		   rmt_send_port_id(struct rmt *instance,
 int		   rmt_receive(struct rmt *instance,
 			       struct du *du,
 			       port_id_t from);
+int		   rmt_receive_batch(struct rmt *instance,
+				     struct du **dus,
+				     unsigned int count,
+				     port_id_t from);
 int		   rmt_enable_port_id(struct rmt *instance,
 				      port_id_t id);
 int		   rmt_disable_port_id(struct rmt *instance,
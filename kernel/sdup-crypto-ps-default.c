@@ -26,7 +26,9 @@
 #include <linux/crypto.h>
 #include <linux/scatterlist.h>
 #include <linux/random.h>
+#include <linux/atomic.h>
 #include <crypto/hash.h>
+#include <crypto/aead.h>
 
 #define RINA_PREFIX "sdup-crypto-ps-default"
 
@@ -36,10 +38,23 @@
 #include "sdup-crypto-ps-default.h"
 #include "debug.h"
 
+/* AEAD nonce: random salt per state followed by a PDU counter */
+#define AEAD_SALT_LEN	4
+#define AEAD_IV_LEN	(AEAD_SALT_LEN + sizeof(u64))
+#define AEAD_TAG_LEN	16
 
 struct sdup_crypto_ps_default_crypto_state {
 	struct crypto_blkcipher * blkcipher;
 
+	/*
+	 * AEAD mode, replaces blkcipher and shash. PDUs are protected
+	 * concurrently from several CPUs, so each one allocates its own
+	 * request and takes its nonce from the atomic counter
+	 */
+	struct crypto_aead *   aead;
+	u8                     aead_salt[AEAD_SALT_LEN];
+	atomic64_t             aead_cnt;
+
 	struct crypto_shash * shash;
 
 	struct crypto_comp * compress;
@@ -66,6 +81,8 @@ struct sdup_crypto_ps_default_data {
 	unsigned int seq_bmap_len;
 	unsigned int seq_win_size;
 
+	/* "enc_mode" parameter, AEAD (gcm) instead of cbc + HMAC */
+	bool            aead;
 };
 
 static struct sdup_crypto_ps_default_crypto_state * crypto_state_create(void)
@@ -75,6 +92,9 @@ static struct sdup_crypto_ps_default_crypto_state * crypto_state_create(void)
 
 	state->blkcipher = NULL;
 
+	state->aead = NULL;
+	atomic64_set(&state->aead_cnt, 0);
+
 	state->shash = NULL;
 
 	state->compress = NULL;
@@ -93,6 +113,9 @@ static void crypto_state_destroy(struct sdup_crypto_ps_default_crypto_state * st
 	if (state->blkcipher)
 		crypto_free_blkcipher(state->blkcipher);
 
+	if (state->aead)
+		crypto_free_aead(state->aead);
+
 	if (state->shash)
 		crypto_free_shash(state->shash);
 
@@ -158,6 +181,7 @@ static struct sdup_crypto_ps_default_data * priv_data_create(void)
 	data->seq_bmap = NULL;
 	data->seq_win_size = 0;
 	data->seq_bmap_len = 0;
+	data->aead = false;
 
 	return data;
 }
@@ -377,6 +401,126 @@ static int decrypt(struct sdup_crypto_ps_default_data * priv_data,
 	return 0;
 }
 
+/*
+ * Encrypts in place everything after the sequence number, which is
+ * authenticated as associated data. The nonce goes in front of it and
+ * the tag at the end of the PDU.
+ */
+static int aead_encrypt(struct sdup_crypto_ps_default_data * priv_data,
+			struct du * du)
+{
+	struct sdup_crypto_ps_default_crypto_state * state;
+	struct aead_request *	req;
+	struct scatterlist	sg;
+	ssize_t			len;
+	char *			iv;
+	u64			cnt;
+	int			ret;
+
+	state = priv_data->current_tx_state;
+
+	/* AEAD is disabled */
+	if (!state->aead)
+		return 0;
+
+	len = du_len(du);
+	if (du_tail_grow(du, AEAD_TAG_LEN)) {
+		LOG_ERR("Failed to grow ser PDU for AEAD tag");
+		return -1;
+	}
+
+	if (du_head_grow(du, AEAD_IV_LEN)) {
+		LOG_ERR("Failed to grow ser PDU for AEAD nonce");
+		return -1;
+	}
+
+	req = aead_request_alloc(state->aead, GFP_ATOMIC);
+	if (!req) {
+		LOG_ERR("Could not allocate AEAD request");
+		return -1;
+	}
+
+	/* A nonce must never be used twice with the same key */
+	cnt = atomic64_inc_return(&state->aead_cnt) - 1;
+
+	iv = du_buffer(du);
+	memcpy(iv, state->aead_salt, AEAD_SALT_LEN);
+	memcpy(iv + AEAD_SALT_LEN, &cnt, sizeof(cnt));
+
+	sg_init_one(&sg, iv + AEAD_IV_LEN, len + AEAD_TAG_LEN);
+
+	aead_request_set_callback(req, 0, NULL, NULL);
+	aead_request_set_ad(req, sizeof(priv_data->tx_seq_num));
+	aead_request_set_crypt(req, &sg, &sg,
+			       len - sizeof(priv_data->tx_seq_num), iv);
+
+	ret = crypto_aead_encrypt(req);
+	aead_request_free(req);
+	if (ret) {
+		LOG_ERR("AEAD encryption failed!");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int aead_decrypt(struct sdup_crypto_ps_default_data * priv_data,
+			struct du * du)
+{
+	struct sdup_crypto_ps_default_crypto_state * state;
+	struct aead_request *	req;
+	struct scatterlist	sg;
+	ssize_t			len;
+	char			iv[AEAD_IV_LEN];
+	int			ret;
+
+	state = priv_data->current_rx_state;
+
+	/* AEAD is disabled */
+	if (!state->aead)
+		return 0;
+
+	len = du_len(du);
+	if (len < AEAD_IV_LEN + sizeof(priv_data->rx_seq_num) + AEAD_TAG_LEN) {
+		LOG_ERR("PDU too short for AEAD (%zd bytes)", len);
+		return -1;
+	}
+
+	memcpy(iv, du_buffer(du), AEAD_IV_LEN);
+	if (du_head_shrink(du, AEAD_IV_LEN)) {
+		LOG_ERR("Failed to shrink ser PDU by AEAD nonce");
+		return -1;
+	}
+	len -= AEAD_IV_LEN;
+
+	req = aead_request_alloc(state->aead, GFP_ATOMIC);
+	if (!req) {
+		LOG_ERR("Could not allocate AEAD request");
+		return -1;
+	}
+
+	sg_init_one(&sg, du_buffer(du), len);
+
+	aead_request_set_callback(req, 0, NULL, NULL);
+	aead_request_set_ad(req, sizeof(priv_data->rx_seq_num));
+	aead_request_set_crypt(req, &sg, &sg,
+			       len - sizeof(priv_data->rx_seq_num), iv);
+
+	ret = crypto_aead_decrypt(req);
+	aead_request_free(req);
+	if (ret) {
+		LOG_ERR("AEAD decryption or authentication failed!");
+		return -1;
+	}
+
+	if (du_tail_shrink(du, AEAD_TAG_LEN)) {
+		LOG_ERR("Failed to shrink ser PDU by AEAD tag");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int add_hmac(struct sdup_crypto_ps_default_data * priv_data,
 		    struct du * du)
 {
@@ -617,7 +761,7 @@ static int add_seq_num(struct sdup_crypto_ps_default_data * priv_data,
 	state = priv_data->current_tx_state;
 
 	/* encryption and therefore sequence numbers are disabled */
-	if (!state->blkcipher)
+	if (!state->blkcipher && !state->aead)
 		return 0;
 
 	if (du_head_grow(du, sizeof(priv_data->tx_seq_num))){
@@ -654,7 +798,7 @@ static int del_seq_num(struct sdup_crypto_ps_default_data * priv_data,
 	state = priv_data->current_rx_state;
 
 	/* decryption and therefore sequence numbers are disabled */
-	if (!state->blkcipher)
+	if (!state->blkcipher && !state->aead)
 		return 0;
 
 	data = du_buffer(du);
@@ -736,6 +880,10 @@ int default_sdup_apply_crypto(struct sdup_crypto_ps * ps,
 	if (result)
 		return result;
 
+	result = aead_encrypt(priv_data, du);
+	if (result)
+		return result;
+
 	return result;
 }
 EXPORT_SYMBOL(default_sdup_apply_crypto);
@@ -748,6 +896,10 @@ int default_sdup_remove_crypto(struct sdup_crypto_ps * ps,
 	struct sdup_port * port = ps->dm;
 	struct dt_cons * dt_cons = port->dt_cons;
 
+	result = aead_decrypt(priv_data, du);
+	if (result)
+		return result;
+
 	result = decrypt(priv_data, du);
 	if (result)
 		return result;
@@ -774,6 +926,72 @@ int default_sdup_remove_crypto(struct sdup_crypto_ps * ps,
 EXPORT_SYMBOL(default_sdup_remove_crypto);
 
 
+static void aead_state_fini(struct sdup_crypto_ps_default_crypto_state * cs)
+{
+	if (cs->aead) {
+		crypto_free_aead(cs->aead);
+		cs->aead = NULL;
+	}
+
+	if (cs->enc_alg) {
+		rkfree(cs->enc_alg);
+		cs->enc_alg = NULL;
+	}
+
+	atomic64_set(&cs->aead_cnt, 0);
+}
+
+static int aead_state_init(struct sdup_crypto_ps_default_crypto_state * cs,
+			   const string_t * enc_alg,
+			   struct buffer * key)
+{
+	/* Rekeying, drop the previous handle */
+	aead_state_fini(cs);
+
+	if (string_cmp(enc_alg, "AES128") != 0 &&
+	    string_cmp(enc_alg, "AES256") != 0) {
+		LOG_ERR("Unsupported encryption algorithm %s", enc_alg);
+		return -1;
+	}
+
+	if (string_dup("gcm(aes)", &cs->enc_alg)) {
+		LOG_ERR("Problems copying 'enc_alg' value");
+		return -1;
+	}
+
+	/*
+	 * Crypto is applied under RCU from the RMT, so only synchronous
+	 * implementations are usable (AES-NI and friends still qualify)
+	 */
+	cs->aead = crypto_alloc_aead(cs->enc_alg, 0, CRYPTO_ALG_ASYNC);
+	if (IS_ERR(cs->aead)) {
+		LOG_ERR("Could not allocate aead handle for %s", cs->enc_alg);
+		cs->aead = NULL;
+		aead_state_fini(cs);
+		return -1;
+	}
+
+	if (crypto_aead_setauthsize(cs->aead, AEAD_TAG_LEN)) {
+		LOG_ERR("Could not set AEAD tag size");
+		aead_state_fini(cs);
+		return -1;
+	}
+
+	if (key && crypto_aead_setkey(cs->aead, buffer_data_ro(key),
+				      buffer_length(key))) {
+		LOG_ERR("Could not set AEAD key");
+		aead_state_fini(cs);
+		return -1;
+	}
+
+	get_random_bytes(cs->aead_salt, AEAD_SALT_LEN);
+	atomic64_set(&cs->aead_cnt, 0);
+
+	LOG_DBG("Encryption cipher is %s", cs->enc_alg);
+
+	return 0;
+}
+
 int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 				     struct sdup_crypto_state * state)
 {
@@ -792,7 +1010,17 @@ int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 	next_tx_state = priv_data->next_tx_state;
 	next_rx_state = priv_data->next_rx_state;
 
-	if (state->enc_alg && string_cmp(state->enc_alg, "") != 0) {
+	if (priv_data->aead && state->enc_alg &&
+	    string_cmp(state->enc_alg, "") != 0) {
+		if (aead_state_init(next_tx_state, state->enc_alg,
+				    state->encrypt_key_tx) ||
+		    aead_state_init(next_rx_state, state->enc_alg,
+				    state->encrypt_key_rx)) {
+			LOG_ERR("Could not set up AEAD for N-1 port %d",
+				ps->dm->port_id);
+			return -1;
+		}
+	} else if (state->enc_alg && string_cmp(state->enc_alg, "") != 0) {
 		if (string_cmp(state->enc_alg, "AES128") == 0 ||
 		    string_cmp(state->enc_alg, "AES256") == 0) {
 			if (string_dup("cbc(aes)",
@@ -829,7 +1057,7 @@ int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 		}
 	}
 
-	if (state->encrypt_key_tx) {
+	if (state->encrypt_key_tx && next_tx_state->blkcipher) {
 		if (crypto_blkcipher_setkey(next_tx_state->blkcipher,
 					    buffer_data_ro(state->encrypt_key_tx),
 					    buffer_length(state->encrypt_key_tx))) {
@@ -838,7 +1066,7 @@ int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 			return -1;
 		}
 	}
-	if (state->encrypt_key_rx) {
+	if (state->encrypt_key_rx && next_rx_state->blkcipher) {
 		if (crypto_blkcipher_setkey(next_rx_state->blkcipher,
 					    buffer_data_ro(state->encrypt_key_rx),
 					    buffer_length(state->encrypt_key_rx))) {
@@ -848,7 +1076,9 @@ int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 		}
 	}
 
-	if (state->mac_alg && string_cmp(state->mac_alg, "") != 0) {
+	/* AEAD tags already authenticate the PDU */
+	if (!priv_data->aead && state->mac_alg &&
+	    string_cmp(state->mac_alg, "") != 0) {
 		if (string_cmp(state->mac_alg, "SHA256") == 0) {
 			if (string_dup("hmac(sha256)", &next_tx_state->mac_alg)) {
 				LOG_ERR("Problems copying 'mac_alg' value");
@@ -890,7 +1120,7 @@ int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 			return -1;
 		}
 	}
-	if (state->mac_key_tx) {
+	if (state->mac_key_tx && next_tx_state->shash) {
 		if (crypto_shash_setkey(next_tx_state->shash,
 					buffer_data_ro(state->mac_key_tx),
 					buffer_length(state->mac_key_tx))) {
@@ -899,7 +1129,7 @@ int default_sdup_update_crypto_state(struct sdup_crypto_ps * ps,
 			return -1;
 		}
 	}
-	if (state->mac_key_rx) {
+	if (state->mac_key_rx && next_rx_state->shash) {
 		if (crypto_shash_setkey(next_rx_state->shash,
 					buffer_data_ro(state->mac_key_rx),
 					buffer_length(state->mac_key_rx))) {
@@ -1041,6 +1271,20 @@ struct ps_base * sdup_crypto_ps_default_create(struct rina_component * component
 			LOG_DBG("Sequence number window size is %d",
 				data->seq_win_size);
 		}
+
+		parameter = policy_param_find(conf->encrypt, "enc_mode");
+		if (parameter) {
+			aux = policy_param_value(parameter);
+			if (string_cmp(aux, "gcm") == 0) {
+				data->aead = true;
+			} else if (string_cmp(aux, "cbc") != 0) {
+				LOG_ERR("Unsupported encryption mode %s", aux);
+				rkfree(ps);
+				priv_data_destroy(data);
+				return NULL;
+			}
+			LOG_DBG("Encryption mode is %s", aux);
+		}
 	} else {
 		LOG_ERR("Bogus configuration passed");
 		rkfree(ps);
@@ -308,6 +308,9 @@ static void sdup_port_destroy(struct sdup_port * instance)
 	sdup_comp_destroy(instance->errc);
 	sdup_comp_destroy(instance->ttl);
 
+	if (instance->rstats)
+		rstats_destroy(instance->rstats);
+
 	instance->conf = NULL;
 
 	rkfree(instance);
@@ -327,13 +330,19 @@ static struct sdup_port * sdup_port_create(port_id_t port_id,
 		return NULL;
 	}
 
-	tmp = rkmalloc(sizeof(*tmp), GFP_ATOMIC);
+	tmp = rkzalloc(sizeof(*tmp), GFP_ATOMIC);
 	if (!tmp) {
 		return NULL;
 	}
 
 	INIT_LIST_HEAD(&(tmp->list));
 
+	tmp->rstats = rstats_create_ni();
+	if (!tmp->rstats) {
+		rkfree(tmp);
+		return NULL;
+	}
+
 	tmp->port_id = port_id;
 	tmp->conf = dup_conf;
 	tmp->dt_cons = dt_cons;
@@ -725,8 +734,10 @@ int sdup_protect_pdu(struct sdup_port * instance,
 
 		if (crypto_ps->sdup_apply_crypto(crypto_ps, du)) {
 			rcu_read_unlock();
+			rstats_inc(instance->rstats, RSTATS_ERR_PDUS);
 			return -1;
 		}
+		rstats_inc_bytes(instance->rstats, RSTATS_TX_PDUS, du_len(du));
 	}
 
 	if (instance->errc) {
@@ -777,8 +788,10 @@ int sdup_unprotect_pdu(struct sdup_port * instance,
 				         struct sdup_crypto_ps,
 				         base);
 
+		rstats_inc_bytes(instance->rstats, RSTATS_RX_PDUS, du_len(du));
 		if (crypto_ps->sdup_remove_crypto(crypto_ps, du)) {
 			rcu_read_unlock();
+			rstats_inc(instance->rstats, RSTATS_ERR_PDUS);
 			return -1;
 		}
 	}
@@ -26,6 +26,7 @@
 #include "ipcp-instances.h"
 #include "ps-factory.h"
 #include "pci.h"
+#include "rds/rstats.h"
 
 /** An SDU Protection module sub-component */
 struct sdup_comp {
@@ -56,6 +57,9 @@ struct sdup_port {
 	/* Data transfer constants - needed to check max pdu size on RX */
 	struct dt_cons * dt_cons;
 
+	/* Bytes through the crypto component and failed PDUs */
+	struct rstats * rstats;
+
 	/* Link it to the main IPCP SDU Protection component */
 	struct list_head list;
 };
@@ -63,6 +63,9 @@ class UNIXConsole {
 	rina::Thread *worker;
 	std::string socket_path;
 	std::string prompt;
+	// Connection whose command is being executed, NULL if it
+	// went away in the middle of the command
+	Connection *current;
 
 	int init(void);
 	int process_command(Connection *conn, char *cmdbuf, int size);
@@ -80,6 +83,12 @@ public:
 	static const int CMDRETCONT = 0;
 	static const int CMDRETSTOP = 1;
 	std::ostringstream outstream;
+
+	// Send what has been written to outstream so far to the client
+	// of the command being executed, so that long outputs can be
+	// streamed as they are produced. Returns false if the client
+	// is gone
+	bool flush();
 	std::map<std::string, ConsoleCmdInfo *> commands_map;
 };
 
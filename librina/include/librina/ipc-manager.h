@@ -364,6 +364,24 @@ public:
 	 */
 	void assignToDIF(const DIFInformation& difInformation, unsigned int opaque);
 
+#ifndef SWIG
+	/**
+	 * Same as above, but with a DIF configuration shared by all the IPC
+	 * Processes of the DIF, only setting the address of this one
+	 *
+	 * @param difName The name of the DIF
+	 * @param difType The type of the DIF
+	 * @param difConfiguration The configuration of the DIF
+	 * @param address The address of the IPC Process in the DIF
+	 * @param opaque an opaque identifier to correlate requests and responses
+	 * @throws AssignToDIFException if an error happens during the process
+	 */
+	void assignToDIF(const ApplicationProcessNamingInformation& difName,
+			 const std::string& difType,
+			 const DIFConfiguration& difConfiguration,
+			 unsigned int address, unsigned int opaque);
+#endif
+
 	/**
 	 * Invoked by the IPC Manager to modify the configuration of an existing IPC
 	 * process that is a member of a DIF. This oepration doesn't change the
@@ -532,12 +550,18 @@ public:
 	 * @param filter An expression evaluated for each object, to determine
 	 * wether the object should be returned by the query
 	 * @param opaque an opaque identifier to correlate requests and responses
+	 * @param pageSize the maximum number of objects returned in one
+	 * response (0 means no limit). Responses with more objects pending
+	 * have QueryRIBResponseEvent::more set.
+	 * @param cursor the name of the last object received in the previous
+	 * response, the query resumes after it ("" to start from the beginning)
 	 * @throws QueryRIBException
 	 */
 	void queryRIB(const std::string& objectClass,
 			const std::string& objectName, unsigned long objectInstance,
 			unsigned int scope, const std::string& filter,
-			unsigned int opaque);
+			unsigned int opaque, unsigned int pageSize = 0,
+			const std::string& cursor = std::string());
 
 	/**
 	 * Invoked by the IPC Manager to change a parameter value in a subcomponent
@@ -665,6 +689,47 @@ public:
          * @throws DestroyIPCProcessException if an error happens during the operation execution
          */
         unsigned int destroy(IPCProcessProxy* ipcp);
+
+        /**
+         * Keep up to size IPC Process daemons started and waiting to be
+         * bound to an IPC Process identity, so that create() does not pay
+         * for the process start-up and the loading of the policy plugins.
+         * The pool is refilled in the background, never by create().
+         * A size of 0 disables the pool and terminates the standby daemons.
+         */
+        void set_standby_pool_size(unsigned int size);
+        unsigned int get_standby_pool_size();
+
+        /** IPC Processes created from a standby daemon */
+        unsigned int get_standby_hits();
+
+        /** IPC Processes that had to be started from scratch */
+        unsigned int get_standby_misses();
+
+        /** Body of the thread that refills the standby pool */
+        void refill_standby_pool();
+
+private:
+        struct StandbyIPCP {
+                pid_t pid;
+
+                /** Our end of the socket the daemon reads its identity from */
+                int fd;
+        };
+
+        bool spawn_standby(StandbyIPCP& standby);
+        pid_t bind_standby(const ApplicationProcessNamingInformation& ipcProcessName,
+                           const std::string& difType,
+                           unsigned short ipcProcessId);
+
+        /** Protects the pool, signalled when it has to be refilled */
+        ConditionVariable standby_cond;
+        Thread * standby_refiller;
+        bool standby_stop;
+        unsigned int standby_pool_size;
+        std::list<StandbyIPCP> standby_pool;
+        unsigned int standby_hits;
+        unsigned int standby_misses;
 };
 
 /**
@@ -792,10 +857,14 @@ class QueryRIBResponseEvent: public BaseResponseEvent {
 public:
         std::list<rib::RIBObjectData> ribObjects;
 
+        /** More objects are pending, ask for them after the last one */
+        bool more;
+
         QueryRIBResponseEvent(const std::list<rib::RIBObjectData>& ribObjects,
                         int result,
                         unsigned int sequenceNumber,
-			unsigned int ctrl_p, unsigned short ipcp_id);
+			unsigned int ctrl_p, unsigned short ipcp_id,
+			bool more = false);
 #ifndef SWIG
         const std::list<rib::RIBObjectData>& getRIBObject() const;
 #endif
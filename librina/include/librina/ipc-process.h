@@ -125,16 +125,26 @@ public:
 	 */
 	std::string filter;
 
+	/** Maximum number of objects in the response (0: no limit) */
+	unsigned int pageSize;
+
+	/** Only objects whose name sorts after this one are returned */
+	std::string cursor;
+
 	QueryRIBRequestEvent(const std::string& objectClass,
 			const std::string& objectName, long objectInstance, int scope,
 			const std::string& filter, unsigned int sequenceNumber,
-			unsigned int ctrl_p, unsigned short ipcp_id);
+			unsigned int ctrl_p, unsigned short ipcp_id,
+			unsigned int pageSize = 0,
+			const std::string& cursor = std::string());
 #ifndef SWIG
 	const std::string& getObjectClass() const;
 	const std::string& getObjectName() const;
 	long getObjectInstance() const;
 	int getScope() const;
 	const std::string& getFilter() const;
+	unsigned int getPageSize() const;
+	const std::string& getCursor() const;
 #endif
 };
 
@@ -673,10 +683,13 @@ public:
 	 * @param event
 	 * @param result
 	 * @param ribObjects
+	 * @param more true if the page size of the request was reached and
+	 * more objects are pending
 	 * @throws QueryRIBResponseException
 	 */
 	void queryRIBResponse(const QueryRIBRequestEvent& event, int result,
-			      const std::list<rib::RIBObjectData>& ribObjects);
+			      const std::list<rib::RIBObjectData>& ribObjects,
+			      bool more = false);
 
 	/**
 	 * Request an available portId to the kernel
@@ -813,6 +813,28 @@ public:
                 const std::string& class_="",
                 const std::string& name="");
 
+        ///
+        /// Get one page of the objects in the RIB, filtered by class/name
+        /// as above. Objects are returned sorted by name.
+        ///
+        /// @param after Only objects whose name sorts after this one are
+        /// returned (all of them if "")
+        /// @param max_objs Maximum number of objects returned (0: no limit)
+        /// @param max_bytes The page is closed once the names, classes and
+        /// displayable values returned add up to this size (0: no limit)
+        /// @param more Set to true if more objects match the filters
+        ///
+        /// @throws eRIBNotFound
+        ///
+        std::list<RIBObjectData> get_rib_objects_data(
+                const rib_handle_t& handle,
+                const std::string& class_,
+                const std::string& name,
+                const std::string& after,
+                unsigned int max_objs,
+                unsigned int max_bytes,
+                bool& more);
+
         int set_security_manager(ApplicationEntity * sec_man);
 
 
@@ -24,8 +24,10 @@
 
 #ifdef __cplusplus
 
+#include <map>
 #include <openssl/dh.h>
 #include <openssl/rsa.h>
+#include <openssl/x509.h>
 
 #include "librina/application.h"
 #include "librina/rib_v2.h"
@@ -382,6 +384,158 @@ private:
 	bool enabled;
 };
 
+/// Process-wide cache of the credentials parsed from keystore files, so that
+/// every new security context does not have to open and parse them again.
+/// Entries are keyed by file path and re-read when the file modification
+/// time or size changes. The objects returned carry their own reference:
+/// callers release them with RSA_free / X509_free as if freshly parsed.
+class CredentialCache {
+public:
+	CredentialCache() : hits(0), misses(0) { };
+	~CredentialCache();
+
+	/// Return the credential stored at path, or NULL if it cannot be
+	/// read or parsed
+	RSA * get_rsa_private_key(const std::string& path);
+	RSA * get_rsa_public_key(const std::string& path);
+	X509 * get_certificate(const std::string& path);
+
+	/// Drop all the cached credentials
+	void flush();
+
+	unsigned long get_hits();
+	unsigned long get_misses();
+
+private:
+	enum CredentialType {
+		RSA_PRIVATE_KEY,
+		RSA_PUBLIC_KEY,
+		CERTIFICATE
+	};
+
+	struct CachedCredential {
+		CredentialType type;
+		time_t mtime;
+		off_t size;
+		RSA * rsa;
+		X509 * cert;
+	};
+
+	/// Returns the up-to-date cached entry for path (parsing the file if
+	/// required) or NULL. Must be called with the lock held
+	CachedCredential * lookup(const std::string& path, CredentialType type);
+	void free_credential(CachedCredential& cred);
+
+	Lockable lock;
+	std::map<std::string, CachedCredential> credentials;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+extern Singleton<CredentialCache> credentialCache;
+
+/// Pool of precomputed ephemeral Diffie-Hellman key pairs for a (p, g)
+/// group, refilled by a background thread so that DH_generate_key is
+/// taken out of the enrollment critical path. Each key pair is handed
+/// out only once. The refill thread is started on first use.
+class DHKeyPool {
+public:
+	static const unsigned int DEFAULT_SIZE;
+
+	DHKeyPool();
+	~DHKeyPool();
+
+	/// Set the group parameters (not owned, must outlive the pool)
+	void set_parameters(DH * params);
+
+	/// Set the number of key pairs to keep precomputed (0 disables
+	/// the pool)
+	void set_size(unsigned int size);
+
+	/// Return a new key pair; if the pool is empty it is generated
+	/// on the spot. Returns NULL on error
+	DH * get();
+
+	/// Stop and join the refill thread
+	void stop_refill();
+
+	/// Body of the refill thread
+	void refill();
+
+	unsigned long get_hits();
+	unsigned long get_misses();
+
+private:
+	DH * generate();
+
+	ConditionVariable cond;
+	std::list<DH *> keys;
+	DH * params;
+	unsigned int size;
+	bool stop;
+	Thread * refill_thread;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+/// Process-wide cache of the secrets of the sessions established with a
+/// full handshake, so that a later authentication with the same peer can
+/// resume the session with an abbreviated one. Entries are keyed by a
+/// string chosen by the policy and expire after their lifetime. A session
+/// is taken out of the cache when it is used, and stored again only if
+/// the resumption succeeds: a failed resumption falls back to a full
+/// handshake next time.
+class SessionCache {
+public:
+	static const unsigned int DEFAULT_LIFETIME;
+	static const unsigned int MAX_SESSIONS;
+
+	SessionCache() : hits(0), misses(0) { };
+
+	/// Store the session id and secret under key, together with the
+	/// peer and the parameters the session was negotiated with. The
+	/// entry expires after lifetime seconds
+	void store(const std::string& key,
+		   const UcharArray& session_id,
+		   const UcharArray& secret,
+		   const std::string& peer,
+		   const std::string& params,
+		   unsigned int lifetime);
+
+	/// Take the session stored under key out of the cache. Returns 0
+	/// if an unexpired one was found, -1 otherwise
+	int take(const std::string& key,
+		 UcharArray& session_id,
+		 UcharArray& secret,
+		 std::string& peer,
+		 std::string& params);
+
+	/// Drop all the cached sessions
+	void flush();
+
+	unsigned long get_hits();
+	unsigned long get_misses();
+
+private:
+	struct CachedSession {
+		std::string session_id;
+		std::string secret;
+		std::string peer;
+		std::string params;
+		time_t expires;
+	};
+
+	/// Drop the expired sessions. Must be called with the lock held
+	void purge(time_t now);
+
+	Lockable lock;
+	std::map<std::string, CachedSession> sessions;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+extern Singleton<SessionCache> sessionCache;
+
 /// Authentication policy set that mimics SSH approach. It is associated to
 /// a cryptographic SDU protection policy, which is configured by this Authz policy.
 /// It uses the Open SSL crypto library to perform all its functions
@@ -398,6 +552,7 @@ public:
 	static const std::string CLIENT_CHALLENGE;
 	static const std::string CLIENT_CHALLENGE_REPLY;
 	static const std::string SERVER_CHALLENGE_REPLY;
+	static const std::string DH_KEY_POOL_SIZE;
 
 	AuthSSH2PolicySet(rib::RIBDaemonProxy * ribd, ISecurityManager * sm);
 	virtual ~AuthSSH2PolicySet();
@@ -480,6 +635,7 @@ private:
 	Lockable lock;
 	BoolConditionVariable encryption_ready_condition;
 	DH * dh_parameters;
+	DHKeyPool dh_key_pool;
 	Timer timer;
 	int timeout;
 };
@@ -57,6 +57,9 @@ public:
 
 	/// Supported encryption algorithms
 	std::list<std::string> encrypt_algs;
+
+	/// Id of the session the client wants to resume (empty if none)
+	UcharArray session_id;
 };
 
 ///Captures all data of the TLS HAndshake security context
@@ -83,6 +86,7 @@ public:
         	BEGIN,
                 WAIT_SERVER_HELLO_and_CERTIFICATE,
 		WAIT_CLIENT_CERTIFICATE_and_KEYS, //and change cipher spec and verify, name could be better
+		WAIT_CLIENT_CIPHER, //abbreviated handshake, resuming a session
 		CLIENT_SENDING_DATA,
 		SERVER_SENDING_CIPHER,
 		WAIT_SERVER_CIPHER,
@@ -111,6 +115,14 @@ public:
 	//Master secret
 	UcharArray master_secret;
 
+	//Session id given by the server, and whether the session was
+	//resumed with an abbreviated handshake
+	UcharArray session_id;
+	bool resumed;
+
+	//Name of the peer, to look up and check cached sessions
+	std::string peer_name;
+
 	//Hash generated in finish message, 12Bytes;
 	UcharArray verify_data;
 
@@ -170,6 +182,8 @@ public:
 	static const std::string SERVER_CHANGE_CIPHER_SPEC;
 	static const std::string CLIENT_FINISH;
 	static const std::string SERVER_FINISH;
+	static const std::string SESSION_LIFETIME;
+	static const int SESSION_ID_LENGTH;
 
 	AuthTLSHandPolicySet(rib::RIBDaemonProxy * ribd,
 			     ISecurityManager * sm);
@@ -216,6 +230,15 @@ private:
 	AuthStatus send_server_change_cipher_spec(TLSHandSecurityContext * sc);
 	AuthStatus send_client_finish(TLSHandSecurityContext * sc);
 
+	//Session resumption. Look up the cached session the client offers
+	//(server) or can offer (client), returns 0 if it can be resumed
+	int resume_server_session(TLSHandSecurityContext * sc,
+				  UcharArray& session_id);
+	int resume_client_session(TLSHandSecurityContext * sc);
+	//Store the session once authenticated, so that it can be resumed
+	void cache_session(TLSHandSecurityContext * sc, bool client);
+	std::string session_params(TLSHandSecurityContext * sc);
+
 	int prf(UcharArray& generated_hash,
 		UcharArray& secret,
 		const std::string& slabel,
@@ -236,6 +259,9 @@ private:
 	Lockable lock;
 	Timer timer;
 	int timeout;
+
+	/// Lifetime of the cached sessions in seconds (0 disables resumption)
+	unsigned int session_lifetime;
 };
 
 }
@@ -101,7 +101,7 @@ console_function(void *opaque)
 
 UNIXConsole::UNIXConsole(const std::string& socket_path_,
 			 const std::string& prompt_) :
-		socket_path(socket_path_), prompt(prompt_)
+		socket_path(socket_path_), prompt(prompt_), current(NULL)
 {
 	commands_map["help"] = new HelpConsoleCmd(this);
 	commands_map["quit"] = new QuitConsoleCmd(this);
@@ -341,6 +341,7 @@ UNIXConsole::process_command(Connection *conn, char *cmdbuf, int size)
 		return 0;
 	}
 
+	current = conn;
 	mit = commands_map.find(args[0]);
 	if (mit == commands_map.end()) {
 		outstream << "Unknown command '" << args[0] << "'";
@@ -350,13 +351,30 @@ UNIXConsole::process_command(Connection *conn, char *cmdbuf, int size)
 	}
 
 	outstream << endl;
-	if (!conn->write(outstream.str())) {
+	if (!current || !conn->write(outstream.str())) {
 		ret = CMDRETSTOP;
 	}
+	current = NULL;
 
 	// Make the stringstream empty
 	outstream.str(string());
 	return ret;
 }
 
+bool
+UNIXConsole::flush()
+{
+	if (!current) {
+		outstream.str(string());
+		return false;
+	}
+
+	if (!current->write(outstream.str())) {
+		current = NULL;
+	}
+
+	outstream.str(string());
+	return current != NULL;
+}
+
 }//namespace rina
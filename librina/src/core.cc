@@ -264,16 +264,19 @@ IPCEvent * IRATICtrlManager::irati_ctrl_msg_to_ipc_event(struct irati_msg_base *
 	case RINA_C_IPCM_QUERY_RIB_REQUEST: {
 		struct irati_kmsg_ipcm_query_rib * sp_msg =
 				(struct irati_kmsg_ipcm_query_rib *) msg;
-		std::string oc, on, fil;
+		std::string oc, on, fil, cur;
 		if (sp_msg->object_class)
 			oc = sp_msg->object_class;
 		if (sp_msg->object_name)
 			on = sp_msg->object_name;
 		if (sp_msg->filter)
 			fil = sp_msg->filter;
+		if (sp_msg->cursor)
+			cur = sp_msg->cursor;
 		event = new QueryRIBRequestEvent(oc, on, sp_msg->object_instance,
 						 sp_msg->scope, fil, sp_msg->event_id,
-						 msg->src_port, msg->src_ipcp_id);
+						 msg->src_port, msg->src_ipcp_id,
+						 sp_msg->page_size, cur);
 		break;
 	}
 	case RINA_C_IPCM_QUERY_RIB_RESPONSE: {
@@ -295,7 +298,8 @@ IPCEvent * IRATICtrlManager::irati_ctrl_msg_to_ipc_event(struct irati_msg_base *
 		        }
 		}
 		event = new QueryRIBResponseEvent(objects, sp_msg->result, sp_msg->event_id,
-						  msg->src_port, msg->src_ipcp_id);
+						  msg->src_port, msg->src_ipcp_id,
+						  sp_msg->more);
 		break;
 	}
 	case RINA_C_RMT_DUMP_FT_REPLY: {
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <iostream>
 #include <signal.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -166,6 +167,35 @@ void IPCProcessProxy::assignToDIF(const DIFInformation& difInformation,
 #endif
 }
 
+void IPCProcessProxy::assignToDIF(const ApplicationProcessNamingInformation& difName,
+				  const std::string& difType,
+				  const DIFConfiguration& difConfiguration,
+				  unsigned int address, unsigned int opaque)
+{
+#if STUB_API
+        //Do nothing
+#else
+        struct irati_kmsg_ipcm_assign_to_dif * msg;
+
+        msg = new irati_kmsg_ipcm_assign_to_dif();
+        msg->msg_type = RINA_C_IPCM_ASSIGN_TO_DIF_REQUEST;
+        msg->dif_name = difName.to_c_name();
+        msg->type = stringToCharArray(difType);
+        msg->dif_config = difConfiguration.to_c_dif_config();
+        msg->dif_config->address = address;
+        msg->dest_ipcp_id = id;
+        msg->dest_port = portId;
+        msg->event_id = opaque;
+
+        if (irati_ctrl_mgr->send_msg((struct irati_msg_base *) msg, false) != 0) {
+        	irati_ctrl_msg_free((struct irati_msg_base *) msg);
+        	throw IPCException("Problems sending CTRL message");
+        }
+
+        irati_ctrl_msg_free((struct irati_msg_base *) msg);
+#endif
+}
+
 void
 IPCProcessProxy::updateDIFConfiguration(const DIFConfiguration& difConfiguration,
 					unsigned int opaque)
@@ -467,7 +497,8 @@ void IPCProcessProxy::deallocateFlow(int flowPortId, unsigned int opaque)
 void IPCProcessProxy::queryRIB(const std::string& objectClass,
 		const std::string& objectName, unsigned long objectInstance,
 		unsigned int scope, const std::string& filter,
-		unsigned int opaque)
+		unsigned int opaque, unsigned int pageSize,
+		const std::string& cursor)
 {
 #if STUB_API
 #else
@@ -480,6 +511,8 @@ void IPCProcessProxy::queryRIB(const std::string& objectClass,
         msg->object_instance = objectInstance;
         msg->scope = scope;
         msg->filter = stringToCharArray(filter);
+        msg->page_size = pageSize;
+        msg->cursor = stringToCharArray(cursor);
         msg->dest_ipcp_id = id;
         msg->dest_port = portId;
         msg->event_id = opaque;
@@ -651,9 +684,236 @@ const std::string IPCProcessFactory::normal_ipc_process_type =
 		"normal";
 
 IPCProcessFactory::IPCProcessFactory() {
+	standby_refiller = 0;
+	standby_stop = false;
+	standby_pool_size = 0;
+	standby_hits = 0;
+	standby_misses = 0;
 }
 
 IPCProcessFactory::~IPCProcessFactory() throw() {
+	std::list<StandbyIPCP>::iterator it;
+
+	if (standby_refiller) {
+		standby_cond.lock();
+		standby_stop = true;
+		standby_cond.signal();
+		standby_cond.unlock();
+
+		standby_refiller->join(NULL);
+		delete standby_refiller;
+	}
+
+	//Standby daemons exit when they read EOF from their socket
+	for (it = standby_pool.begin(); it != standby_pool.end(); ++it)
+		close(it->fd);
+}
+
+static void * standby_refill_function(void * opaque)
+{
+	IPCProcessFactory * factory = (IPCProcessFactory *) opaque;
+
+	factory->refill_standby_pool();
+
+	return NULL;
+}
+
+void IPCProcessFactory::set_standby_pool_size(unsigned int size)
+{
+	ScopedLock g(standby_cond);
+
+	standby_pool_size = size;
+	while (standby_pool.size() > standby_pool_size) {
+		close(standby_pool.back().fd);
+		standby_pool.pop_back();
+	}
+
+	if (!standby_pool_size)
+		return;
+
+	if (!standby_refiller) {
+		try {
+			standby_refiller = new Thread(standby_refill_function,
+						      this,
+						      std::string("ipcp-standby"),
+						      false);
+			standby_refiller->start();
+		} catch (Exception &e) {
+			LOG_ERR("Problems starting the standby pool thread: %s",
+				e.what());
+			delete standby_refiller;
+			standby_refiller = 0;
+			return;
+		}
+	}
+
+	standby_cond.signal();
+}
+
+unsigned int IPCProcessFactory::get_standby_pool_size()
+{
+	ScopedLock g(standby_cond);
+
+	return standby_pool_size;
+}
+
+unsigned int IPCProcessFactory::get_standby_hits()
+{
+	ScopedLock g(standby_cond);
+
+	return standby_hits;
+}
+
+unsigned int IPCProcessFactory::get_standby_misses()
+{
+	ScopedLock g(standby_cond);
+
+	return standby_misses;
+}
+
+bool IPCProcessFactory::spawn_standby(StandbyIPCP& standby)
+{
+#if STUB_API
+	return false;
+#else
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+		LOG_ERR("Problems creating standby IPCP socket: %s",
+			strerror(errno));
+		return false;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		//The standby daemon reads its identity from stdin
+		if (dup2(sv[1], STDIN_FILENO) < 0)
+			exit(-1);
+
+		char * argv[] =
+		{
+			stringToCharArray(_installation_path +"/ipcp"),
+			stringToCharArray("--standby"),
+			stringToCharArray(_log_level),
+			0
+		};
+		char * envp[] =
+		{
+			stringToCharArray("PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"),
+			stringToCharArray("LD_LIBRARY_PATH=$LD_LIBRARY_PATH:"
+				          +_library_path),
+			(char*) 0
+		};
+
+		execve(argv[0], &argv[0], envp);
+
+		LOG_ERR("Problems loading standby IPC Process program: %s",
+			strerror(errno));
+
+		exit(-1);
+	}
+
+	close(sv[1]);
+	if (pid < 0) {
+		LOG_ERR("Problems forking standby IPC Process: %s",
+			strerror(errno));
+		close(sv[0]);
+		return false;
+	}
+
+	standby.pid = pid;
+	standby.fd = sv[0];
+	LOG_DBG("Started standby IPC Process daemon with pid = %d", pid);
+
+	return true;
+#endif
+}
+
+void IPCProcessFactory::refill_standby_pool()
+{
+	StandbyIPCP standby;
+	bool spawned = true;
+
+	standby_cond.lock();
+	while (!standby_stop) {
+		if (standby_pool.size() >= standby_pool_size) {
+			standby_cond.doWait();
+			continue;
+		}
+
+		//Back off for a while if the last daemon could not be started
+		if (!spawned) {
+			try {
+				standby_cond.timedwait(1, 0);
+			} catch (ConcurrentException &e) {
+			}
+			spawned = true;
+			continue;
+		}
+
+		//Fork without the lock, create() must not wait for it
+		standby_cond.unlock();
+		spawned = spawn_standby(standby);
+		standby_cond.lock();
+
+		if (!spawned)
+			continue;
+
+		if (standby_stop || standby_pool.size() >= standby_pool_size) {
+			close(standby.fd);
+			continue;
+		}
+
+		standby_pool.push_back(standby);
+	}
+	standby_cond.unlock();
+}
+
+pid_t IPCProcessFactory::bind_standby(const ApplicationProcessNamingInformation& ipcProcessName,
+				      const std::string& difType,
+				      unsigned short ipcProcessId)
+{
+	ScopedLock g(standby_cond);
+	std::stringstream ss;
+	std::string identity;
+	StandbyIPCP standby;
+	ssize_t n;
+
+	//One line per argument of the ipcp program, in the same order
+	ss << ipcProcessName.processName << "\n"
+	   << ipcProcessName.processInstance << "\n"
+	   << ipcProcessId << "\n"
+	   << irati_ctrl_mgr->get_irati_ctrl_port() << "\n"
+	   << _log_path << "/" << ipcProcessName.processName << "-"
+	   << ipcProcessName.processInstance << ".log\n"
+	   << difType << "\n";
+	identity = ss.str();
+
+	while (!standby_pool.empty()) {
+		standby = standby_pool.front();
+		standby_pool.pop_front();
+
+		//A standby daemon that died meanwhile fails with EPIPE
+		n = send(standby.fd, identity.c_str(), identity.size(),
+			 MSG_NOSIGNAL);
+		close(standby.fd);
+		if (n == (ssize_t) identity.size()) {
+			standby_hits++;
+			standby_cond.signal();
+			return standby.pid;
+		}
+
+		LOG_WARN("Standby IPC Process %d is gone, discarding it",
+			 standby.pid);
+	}
+
+	if (standby_pool_size > 0) {
+		standby_misses++;
+		standby_cond.signal();
+	}
+
+	return 0;
 }
 
 std::list<std::string> IPCProcessFactory::getSupportedIPCProcessTypes() {
@@ -695,8 +955,11 @@ IPCProcessProxy * IPCProcessFactory::create(
 	if (difType == NORMAL_IPC_PROCESS ||
 		difType == SHIM_WIFI_IPC_PROCESS_STA ||
 		difType == SHIM_WIFI_IPC_PROCESS_AP)	{
-		pid = fork();
-		if (pid == 0) {
+		pid = bind_standby(ipcProcessName, difType, ipcProcessId);
+		if (pid > 0) {
+			portId = pid;
+			LOG_DBG("Bound standby IPC Process with pid = %d", pid);
+		} else if ((pid = fork()) == 0) {
 			//This is the OS process that has to execute the IPC Process
 			//program and then exit
 			LOG_DBG("New OS Process created, executing IPC Process ...");
@@ -1055,11 +1318,15 @@ QueryRIBResponseEvent::QueryRIBResponseEvent(
                 const std::list<rib::RIBObjectData>& ribObjects,
                 int result,
                 unsigned int sequenceNumber,
-		unsigned int ctrl_port, unsigned short ipcp_id) :
+		unsigned int ctrl_port, unsigned short ipcp_id,
+		bool more) :
         BaseResponseEvent(result,
                           QUERY_RIB_RESPONSE_EVENT,
                           sequenceNumber, ctrl_port, ipcp_id)
-{ this->ribObjects = ribObjects; }
+{
+	this->ribObjects = ribObjects;
+	this->more = more;
+}
 
 const std::list<rib::RIBObjectData>& QueryRIBResponseEvent::getRIBObject() const
 { return ribObjects; }
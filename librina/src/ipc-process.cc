@@ -101,7 +101,8 @@ QueryRIBRequestEvent::QueryRIBRequestEvent(const std::string& objectClass,
 		const std::string& objectName, long objectInstance,
 		int scope, const std::string& filter,
 		unsigned int sequenceNumber,
-		unsigned int ctrl_p, unsigned short ipcp_id):
+		unsigned int ctrl_p, unsigned short ipcp_id,
+		unsigned int pageSize, const std::string& cursor):
 				IPCEvent(IPC_PROCESS_QUERY_RIB,
                                          sequenceNumber, ctrl_p, ipcp_id)
 {
@@ -110,6 +111,8 @@ QueryRIBRequestEvent::QueryRIBRequestEvent(const std::string& objectClass,
 	this->objectInstance = objectInstance;
 	this->scope = scope;
 	this->filter = filter;
+	this->pageSize = pageSize;
+	this->cursor = cursor;
 }
 
 const std::string& QueryRIBRequestEvent::getObjectClass() const{
@@ -132,6 +135,14 @@ const std::string& QueryRIBRequestEvent::getFilter() const{
 	return filter;
 }
 
+unsigned int QueryRIBRequestEvent::getPageSize() const{
+	return pageSize;
+}
+
+const std::string& QueryRIBRequestEvent::getCursor() const{
+	return cursor;
+}
+
 /* CLASS SET POLICY SET PARAM REQUEST EVENT */
 SetPolicySetParamRequestEvent::SetPolicySetParamRequestEvent(
                 const std::string& path, const std::string& name,
@@ -655,7 +666,8 @@ void ExtendedIPCManager::flowDeallocatedRemotely(int portId, int code)
 
 void ExtendedIPCManager::queryRIBResponse(const QueryRIBRequestEvent& event,
 					  int result,
-					  const std::list<rib::RIBObjectData>& ribObjects)
+					  const std::list<rib::RIBObjectData>& ribObjects,
+					  bool more)
 {
 #if STUB_API
 	//Do nothing
@@ -667,6 +679,7 @@ void ExtendedIPCManager::queryRIBResponse(const QueryRIBRequestEvent& event,
         msg = new irati_kmsg_ipcm_query_rib_resp();
         msg->msg_type = RINA_C_IPCM_QUERY_RIB_RESPONSE;
         msg->result = result;
+        msg->more = more;
         msg->event_id = event.sequenceNumber;
         msg->src_ipcp_id = ipcProcessId;
         msg->dest_port = ipcManagerPort;
@@ -372,6 +372,14 @@ public:
 		const std::string& class_,
 		const std::string& name);
 
+	std::list<RIBObjectData> get_all_rib_objects_data(
+		const std::string& class_,
+		const std::string& name,
+		const std::string& after,
+		unsigned int max_objs,
+		unsigned int max_bytes,
+		bool& more);
+
 	void set_security_manager(ISecurityManager * sec_man);
 
 protected:
@@ -1728,21 +1736,54 @@ const cdap_rib::vers_info_t& RIB::get_version() const {
 std::list<RIBObjectData> RIB::get_all_rib_objects_data(
 		const std::string& class_,
 		const std::string& name)
+{
+	bool more;
+
+	return get_all_rib_objects_data(class_, name, "", 0, 0, more);
+}
+
+std::list<RIBObjectData> RIB::get_all_rib_objects_data(
+		const std::string& class_,
+		const std::string& name,
+		const std::string& after,
+		unsigned int max_objs,
+		unsigned int max_bytes,
+		bool& more)
 {
 	std::list<RIBObjectData> result;
 	RIBObjectData data;
+	std::map<std::string, RIBObj*>::iterator it;
 	unsigned n = name.size();
+	bool prefix = n && name[n-1] == '/';
+	unsigned int objs = 0;
+	unsigned int bytes = 0;
 
-	for (std::map<std::string, RIBObj*>::iterator it = obj_name_map.begin();
-			it != obj_name_map.end(); ++it) {
-		data = it->second->get_object_data();
-		if (class_.size() && class_ != data.class_)
-			continue;
-		if (n && (name[n-1] == '/' ? data.name_.compare(0, n, name)
-					   : data.name_ != name))
+	more = false;
+
+	//Objects are sorted by name: the ones matching the name filter are
+	//contiguous, and so are the ones after the cursor
+	it = n ? obj_name_map.lower_bound(name) : obj_name_map.begin();
+	if (after.size() && (it == obj_name_map.end() || after >= it->first))
+		it = obj_name_map.upper_bound(after);
+
+	for (; it != obj_name_map.end(); ++it) {
+		if (n && (prefix ? it->first.compare(0, n, name)
+				 : it->first != name))
+			break;
+		if (class_.size() && class_ != it->second->class_name)
 			continue;
+		if ((max_objs && objs >= max_objs) ||
+				(max_bytes && bytes >= max_bytes)) {
+			more = true;
+			break;
+		}
+
+		data = it->second->get_object_data();
 		if (it->first != "/")
 			data.instance_ = __get_obj_inst_id(data.name_);
+		bytes += data.name_.size() + data.class_.size() +
+			 data.displayable_value_.size();
+		objs++;
 		result.push_back(data);
 	}
 
@@ -1966,6 +2007,15 @@ public:
 		const std::string& class_,
 		const std::string& name);
 
+	std::list<RIBObjectData> get_rib_objects_data(
+		const rib_handle_t& handle,
+		const std::string& class_,
+		const std::string& name,
+		const std::string& after,
+		unsigned int max_objs,
+		unsigned int max_bytes,
+		bool& more);
+
 	int set_security_manager(ApplicationEntity * sec_man);
 
 	///
@@ -2779,6 +2829,30 @@ std::list<RIBObjectData> RIBDaemon::get_rib_objects_data(
 	return rib->get_all_rib_objects_data(class_, name);
 }
 
+std::list<RIBObjectData> RIBDaemon::get_rib_objects_data(
+		const rib_handle_t& handle,
+		const std::string& class_,
+		const std::string& name,
+		const std::string& after,
+		unsigned int max_objs,
+		unsigned int max_bytes,
+		bool& more)
+{
+	//Mutual exclusion
+	ReadScopedLock rlock(rwlock);
+
+	//Retreive the RIB
+	RIB* rib = getRIB(handle);
+
+	if(rib == NULL){
+		LOG_ERR("RIB ('%" PRId64 "') does not exist", handle);
+		throw eRIBNotFound();
+	}
+
+	return rib->get_all_rib_objects_data(class_, name, after, max_objs,
+					     max_bytes, more);
+}
+
 int RIBDaemon::set_security_manager(ApplicationEntity * sec_man)
 {
 	if (security_m) {
@@ -3546,6 +3620,19 @@ std::list<RIBObjectData> RIBDaemonProxy::get_rib_objects_data(
 	return ribd->get_rib_objects_data(handle, class_, name);
 }
 
+std::list<RIBObjectData> RIBDaemonProxy::get_rib_objects_data(
+		const rib_handle_t& handle,
+		const std::string& class_,
+		const std::string& name,
+		const std::string& after,
+		unsigned int max_objs,
+		unsigned int max_bytes,
+		bool& more)
+{
+	return ribd->get_rib_objects_data(handle, class_, name, after,
+					  max_objs, max_bytes, more);
+}
+
 int RIBDaemonProxy::set_security_manager(ApplicationEntity * sec_man)
 {
 	return ribd->set_security_manager(sec_man);
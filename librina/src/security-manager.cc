@@ -20,6 +20,7 @@
 //
 
 #include <cstdlib>
+#include <sys/stat.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/md5.h>
@@ -891,8 +892,467 @@ void DH_get0_pqg(const DH *dh, const BIGNUM **p,
 	if (g)
 		*g = dh->g;
 }
+
+int RSA_up_ref(RSA *r)
+{
+	CRYPTO_add(&r->references, 1, CRYPTO_LOCK_RSA);
+
+	return 1;
+}
+
+int X509_up_ref(X509 *x)
+{
+	CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509);
+
+	return 1;
+}
 #endif
 
+//Class CredentialCache
+Singleton<CredentialCache> credentialCache;
+
+CredentialCache::~CredentialCache()
+{
+	flush();
+}
+
+void CredentialCache::free_credential(CachedCredential& cred)
+{
+	if (cred.rsa) {
+		RSA_free(cred.rsa);
+		cred.rsa = NULL;
+	}
+
+	if (cred.cert) {
+		X509_free(cred.cert);
+		cred.cert = NULL;
+	}
+}
+
+void CredentialCache::flush()
+{
+	std::map<std::string, CachedCredential>::iterator it;
+
+	ScopedLock g(lock);
+
+	for (it = credentials.begin(); it != credentials.end(); ++it)
+		free_credential(it->second);
+
+	credentials.clear();
+}
+
+CredentialCache::CachedCredential * CredentialCache::lookup(const std::string& path,
+							    CredentialType type)
+{
+	std::map<std::string, CachedCredential>::iterator it;
+	CachedCredential cred;
+	struct stat st;
+	BIO * store;
+
+	if (stat(path.c_str(), &st) != 0) {
+		LOG_ERR("Problems accessing credentials file at: %s",
+			path.c_str());
+		return NULL;
+	}
+
+	it = credentials.find(path);
+	if (it != credentials.end()) {
+		if (it->second.type == type &&
+				it->second.mtime == st.st_mtime &&
+				it->second.size == st.st_size) {
+			hits++;
+			return &it->second;
+		}
+
+		//Stale (file changed) or read with another type
+		free_credential(it->second);
+		credentials.erase(it);
+	}
+
+	misses++;
+
+	store = BIO_new_file(path.c_str(), "r");
+	if (!store) {
+		LOG_ERR("Problems opening credentials file at: %s",
+			path.c_str());
+		return NULL;
+	}
+
+	cred.type = type;
+	cred.mtime = st.st_mtime;
+	cred.size = st.st_size;
+	cred.rsa = NULL;
+	cred.cert = NULL;
+
+	//TODO fix problems with reading private keys from encrypted repos
+	switch (type) {
+	case RSA_PRIVATE_KEY:
+		cred.rsa = PEM_read_bio_RSAPrivateKey(store, NULL, 0, NULL);
+		break;
+	case RSA_PUBLIC_KEY:
+		cred.rsa = PEM_read_bio_RSA_PUBKEY(store, NULL, 0, NULL);
+		break;
+	case CERTIFICATE:
+		cred.cert = PEM_read_bio_X509(store, NULL, 0, NULL);
+		break;
+	}
+	BIO_free(store);
+
+	if (!cred.rsa && !cred.cert) {
+		LOG_ERR("Problems parsing credentials at %s: %s",
+			path.c_str(),
+			ERR_error_string(ERR_get_error(), NULL));
+		return NULL;
+	}
+
+	return &(credentials[path] = cred);
+}
+
+RSA * CredentialCache::get_rsa_private_key(const std::string& path)
+{
+	CachedCredential * cred;
+
+	ScopedLock g(lock);
+
+	cred = lookup(path, RSA_PRIVATE_KEY);
+	if (!cred)
+		return NULL;
+
+	RSA_up_ref(cred->rsa);
+	return cred->rsa;
+}
+
+RSA * CredentialCache::get_rsa_public_key(const std::string& path)
+{
+	CachedCredential * cred;
+
+	ScopedLock g(lock);
+
+	cred = lookup(path, RSA_PUBLIC_KEY);
+	if (!cred)
+		return NULL;
+
+	RSA_up_ref(cred->rsa);
+	return cred->rsa;
+}
+
+X509 * CredentialCache::get_certificate(const std::string& path)
+{
+	CachedCredential * cred;
+
+	ScopedLock g(lock);
+
+	cred = lookup(path, CERTIFICATE);
+	if (!cred)
+		return NULL;
+
+	X509_up_ref(cred->cert);
+	return cred->cert;
+}
+
+unsigned long CredentialCache::get_hits()
+{
+	ScopedLock g(lock);
+	return hits;
+}
+
+unsigned long CredentialCache::get_misses()
+{
+	ScopedLock g(lock);
+	return misses;
+}
+
+//Class DHKeyPool
+const unsigned int DHKeyPool::DEFAULT_SIZE = 8;
+
+static void * dh_key_pool_refill(void * arg)
+{
+	DHKeyPool * pool = (DHKeyPool *) arg;
+
+	pool->refill();
+
+	return (void *) 0;
+}
+
+DHKeyPool::DHKeyPool()
+{
+	params = NULL;
+	size = DEFAULT_SIZE;
+	stop = false;
+	refill_thread = NULL;
+	hits = 0;
+	misses = 0;
+}
+
+DHKeyPool::~DHKeyPool()
+{
+	std::list<DH *>::iterator it;
+
+	stop_refill();
+
+	for (it = keys.begin(); it != keys.end(); ++it)
+		DH_free(*it);
+	keys.clear();
+}
+
+void DHKeyPool::stop_refill()
+{
+	void * status;
+
+	cond.lock();
+	stop = true;
+	cond.broadcast();
+	cond.unlock();
+
+	if (refill_thread) {
+		refill_thread->join(&status);
+		delete refill_thread;
+		refill_thread = NULL;
+	}
+}
+
+void DHKeyPool::set_parameters(DH * dh_params)
+{
+	ScopedLock g(cond);
+	params = dh_params;
+}
+
+void DHKeyPool::set_size(unsigned int pool_size)
+{
+	ScopedLock g(cond);
+
+	size = pool_size;
+	while (keys.size() > size) {
+		DH_free(keys.back());
+		keys.pop_back();
+	}
+	cond.signal();
+}
+
+DH * DHKeyPool::generate()
+{
+	DH * dh_state;
+	const BIGNUM *p, *g;
+
+	if ((dh_state = DH_new()) == NULL) {
+		LOG_ERR("Error initializing Diffie-Hellman state");
+		return NULL;
+	}
+
+	DH_get0_pqg(params, &p, NULL, &g);
+	DH_set0_pqg(dh_state, BN_dup(p), NULL, BN_dup(g));
+
+	// Generate the public and private key pair
+	if (DH_generate_key(dh_state) != 1) {
+		LOG_ERR("Error generating public and private key pair: %s",
+			ERR_error_string(ERR_get_error(), NULL));
+		DH_free(dh_state);
+		return NULL;
+	}
+
+	return dh_state;
+}
+
+DH * DHKeyPool::get()
+{
+	DH * dh_state = NULL;
+
+	cond.lock();
+
+	if (!params) {
+		cond.unlock();
+		LOG_ERR("Diffie-Hellman parameters not yet initialized");
+		return NULL;
+	}
+
+	if (keys.size() > 0) {
+		dh_state = keys.front();
+		keys.pop_front();
+		hits++;
+	} else {
+		misses++;
+	}
+
+	//Start refilling on first use, so that processes that never
+	//authenticate with this policy do not pay for it
+	if (!refill_thread && size > 0 && !stop) {
+		try {
+			refill_thread = new Thread(&dh_key_pool_refill,
+						   (void *) this,
+						   std::string("dh-key-pool"),
+						   false);
+			refill_thread->start();
+		} catch (Exception &e) {
+			LOG_ERR("Problems starting DH key pool thread: %s",
+				e.what());
+			delete refill_thread;
+			refill_thread = NULL;
+		}
+	}
+
+	cond.signal();
+	cond.unlock();
+
+	if (!dh_state)
+		dh_state = generate();
+
+	return dh_state;
+}
+
+void DHKeyPool::refill()
+{
+	DH * dh_state;
+
+	cond.lock();
+	while (!stop) {
+		if (keys.size() >= size || !params) {
+			cond.doWait();
+			continue;
+		}
+
+		//Generate without holding the lock, it takes a while
+		cond.unlock();
+		dh_state = generate();
+		cond.lock();
+
+		if (!dh_state)
+			break;
+
+		if (stop || keys.size() >= size)
+			DH_free(dh_state);
+		else
+			keys.push_back(dh_state);
+	}
+	cond.unlock();
+}
+
+unsigned long DHKeyPool::get_hits()
+{
+	ScopedLock g(cond);
+	return hits;
+}
+
+unsigned long DHKeyPool::get_misses()
+{
+	ScopedLock g(cond);
+	return misses;
+}
+
+//Class SessionCache
+const unsigned int SessionCache::DEFAULT_LIFETIME = 3600;
+const unsigned int SessionCache::MAX_SESSIONS = 1024;
+Singleton<SessionCache> sessionCache;
+
+void SessionCache::purge(time_t now)
+{
+	std::map<std::string, CachedSession>::iterator it;
+
+	it = sessions.begin();
+	while (it != sessions.end()) {
+		if (it->second.expires <= now)
+			sessions.erase(it++);
+		else
+			++it;
+	}
+}
+
+void SessionCache::store(const std::string& key,
+			 const UcharArray& session_id,
+			 const UcharArray& secret,
+			 const std::string& peer,
+			 const std::string& params,
+			 unsigned int lifetime)
+{
+	CachedSession session;
+	time_t now = time(NULL);
+
+	if (lifetime == 0 || session_id.length <= 0 || secret.length <= 0)
+		return;
+
+	session.session_id.assign((const char *) session_id.data,
+				  session_id.length);
+	session.secret.assign((const char *) secret.data, secret.length);
+	session.peer = peer;
+	session.params = params;
+	session.expires = now + lifetime;
+
+	ScopedLock g(lock);
+
+	if (sessions.size() >= MAX_SESSIONS &&
+			sessions.find(key) == sessions.end()) {
+		purge(now);
+		if (sessions.size() >= MAX_SESSIONS) {
+			LOG_WARN("Session cache full, not storing session %s",
+				 key.c_str());
+			return;
+		}
+	}
+
+	sessions[key] = session;
+}
+
+int SessionCache::take(const std::string& key,
+		       UcharArray& session_id,
+		       UcharArray& secret,
+		       std::string& peer,
+		       std::string& params)
+{
+	std::map<std::string, CachedSession>::iterator it;
+
+	ScopedLock g(lock);
+
+	it = sessions.find(key);
+	if (it == sessions.end()) {
+		misses++;
+		return -1;
+	}
+
+	if (it->second.expires <= time(NULL)) {
+		sessions.erase(it);
+		misses++;
+		return -1;
+	}
+
+	if (session_id.data)
+		delete[] session_id.data;
+	session_id.length = it->second.session_id.size();
+	session_id.data = new unsigned char[session_id.length];
+	memcpy(session_id.data, it->second.session_id.data(),
+	       session_id.length);
+
+	if (secret.data)
+		delete[] secret.data;
+	secret.length = it->second.secret.size();
+	secret.data = new unsigned char[secret.length];
+	memcpy(secret.data, it->second.secret.data(), secret.length);
+
+	peer = it->second.peer;
+	params = it->second.params;
+
+	sessions.erase(it);
+	hits++;
+
+	return 0;
+}
+
+void SessionCache::flush()
+{
+	ScopedLock g(lock);
+	sessions.clear();
+}
+
+unsigned long SessionCache::get_hits()
+{
+	ScopedLock g(lock);
+	return hits;
+}
+
+unsigned long SessionCache::get_misses()
+{
+	ScopedLock g(lock);
+	return misses;
+}
+
 //Class AuthSSH2
 const int AuthSSH2PolicySet::DEFAULT_TIMEOUT = 10000;
 const std::string AuthSSH2PolicySet::EDH_EXCHANGE = "Ephemeral Diffie-Hellman exchange";
@@ -900,6 +1360,7 @@ const int AuthSSH2PolicySet::MIN_RSA_KEY_PAIR_LENGTH = 256;
 const std::string AuthSSH2PolicySet::CLIENT_CHALLENGE = "Client challenge";
 const std::string AuthSSH2PolicySet::CLIENT_CHALLENGE_REPLY = "Client challenge reply and server challenge";
 const std::string AuthSSH2PolicySet::SERVER_CHALLENGE_REPLY = "Server challenge reply";
+const std::string AuthSSH2PolicySet::DH_KEY_POOL_SIZE = "dhKeyPoolSize";
 
 AuthSSH2PolicySet::AuthSSH2PolicySet(rib::RIBDaemonProxy * ribd, ISecurityManager * sm) :
 		IAuthPolicySet(IAuthPolicySet::AUTH_SSH2)
@@ -914,10 +1375,13 @@ AuthSSH2PolicySet::AuthSSH2PolicySet(rib::RIBDaemonProxy * ribd, ISecurityManage
 	if (!dh_parameters) {
 		LOG_ERR("Error initializing DH parameters");
 	}
+	dh_key_pool.set_parameters(dh_parameters);
 }
 
 AuthSSH2PolicySet::~AuthSSH2PolicySet()
 {
+	dh_key_pool.stop_refill();
+
 	if (dh_parameters) {
 		DH_free(dh_parameters);
 		dh_parameters = NULL;
@@ -1077,55 +1541,34 @@ cdap_rib::auth_policy_t AuthSSH2PolicySet::get_auth_policy(int session_id,
 
 int AuthSSH2PolicySet::load_authentication_keys(SSH2SecurityContext * sc)
 {
-	BIO * keystore;
 	std::stringstream ss;
 
+	//Keys are parsed once per process and shared between contexts
 	ss << sc->keystore_path << "/" << SSH2SecurityContext::KEY;
-	keystore =  BIO_new_file(ss.str().c_str(), "r");
-	if (!keystore) {
-		LOG_ERR("Problems opening keystore file at: %s",
-			ss.str().c_str());
-		return -1;
-	}
-
-	//TODO fix problems with reading private keys from encrypted repos
-	//we should use sc->keystore_pass.c_str() as the last argument
-	sc->auth_keypair = PEM_read_bio_RSAPrivateKey(keystore, NULL, 0, NULL);
+	sc->auth_keypair = credentialCache->get_rsa_private_key(ss.str());
 	ss.str(std::string());
 	ss.clear();
-	BIO_free(keystore);
 
 	if (!sc->auth_keypair) {
-		LOG_ERR("Problems reading RSA key pair from keystore: %s",
-			ERR_error_string(ERR_get_error(), NULL));
+		LOG_ERR("Problems reading RSA key pair from keystore");
 		return -1;
 	}
 
 	//Read peer public key from keystore
 	ss << sc->keystore_path << "/" << sc->peer_ap_name;
-	keystore =  BIO_new_file(ss.str().c_str(), "r");
-	if (!keystore) {
-		LOG_ERR("Problems opening keystore file at: %s",
-			ss.str().c_str());
-		return -1;
-	}
-
-	//TODO fix problems with reading private keys from encrypted repos
-	//we should use sc->keystore_pass.c_str() as the last argument
-	sc->auth_peer_pub_key = PEM_read_bio_RSA_PUBKEY(keystore, NULL, 0, NULL);
-	BIO_free(keystore);
+	sc->auth_peer_pub_key = credentialCache->get_rsa_public_key(ss.str());
 
 	if (!sc->auth_peer_pub_key) {
-		LOG_ERR("Problems reading RSA public key from keystore: %s",
-			ERR_error_string(ERR_get_error(), NULL));
+		LOG_ERR("Problems reading RSA public key from keystore");
 		return -1;
 	}
 
 	int rsa_size = RSA_size(sc->auth_keypair);
 	if (rsa_size < MIN_RSA_KEY_PAIR_LENGTH) {
 		LOG_ERR("RSA keypair size is too low. Minimum: %d, actual: %d",
-				MIN_RSA_KEY_PAIR_LENGTH, sc->challenge.length);
+				MIN_RSA_KEY_PAIR_LENGTH, rsa_size);
 		RSA_free(sc->auth_keypair);
+		sc->auth_keypair = NULL;
 		return -1;
 	}
 
@@ -1140,30 +1583,11 @@ int AuthSSH2PolicySet::load_authentication_keys(SSH2SecurityContext * sc)
 int AuthSSH2PolicySet::edh_init_keys(SSH2SecurityContext * sc)
 {
 	DH *dh_state;
-	const BIGNUM *p, *g;
-
-	// Init own parameters
-	if (!dh_parameters) {
-		LOG_ERR("Diffie-Hellman parameters not yet initialized");
-		return -1;
-	}
 
-	if ((dh_state = DH_new()) == NULL) {
-		LOG_ERR("Error initializing Diffie-Hellman state");
+	// Take a precomputed key pair for our P and G (or generate one)
+	dh_state = dh_key_pool.get();
+	if (!dh_state)
 		return -1;
-	}
-
-	// Set P and G (re-use defaults or use the ones sent by the peer)
-	DH_get0_pqg(dh_parameters, &p, NULL, &g);
-	DH_set0_pqg(dh_state, BN_dup(p), NULL, BN_dup(g));
-
-	// Generate the public and private key pair
-	if (DH_generate_key(dh_state) != 1) {
-		LOG_ERR("Error generating public and private key pair: %s",
-			ERR_error_string(ERR_get_error(), NULL));
-		DH_free(dh_state);
-		return -1;
-	}
 
 	sc->dh_state = dh_state;
 
@@ -1880,6 +2304,20 @@ int AuthSSH2PolicySet::process_server_challenge_reply_message(const cdap::CDAPMe
 int AuthSSH2PolicySet::set_policy_set_param(const std::string& name,
                          	 	      const std::string& value)
 {
+	if (name == DH_KEY_POOL_SIZE) {
+		std::stringstream ss(value);
+		unsigned int size;
+
+		if (!(ss >> size)) {
+			LOG_ERR("Invalid value for %s: %s",
+				name.c_str(), value.c_str());
+			return -1;
+		}
+
+		dh_key_pool.set_size(size);
+		return 0;
+	}
+
         LOG_DBG("No policy-set-specific parameters to set (%s, %s)",
                         name.c_str(), value.c_str());
         return -1;
@@ -72,6 +72,15 @@ void decode_tls_hand_auth_options(const ser_obj_t &message,
 		       gpb_options.random_bytes().size());
 		options.random.random_bytes.length = gpb_options.random_bytes().size();
 	}
+
+	if (gpb_options.has_session_id()) {
+		options.session_id.data =
+				new unsigned char[gpb_options.session_id().size()];
+		memcpy(options.session_id.data,
+		       gpb_options.session_id().data(),
+		       gpb_options.session_id().size());
+		options.session_id.length = gpb_options.session_id().size();
+	}
 }
 
 void encode_tls_hand_auth_options(const TLSHandAuthOptions& options,
@@ -100,6 +109,11 @@ void encode_tls_hand_auth_options(const TLSHandAuthOptions& options,
 					     options.random.random_bytes.length);
 	}
 
+	if (options.session_id.length > 0) {
+		gpb_options.set_session_id(options.session_id.data,
+					   options.session_id.length);
+	}
+
 	int size = gpb_options.ByteSize();
 	result.message_ = new unsigned char[size];
 	result.size_ = size;
@@ -110,6 +124,7 @@ void encode_server_hello_tls_hand(const TLSHandRandom& random,
 				  const std::string& mac_alg,
 				  const std::string& compress_method,
 				  const std::string& version,
+				  const UcharArray& session_id,
 				  ser_obj_t& result)
 {
 	rina::auth::policies::googleprotobuf::serverHelloTLSHandshake_t gpb_hello;
@@ -120,6 +135,10 @@ void encode_server_hello_tls_hand(const TLSHandRandom& random,
 	gpb_hello.set_version(version);
 	gpb_hello.set_mac_alg(mac_alg);
 	gpb_hello.set_compress_method(compress_method);
+	if (session_id.length > 0) {
+		gpb_hello.set_session_id(session_id.data,
+					 session_id.length);
+	}
 
 	int size = gpb_hello.ByteSize();
 	result.message_ = new unsigned char[size];
@@ -131,7 +150,8 @@ void decode_server_hello_tls_hand(const ser_obj_t &message,
 				  TLSHandRandom& random,
 				  std::string& mac_alg,
 				  std::string& compress_method,
-				  std::string& version)
+				  std::string& version,
+				  UcharArray& session_id)
 {
 	rina::auth::policies::googleprotobuf::serverHelloTLSHandshake_t gpb_hello;
 
@@ -151,6 +171,15 @@ void decode_server_hello_tls_hand(const ser_obj_t &message,
 	version = gpb_hello.version();
 	mac_alg = gpb_hello.mac_alg();
 	compress_method = gpb_hello.compress_method();
+
+	if (gpb_hello.has_session_id()) {
+		session_id.data =
+				new unsigned char[gpb_hello.session_id().size()];
+		memcpy(session_id.data,
+		       gpb_hello.session_id().data(),
+		       gpb_hello.session_id().size());
+		session_id.length = gpb_hello.session_id().size();
+	}
 }
 
 //Certificates
@@ -343,6 +372,7 @@ TLSHandSecurityContext::TLSHandSecurityContext(int session_id):
 	client_keys_received = false;
 	client_cert_verify_received = false;
 	client_cipher_received = false;
+	resumed = false;
 	master_secret.length = 48;
 	master_secret.data = new unsigned char[48];
 	verify_data.length = 12;
@@ -381,6 +411,7 @@ TLSHandSecurityContext::TLSHandSecurityContext(int session_id,
 	client_keys_received = false;
 	client_cert_verify_received = false;
 	client_cipher_received = false;
+	resumed = false;
 	master_secret.length = 48;
 	master_secret.data = new unsigned char[48];
 	verify_data.length = 12;
@@ -442,6 +473,7 @@ TLSHandSecurityContext::TLSHandSecurityContext(int session_id,
 	client_keys_received = false;
 	client_cert_verify_received = false;
 	client_cipher_received = false;
+	resumed = false;
 	master_secret.length = 48;
 	master_secret.data = new unsigned char[48];
 	verify_data.length = 12;
@@ -461,6 +493,8 @@ const std::string AuthTLSHandPolicySet::CLIENT_CHANGE_CIPHER_SPEC = "Client chan
 const std::string AuthTLSHandPolicySet::SERVER_CHANGE_CIPHER_SPEC = "Server change cipher spec";
 const std::string AuthTLSHandPolicySet::CLIENT_FINISH = "Client finish";
 const std::string AuthTLSHandPolicySet::SERVER_FINISH = "Server finish";
+const std::string AuthTLSHandPolicySet::SESSION_LIFETIME = "sessionLifetime";
+const int AuthTLSHandPolicySet::SESSION_ID_LENGTH = 32;
 
 AuthTLSHandPolicySet::AuthTLSHandPolicySet(rib::RIBDaemonProxy * ribd,
 		ISecurityManager * sm) :
@@ -469,6 +503,7 @@ AuthTLSHandPolicySet::AuthTLSHandPolicySet(rib::RIBDaemonProxy * ribd,
 	rib_daemon = ribd;
 	sec_man = sm;
 	timeout = DEFAULT_TIMEOUT;
+	session_lifetime = SessionCache::DEFAULT_LIFETIME;
 }
 
 AuthTLSHandPolicySet::~AuthTLSHandPolicySet()
@@ -479,8 +514,6 @@ cdap_rib::auth_policy_t AuthTLSHandPolicySet::get_auth_policy(int session_id,
 							      const cdap_rib::ep_info_t& peer_ap,
 							      const AuthSDUProtectionProfile& profile)
 {
-	(void) peer_ap;
-
 	if (profile.authPolicy.name_ != type) {
 		LOG_ERR("Wrong policy name: %s, expected: %s",
 				profile.authPolicy.name_.c_str(),
@@ -503,6 +536,7 @@ cdap_rib::auth_policy_t AuthTLSHandPolicySet::get_auth_policy(int session_id,
 
 	TLSHandSecurityContext * sc = new TLSHandSecurityContext(session_id,
 			profile);
+	sc->peer_name = peer_ap.ap_name_ + "-" + peer_ap.ap_inst_;
 	sc->client_random.utc_unix_time = (unsigned int) time(NULL);
 	sc->client_random.random_bytes.data = new unsigned char[28];
 	sc->client_random.random_bytes.length = 28;
@@ -520,6 +554,11 @@ cdap_rib::auth_policy_t AuthTLSHandPolicySet::get_auth_policy(int session_id,
 	options.random = sc->client_random;
 	options.encrypt_algs.push_back(sc->encrypt_alg);
 
+	//Offer to resume the last session with this peer, if still cached
+	if (resume_client_session(sc) == 0) {
+		options.session_id = sc->session_id;
+	}
+
 	encode_tls_hand_auth_options(options, auth_policy.options);
 
 	//Store security context
@@ -529,8 +568,6 @@ cdap_rib::auth_policy_t AuthTLSHandPolicySet::get_auth_policy(int session_id,
 	//Initialized verify hash, used in certificate verify message
 	sc->verify_hash.length = 160;
 	sc->verify_hash.data = new unsigned char[160];
-	sc->master_secret.length = 48;
-	sc->master_secret.data = new unsigned char[48];
 
 	//Get auth policy options to obtain first hash message [0,--31]
 	unsigned char hash1[SHA256_DIGEST_LENGTH];
@@ -556,8 +593,6 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::initiate_authentication(const c
 									 const cdap_rib::ep_info_t& peer_ap,
 									 int session_id)
 {
-	(void) peer_ap;
-
 	if (auth_policy.name != type) {
 		LOG_ERR("Wrong policy name: %s", auth_policy.name.c_str());
 		return IAuthPolicySet::FAILED;
@@ -586,12 +621,11 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::initiate_authentication(const c
 	} catch (Exception &e){
 		return IAuthPolicySet::FAILED;
 	}
+	sc->peer_name = peer_ap.ap_name_ + "-" + peer_ap.ap_inst_;
 
 	//Initialized verify hash, used in certificate verify message
 	sc->verify_hash.length = 160;
 	sc->verify_hash.data = new unsigned char[160];
-	sc->master_secret.length = 48;
-	sc->master_secret.data = new unsigned char[48];
 
 	//Get auth policy options to obtain first hash message [0,--31]
 	unsigned char hash1[SHA256_DIGEST_LENGTH];
@@ -618,6 +652,23 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::initiate_authentication(const c
 		return IAuthPolicySet::FAILED;
 	}
 
+	//Resume the session the client offers if it is still cached,
+	//otherwise give the new one an id so that it can be resumed later
+	if (options.session_id.length > 0 &&
+			resume_server_session(sc, options.session_id) == 0) {
+		sc->resumed = true;
+	} else if (session_lifetime > 0) {
+		sc->session_id.data = new unsigned char[SESSION_ID_LENGTH];
+		sc->session_id.length = SESSION_ID_LENGTH;
+		if (RAND_bytes(sc->session_id.data,
+				sc->session_id.length) == 0) {
+			LOG_ERR("Problems generating session id: %s",
+				ERR_error_string(ERR_get_error(), NULL));
+			delete sc;
+			return IAuthPolicySet::FAILED;
+		}
+	}
+
 	//Send Server Hello
 	cdap_rib::obj_info_t obj_info;
 	try {
@@ -633,6 +684,7 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::initiate_authentication(const c
 					     sc->mac_alg,
 					     sc->compress_method,
 					     RINA_DEFAULT_POLICY_VERSION,
+					     sc->session_id,
 					     obj_info.value_);
 
 		rib_daemon->remote_write(sc->con,
@@ -658,6 +710,26 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::initiate_authentication(const c
 	//prepare verify_hash vector for posterior signing
 	memcpy(sc->verify_hash.data+32, hash2, 32);
 
+	//Abbreviated handshake: no certificates nor key exchange, the keys
+	//are derived from the cached master secret and the new randoms
+	if (sc->resumed) {
+		memset(sc->verify_hash.data+64, 0, 96);
+
+		if (generate_encryption_keys(sc, false)) {
+			LOG_ERR("Error generating key material from master secret");
+			delete sc;
+			return IAuthPolicySet::FAILED;
+		}
+
+		sc->state = TLSHandSecurityContext::WAIT_CLIENT_CIPHER;
+		sec_man->add_security_context(sc);
+
+		sc->timer_task = new CancelAuthTimerTask(sec_man, session_id);
+		timer.scheduleTask(sc->timer_task, timeout);
+
+		return IAuthPolicySet::IN_PROGRESS;
+	}
+
 	if (load_credentials(sc)) {
 		LOG_ERR("Error loading credentials");
 		delete sc;
@@ -764,46 +836,25 @@ int AuthTLSHandPolicySet::process_incoming_message(const cdap::CDAPMessage& mess
 
 int AuthTLSHandPolicySet::load_credentials(TLSHandSecurityContext * sc)
 {
-	BIO * store;
 	std::stringstream ss;
 
+	//Credentials are parsed once per process and shared between contexts
 	ss << sc->keystore_path.c_str() << "/"
 	   << TLSHandSecurityContext::MY_CERTIFICATE;
 
-	store =  BIO_new_file(ss.str().c_str(),  "r");
-	if (!store) {
-		LOG_ERR("Problems opening certificate file at: %s",
-			ss.str().c_str());
-		return -1;
-	}
-
-	sc->cert = PEM_read_bio_X509(store, NULL, 0, NULL);
+	sc->cert = credentialCache->get_certificate(ss.str());
 	ss.str(std::string());
 	ss.clear();
-	BIO_free(store);
 	if (!sc->cert) {
-		LOG_ERR("Problems reading certificate %s",
-			ERR_error_string(ERR_get_error(), NULL));
+		LOG_ERR("Problems reading certificate");
 		return -1;
-
 	}
 
 	ss << sc->keystore_path << "/" << TLSHandSecurityContext::PRIV_KEY_PATH;
-	store =  BIO_new_file(ss.str().c_str(), "r");
-	if (!store) {
-		LOG_ERR("Problems opening keystore file at: %s",
-			ss.str().c_str());
-		return -1;
-	}
-
-	//TODO fix problems with reading private keys from encrypted repos
-	//we should use sc->keystore_pass.c_str() as the last argument
-	sc->key = PEM_read_bio_RSAPrivateKey(store, NULL, 0, NULL);
-	BIO_free(store);
+	sc->key = credentialCache->get_rsa_private_key(ss.str());
 
 	if (!sc->key) {
-		LOG_ERR("Problems reading RSA key pair from keystore: %s",
-				ERR_error_string(ERR_get_error(), NULL));
+		LOG_ERR("Problems reading RSA key pair from keystore");
 		return -1;
 	}
 
@@ -919,11 +970,13 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::process_server_hello_message(co
 	}
 	sc->hello_received = true;
 
+	UcharArray hello_session_id;
 	decode_server_hello_tls_hand(message.obj_value_,
 				     sc->server_random,
 				     sc->mac_alg,
 				     sc->compress_method,
-				     sc->version);
+				     sc->version,
+				     hello_session_id);
 
 	//Get obj.info_value options to obtain third hash message [0,--31]
 	unsigned char hash2[SHA256_DIGEST_LENGTH];
@@ -938,6 +991,35 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::process_server_hello_message(co
 	//prepare verify_hash vector for posterior signing
 	memcpy(sc->verify_hash.data+32, hash2, 32);
 
+	//The server resumes the session offered by returning the same id
+	if (sc->session_id.length > 0 && hello_session_id == sc->session_id) {
+		LOG_DBG("Resuming session with %s", sc->peer_name.c_str());
+		sc->resumed = true;
+		memset(sc->verify_hash.data+64, 0, 96);
+
+		if (generate_encryption_keys(sc, true)) {
+			LOG_ERR("Error generating key material from master secret");
+			sec_man->destroy_security_context(sc->id);
+			return IAuthPolicySet::FAILED;
+		}
+
+		AuthStatus result = send_client_change_cipher_spec(sc);
+		if (result != IAuthPolicySet::IN_PROGRESS)
+			return result;
+
+		sc->state = TLSHandSecurityContext::WAIT_SERVER_CIPHER;
+
+		sc->timer_task = new CancelAuthTimerTask(sec_man, session_id);
+		timer.scheduleTask(sc->timer_task, timeout);
+
+		return IAuthPolicySet::IN_PROGRESS;
+	}
+
+	//Full handshake, keep the new id to resume the session later
+	if (sc->session_id.data)
+		delete[] sc->session_id.data;
+	sc->session_id = hello_session_id;
+
 	//if certificate received change state
 	if (sc->cert_received) {
 		sc->state = TLSHandSecurityContext::CLIENT_SENDING_DATA;
@@ -1272,13 +1354,14 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::process_client_change_cipher_sp
 
 	ScopedLock sc_lock(lock);
 
-	if (sc->state != TLSHandSecurityContext::WAIT_CLIENT_CERTIFICATE_and_KEYS) {
+	if (sc->state != TLSHandSecurityContext::WAIT_CLIENT_CERTIFICATE_and_KEYS &&
+			sc->state != TLSHandSecurityContext::WAIT_CLIENT_CIPHER) {
 		LOG_ERR("Wrong session state: %d", sc->state);
 		sec_man->destroy_security_context(sc->id);
 		return IAuthPolicySet::FAILED;
 	}
 
-	if(!sc->client_keys_received or !sc->client_cert_received or !sc->client_cert_verify_received){
+	if(!sc->resumed and (!sc->client_keys_received or !sc->client_cert_received or !sc->client_cert_verify_received)){
 		LOG_ERR("Not enough messages received to proceed...");
 		sec_man->destroy_security_context(sc->id);
 		return IAuthPolicySet::FAILED;
@@ -1439,6 +1522,7 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::process_server_finish_message(c
 	}
 
 	sc->state = TLSHandSecurityContext::DONE;
+	cache_session(sc, true);
 
 	return IAuthPolicySet::SUCCESSFULL;
 }
@@ -1767,9 +1851,118 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::send_client_finish(TLSHandSecur
 	return IAuthPolicySet::IN_PROGRESS;
 }
 
+static std::string client_session_key(const std::string& peer_name)
+{
+	return "client/" + peer_name;
+}
+
+static std::string server_session_key(UcharArray& session_id)
+{
+	return "server/" + session_id.toString();
+}
+
+std::string AuthTLSHandPolicySet::session_params(TLSHandSecurityContext * sc)
+{
+	return sc->mac_alg + "/" + sc->encrypt_alg + "/" +
+		sc->compress_method + "/" + sc->keystore_path;
+}
+
+int AuthTLSHandPolicySet::resume_client_session(TLSHandSecurityContext * sc)
+{
+	UcharArray session_id, secret;
+	std::string peer, params;
+
+	if (session_lifetime == 0)
+		return -1;
+
+	if (sessionCache->take(client_session_key(sc->peer_name),
+			       session_id, secret, peer, params))
+		return -1;
+
+	//The configuration may have changed since the session was cached
+	if (params != session_params(sc) ||
+			secret.length != sc->master_secret.length) {
+		LOG_DBG("Cached session with %s no longer valid",
+			sc->peer_name.c_str());
+		return -1;
+	}
+
+	memcpy(sc->master_secret.data, secret.data, secret.length);
+	sc->session_id = session_id;
+
+	return 0;
+}
+
+int AuthTLSHandPolicySet::resume_server_session(TLSHandSecurityContext * sc,
+						UcharArray& session_id)
+{
+	UcharArray cached_id, secret;
+	std::string peer, params;
+
+	if (session_lifetime == 0)
+		return -1;
+
+	if (sessionCache->take(server_session_key(session_id),
+			       cached_id, secret, peer, params)) {
+		LOG_DBG("Unknown or expired session %s, full handshake",
+			session_id.toString().c_str());
+		return -1;
+	}
+
+	//The session can only be resumed by the peer that established it
+	if (peer != sc->peer_name || params != session_params(sc) ||
+			secret.length != sc->master_secret.length) {
+		LOG_WARN("Session %s offered by %s cannot be resumed",
+			 session_id.toString().c_str(),
+			 sc->peer_name.c_str());
+		return -1;
+	}
+
+	memcpy(sc->master_secret.data, secret.data, secret.length);
+	sc->session_id = session_id;
+	LOG_DBG("Resuming session with %s", sc->peer_name.c_str());
+
+	return 0;
+}
+
+void AuthTLSHandPolicySet::cache_session(TLSHandSecurityContext * sc,
+					 bool client)
+{
+	std::string key;
+
+	if (session_lifetime == 0 || sc->session_id.length == 0)
+		return;
+
+	if (client)
+		key = client_session_key(sc->peer_name);
+	else
+		key = server_session_key(sc->session_id);
+
+	sessionCache->store(key,
+			    sc->session_id,
+			    sc->master_secret,
+			    sc->peer_name,
+			    session_params(sc),
+			    session_lifetime);
+}
+
 int AuthTLSHandPolicySet::set_policy_set_param(const std::string& name,
 		const std::string& value)
 {
+	if (name == SESSION_LIFETIME) {
+		std::stringstream ss(value);
+		unsigned int lifetime;
+
+		if (!(ss >> lifetime)) {
+			LOG_ERR("Invalid value for %s: %s",
+				name.c_str(), value.c_str());
+			return -1;
+		}
+
+		session_lifetime = lifetime;
+		return 0;
+	}
+
 	LOG_DBG("No policy-set-specific parameters to set (%s, %s)",
 		name.c_str(),
 		value.c_str());
@@ -1945,6 +2138,7 @@ IAuthPolicySet::AuthStatus AuthTLSHandPolicySet::encryption_enabled_server(TLSHa
 	}
 
 	sc->state = TLSHandSecurityContext::DONE;
+	cache_session(sc, false);
 
 	return IAuthPolicySet::SUCCESSFULL;
 }
@@ -0,0 +1,121 @@
+//
+// DIF configuration encoding test
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+// MA  02110-1301  USA
+//
+
+#include <iostream>
+#include <vector>
+
+#include "librina/configuration.h"
+#include "irati/serdes-utils.h"
+
+using namespace rina;
+
+static std::vector<char> serialize(struct dif_config * dc)
+{
+	std::vector<char> result(dif_config_serlen(dc));
+	void * ptr = &result[0];
+
+	serialize_dif_config(&ptr, dc);
+	dif_config_free(dc);
+
+	return result;
+}
+
+static void fill_dif_config(DIFConfiguration& dif_config)
+{
+	DataTransferConstants dtc;
+	QoSCube * cube;
+	StaticIPCProcessAddress static_address;
+
+	dtc.address_length_ = 2;
+	dtc.cep_id_length_ = 2;
+	dtc.ctrl_sequence_number_length_ = 4;
+	dtc.frame_length_ = 4;
+	dtc.length_length_ = 2;
+	dtc.max_pdu_lifetime_ = 60000;
+	dtc.max_pdu_size_ = 10000;
+	dtc.port_id_length_ = 2;
+	dtc.qos_id_length_ = 1;
+	dtc.rate_length_ = 4;
+	dtc.sequence_number_length_ = 4;
+	dif_config.efcp_configuration_.set_data_transfer_constants(dtc);
+
+	for (int i = 0; i < 3; i++) {
+		cube = new QoSCube("cube", i + 1);
+		cube->max_allowable_gap_ = i;
+		dif_config.efcp_configuration_.add_qos_cube(cube);
+	}
+
+	for (int i = 0; i < 20; i++) {
+		static_address.ap_name_ = "test.IPCP";
+		static_address.ap_instance_ = "1";
+		static_address.address_ = i + 1;
+		dif_config.nsm_configuration_.addressing_configuration_
+			.static_address_.push_back(static_address);
+	}
+
+	dif_config.rmt_configuration_.policy_set_.name_ = "default";
+	dif_config.routing_configuration_.policy_set_.name_ = "link-state";
+	dif_config.add_parameter(PolicyParameter("interface-name", "eth0"));
+}
+
+//Serialize dc, decode it back and check that the decoded copy
+//serializes to the same bytes
+static int check_round_trip(struct dif_config * dc, unsigned int address)
+{
+	std::vector<char> encoded, decoded;
+	struct dif_config * copy = 0;
+	const void * ptr;
+
+	encoded = serialize(dc);
+	ptr = &encoded[0];
+	if (deserialize_dif_config(&ptr, &copy) || !copy ||
+			copy->address != address) {
+		std::cout << "Problems decoding DIF configuration\n";
+		dif_config_free(copy);
+		return -1;
+	}
+
+	decoded = serialize(copy);
+	if (encoded != decoded) {
+		std::cout << "Decoded DIF configuration differs\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+int main()
+{
+	DIFConfiguration dif_config;
+
+	std::cout << "TESTING DIF CONFIGURATION ENCODING\n";
+
+	//A configuration without parameters
+	dif_config.set_address(1);
+	if (check_round_trip(dif_config.to_c_dif_config(), 1))
+		return -1;
+
+	fill_dif_config(dif_config);
+	dif_config.set_address(17);
+	if (check_round_trip(dif_config.to_c_dif_config(), 17))
+		return -1;
+
+	std::cout << "DIF configuration encoding tests passed\n";
+	return 0;
+}
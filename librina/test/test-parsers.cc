@@ -881,10 +881,12 @@ int test_irati_kmsg_ipcm_query_rib()
 	unsigned int serlen;
 	unsigned int expected_serlen;
 	std::string f_before, f_after, oc_before, oc_after, on_before, on_after;
+	std::string c_before, c_after;
 
 	std::cout << "TESTING KMSG IPCM QUERY RIB" << std::endl;
 
 	f_before = "test filter";
+	c_before = "/dif/management/flow-allocator";
 	on_before = "/dif/naming/address";
 	oc_before = "o_class";
 
@@ -892,9 +894,11 @@ int test_irati_kmsg_ipcm_query_rib()
 	msg->msg_type = RINA_C_IPCM_QUERY_RIB_REQUEST;
 	msg->object_instance = 23;
 	msg->scope = 4;
+	msg->page_size = 128;
 	msg->filter = stringToCharArray(f_before);
 	msg->object_name = stringToCharArray(on_before);
 	msg->object_class = stringToCharArray(oc_before);
+	msg->cursor = stringToCharArray(c_before);
 
 	expected_serlen = irati_msg_serlen(irati_ker_numtables, RINA_C_MAX,
 			     	     	   (irati_msg_base *) msg);
@@ -929,6 +933,7 @@ int test_irati_kmsg_ipcm_query_rib()
 	f_after = resp->filter;
 	on_after = resp->object_name;
 	oc_after = resp->object_class;
+	c_after = resp->cursor;
 
 	if (f_before != f_after) {
 		std::cout << "Filter on original and recovered messages"
@@ -950,6 +955,14 @@ int test_irati_kmsg_ipcm_query_rib()
 		std::cout << "Scope on original and recovered "
 				<< "messages are different\n";
 		ret = -1;
+	} else if (msg->page_size != resp->page_size) {
+		std::cout << "Page size on original and recovered "
+				<< "messages are different\n";
+		ret = -1;
+	} else if (c_before != c_after) {
+		std::cout << "Cursor on original and recovered "
+				<< "messages are different\n";
+		ret = -1;
 	} else {
 		std::cout << "Test ok!" << std::endl;
 		ret = 0;
@@ -976,6 +989,7 @@ int test_irati_kmsg_ipcm_query_rib_resp()
 	msg = new irati_kmsg_ipcm_query_rib_resp();
 	msg->msg_type = RINA_C_IPCM_QUERY_RIB_RESPONSE;
 	msg->result = 14;
+	msg->more = 1;
 	msg->rib_entries = query_rib_resp_create();
 	rodata = rib_object_data_create();
 	rodata->instance = 25;
@@ -1023,6 +1037,10 @@ int test_irati_kmsg_ipcm_query_rib_resp()
 		std::cout << "Filter on original and recovered messages"
 			   << " are different\n";
 		ret = -1;
+	} else if (msg->more != resp->more) {
+		std::cout << "More flag on original and recovered "
+				<< "messages are different\n";
+		ret = -1;
 	} else if (num_entries != 1) {
 		std::cout << "Number of RIB entries on original and recovered "
 				<< "messages are different\n";
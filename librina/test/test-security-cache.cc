@@ -0,0 +1,364 @@
+//
+// Credential cache, DH key pool and session cache test
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+// MA  02110-1301  USA
+//
+
+#include <iostream>
+#include <set>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <utime.h>
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+
+#include "librina/security-manager.h"
+
+// Number of security contexts created in the enrollment storm
+#define STORM_SIZE 200
+
+using namespace rina;
+
+static unsigned long now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_keys(const std::string& priv_path,
+		      const std::string& pub_path)
+{
+	RSA * rsa = RSA_new();
+	BIGNUM * e = BN_new();
+	FILE * f;
+	int ret = -1;
+
+	BN_set_word(e, RSA_F4);
+	if (RSA_generate_key_ex(rsa, 2048, e, NULL) != 1)
+		goto out;
+
+	f = fopen(priv_path.c_str(), "w");
+	if (!f)
+		goto out;
+	PEM_write_RSAPrivateKey(f, rsa, NULL, NULL, 0, NULL, NULL);
+	fclose(f);
+
+	f = fopen(pub_path.c_str(), "w");
+	if (!f)
+		goto out;
+	PEM_write_RSA_PUBKEY(f, rsa);
+	fclose(f);
+	ret = 0;
+
+out:
+	BN_free(e);
+	RSA_free(rsa);
+	return ret;
+}
+
+static RSA * parse_private_key(const std::string& path)
+{
+	BIO * store = BIO_new_file(path.c_str(), "r");
+	RSA * rsa;
+
+	if (!store)
+		return NULL;
+
+	rsa = PEM_read_bio_RSAPrivateKey(store, NULL, 0, NULL);
+	BIO_free(store);
+
+	return rsa;
+}
+
+int test_credential_cache(const std::string& dir)
+{
+	std::string priv_path = dir + "/key";
+	std::string pub_path = dir + "/peer";
+	CredentialCache cache;
+	RSA * a, * b, * c;
+	unsigned long t0, t_parse, t_cache;
+	struct utimbuf times;
+
+	if (write_keys(priv_path, pub_path)) {
+		std::cout << "Problems generating keys" << std::endl;
+		return -1;
+	}
+
+	a = cache.get_rsa_private_key(priv_path);
+	b = cache.get_rsa_private_key(priv_path);
+	if (!a || a != b) {
+		std::cout << "Cache did not return the same parsed key" << std::endl;
+		return -1;
+	}
+
+	//Callers own a reference each, releasing them must not free the
+	//cached key
+	RSA_free(a);
+	RSA_free(b);
+	c = cache.get_rsa_public_key(pub_path);
+	if (!c || RSA_size(c) != 256) {
+		std::cout << "Problems reading public key" << std::endl;
+		return -1;
+	}
+	RSA_free(c);
+
+	if (cache.get_misses() != 2 || cache.get_hits() != 1) {
+		std::cout << "Unexpected hits/misses: " << cache.get_hits()
+			  << "/" << cache.get_misses() << std::endl;
+		return -1;
+	}
+
+	//A modified keystore file must be parsed again
+	times.actime = time(NULL) + 10;
+	times.modtime = times.actime;
+	utime(priv_path.c_str(), &times);
+	a = cache.get_rsa_private_key(priv_path);
+	if (!a || cache.get_misses() != 3) {
+		std::cout << "Modified key file was not parsed again" << std::endl;
+		return -1;
+	}
+	RSA_free(a);
+
+	if (cache.get_rsa_private_key(dir + "/does-not-exist")) {
+		std::cout << "Got a key from a file that does not exist" << std::endl;
+		return -1;
+	}
+
+	//Enrollment storm: each new security context loads the keys
+	t0 = now_us();
+	for (int i = 0; i < STORM_SIZE; i++)
+		RSA_free(parse_private_key(priv_path));
+	t_parse = now_us() - t0;
+
+	t0 = now_us();
+	for (int i = 0; i < STORM_SIZE; i++)
+		RSA_free(cache.get_rsa_private_key(priv_path));
+	t_cache = now_us() - t0;
+
+	std::cout << STORM_SIZE << " key loads: parsing " << t_parse
+		  << " us, cached " << t_cache << " us" << std::endl;
+
+	unlink(priv_path.c_str());
+	unlink(pub_path.c_str());
+
+	return 0;
+}
+
+int test_dh_key_pool()
+{
+	DH * params = DH_new();
+	std::set<DH *> handed_out;
+	std::set<DH *>::iterator it;
+	unsigned long t0, t_cold, t_warm;
+	DH * dh;
+	int ret = -1;
+
+	if (DH_generate_parameters_ex(params, 512, DH_GENERATOR_2, NULL) != 1) {
+		std::cout << "Problems generating DH parameters" << std::endl;
+		DH_free(params);
+		return -1;
+	}
+
+	{
+		DHKeyPool pool;
+
+		if (pool.get()) {
+			std::cout << "Got a key pair without parameters" << std::endl;
+			goto out;
+		}
+
+		pool.set_parameters(params);
+		pool.set_size(STORM_SIZE);
+
+		//First use generates on the spot and starts the refill
+		t0 = now_us();
+		dh = pool.get();
+		t_cold = now_us() - t0;
+		if (!dh)
+			goto out;
+		handed_out.insert(dh);
+
+		//Let the pool fill up
+		sleep(2);
+
+		t0 = now_us();
+		for (int i = 0; i < STORM_SIZE / 2; i++) {
+			dh = pool.get();
+			if (!dh || handed_out.count(dh)) {
+				std::cout << "Key pair handed out twice" << std::endl;
+				goto out;
+			}
+			handed_out.insert(dh);
+		}
+		t_warm = now_us() - t0;
+
+		std::cout << "DH key pairs: cold " << t_cold << " us, "
+			  << STORM_SIZE / 2 << " from pool " << t_warm
+			  << " us (hits " << pool.get_hits() << ", misses "
+			  << pool.get_misses() << ")" << std::endl;
+
+		if (pool.get_hits() == 0) {
+			std::cout << "Pool was never refilled" << std::endl;
+			goto out;
+		}
+
+		ret = 0;
+	}
+
+out:
+	for (it = handed_out.begin(); it != handed_out.end(); ++it)
+		DH_free(*it);
+	DH_free(params);
+	return ret;
+}
+
+static void fill(UcharArray& array, int length, unsigned char value)
+{
+	array.data = new unsigned char[length];
+	array.length = length;
+	memset(array.data, value, length);
+}
+
+int test_session_cache()
+{
+	SessionCache cache;
+	UcharArray id, secret, out_id, out_secret, enc, dec(256), sig(256);
+	std::string peer, params;
+	RSA * rsa = RSA_new();
+	BIGNUM * e = BN_new();
+	unsigned long t0, t_full, t_resumed;
+	int ret = -1;
+
+	fill(id, 32, 0xaa);
+	fill(secret, 48, 0x55);
+
+	cache.store("client/B-1", id, secret, "B-1", "params", 60);
+	if (cache.take("client/B-1", out_id, out_secret, peer, params) ||
+			out_id != id || out_secret != secret ||
+			peer != "B-1" || params != "params") {
+		std::cout << "Stored session not returned" << std::endl;
+		goto out;
+	}
+
+	//A session is used once, it is stored again if resumed
+	if (cache.take("client/B-1", out_id, out_secret, peer, params) == 0) {
+		std::cout << "Session taken twice" << std::endl;
+		goto out;
+	}
+
+	cache.store("client/C-1", id, secret, "C-1", "params", 0);
+	cache.store("client/D-1", id, secret, "D-1", "params", 1);
+	sleep(2);
+	if (cache.take("client/C-1", out_id, out_secret, peer, params) == 0 ||
+			cache.take("client/D-1", out_id, out_secret, peer, params) == 0) {
+		std::cout << "Got a disabled or expired session" << std::endl;
+		goto out;
+	}
+
+	if (cache.get_hits() != 1 || cache.get_misses() != 3) {
+		std::cout << "Unexpected hits/misses: " << cache.get_hits()
+			  << "/" << cache.get_misses() << std::endl;
+		goto out;
+	}
+
+	//Enrollment storm, server side: a full handshake decrypts the
+	//pre-master secret and checks the certificate verify signature,
+	//a resumed one takes the cached session and stores it again
+	BN_set_word(e, RSA_F4);
+	if (RSA_generate_key_ex(rsa, 2048, e, NULL) != 1) {
+		std::cout << "Problems generating keys" << std::endl;
+		goto out;
+	}
+
+	enc.data = new unsigned char[RSA_size(rsa)];
+	enc.length = RSA_public_encrypt(secret.length, secret.data, enc.data,
+					rsa, RSA_PKCS1_OAEP_PADDING);
+	sig.length = RSA_private_encrypt(32, id.data, sig.data, rsa,
+					 RSA_PKCS1_PADDING);
+
+	t0 = now_us();
+	for (int i = 0; i < STORM_SIZE; i++) {
+		RSA_private_decrypt(enc.length, enc.data, dec.data, rsa,
+				    RSA_PKCS1_OAEP_PADDING);
+		RSA_public_decrypt(sig.length, sig.data, dec.data, rsa,
+				   RSA_PKCS1_PADDING);
+	}
+	t_full = now_us() - t0;
+
+	cache.store("server/aa", id, secret, "B-1", "params", 60);
+	t0 = now_us();
+	for (int i = 0; i < STORM_SIZE; i++) {
+		if (cache.take("server/aa", out_id, out_secret, peer, params)) {
+			std::cout << "Resumed session was not stored again"
+				  << std::endl;
+			goto out;
+		}
+		cache.store("server/aa", out_id, out_secret, peer, params, 60);
+	}
+	t_resumed = now_us() - t0;
+
+	std::cout << STORM_SIZE << " server handshakes: full " << t_full
+		  << " us, resumed " << t_resumed << " us" << std::endl;
+
+	ret = 0;
+
+out:
+	BN_free(e);
+	RSA_free(rsa);
+	return ret;
+}
+
+int main()
+{
+	char dir_template[] = "/tmp/librina-test-keystore-XXXXXX";
+	char * dir;
+	int result;
+
+	std::cout << "TESTING CREDENTIAL CACHE, DH KEY POOL AND SESSION CACHE\n";
+
+	dir = mkdtemp(dir_template);
+	if (!dir) {
+		std::cout << "Problems creating keystore directory\n";
+		return -1;
+	}
+
+	result = test_credential_cache(dir);
+	rmdir(dir);
+	if (result) {
+		std::cout << "Credential cache test failed\n";
+		return result;
+	}
+
+	result = test_dh_key_pool();
+	if (result) {
+		std::cout << "DH key pool test failed\n";
+		return result;
+	}
+
+	result = test_session_cache();
+	if (result) {
+		std::cout << "Session cache test failed\n";
+		return result;
+	}
+
+	std::cout << "Credential cache, DH key pool and session cache tests passed\n";
+	return 0;
+}
@@ -30,11 +30,21 @@
 #include "pff-ps.h"
 
 extern struct ps_factory pff_factory;
+#ifdef CONFIG_RINA_PFF_MULTIPATH_REGRESSION_TESTS
+extern bool regression_tests_pff_multipath(void);
+#endif
 
 static int __init mod_init(void)
 {
         int ret;
 
+#ifdef CONFIG_RINA_PFF_MULTIPATH_REGRESSION_TESTS
+        if (!regression_tests_pff_multipath()) {
+                LOG_ERR("PFF multipath regression tests failed");
+                return -1;
+        }
+#endif
+
 	strcpy(pff_factory.name, RINA_PFF_MULTIPATH_NAME);
 
         ret = pff_ps_publish(&pff_factory);
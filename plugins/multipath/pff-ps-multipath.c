@@ -21,7 +21,8 @@
 #include <linux/export.h>
 #include <linux/module.h>
 #include <linux/string.h>
-#include <linux/crc16.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
 #include <linux/random.h>
 #include <linux/list.h>
 #include <linux/types.h>
@@ -35,10 +36,19 @@
 #include "pff.h"
 #include "debug.h"
 
+/* Buckets of each destination, must be a power of 2 */
+#define MP_DEFAULT_BUCKETS 128
+#define MP_MAX_BUCKETS     4096
+
 
 /* FIXME: This representation is crappy and MUST be changed */
 struct pft_port_entry {
         port_id_t        port_id;
+        /* Buckets this port should own, and owns, while rebuilding */
+        unsigned int     target;
+        unsigned int     count;
+        /* Still listed by the table being applied by mp_modify */
+        bool             keep;
         struct list_head next;
 };
 
@@ -54,6 +64,9 @@ static struct pft_port_entry * pft_pe_create_gfp(gfp_t     flags,
                 return NULL;
 
         tmp->port_id = port_id;
+        tmp->target  = 0;
+        tmp->count   = 0;
+        tmp->keep    = false;
         INIT_LIST_HEAD(&tmp->next);
 
         return tmp;
@@ -83,12 +96,28 @@ static port_id_t pft_pe_port(struct pft_port_entry * pe)
         return pe->port_id;
 }
 
+/*
+ * A slice of the flow hash space. Flows always go to port; a rebuild that
+ * has to move a bucket whose port is still usable only sets pending, which
+ * is taken once the bucket has been idle for the flowlet gap.
+ */
+struct mp_bucket {
+        port_id_t     port;
+        port_id_t     pending;
+        unsigned long last;
+        bool          reassign;
+};
+
 /* FIXME: This representation is crappy and MUST be changed */
 struct pft_entry {
-        address_t        destination;
-        qos_id_t         qos_id;
-        struct list_head ports;
-        struct list_head next;
+        address_t          destination;
+        qos_id_t           qos_id;
+        struct list_head   ports;
+        struct mp_bucket * buckets;
+        unsigned int       nbuckets;
+        /* Still listed by the table being applied by mp_modify */
+        bool               keep;
+        struct list_head   next;
 };
 
 static struct pft_entry * pfte_create_gfp(gfp_t     flags,
@@ -103,6 +132,9 @@ static struct pft_entry * pfte_create_gfp(gfp_t     flags,
 
         tmp->destination = destination;
         tmp->qos_id      = qos_id;
+        tmp->buckets     = NULL;
+        tmp->nbuckets    = 0;
+        tmp->keep        = false;
         INIT_LIST_HEAD(&tmp->ports);
         INIT_LIST_HEAD(&tmp->next);
 
@@ -129,6 +161,9 @@ static void pfte_destroy(struct pft_entry * entry)
                 pft_pe_destroy(pos);
         }
 
+        if (entry->buckets)
+                rkfree(entry->buckets);
+
         list_del(&entry->next);
         rkfree(entry);
 }
@@ -185,9 +220,9 @@ static void pfte_port_remove(struct pft_entry * entry,
 
 }
 
-static int pfte_ports_copy(struct  pft_port_entry * port,
-                           port_id_t **       port_ids,
-                           size_t *           entries)
+static int pfte_ports_copy(port_id_t    port,
+                           port_id_t ** port_ids,
+                           size_t *     entries)
 {
         size_t	count;
         count = 1;
@@ -208,19 +243,169 @@ static int pfte_ports_copy(struct  pft_port_entry * port,
                 *entries = count;
         }
 
-        (*port_ids)[0] = pft_pe_port(port);
+        (*port_ids)[0] = port;
 
         return 0;
 }
 
+/* Weight of an N-1 port, ports not in the list weigh 1 */
+struct mp_weight {
+        port_id_t        port_id;
+        unsigned int     weight;
+        struct list_head next;
+};
+
 struct pff_ps_priv {
         spinlock_t       lock;
         struct list_head entries;
+        struct list_head weights;
+        unsigned int     nbuckets;
+        /* Idle time before a bucket takes its pending port, in jiffies */
+        unsigned long    flowlet_gap;
+        u32              seed;
 };
 
 static bool priv_is_ok(struct pff_ps_priv * priv)
 { return priv != NULL; }
 
+static struct mp_weight * mp_weight_find(struct pff_ps_priv * priv,
+                                         port_id_t            port_id)
+{
+        struct mp_weight * pos;
+
+        list_for_each_entry(pos, &priv->weights, next) {
+                if (pos->port_id == port_id)
+                        return pos;
+        }
+
+        return NULL;
+}
+
+static unsigned int mp_port_weight(struct pff_ps_priv * priv,
+                                   port_id_t            port_id)
+{
+        struct mp_weight * w;
+
+        w = mp_weight_find(priv, port_id);
+
+        return w ? w->weight : 1;
+}
+
+static void mp_bucket_move(struct pft_entry * entry,
+                           struct mp_bucket * b,
+                           port_id_t          port_id,
+                           unsigned long      gap)
+{
+        if (gap && b->port != port_id && is_port_id_ok(b->port) &&
+            pfte_port_find(entry, b->port)) {
+                b->pending = port_id;
+                return;
+        }
+
+        b->port    = port_id;
+        b->pending = port_id_bad();
+}
+
+/*
+ * Spreads the buckets of the entry among its ports, proportionally to their
+ * weights. Buckets already on a port that has not reached its share stay
+ * there, so only the flows of the buckets that must move are disturbed.
+ */
+static int pfte_buckets_rebuild(struct pff_ps_priv * priv,
+                                struct pft_entry *   entry)
+{
+        struct pft_port_entry * pe;
+        struct mp_bucket *      b;
+        port_id_t               port_id;
+        unsigned int            total, assigned, i;
+
+        if (entry->nbuckets != priv->nbuckets) {
+                b = rkzalloc(priv->nbuckets * sizeof(*b), GFP_ATOMIC);
+                if (!b)
+                        return -1;
+
+                for (i = 0; i < priv->nbuckets; i++) {
+                        b[i].port    = port_id_bad();
+                        b[i].pending = port_id_bad();
+                }
+
+                if (entry->buckets)
+                        rkfree(entry->buckets);
+                entry->buckets  = b;
+                entry->nbuckets = priv->nbuckets;
+        }
+
+        total = 0;
+        list_for_each_entry(pe, &entry->ports, next) {
+                total += mp_port_weight(priv, pe->port_id);
+        }
+
+        if (!total) {
+                for (i = 0; i < entry->nbuckets; i++) {
+                        entry->buckets[i].port    = port_id_bad();
+                        entry->buckets[i].pending = port_id_bad();
+                }
+                return 0;
+        }
+
+        assigned = 0;
+        list_for_each_entry(pe, &entry->ports, next) {
+                pe->target = entry->nbuckets *
+                        mp_port_weight(priv, pe->port_id) / total;
+                pe->count  = 0;
+                assigned  += pe->target;
+        }
+        list_for_each_entry(pe, &entry->ports, next) {
+                if (assigned == entry->nbuckets)
+                        break;
+                pe->target++;
+                assigned++;
+        }
+
+        for (i = 0; i < entry->nbuckets; i++) {
+                b = &entry->buckets[i];
+                port_id = is_port_id_ok(b->pending) ? b->pending : b->port;
+                pe = is_port_id_ok(port_id) ?
+                        pfte_port_find(entry, port_id) : NULL;
+
+                if (pe && pe->count < pe->target) {
+                        pe->count++;
+                        b->reassign = false;
+                } else {
+                        b->reassign = true;
+                }
+        }
+
+        i = 0;
+        list_for_each_entry(pe, &entry->ports, next) {
+                for (; i < entry->nbuckets && pe->count < pe->target; i++) {
+                        b = &entry->buckets[i];
+                        if (!b->reassign)
+                                continue;
+
+                        b->reassign = false;
+                        pe->count++;
+                        mp_bucket_move(entry, b, pe->port_id,
+                                       priv->flowlet_gap);
+                }
+        }
+
+        return 0;
+}
+
+static int __pft_rebuild(struct pff_ps_priv * priv)
+{
+        struct pft_entry * pos;
+        int                result = 0;
+
+        list_for_each_entry(pos, &priv->entries, next) {
+                if (pfte_buckets_rebuild(priv, pos))
+                        result = -1;
+        }
+
+        return result;
+}
+
 static struct pft_entry * pft_find(struct pff_ps_priv * priv,
                                    address_t            destination,
                                    qos_id_t             qos_id)
@@ -270,6 +455,11 @@ static int __pff_add(struct pff_ps *        ps,
                 }
 	}
 
+        if (pfte_buckets_rebuild(priv, tmp)) {
+                pfte_destroy(tmp);
+                return -1;
+        }
+
 	return 0;
 }
 
@@ -354,8 +544,10 @@ static int mp_remove(struct pff_ps *        ps,
 	
         if (list_empty(&tmp->ports)) {
                 pfte_destroy(tmp);
+        } else if (pfte_buckets_rebuild(priv, tmp)) {
+                spin_unlock_bh(&priv->lock);
+                return -1;
         }
-	
 
         spin_unlock_bh(&priv->lock);
 
@@ -409,58 +601,43 @@ static int mp_flush(struct pff_ps * ps)
 
 
 /**
- * @brief Selects the next hop pft_entry from a list based
- * on hash-threshold algorithm
- * @param entry_list: list of possible next hop pft_entries
- * @param pci: PCI to extract the source & dest address and QoS
+ * @brief Selects the next hop port of a PDU, the flow hash indexes the
+ * precomputed buckets of the entry
+ * @param priv: private data of the policy set
+ * @param entry: pft_entry of the destination of the PDU
+ * @param pci: PCI to extract the source & dest address, CEP-ids and QoS
  * of the PDU
- * @return pointer to selected pft_entry
+ * @return selected port-id, or a bad one if there are no ports
  */
-struct pft_port_entry * select_entry(struct pft_entry * entry,
-                                struct pci * pci)
+static port_id_t select_entry(struct pff_ps_priv * priv,
+                              struct pft_entry *   entry,
+                              struct pci *         pci)
 {
-        int num_entries;
-        struct pft_port_entry * pos;
-        int i;
-
-        unsigned short hash_key;
-        const int KEYSPACE = 0xFFFF;
-        int region_size;
-        unsigned short region;
-        
-	typedef struct {
-		address_t pci_source;
-		address_t pci_destination;
-		address_t pci_qos_id;
-		cep_id_t  pci_cep_source;
-		cep_id_t  pci_cep_destination;
-	} connection_id;
-	connection_id c_id;
-
-	c_id.pci_source = pci_source(pci);
-	c_id.pci_destination = pci_destination(pci);
-	c_id.pci_qos_id = pci_qos_id(pci);
-	c_id.pci_cep_source = pci_cep_source(pci);
-	c_id.pci_cep_destination = pci_cep_destination(pci);
-
-        num_entries = 0;
-        list_for_each_entry(pos, &entry->ports, next) {
-                num_entries++;
-        }
-        
-        hash_key = crc16(0, (const u8 *)&c_id, sizeof(c_id));
-        
-        region_size = KEYSPACE / num_entries;
-        region = hash_key / region_size;
-        
-        i = 0;
-        list_for_each_entry(pos, &entry->ports, next) {
-                if (region == i++) {
-                        return pos;
-                }
+        struct mp_bucket * b;
+        unsigned long      now;
+        u32                hash;
+
+        if (!entry->nbuckets)
+                return port_id_bad();
+
+        hash = jhash_3words((u32) pci_source(pci),
+                            (u32) pci_destination(pci),
+                            ((u32) pci_cep_source(pci) << 16) ^
+                            (u32) pci_cep_destination(pci) ^
+                            ((u32) pci_qos_id(pci) << 24),
+                            priv->seed);
+
+        b   = &entry->buckets[hash & (entry->nbuckets - 1)];
+        now = jiffies;
+
+        if (is_port_id_ok(b->pending) &&
+            time_after_eq(now, b->last + priv->flowlet_gap)) {
+                b->port    = b->pending;
+                b->pending = port_id_bad();
         }
-        
-        return pos;
+        b->last = now;
+
+        return b->port;
 }
 
 static int mp_next_hop(struct pff_ps * ps,
@@ -472,7 +649,7 @@ static int mp_next_hop(struct pff_ps * ps,
         address_t               destination;
         qos_id_t                qos_id;
         struct pft_entry *      tmp;
-	struct pft_port_entry * port;
+	port_id_t               port;
 
         priv = (struct pff_ps_priv *) ps->priv;
         if (priv == NULL) {
@@ -510,12 +687,9 @@ static int mp_next_hop(struct pff_ps * ps,
                 return -1;
         }
 
-        /* 
-         * Hash-threshold algorithm based on
-         * CRC16 Linux kernel implementation
-        */
-        port = select_entry(tmp, pci);
-	if (!port) {
+        /* Resilient hashing on the weighted buckets of the entry */
+        port = select_entry(priv, tmp, pci);
+	if (!is_port_id_ok(port)) {
                 LOG_ERR("Could not select destination port for dest "
                          "address %u and qos_id %d", destination, qos_id);
                 spin_unlock_bh(&priv->lock);
@@ -598,11 +772,76 @@ static int mp_dump(struct pff_ps *    ps,
         return 0;
 }
 
+static struct pft_entry * pft_find_exact(struct pff_ps_priv * priv,
+                                         address_t            destination,
+                                         qos_id_t             qos_id)
+{
+        struct pft_entry * pos;
+
+        list_for_each_entry(pos, &priv->entries, next) {
+                if (pos->destination == destination && pos->qos_id == qos_id)
+                        return pos;
+        }
+
+        return NULL;
+}
+
+/*
+ * Brings an existing entry to the ports listed by @entry. Ports that stay
+ * keep their buckets, so only the flows hashed to the buckets of removed
+ * ports, or taken over by new ones, change their next hop.
+ */
+static int pfte_ports_update(struct pff_ps_priv *   priv,
+                             struct pft_entry *     tmp,
+                             struct mod_pff_entry * entry)
+{
+        struct port_id_altlist * alts;
+        struct pft_port_entry *  pe, * next;
+        int                      result = 0;
+
+        list_for_each_entry(pe, &tmp->ports, next) {
+                pe->keep = false;
+        }
+
+        list_for_each_entry(alts, &entry->port_id_altlists, next) {
+                if (alts->num_ports < 1)
+                        continue;
+
+                pe = pfte_port_find(tmp, alts->ports[0]);
+                if (!pe) {
+                        if (pfte_port_add(tmp, alts->ports[0])) {
+                                result = -1;
+                                continue;
+                        }
+                        pe = pfte_port_find(tmp, alts->ports[0]);
+                }
+                pe->keep = true;
+        }
+
+        list_for_each_entry_safe(pe, next, &tmp->ports, next) {
+                if (!pe->keep)
+                        pft_pe_destroy(pe);
+        }
+
+        if (pfte_buckets_rebuild(priv, tmp))
+                result = -1;
+
+        return result;
+}
+
+/*
+ * Applies a whole new forwarding table. Entries are diffed against the
+ * current ones and updated in place instead of being flushed and added
+ * again, so that the buckets and the flowlet state of the destinations
+ * whose next hops did not change survive a routing update.
+ */
 int mp_modify(struct pff_ps *    ps,
               struct list_head * entries)
 {
         struct pff_ps_priv *   priv;
         struct mod_pff_entry * entry;
+        struct pft_entry *     tmp, * next;
+        int                    result = 0;
 
         priv = (struct pff_ps_priv *) ps->priv;
         if (!priv_is_ok(priv))
@@ -610,7 +849,9 @@ int mp_modify(struct pff_ps *    ps,
 
         spin_lock_bh(&priv->lock);
 
-        __pft_flush(priv);
+        list_for_each_entry(tmp, &priv->entries, next) {
+                tmp->keep = false;
+        }
 
         list_for_each_entry(entry, entries, next) {
         	if (!entry)
@@ -622,22 +863,74 @@ int mp_modify(struct pff_ps *    ps,
         	if (!is_qos_id_ok(entry->qos_id))
         		continue;
 
-                __pff_add(ps, priv, entry);
+                tmp = pft_find_exact(priv, entry->fwd_info, entry->qos_id);
+                if (!tmp) {
+                        tmp = pfte_create_ni(entry->fwd_info, entry->qos_id);
+                        if (!tmp) {
+                                result = -1;
+                                continue;
+                        }
+
+                        list_add(&tmp->next, &priv->entries);
+                }
+
+                if (pfte_ports_update(priv, tmp, entry))
+                        result = -1;
+
+                tmp->keep = true;
+        }
+
+        list_for_each_entry_safe(tmp, next, &priv->entries, next) {
+                if (!tmp->keep || list_empty(&tmp->ports))
+                        pfte_destroy(tmp);
         }
 
         spin_unlock_bh(&priv->lock);
 
+        return result;
+}
+
+static int mp_set_weight(struct pff_ps_priv * priv,
+                         const char *         value)
+{
+        struct mp_weight * w;
+        port_id_t          port_id;
+        unsigned int       weight;
+
+        if (sscanf(value, "%d:%u", &port_id, &weight) != 2 ||
+            !is_port_id_ok(port_id) || weight < 1) {
+                LOG_ERR("Invalid port weight '%s', expected port:weight",
+                        value);
+                return -1;
+        }
+
+        w = mp_weight_find(priv, port_id);
+        if (!w) {
+                if (weight == 1)
+                        return 0;
+
+                w = rkmalloc(sizeof(*w), GFP_ATOMIC);
+                if (!w)
+                        return -1;
+
+                w->port_id = port_id;
+                INIT_LIST_HEAD(&w->next);
+                list_add(&w->next, &priv->weights);
+        }
+
+        w->weight = weight;
+
         return 0;
 }
 
-/* NOTE: This is skeleton code that was directly copy pasted */
 static int pff_ps_set_policy_set_param(struct ps_base * bps,
                                        const char *     name,
                                        const char *     value)
 {
-        struct pff_ps * ps = container_of(bps, struct pff_ps, base);
-
-        (void) ps;
+        struct pff_ps *      ps = container_of(bps, struct pff_ps, base);
+        struct pff_ps_priv * priv;
+        unsigned int         uval;
+        int                  ret;
 
         if (!name) {
                 LOG_ERR("Null parameter name");
@@ -649,6 +942,50 @@ static int pff_ps_set_policy_set_param(struct ps_base * bps,
                 return -1;
         }
 
+        priv = (struct pff_ps_priv *) ps->priv;
+        if (!priv_is_ok(priv))
+                return -1;
+
+        if (strcmp(name, "port-weight") == 0) {
+                spin_lock_bh(&priv->lock);
+                ret = mp_set_weight(priv, value);
+                if (!ret)
+                        ret = __pft_rebuild(priv);
+                spin_unlock_bh(&priv->lock);
+
+                return ret;
+        }
+
+        if (strcmp(name, "buckets") == 0) {
+                ret = kstrtouint(value, 10, &uval);
+                if (ret || !uval || uval > MP_MAX_BUCKETS ||
+                    (uval & (uval - 1))) {
+                        LOG_ERR("Invalid number of buckets '%s'", value);
+                        return -1;
+                }
+
+                spin_lock_bh(&priv->lock);
+                priv->nbuckets = uval;
+                ret = __pft_rebuild(priv);
+                spin_unlock_bh(&priv->lock);
+
+                return ret;
+        }
+
+        if (strcmp(name, "flowlet-gap") == 0) {
+                ret = kstrtouint(value, 10, &uval);
+                if (ret) {
+                        LOG_ERR("Invalid flowlet gap '%s'", value);
+                        return -1;
+                }
+
+                spin_lock_bh(&priv->lock);
+                priv->flowlet_gap = msecs_to_jiffies(uval);
+                spin_unlock_bh(&priv->lock);
+
+                return 0;
+        }
+
         LOG_ERR("No such parameter to set");
 
         return -1;
@@ -669,6 +1006,10 @@ pff_ps_multipath_create(struct rina_component * component)
         spin_lock_init(&priv->lock);
 
         INIT_LIST_HEAD(&priv->entries);
+        INIT_LIST_HEAD(&priv->weights);
+        priv->nbuckets    = MP_DEFAULT_BUCKETS;
+        priv->flowlet_gap = 0;
+        get_random_bytes(&priv->seed, sizeof(priv->seed));
 
         ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
         if (!ps) {
@@ -697,6 +1038,7 @@ static void pff_ps_multipath_destroy(struct ps_base * bps)
 
         if (bps) {
                 struct pff_ps_priv * priv;
+                struct mp_weight *   pos, * next;
 
                 priv = (struct pff_ps_priv *) ps->priv;
                 if(!priv_is_ok(priv)) {
@@ -707,6 +1049,11 @@ static void pff_ps_multipath_destroy(struct ps_base * bps)
 
                 __pft_flush(priv);
 
+                list_for_each_entry_safe(pos, next, &priv->weights, next) {
+                        list_del(&pos->next);
+                        rkfree(pos);
+                }
+
                 spin_unlock_bh(&priv->lock);
 
                 rkfree(priv);
@@ -719,3 +1066,206 @@ struct ps_factory pff_factory = {
         .create  = pff_ps_multipath_create,
         .destroy = pff_ps_multipath_destroy,
 };
+
+#ifdef CONFIG_RINA_PFF_MULTIPATH_REGRESSION_TESTS
+#define MP_TEST_DEST 10
+#define MP_TEST_DEST2 20
+
+static struct mod_pff_entry * mp_test_entry(struct list_head * entries,
+                                            address_t          dest,
+                                            const port_id_t *  ports,
+                                            unsigned int       nports)
+{
+        struct mod_pff_entry *   e;
+        struct port_id_altlist * alt;
+        unsigned int             i;
+
+        e = rkzalloc(sizeof(*e), GFP_KERNEL);
+        if (!e)
+                return NULL;
+
+        e->fwd_info = dest;
+        INIT_LIST_HEAD(&e->port_id_altlists);
+        INIT_LIST_HEAD(&e->next);
+        list_add_tail(&e->next, entries);
+
+        for (i = 0; i < nports; i++) {
+                alt = rkzalloc(sizeof(*alt), GFP_KERNEL);
+                if (!alt)
+                        return NULL;
+                INIT_LIST_HEAD(&alt->next);
+                list_add_tail(&alt->next, &e->port_id_altlists);
+
+                alt->ports = rkmalloc(sizeof(*alt->ports), GFP_KERNEL);
+                if (!alt->ports)
+                        return NULL;
+                alt->ports[0]  = ports[i];
+                alt->num_ports = 1;
+        }
+
+        return e;
+}
+
+static void mp_test_entries_free(struct list_head * entries)
+{
+        struct mod_pff_entry *   e, * ne;
+        struct port_id_altlist * alt, * nalt;
+
+        list_for_each_entry_safe(e, ne, entries, next) {
+                list_for_each_entry_safe(alt, nalt, &e->port_id_altlists,
+                                         next) {
+                        list_del(&alt->next);
+                        if (alt->ports)
+                                rkfree(alt->ports);
+                        rkfree(alt);
+                }
+                list_del(&e->next);
+                rkfree(e);
+        }
+}
+
+/* Applies a table with a single destination plus, optionally, another one */
+static int mp_test_modify(struct pff_ps *   ps,
+                          const port_id_t * ports,
+                          unsigned int      nports,
+                          bool              dest2)
+{
+        static const port_id_t port2 = 9;
+        struct list_head       entries;
+        int                    ret = -1;
+
+        INIT_LIST_HEAD(&entries);
+        if (nports && !mp_test_entry(&entries, MP_TEST_DEST, ports, nports))
+                goto out;
+        if (dest2 && !mp_test_entry(&entries, MP_TEST_DEST2, &port2, 1))
+                goto out;
+
+        ret = mp_modify(ps, &entries);
+ out:
+        mp_test_entries_free(&entries);
+
+        return ret;
+}
+
+static unsigned int mp_test_owned(struct pft_entry * entry,
+                                  port_id_t          port_id)
+{
+        unsigned int i, n = 0;
+
+        for (i = 0; i < entry->nbuckets; i++) {
+                if (entry->buckets[i].port == port_id)
+                        n++;
+        }
+
+        return n;
+}
+
+bool regression_tests_pff_multipath(void)
+{
+        static const port_id_t ports[] = { 1, 2, 3, 4 };
+        struct pff_ps_priv *   priv;
+        struct pff_ps *        ps;
+        struct pft_entry *     entry;
+        struct mp_bucket *     before;
+        unsigned int           i, moved;
+        bool                   ret = false;
+
+        LOG_DBG("PFF multipath regression tests");
+
+        priv   = rkzalloc(sizeof(*priv), GFP_KERNEL);
+        ps     = rkzalloc(sizeof(*ps), GFP_KERNEL);
+        before = rkzalloc(MP_DEFAULT_BUCKETS * sizeof(*before), GFP_KERNEL);
+        if (!priv || !ps || !before)
+                goto free;
+
+        spin_lock_init(&priv->lock);
+        INIT_LIST_HEAD(&priv->entries);
+        INIT_LIST_HEAD(&priv->weights);
+        priv->nbuckets = MP_DEFAULT_BUCKETS;
+        ps->priv       = priv;
+
+        LOG_DBG("Regression test #1, initial table");
+        if (mp_test_modify(ps, ports, 3, false))
+                goto out;
+        entry = pft_find_exact(priv, MP_TEST_DEST, 0);
+        if (!entry || entry->nbuckets != MP_DEFAULT_BUCKETS)
+                goto out;
+        for (i = 0; i < 3; i++) {
+                if (mp_test_owned(entry, ports[i]) <
+                    MP_DEFAULT_BUCKETS / 3)
+                        goto out;
+        }
+        memcpy(before, entry->buckets, MP_DEFAULT_BUCKETS * sizeof(*before));
+
+        LOG_DBG("Regression test #2, same table again");
+        if (mp_test_modify(ps, ports, 3, false) ||
+            pft_find_exact(priv, MP_TEST_DEST, 0) != entry)
+                goto out;
+        for (i = 0; i < MP_DEFAULT_BUCKETS; i++) {
+                if (entry->buckets[i].port != before[i].port)
+                        goto out;
+        }
+
+        LOG_DBG("Regression test #3, a next hop and a destination added");
+        if (mp_test_modify(ps, ports, 4, true) ||
+            pft_find_exact(priv, MP_TEST_DEST, 0) != entry ||
+            !pft_find_exact(priv, MP_TEST_DEST2, 0))
+                goto out;
+        moved = 0;
+        for (i = 0; i < MP_DEFAULT_BUCKETS; i++) {
+                if (entry->buckets[i].port == before[i].port)
+                        continue;
+                /* Only the share of the new port may move */
+                if (entry->buckets[i].port != ports[3])
+                        goto out;
+                moved++;
+        }
+        if (moved != MP_DEFAULT_BUCKETS / 4)
+                goto out;
+        memcpy(before, entry->buckets, MP_DEFAULT_BUCKETS * sizeof(*before));
+
+        LOG_DBG("Regression test #4, moves wait for the flowlet gap");
+        priv->flowlet_gap = msecs_to_jiffies(1000);
+        if (mp_test_modify(ps, &ports[1], 3, true))
+                goto out;
+        for (i = 0; i < MP_DEFAULT_BUCKETS; i++) {
+                /* Buckets of a removed port move right away */
+                if (entry->buckets[i].port == ports[0] ||
+                    is_port_id_ok(entry->buckets[i].pending))
+                        goto out;
+        }
+        memcpy(before, entry->buckets, MP_DEFAULT_BUCKETS * sizeof(*before));
+        if (mp_test_modify(ps, ports, 4, true))
+                goto out;
+        moved = 0;
+        for (i = 0; i < MP_DEFAULT_BUCKETS; i++) {
+                /* Flows on live ports are not disturbed before the gap */
+                if (entry->buckets[i].port != before[i].port)
+                        goto out;
+                if (entry->buckets[i].pending == ports[0])
+                        moved++;
+        }
+        if (moved != MP_DEFAULT_BUCKETS / 4)
+                goto out;
+        priv->flowlet_gap = 0;
+
+        LOG_DBG("Regression test #5, destination removed");
+        if (mp_test_modify(ps, ports, 3, false) ||
+            pft_find_exact(priv, MP_TEST_DEST2, 0) ||
+            pft_find_exact(priv, MP_TEST_DEST, 0) != entry)
+                goto out;
+
+        ret = true;
+ out:
+        __pft_flush(priv);
+ free:
+        if (before)
+                rkfree(before);
+        if (ps)
+                rkfree(ps);
+        if (priv)
+                rkfree(priv);
+
+        return ret;
+}
+#endif
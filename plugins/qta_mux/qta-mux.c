@@ -24,6 +24,10 @@
 #include <linux/string.h>
 #include <linux/random.h>
 #include <linux/ktime.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/hashtable.h>
+#include <linux/version.h>
 
 #define RINA_PREFIX "qta-mux-plugin"
 
@@ -40,16 +44,24 @@
 
 #define TIMER_T  100
 
-struct pdu_entry {
-	struct list_head list;
-	struct du *      pdu;
+#define QTA_MUX_MAX_URGENCY_LEVELS 64
+#define TBF_HASH_BITS              4
+#define PDU_RING_MIN_SIZE          64
+
+/* FIFO of PDUs in a power of two array, that doubles its size when full */
+struct pdu_ring {
+	struct du ** pdus;
+	uint_t       head;
+	uint_t       length;
+	uint_t       size;
 };
 
 struct urgency_queue {
 	struct list_head 	   list;
-	struct list_head 	   queued_pdus;
+	struct pdu_ring 	   queued_pdus;
 	uint_t           	   urgency_level;
-	uint_t           	   length;
+	/* Position in the C/U mux, lower is more urgent */
+	uint_t			   index;
 	struct robject   	   robj;
 	uint_t			   dropped_pdus;
 	uint_t		 	   dropped_bytes;
@@ -64,14 +76,21 @@ struct urgency_queue {
 
 struct cu_mux {
 	struct list_head      urgency_queues;
-	struct list_head      mgmt_queue;
+	/* Urgency queues by index, and the indexes of the non-empty ones */
+	struct urgency_queue * queues[QTA_MUX_MAX_URGENCY_LEVELS];
+	uint_t                nqueues;
+	DECLARE_BITMAP(active, QTA_MUX_MAX_URGENCY_LEVELS);
+	struct pdu_ring       mgmt_queue;
 	struct robject	      robj;
 	struct rset *         rset;
 };
 
 struct token_bucket_filter {
 	struct list_head list;
+	struct hlist_node hlist;
 	qos_id_t         qos_id;
+	/* Urgency queue of urgency_level */
+	struct urgency_queue * uq;
 	uint_t		 urgency_level;
 	uint_t		 cherish_level;
 	uint_t           abs_cherish_threshold; /* in PDUs */
@@ -121,6 +140,7 @@ struct qta_mux_conf {
 struct qta_mux {
 	struct list_head list;
 	struct list_head token_bucket_filters;
+	DECLARE_HASHTABLE(tbf_table, TBF_HASH_BITS);
 	struct cu_mux    cu_mux;
 	port_id_t        port_id;
 	struct robject   robj;
@@ -166,7 +186,7 @@ static ssize_t urgency_queue_attr_show(struct robject * robj,
 			return sprintf(buf, "%u\n", q->dequeue_prob);
 		}
 	if (strcmp(robject_attr_name(attr), "queued_pdus") == 0) {
-		return sprintf(buf, "%u\n", q->length);
+		return sprintf(buf, "%u\n", q->queued_pdus.length);
 	}
 	if (strcmp(robject_attr_name(attr), "dropped_pdus") == 0) {
 		return sprintf(buf, "%u\n", q->dropped_pdus);
@@ -381,26 +401,85 @@ static struct qta_mux_set * qta_mux_set_create(void)
 	return tmp;
 }
 
-static void pdu_entry_destroy(struct pdu_entry * pdu_entry, bool destroy)
+static int pdu_ring_init(struct pdu_ring * ring)
+{
+	ring->pdus = rkmalloc(PDU_RING_MIN_SIZE * sizeof(*ring->pdus),
+			      GFP_ATOMIC);
+	if (!ring->pdus)
+		return -1;
+
+	ring->head = 0;
+	ring->length = 0;
+	ring->size = PDU_RING_MIN_SIZE;
+
+	return 0;
+}
+
+static void pdu_ring_fini(struct pdu_ring * ring)
 {
-	if (!pdu_entry)
+	if (!ring->pdus)
 		return;
 
-	list_del(&pdu_entry->list);
+	for (; ring->length; ring->length--) {
+		du_destroy(ring->pdus[ring->head]);
+		ring->head = (ring->head + 1) & (ring->size - 1);
+	}
+
+	rkfree(ring->pdus);
+	ring->pdus = NULL;
+}
+
+static int pdu_ring_push(struct pdu_ring * ring, struct du * du)
+{
+	struct du ** tmp;
+	uint_t       i;
+
+	if (ring->length == ring->size) {
+		tmp = rkmalloc(2 * ring->size * sizeof(*tmp), GFP_ATOMIC);
+		if (!tmp)
+			return -1;
+
+		for (i = 0; i < ring->length; i++)
+			tmp[i] = ring->pdus[(ring->head + i) & (ring->size - 1)];
 
-	if (destroy) {
-		du_destroy(pdu_entry->pdu);
+		rkfree(ring->pdus);
+		ring->pdus = tmp;
+		ring->head = 0;
+		ring->size *= 2;
 	}
 
-	rkfree(pdu_entry);
+	ring->pdus[(ring->head + ring->length) & (ring->size - 1)] = du;
+	ring->length++;
 
-	return;
+	return 0;
 }
 
-static void urgency_queue_destroy(struct urgency_queue * uq)
+static struct du * pdu_ring_pop(struct pdu_ring * ring)
+{
+	struct du * du;
+
+	if (!ring->length)
+		return NULL;
+
+	du = ring->pdus[ring->head];
+	ring->head = (ring->head + 1) & (ring->size - 1);
+	ring->length--;
+
+	return du;
+}
+
+/* Uniform in [0, NORM_PROB), from the cheap per-CPU generator */
+static inline uint_t random_prob(void)
 {
-	struct pdu_entry *pos, *next;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,1,0)
+	return reciprocal_scale(prandom_u32(), NORM_PROB);
+#else
+	return reciprocal_scale(get_random_u32(), NORM_PROB);
+#endif
+}
 
+static void urgency_queue_destroy(struct urgency_queue * uq)
+{
 	if (!uq)
 		return;
 
@@ -408,10 +487,7 @@ static void urgency_queue_destroy(struct urgency_queue * uq)
 
 	robject_del(&uq->robj);
 
-	list_for_each_entry_safe(pos, next,
-			&uq->queued_pdus, list) {
-		pdu_entry_destroy(pos, true);
-	}
+	pdu_ring_fini(&uq->queued_pdus);
 
 #if QTA_MUX_DEBUG
 	udebug_info_destroy(uq->debug_info);
@@ -426,6 +502,8 @@ static void token_bucket_filter_destroy(struct token_bucket_filter * sq)
 		return;
 
 	list_del(&sq->list);
+	if (!hlist_unhashed(&sq->hlist))
+		hash_del(&sq->hlist);
 
 	robject_del(&sq->robj);
 
@@ -436,7 +514,6 @@ static void qta_mux_destroy(struct qta_mux * qta_mux)
 {
 	struct urgency_queue *pos, *next;
 	struct token_bucket_filter *pos2, *next2;
-	struct pdu_entry *pos3, *next3;
 
 	if (!qta_mux)
 		return;
@@ -453,10 +530,7 @@ static void qta_mux_destroy(struct qta_mux * qta_mux)
 		token_bucket_filter_destroy(pos2);
 	}
 
-	list_for_each_entry_safe(pos3, next3,
-			&qta_mux->cu_mux.mgmt_queue, list) {
-		pdu_entry_destroy(pos3, true);
-	}
+	pdu_ring_fini(&qta_mux->cu_mux.mgmt_queue);
 
 	robject_del(&qta_mux->cu_mux.robj);
 	if (qta_mux->cu_mux.rset)
@@ -482,10 +556,16 @@ static struct qta_mux * qta_mux_create(port_id_t port_id,
 
 	INIT_LIST_HEAD(&tmp->list);
 	INIT_LIST_HEAD(&tmp->token_bucket_filters);
+	hash_init(tmp->tbf_table);
 	INIT_LIST_HEAD(&tmp->cu_mux.urgency_queues);
-	INIT_LIST_HEAD(&tmp->cu_mux.mgmt_queue);
 	tmp->port_id = port_id;
 
+	if (pdu_ring_init(&tmp->cu_mux.mgmt_queue)) {
+		LOG_ERR("Problems creating management queue");
+		qta_mux_destroy(tmp);
+		return NULL;
+	}
+
 	if (robject_init_and_add(&tmp->robj, &qta_mux_rtype, parent, "qta_mux")) {
 		LOG_ERR("Failed to create QTA MUX sysfs object");
 		qta_mux_destroy(tmp);
@@ -531,6 +611,7 @@ static struct token_bucket_filter * token_bucket_filter_create(struct urgency_qu
 	cherish_thres = uq_conf->cherish_thresholds[sq_conf->cherish_level -1];
 
 	INIT_LIST_HEAD(&tmp->list);
+	INIT_HLIST_NODE(&tmp->hlist);
 	tmp->max_rate = sq_conf->max_rate;
 	tmp->qos_id = sq_conf->qos_id;
 	tmp->urgency_level = sq_conf->urgency_level;
@@ -574,8 +655,6 @@ static struct urgency_queue * urgency_queue_create(uint_t urgency_level,
 	}
 
 	INIT_LIST_HEAD(&tmp->list);
-	INIT_LIST_HEAD(&tmp->queued_pdus);
-	tmp->length = 0;
 	tmp->urgency_level = urgency_level;
 	tmp->dequeue_prob = dequeue_prob;
 	tmp->dropped_bytes = 0;
@@ -584,6 +663,12 @@ static struct urgency_queue * urgency_queue_create(uint_t urgency_level,
 	tmp->tx_pdus = 0;
 	tmp->max_occupation = 0;
 
+	if (pdu_ring_init(&tmp->queued_pdus)) {
+		LOG_ERR("Problems creating urgency queue");
+		rkfree(tmp);
+		return NULL;
+	}
+
 	robject_init(&tmp->robj, &urgency_queue_rtype);
 	if (robject_rset_add(&tmp->robj, parent, "%d", tmp->urgency_level)) {
 		LOG_ERR("Failed to create Urgency queue sysfs entry");
@@ -598,22 +683,6 @@ static struct urgency_queue * urgency_queue_create(uint_t urgency_level,
 	return tmp;
 }
 
-static struct pdu_entry * pdu_entry_create(struct du* du)
-{
-	struct pdu_entry * tmp;
-
-	tmp = rkzalloc(sizeof(*tmp), GFP_ATOMIC);
-	if (!tmp) {
-		LOG_ERR("Problems creating PDU entry");
-		return NULL;
-	}
-
-	INIT_LIST_HEAD(&tmp->list);
-	tmp->pdu = du;
-
-	return tmp;
-}
-
 static void qta_mux_set_destroy(struct qta_mux_set * qta_mux_set)
 {
 	struct qta_mux *pos, *next;
@@ -639,7 +708,7 @@ static struct token_bucket_filter * tbf_find(struct qta_mux * qta_mux,
 {
 	struct token_bucket_filter * pos;
 
-	list_for_each_entry(pos, &qta_mux->token_bucket_filters, list) {
+	hash_for_each_possible(qta_mux->tbf_table, pos, hlist, qos_id) {
 		if (pos->qos_id == qos_id)
 			return pos;
 	}
@@ -660,31 +729,15 @@ static struct urgency_queue * urgency_queue_find(struct qta_mux * qta_mux,
 	return NULL;
 }
 
-static struct du * dequeue_pdu(struct list_head * list)
-{
-	struct pdu_entry * pdu_entry = NULL;
-	struct du * pdu;
-
-	pdu_entry = list_first_entry(list, struct pdu_entry, list);
-	if (!pdu_entry) {
-		return NULL;
-	}
-
-	pdu = pdu_entry->pdu;
-
-	pdu_entry_destroy(pdu_entry, false);
-
-	return pdu;
-}
-
 struct du * qta_rmt_dequeue_policy(struct rmt_ps	  *ps,
 				   struct rmt_n1_port *n1_port)
 {
 	struct du *            ret_pdu;
 	struct qta_mux *       qta_mux;
+	struct cu_mux *        cu_mux;
 	struct urgency_queue * pos;
-	uint_t		       random_bytes;
 	struct urgency_queue * candidate;
+	uint_t		       i;
 
 	if (!ps || !n1_port || !n1_port->rmt_ps_queues) {
 		LOG_ERR("Wrong input parameters for "
@@ -696,40 +749,39 @@ struct du * qta_rmt_dequeue_policy(struct rmt_ps	  *ps,
 	if (!qta_mux)
 		return NULL;
 
+	cu_mux = &qta_mux->cu_mux;
+
 	/* Layer management PDUs always have top priority */
-	if (!list_empty(&qta_mux->cu_mux.mgmt_queue))
-		return dequeue_pdu(&qta_mux->cu_mux.mgmt_queue);
+	if (cu_mux->mgmt_queue.length)
+		return pdu_ring_pop(&cu_mux->mgmt_queue);
 
-	/* Go through the urgency queues in urgency level: the queues */
-	/* with a higher urgency level are checked first */
+	/* Go through the non-empty urgency queues in urgency level: the */
+	/* queues with a higher urgency level are checked first */
 	candidate = NULL;
-	list_for_each_entry(pos, &qta_mux->cu_mux.urgency_queues, list) {
-		if (!list_empty(&pos->queued_pdus)) {
-			/* This queue is not empty, can be a candidate */
-			get_random_bytes(&random_bytes, sizeof(random_bytes));
-			random_bytes = random_bytes % NORM_PROB;
-			if (pos->dequeue_prob > random_bytes) {
-				/* We can dequeue from this urgency queue */
-				candidate = pos;
-				goto exit;
-			} else if (!candidate) {
-				candidate = pos;
-			}
+	for_each_set_bit(i, cu_mux->active, cu_mux->nqueues) {
+		pos = cu_mux->queues[i];
+		if (pos->dequeue_prob >= NORM_PROB ||
+		    pos->dequeue_prob > random_prob()) {
+			/* We can dequeue from this urgency queue */
+			candidate = pos;
+			break;
+		} else if (!candidate) {
+			candidate = pos;
 		}
 	}
 
-exit:
 	if (!candidate)
 		return NULL;
 
-	ret_pdu = dequeue_pdu(&candidate->queued_pdus);
-	candidate->length--;
+	ret_pdu = pdu_ring_pop(&candidate->queued_pdus);
+	if (!candidate->queued_pdus.length)
+		__clear_bit(candidate->index, cu_mux->active);
 	candidate->tx_pdus++;
 	candidate->tx_bytes += du_len(ret_pdu);
 
 #if QTA_MUX_DEBUG
 if (candidate->debug_info->q_index < UQUEUE_DEBUG_SIZE) {
-	candidate->debug_info->q_log[candidate->debug_info->q_index][0] = candidate->length;
+	candidate->debug_info->q_log[candidate->debug_info->q_index][0] = candidate->queued_pdus.length;
 	candidate->debug_info->q_log[candidate->debug_info->q_index][1] = ktime_get_ns();
 	candidate->debug_info->q_index++;
 }
@@ -748,11 +800,9 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 	struct urgency_queue *       urgency_queue;
 	qos_id_t               	     qos_id;
 	pdu_type_t 		     pdu_type;
-	struct pdu_entry * 	     pdu_entry;
 	s64			     now;
 	s64			     delta_tokens;
 	ssize_t			     pdu_length;
-	uint_t			     random_bytes;
 	bool 			     ecn_mark;
 	pdu_flags_t     	     pci_flags;
 
@@ -771,17 +821,15 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 	 */
 	pdu_type = pci_type(&du->pci);
 	if (pdu_type == PDU_TYPE_MGMT) {
-		if (!must_enqueue && list_empty(&qta_mux->cu_mux.mgmt_queue))
+		if (!must_enqueue && !qta_mux->cu_mux.mgmt_queue.length)
 			return RMT_PS_ENQ_SEND;
 
-		pdu_entry = pdu_entry_create(du);
-		if (!pdu_entry) {
-			LOG_ERR("Problems allocating memory for PDU entry");
+		if (pdu_ring_push(&qta_mux->cu_mux.mgmt_queue, du)) {
+			LOG_ERR("Problems allocating memory for PDU queue");
 			du_destroy(du);
 			return RMT_PS_ENQ_ERR;
 		}
 
-		list_add_tail(&pdu_entry->list, &qta_mux->cu_mux.mgmt_queue);
 		return RMT_PS_ENQ_SCHED;
 	}
 
@@ -823,7 +871,7 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 		return RMT_PS_ENQ_SEND;
 
 	/* Put PDU put it in the right urgency queue */
-	urgency_queue = urgency_queue_find(qta_mux, tbf->urgency_level);
+	urgency_queue = tbf->uq;
 	if (!urgency_queue) {
 		LOG_ERR("No urgency queue for level %u, dropping PDU",
 			tbf->urgency_level);
@@ -832,7 +880,7 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 	}
 
 	/* queue length is larger than cherish threshold, drop PDU */
-	if (urgency_queue->length > tbf->abs_cherish_threshold) {
+	if (urgency_queue->queued_pdus.length > tbf->abs_cherish_threshold) {
 		urgency_queue->dropped_bytes += pdu_length;
 		urgency_queue->dropped_pdus++;
 		tbf->dropped_pdus_cu_mux++;
@@ -842,10 +890,8 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 
 	/* queue length is larger than probabilistic ch. threshold */
 	ecn_mark = false;
-	if (urgency_queue->length > tbf->prob_cherish_threshold) {
-		get_random_bytes(&random_bytes, sizeof(random_bytes));
-		random_bytes = random_bytes % NORM_PROB;
-		if (tbf->drop_probability > random_bytes) {
+	if (urgency_queue->queued_pdus.length > tbf->prob_cherish_threshold) {
+		if (tbf->drop_probability > random_prob()) {
 			if (tbf->drop) {
 				urgency_queue->dropped_bytes += pdu_length;
 				urgency_queue->dropped_pdus++;
@@ -858,26 +904,24 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 		}
 	}
 
-	pdu_entry = pdu_entry_create(du);
-	if (!pdu_entry) {
-		LOG_ERR("Problems allocating memory for PDU entry");
-		du_destroy(du);
-		return RMT_PS_ENQ_ERR;
-	}
-
 	if (ecn_mark) {
 		pci_flags = pci_flags_get(&du->pci);
 		pci_flags_set(&du->pci,
 			      pci_flags |= PDU_FLAGS_EXPLICIT_CONGESTION);
 	}
-	list_add_tail(&pdu_entry->list, &urgency_queue->queued_pdus);
-	urgency_queue->length++;
-	if (urgency_queue->length > urgency_queue->max_occupation)
-		urgency_queue->max_occupation = urgency_queue->length;
+
+	if (pdu_ring_push(&urgency_queue->queued_pdus, du)) {
+		LOG_ERR("Problems allocating memory for PDU queue");
+		du_destroy(du);
+		return RMT_PS_ENQ_ERR;
+	}
+	__set_bit(urgency_queue->index, qta_mux->cu_mux.active);
+	if (urgency_queue->queued_pdus.length > urgency_queue->max_occupation)
+		urgency_queue->max_occupation = urgency_queue->queued_pdus.length;
 
 #if QTA_MUX_DEBUG
 	if (urgency_queue->debug_info->q_index < UQUEUE_DEBUG_SIZE) {
-		urgency_queue->debug_info->q_log[urgency_queue->debug_info->q_index][0] = urgency_queue->length;
+		urgency_queue->debug_info->q_log[urgency_queue->debug_info->q_index][0] = urgency_queue->queued_pdus.length;
 		urgency_queue->debug_info->q_log[urgency_queue->debug_info->q_index][1] = now;
 		urgency_queue->debug_info->q_index++;
 	}
@@ -942,6 +986,7 @@ void * qta_rmt_q_create_policy(struct rmt_ps      *ps,
 	struct token_bucket_filter * tbf;
 	struct urgency_queue * urgency_queue;
 	struct urgency_queue_conf * uq_conf;
+	uint_t i;
 
 	if (!ps || !n1_port || !qta_mux_set) {
 		LOG_ERR("Wrong input parameters for "
@@ -959,6 +1004,39 @@ void * qta_rmt_q_create_policy(struct rmt_ps      *ps,
 	}
 	list_add(&qta_mux->list, &qta_mux_set->qta_muxes);
 
+	/* Create one urgency_queue per urgency level, add it to the qta_mux */
+	list_for_each_entry(uq_conf, &config->urgency_queue_conf, list) {
+		if (qta_mux->cu_mux.nqueues == QTA_MUX_MAX_URGENCY_LEVELS) {
+			LOG_ERR("Too many urgency levels, at most %d",
+				QTA_MUX_MAX_URGENCY_LEVELS);
+			qta_mux_destroy(qta_mux);
+			return NULL;
+		}
+
+		urgency_queue = urgency_queue_create(uq_conf->urgency_level,
+						     uq_conf->dequeue_prob,
+						     n1_port->port_id,
+						     qta_mux->cu_mux.rset);
+		if (!urgency_queue) {
+			LOG_ERR("Problems creating urgency queue");
+			qta_mux_destroy(qta_mux);
+			return NULL;
+		}
+
+		qta_mux_add_uqueue(qta_mux, urgency_queue);
+		qta_mux->cu_mux.nqueues++;
+		LOG_INFO("Added urgency queue for urgency level %d",
+			 uq_conf->urgency_level);
+	}
+
+	/* Index them by urgency */
+	i = 0;
+	list_for_each_entry(urgency_queue, &qta_mux->cu_mux.urgency_queues,
+			    list) {
+		urgency_queue->index = i;
+		qta_mux->cu_mux.queues[i++] = urgency_queue;
+	}
+
 	/* Create one token bucket filter per QoS level */
 	list_for_each_entry(pos, &config->token_buckets_conf, list) {
 		uq_conf = uqc_find(config, pos->urgency_level);
@@ -975,27 +1053,12 @@ void * qta_rmt_q_create_policy(struct rmt_ps      *ps,
 			return NULL;
 		}
 
+		tbf->uq = urgency_queue_find(qta_mux, tbf->urgency_level);
 		list_add_tail(&tbf->list, &qta_mux->token_bucket_filters);
+		hash_add(qta_mux->tbf_table, &tbf->hlist, tbf->qos_id);
 		LOG_INFO("Added token bucket filter for QoS id %u", pos->qos_id);
 	}
 
-	/* Create one urgency_queue per urgency level, add it to the qta_mux */
-	list_for_each_entry(uq_conf, &config->urgency_queue_conf, list) {
-		urgency_queue = urgency_queue_create(uq_conf->urgency_level,
-						     uq_conf->dequeue_prob,
-						     n1_port->port_id,
-						     qta_mux->cu_mux.rset);
-		if (!urgency_queue) {
-			LOG_ERR("Problems creating urgency queue");
-			qta_mux_destroy(qta_mux);
-			return NULL;
-		}
-
-		qta_mux_add_uqueue(qta_mux, urgency_queue);
-		LOG_INFO("Added urgency queue for urgency level %d",
-			 uq_conf->urgency_level);
-	}
-
 	return qta_mux;
 }
 
@@ -1143,6 +1206,8 @@ static int qta_mux_ps_set_policy_set_param_priv(struct qta_mux_set * data,
 					if (tbf->qos_id == qos_id) {
 						tbf->max_rate = max_rate;
 						tbf->urgency_level = urgency_level;
+						tbf->uq = urgency_queue_find(qta_mux,
+									     urgency_level);
 						tbf->cherish_level = cherish_level;
 						tbf->bucket_capacity = max_burst_size;
 					}
@@ -28,6 +28,9 @@
 #include <linux/list.h>
 #include <linux/types.h>
 #include <linux/slab.h>
+#include <linux/hashtable.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
 
 #define RINA_PREFIX 	"pff-ps-pffb"
 
@@ -50,6 +53,13 @@
  */
 #define PFFB_RAND_DIST 		1
 
+/* How often timed out flows are looked for (in ms) */
+#define PFFB_AGING_INTERVAL	1000
+
+/* Buckets of the flows and forwarding entries tables, as bits */
+#define PFFB_FLOWS_HASH_BITS	10
+#define PFFB_PFT_HASH_BITS	6
+
 /*
  * Data structure:
  */
@@ -64,22 +74,22 @@ struct connection_id {
 
 /* Flow info. */
 struct flow_info {
-	struct list_head next;
-	struct timespec la;
+	struct hlist_node hlist;
+	/* Last access, in jiffies. */
+	unsigned long la;
 	unsigned short key;
 	unsigned int rate;
 	port_id_t port_id;
 };
 
-struct pft_port_entry {
-	struct list_head next;
-        port_id_t        port_id;
-};
-
 /* Master private data structure for the policy set. */
 struct pff_ps_priv {
         spinlock_t       lock;
-        struct list_head entries;
+        DECLARE_HASHTABLE(entries, PFFB_PFT_HASH_BITS);
+        /* Flows being balanced, by key. */
+        DECLARE_HASHTABLE(flows, PFFB_FLOWS_HASH_BITS);
+        /* Removes the timed out flows. */
+        struct delayed_work aging;
 };
 
 /* Definition for one particular destination. */
@@ -88,12 +98,14 @@ struct pft_entry {
         qos_id_t qos_id;
         /* Last port used; for water distribution. */
         unsigned int lpu;
-        struct list_head ports;
-        /* Num. of ports. */
+        /* Next hop ports, and their number. */
+        port_id_t * ports;
         int nop;
-        struct list_head next;
+        struct hlist_node hlist;
 };
 
+#define pft_key(D, Q) ((u32) (D) ^ ((u32) (u16) (Q) << 16))
+
 /*
  * Globals:
  */
@@ -108,12 +120,11 @@ static unsigned int pffb_full_renew = 0;
 /* Flow distribution strategy? */
 static int pffb_distr = PFFB_RAND_DIST;
 
-static struct timespec pffb_load = {0};
+static unsigned long pffb_load = 0;
 
 #define PFFB_NOP 64
 
 static unsigned int pffb_flows[PFFB_NOP] = {0};
-static LIST_HEAD(pffb_flows_info);
 
 /*
  * PFFB sysfs:
@@ -213,231 +224,157 @@ static struct kobj_type pffb_ktype = {
 	.release = pffb_release,
 	.default_attrs = pffb_attrs,
 };
+
 /*
  * Port-status related:
  */
 
-/* Timespec to ms. */
-static inline unsigned long pffb_to_ms(struct timespec * t) {
-	return (t->tv_sec * 1000) + (t->tv_nsec / 1000000);
-}
-
-/* Just remove the entry... */
-static void __pffb_rem_flow(struct flow_info * f) {
-	list_del(&f->next);
-	rkfree(f);
-}
-
 /* Remove a flow entry with a little logic. */
-static void pffb_rem_flow(
-	struct pft_port_entry * port_e,
-	struct flow_info * flow) {
-
-	if(pffb_distr == PFFB_NOF_DIST) {
+static void pffb_rem_flow(struct flow_info * flow) {
+	if(pffb_distr == PFFB_NOF_DIST && flow->port_id < PFFB_NOP) {
 		pffb_flows[flow->port_id] -= flow->rate;
 	}
 
-	LOG_INFO("PFFBI > %x expired on port %d, remains %d",
-		flow->key, flow->port_id, pffb_flows[flow->port_id]);
+	LOG_INFO("PFFBI > %x expired on port %d", flow->key, flow->port_id);
 
-	__pffb_rem_flow(flow);
+	hash_del(&flow->hlist);
+	rkfree(flow);
+}
+
+/* Is the port one of the next hops of the entry? */
+static bool pfte_has_port(struct pft_entry * entry, port_id_t id) {
+	int i;
+
+	for(i = 0; i < entry->nop; i++) {
+		if(entry->ports[i] == id) {
+			return true;
+		}
+	}
 
-	return;
+	return false;
 }
 
-/* Find and update the flow entry. On expiration the entry is removed.
- * Returns -1 if the flow has not found (and so is new).
+/* Find and refresh the flow entry.
+ * Returns a bad port-id if the flow has not found (and so is new).
  */
-static struct pft_port_entry * pffb_find_key(
+static port_id_t pffb_find_key(
+	struct pff_ps_priv * priv,
 	unsigned short key,
 	struct pft_entry * entry) {
 
-	struct pft_port_entry * p = 0;
 	struct flow_info * f = 0;
-	struct flow_info * t = 0;
-	struct timespec now;
 
-	port_id_t pid = -1;
+	hash_for_each_possible(priv->flows, f, hlist, key) {
+		if(f->key == key) {
+			f->la = jiffies;
 
-	switch(pffb_distr) {
-	default:
-		getnstimeofday(&now); /* Only once! */
-
-		list_for_each_entry_safe(f, t, &pffb_flows_info, next) {
-			if(pffb_to_ms(&now) -
-				pffb_to_ms(&f->la) >
-				pffb_flow_timeout) {
-
-				LOG_INFO("PFFBI > %x expired!", f->key);
-				pffb_rem_flow(p, f);
+			if(!pfte_has_port(entry, f->port_id)) {
+				return port_id_bad();
 			}
 
-			if(f->key == key) {
-				f->la.tv_sec  = now.tv_sec;
-				f->la.tv_nsec = now.tv_nsec;
-
-				pid = f->port_id;
-				break;
-			}
+			return f->port_id;
 		}
+	}
 
-		if(pid == -1) {
-			return 0;
-		}
+	return port_id_bad();
+}
 
-		list_for_each_entry(p, &entry->ports, next) {
-			if(p->port_id == pid) {
-				return p;
-			}
+/* Timed out flows are removed here, out of the forwarding path. */
+static void pffb_aging(struct work_struct * work) {
+	struct pff_ps_priv * priv =
+		container_of(to_delayed_work(work), struct pff_ps_priv, aging);
+	struct flow_info * f = 0;
+	struct hlist_node * t = 0;
+	unsigned long timeout = msecs_to_jiffies(pffb_flow_timeout);
+	unsigned long flags = 0;
+	int bkt;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	hash_for_each_safe(priv->flows, bkt, t, f, hlist) {
+		if(time_after(jiffies, f->la + timeout)) {
+			pffb_rem_flow(f);
 		}
-		break;
 	}
+	spin_unlock_irqrestore(&priv->lock, flags);
 
-	return 0;
+	schedule_delayed_work(&priv->aging,
+		msecs_to_jiffies(PFFB_AGING_INTERVAL));
 }
 
-static struct pft_port_entry * pffb_add_key(
+static port_id_t pffb_add_key(
+	struct pff_ps_priv * priv,
 	unsigned short key,
 	unsigned int rate,
 	struct pft_entry * entry,
 	struct flow_info ** fi) {
 
 	struct flow_info * f = 0;
-	struct pft_port_entry * p = 0;
-	struct pft_port_entry * r = 0;
-	struct timespec now;
+	port_id_t r = port_id_bad();
 
 	unsigned int rnd = 0;
-	int t = INT_MAX;
+	unsigned int t = UINT_MAX;
+	int i;
+
+	if(entry->nop < 1) {
+		return port_id_bad();
+	}
 
 	switch(pffb_distr) {
 	/* "Pick a random port" distribution. */
 	case PFFB_RAND_DIST:
-		f = rkzalloc(sizeof(struct flow_info), GFP_KERNEL);
-
-		if(!f) {
-			LOG_ERR("No more memory!");
-			return 0;
-		}
-
-		getnstimeofday(&now);
-
-		INIT_LIST_HEAD(&f->next);
-		f->key = key;
-		f->la.tv_sec = now.tv_sec;
-		f->la.tv_nsec = now.tv_nsec;
-		f->rate = rate;
-
 		get_random_bytes(&rnd, sizeof(unsigned int));
 
-		t = 0;
-		list_for_each_entry(p, &entry->ports, next) {
-			t++;
-		}
-
-		LOG_INFO("PFFBI Rnd=%u, ports=%u, index=%u", rnd, t, rnd % t);
+		LOG_INFO("PFFBI Rnd=%u, ports=%u, index=%u",
+			rnd, entry->nop, rnd % entry->nop);
 
 		/* Stay within the range. */
-		rnd = rnd % t;
-
-		/* Select the port. */
-		t = 0;
-		list_for_each_entry(p, &entry->ports, next) {
-			if(t == rnd) {
-				r = p;
-			}
-
-			t++;
-		}
-
-		if(!r) {
-			LOG_ERR("Next port NOT selected, %u", rnd);
-			rkfree(f);
-			return 0;
-		}
-
-		f->port_id = r->port_id;
-		list_add(&f->next, &pffb_flows_info);
-		*fi = f;
-
-		return r;
+		r = entry->ports[rnd % entry->nop];
+		break;
 
 	/* Default is the NOF distribution. */
 	default:
 		/* Select the less 'used' one, whatever used means to you... */
-		list_for_each_entry(p, &entry->ports, next) {
-			if(p->port_id < PFFB_NOP && p->port_id > 0) {
-				if(pffb_flows[p->port_id] < t) {
-					t = pffb_flows[p->port_id];
-					r = p;
+		for(i = 0; i < entry->nop; i++) {
+			if(entry->ports[i] < PFFB_NOP && entry->ports[i] > 0) {
+				if(pffb_flows[entry->ports[i]] < t) {
+					t = pffb_flows[entry->ports[i]];
+					r = entry->ports[i];
 				}
 			}
 		}
 
-		f = rkzalloc(sizeof(struct flow_info), GFP_KERNEL);
-
-		if(!f) {
-			LOG_ERR("No more memory!");
-			return 0;
+		if(!is_port_id_ok(r)) {
+			return port_id_bad();
 		}
+		break;
+	}
 
-		getnstimeofday(&now);
-
-		INIT_LIST_HEAD(&f->next);
-		f->key = key;
-		f->la.tv_sec = now.tv_sec;
-		f->la.tv_nsec = now.tv_nsec;
-		f->rate = rate;
+	f = rkzalloc(sizeof(struct flow_info), GFP_ATOMIC);
 
-		if(!r) {
-			rkfree(f);
-			return 0;
-		}
+	if(!f) {
+		LOG_ERR("No more memory!");
+		return port_id_bad();
+	}
 
-		f->port_id = r->port_id;
-		list_add(&f->next, &pffb_flows_info);
-		pffb_flows[f->port_id] += rate;
-		*fi = f;
+	f->key = key;
+	f->la = jiffies;
+	f->rate = rate;
+	f->port_id = r;
+	hash_add(priv->flows, &f->hlist, key);
 
-		return r;
+	if(pffb_distr != PFFB_RAND_DIST) {
+		pffb_flows[r] += rate;
 	}
 
-	return 0;
+	*fi = f;
+
+	return r;
 }
 
 /*
  * Procedures:
  */
 
-/* Create a new port entry... with flags... */
-static struct pft_port_entry * pft_pe_create_gfp(
-	gfp_t flags, port_id_t port_id) {
-
-	struct pft_port_entry * tmp = 0;
-
-        tmp = rkmalloc(sizeof(*tmp), flags);
-
-        if (!tmp) {
-                return NULL;
-        }
-
-        tmp->port_id = port_id;
-        INIT_LIST_HEAD(&tmp->next);
-
-        return tmp;
-}
-
-/* Create a new port entry... */
-static struct pft_port_entry * pft_pe_create_ni(port_id_t port_id) {
-	return pft_pe_create_gfp(GFP_ATOMIC, port_id);
-}
-
-/* Destroy the port entry. */
-static void pft_pe_destroy(struct pft_port_entry * pe) {
-        list_del(&pe->next);
-        rkfree(pe);
-}
-
 /* Returns brand new, initialized, entry... with flags... */
 static struct pft_entry * pfte_create_gfp(
 	gfp_t flags, address_t destination, qos_id_t qos_id) {
@@ -452,10 +389,11 @@ static struct pft_entry * pfte_create_gfp(
 
         tmp->destination = destination;
         tmp->qos_id = qos_id;
-        tmp->nop = -1;
+        tmp->lpu = 0;
+        tmp->ports = NULL;
+        tmp->nop = 0;
 
-        INIT_LIST_HEAD(&tmp->ports);
-        INIT_LIST_HEAD(&tmp->next);
+        INIT_HLIST_NODE(&tmp->hlist);
 
         return tmp;
 }
@@ -469,71 +407,59 @@ static struct pft_entry * pfte_create_ni(
 
 /* Destroy da entry... */
 static void pfte_destroy(struct pft_entry * entry) {
-        struct pft_port_entry * pos  = 0;
-        struct pft_port_entry * next = 0;
-
         if(!entry) {
         	LOG_WARN("NULL entry to remove.");
         	return;
         }
 
-        list_for_each_entry_safe(pos, next, &entry->ports, next) {
-                pft_pe_destroy(pos);
+        if (!hlist_unhashed(&entry->hlist)) {
+                hash_del(&entry->hlist);
         }
 
-        list_del(&entry->next);
-        rkfree(entry);
-}
-
-/* Find da port. */
-static struct pft_port_entry * pfte_port_find(
-	struct pft_entry * entry, port_id_t id) {
-
-	struct pft_port_entry * pos = 0;
-
-        list_for_each_entry(pos, &entry->ports, next) {
-                if (pos->port_id == id) {
-                        return pos;
-                }
+        if (entry->ports) {
+                rkfree(entry->ports);
         }
 
-        return NULL;
+        rkfree(entry);
 }
 
 /* Adds da port. */
 static int pfte_port_add(struct pft_entry * entry, port_id_t id) {
-        struct pft_port_entry * pe = 0;
-
-        pe = pfte_port_find(entry, id);
+        port_id_t * ports = 0;
 
-        if (pe) {
+        if (pfte_has_port(entry, id)) {
                 return 0;
         }
 
-        pe = pft_pe_create_ni(id);
+        ports = rkmalloc(sizeof(*ports) * (entry->nop + 1), GFP_ATOMIC);
 
-        if (!pe) {
+        if (!ports) {
                 return -1;
         }
 
-        list_add(&pe->next, &entry->ports);
+        if (entry->nop) {
+                memcpy(ports, entry->ports, sizeof(*ports) * entry->nop);
+                rkfree(entry->ports);
+        }
+
+        ports[entry->nop++] = id;
+        entry->ports = ports;
 
         return 0;
 }
 
 /* Removes da port. */
 static void pfte_port_remove(struct pft_entry * entry, port_id_t id) {
-        struct pft_port_entry * pos  = 0;
-        struct pft_port_entry * next = 0;
+        int i;
 
         if(!entry) {
         	LOG_WARN("NULL entry to remove port from...");
         	return;
         }
 
-        list_for_each_entry_safe(pos, next, &entry->ports, next) {
-                if (pos->port_id == id) {
-                        pft_pe_destroy(pos);
+        for (i = 0; i < entry->nop; i++) {
+                if (entry->ports[i] == id) {
+                        entry->ports[i] = entry->ports[--entry->nop];
                         return;
                 }
         }
@@ -544,7 +470,7 @@ static void pfte_port_remove(struct pft_entry * entry, port_id_t id) {
  * one.
  */
 static int pfte_ports_copy(
-	struct  pft_port_entry * port,
+	port_id_t port,
 	port_id_t ** port_ids,
 	size_t * entries) {
 
@@ -573,7 +499,7 @@ static int pfte_ports_copy(
                 *entries = count;
         }
 
-        (*port_ids)[0] = port->port_id;
+        (*port_ids)[0] = port;
 
         return 0;
 }
@@ -591,7 +517,8 @@ static struct pft_entry * pft_find(
         	return 0;
         }
 
-        list_for_each_entry(pos, &priv->entries, next) {
+        hash_for_each_possible(priv->entries, pos, hlist,
+			       pft_key(destination, qos_id)) {
 		if ((pos->destination == destination) &&
                     (pos->qos_id == qos_id)) {
 
@@ -606,17 +533,16 @@ static struct pft_entry * pft_find(
 /* Do the dirty flush job, but must be protected... "Lock me Onii-chan!" */
 static void pft_do_flush(struct pff_ps_priv * priv) {
         struct pft_entry * pos  = 0;
-        struct pft_entry * next = 0;
-
         struct flow_info * f = 0;
-        struct flow_info * t = 0;
+        struct hlist_node * t = 0;
+        int bkt;
 
-        list_for_each_entry_safe(f, t, &pffb_flows_info, next) {
-		list_del(&f->next);
+        hash_for_each_safe(priv->flows, bkt, t, f, hlist) {
+		hash_del(&f->hlist);
 		rkfree(f);
 	}
 
-        list_for_each_entry_safe(pos, next, &priv->entries, next) {
+        hash_for_each_safe(priv->entries, bkt, t, pos, hlist) {
                 pfte_destroy(pos);
         }
 }
@@ -657,7 +583,8 @@ static int pffb_add(struct pff_ps * ps, struct mod_pff_entry * entry) {
                         return -1;
                 }
 
-                list_add(&tmp->next, &priv->entries);
+                hash_add(priv->entries, &tmp->hlist,
+			 pft_key(entry->fwd_info, entry->qos_id));
         }
 
 	list_for_each_entry(alts, &entry->port_id_altlists, next) {
@@ -723,7 +650,7 @@ static int pffb_remove(struct pff_ps * ps, struct mod_pff_entry * entry) {
 		pfte_port_remove(tmp, alts->ports[0]);
 	}
 
-        if (list_empty(&tmp->ports)) {
+        if (!tmp->nop) {
                 pfte_destroy(tmp);
         }
 	
@@ -744,7 +671,7 @@ static bool pffb_is_empty(struct pff_ps * ps) {
         }
 
         spin_lock(&priv->lock);
-        empty = list_empty(&priv->entries);
+        empty = hash_empty(priv->entries);
         spin_unlock(&priv->lock);
 
         return empty;
@@ -766,11 +693,11 @@ static int pffb_flush(struct pff_ps * ps) {
         return 0;
 }
 
-/* Select the right entry for the next hop alternatives. */
-struct pft_port_entry * pffb_select_entry(
+/* Select the right port for the next hop alternatives. */
+port_id_t pffb_select_entry(
 	struct pft_entry * entry, struct pci * pci, struct pff_ps_priv * priv) {
 
-	struct pft_port_entry * ret = 0;
+	port_id_t ret = port_id_bad();
 	unsigned short key = 0;
 	struct connection_id c_id = {0};
 	struct flow_info * fi = 0;
@@ -795,16 +722,16 @@ struct pft_port_entry * pffb_select_entry(
 
 	rt = 1; /* Weight of the flow. */
 	key = crc16(0, (const u8 *)&c_id, sizeof(struct connection_id));
-	ret = pffb_find_key(key, entry);
+	ret = pffb_find_key(priv, key, entry);
 
 	/* New entry...
 	 * NOTE: some fwd type will never enter here, for example
 	 * 	- Water distribution.
 	 */
-	if(!ret) {
-		ret = pffb_add_key(key, rt, entry, &fi);
+	if(!is_port_id_ok(ret)) {
+		ret = pffb_add_key(priv, key, rt, entry, &fi);
 
-		if(!ret) {
+		if(!is_port_id_ok(ret)) {
 			LOG_ALERT("Could not select next HOP for %x!", key);
 		} else {
 			if(!fi) {
@@ -814,9 +741,8 @@ struct pft_port_entry * pffb_select_entry(
 			LOG_INFO("PFFBI > (%d-%u <--> %d-%u, qos:%d), "
 				"hash=%x, "
 				"isM?=%d, "
-				"on=%lu.%lu, "
-				"port=%d, "
-				"flows=%d",
+				"on=%u ms, "
+				"port=%d",
 				c_id.pci_source,
 				c_id.pci_cep_source,
 				c_id.pci_destination,
@@ -824,10 +750,8 @@ struct pft_port_entry * pffb_select_entry(
 				entry->qos_id,
 				key,
 				m,
-				fi->la.tv_sec - pffb_load.tv_sec,
-				fi->la.tv_nsec / 1000000,
-				ret->port_id,
-				pffb_flows[ret->port_id]);
+				jiffies_to_msecs(fi->la - pffb_load),
+				ret);
 		}
 	}
 
@@ -848,7 +772,7 @@ static int pffb_next_hop(
 
         struct pff_ps_priv * priv = 0;
         struct pft_entry * tmp = 0;
-	struct pft_port_entry * port = 0;
+	port_id_t port = port_id_bad();
 
         priv = (struct pff_ps_priv *) ps->priv;
 
@@ -893,7 +817,7 @@ static int pffb_next_hop(
 
         port = pffb_select_entry(tmp, pci, priv);
 
-        if(!port) {
+        if(!is_port_id_ok(port)) {
         	LOG_ERR("Could not select next port!");
         	spin_unlock_irqrestore(&priv->lock, flags);
         	return -1;
@@ -914,11 +838,11 @@ static int pffb_next_hop(
 static int pfte_copy_alts(
 	struct pft_entry * entry, struct list_head * port_id_altlists) {
 
-	struct pft_port_entry * pos = 0;
 	struct port_id_altlist * alt = 0;
 	int cnt = 1;
+	int i;
 
-        list_for_each_entry(pos, &entry->ports, next) {
+        for (i = 0; i < entry->nop; i++) {
 		alt = rkmalloc(sizeof(*alt), GFP_ATOMIC);
 
 		if (!alt) {
@@ -934,7 +858,7 @@ static int pfte_copy_alts(
 			return -1;
 		}
 
-		alt->ports[0]  = pos->port_id;
+		alt->ports[0]  = entry->ports[i];
 		alt->num_ports = cnt;
 
 		list_add_tail(&alt->next, port_id_altlists);
@@ -948,6 +872,7 @@ static int pffb_dump(struct pff_ps * ps, struct list_head * entries) {
         struct pff_ps_priv * priv = 0;
         struct pft_entry * pos = 0;
         struct mod_pff_entry * entry = 0;
+        int bkt;
 
         priv = (struct pff_ps_priv *) ps->priv;
 
@@ -957,7 +882,7 @@ static int pffb_dump(struct pff_ps * ps, struct list_head * entries) {
         }
 
         spin_lock(&priv->lock);
-        list_for_each_entry(pos, &priv->entries, next) {
+        hash_for_each(priv->entries, bkt, pos, hlist) {
                 entry = rkmalloc(sizeof(*entry), GFP_ATOMIC);
 
                 if (!entry) {
@@ -1007,7 +932,6 @@ static struct ps_base * pffb_create(struct rina_component * component) {
         struct pff_ps * ps;
         struct pff_ps_priv * priv;
         struct pff * pff = pff_from_component(component);
-        struct timespec n;
 
         priv = rkzalloc(sizeof(*priv), GFP_KERNEL);
 
@@ -1017,7 +941,9 @@ static struct ps_base * pffb_create(struct rina_component * component) {
         }
 
         spin_lock_init(&priv->lock);
-        INIT_LIST_HEAD(&priv->entries);
+        hash_init(priv->entries);
+        hash_init(priv->flows);
+        INIT_DELAYED_WORK(&priv->aging, pffb_aging);
 
         ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
 
@@ -1027,9 +953,7 @@ static struct ps_base * pffb_create(struct rina_component * component) {
                 return NULL;
         }
 
-        getnstimeofday(&n);
-        pffb_load.tv_sec  = n.tv_sec;
-        pffb_load.tv_nsec = n.tv_nsec;
+        pffb_load = jiffies;
 
         ps->base.set_policy_set_param = pffb_set_param;
         ps->dm = pff;
@@ -1042,6 +966,9 @@ static struct ps_base * pffb_create(struct rina_component * component) {
         ps->pff_nhop = pffb_next_hop;
         ps->pff_dump = pffb_dump;
 
+	schedule_delayed_work(&priv->aging,
+		msecs_to_jiffies(PFFB_AGING_INTERVAL));
+
 	LOG_DBG("PFFB instance created...");
 
         return &ps->base;
@@ -1058,6 +985,8 @@ static void pffb_destroy(struct ps_base * bps) {
 		return;
 	}
 
+	cancel_delayed_work_sync(&priv->aging);
+
 	spin_lock(&priv->lock);
 	pft_do_flush(priv);
 	spin_unlock(&priv->lock);
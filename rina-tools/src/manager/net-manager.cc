@@ -35,8 +35,6 @@
 
 #include <rina/api.h>
 
-//TODO Add cache with managed system names - system id
-
 //Class NMConsole
 class CreateDIFsConsoleCmd: public rina::ConsoleCmdInfo {
 public:
@@ -714,30 +712,46 @@ void NetworkManager::n1_flow_accepted(const char * incoming_apn, int fd)
 	rina::cdap::add_fd_to_port_id_mapping(fd, fd);
 }
 
-int NetworkManager::assign_system_id(void)
+int NetworkManager::assign_system_id(ManagedSystem * system)
 {
-	rina::ScopedLock(et->lock);
-	int candidate = 1;
-	std::map<std::string, ManagedSystem *>::iterator it;
-	bool assigned;
+	rina::ScopedLock g(et->lock);
+	int candidate;
 
 	for (candidate = 1; candidate < 2000; candidate ++) {
-		assigned = false;
-		for (it = et->enrolled_systems.begin();
-				it != et->enrolled_systems.end(); ++it) {
-			if (it->second->system_id == candidate) {
-				assigned = true;
-				break;
-			}
-		}
-
-		if (!assigned)
+		if (et->systems_by_id.find(candidate) == et->systems_by_id.end())
 			break;
 	}
 
+	system->system_id = candidate;
+	et->systems_by_id[candidate] = system;
+
 	return candidate;
 }
 
+ManagedSystem * NetworkManager::find_system(int system_id)
+{
+	std::map<int, ManagedSystem *>::iterator it;
+	rina::ScopedLock g(et->lock);
+
+	it = et->systems_by_id.find(system_id);
+	if (it == et->systems_by_id.end())
+		return NULL;
+
+	return it->second;
+}
+
+ManagedSystem * NetworkManager::find_system(const std::string& system_name)
+{
+	std::map<std::string, ManagedSystem *>::iterator it;
+	rina::ScopedLock g(et->lock);
+
+	it = et->enrolled_systems.find(system_name);
+	if (it == et->enrolled_systems.end())
+		return NULL;
+
+	return it->second;
+}
+
 void NetworkManager::disconnect_from_system_async(int fd)
 {
 	DisconnectFromSystemTimerTask * ttask;
@@ -763,6 +777,7 @@ void NetworkManager::disconnect_from_system(int fd)
 		if (it->second->con.port_id == (unsigned int) fd) {
 			ms = it->second;
 			et->enrolled_systems.erase(it);
+			et->systems_by_id.erase(ms->system_id);
 			break;
 		}
 	}
@@ -809,7 +824,7 @@ void NetworkManager::enrollment_completed(struct ManagedSystem * system)
 			system->con.dest_.ap_name_.c_str(),
 			system->con.dest_.ap_inst_.c_str());
 
-	system->system_id = assign_system_id();
+	assign_system_id(system);
 
 	//Add RIB objects for the managed system
 	try {
@@ -924,7 +939,7 @@ void NetworkManager::list_systems(std::ostream& os)
 
 	os << "Current Managed Systems (system id | MA name | port-id)" << std::endl;
 
-	rina::ScopedLock(et->lock);
+	rina::ScopedLock g(et->lock);
 
 	for (it = et->enrolled_systems.begin();
 			it != et->enrolled_systems.end(); ++it) {
@@ -938,22 +953,11 @@ void NetworkManager::list_systems(std::ostream& os)
 netman_res_t NetworkManager::create_ipcp(CreateIPCPPromise * promise, int system_id,
 			 	 	 const std::string& ipcp_desc)
 {
-	std::map<std::string, ManagedSystem *>::iterator it;
 	ManagedSystem * mas;
 	rinad::configs::ipcp_config_t ipcp_config;
 
 	//1 Retrieve system from system-id, if it doesn't exist, return error
-	mas = NULL;
-	et->lock.lock();
-	for (it = et->enrolled_systems.begin();
-			it != et->enrolled_systems.end(); ++it) {
-		if (it->second->system_id == system_id) {
-			mas = it->second;
-			break;
-		}
-	}
-	et->lock.unlock();
-
+	mas = find_system(system_id);
 	if (!mas) {
 		LOG_ERR("Could not find Managed System with id %d", system_id);
 		return NETMAN_FAILURE;
@@ -1037,7 +1041,6 @@ void NetworkManager::remoteCreateResult(const rina::cdap_rib::con_handle_t &con,
 	int ipcp_id;
 	rina::rib::RIBObj * rib_obj;
 	ManagedSystem * mas;
-	std::map<std::string, ManagedSystem *>::iterator it;
 
 	ss << con.port_id << "-" << obj.name_.substr(0, obj.name_.find("ipcpid") + 6);
 
@@ -1062,17 +1065,7 @@ void NetworkManager::remoteCreateResult(const rina::cdap_rib::con_handle_t &con,
 
 	// Mark transaction as completed
 	if (res.code_ == rina::cdap_rib::CDAP_SUCCESS) {
-		mas = NULL;
-		et->lock.lock();
-		for (it = et->enrolled_systems.begin();
-				it != et->enrolled_systems.end(); ++it) {
-			if (it->second->system_id == trans->system_id) {
-				mas = it->second;
-				break;
-			}
-		}
-		et->lock.unlock();
-
+		mas = find_system(trans->system_id);
 		if (!mas) {
 			LOG_WARN("Could not find Managed System with id %d", trans->system_id);
 			if (trans->ipcp_desc)
@@ -1095,12 +1088,46 @@ void NetworkManager::remoteCreateResult(const rina::cdap_rib::con_handle_t &con,
 	remove_transaction_state(trans->tid);
 }
 
+//Class DIFBuildPlan
+DIFBuildPlan::DIFBuildPlan(const DIFDescriptor& dif_desc)
+{
+	std::map<std::string, unsigned int> ipcp_stage;
+	std::map<std::string, unsigned int> system_next_stage;
+	std::map<std::string, unsigned int>::iterator sit;
+	std::list<IPCPDescriptor>::const_iterator it;
+	std::list<rina::Neighbor>::const_iterator nit;
+	unsigned int stage;
+
+	for (it = dif_desc.ipcps.begin(); it != dif_desc.ipcps.end(); ++it) {
+		// Only one IPCP creation per system can be outstanding
+		stage = 0;
+		sit = system_next_stage.find(it->system_name);
+		if (sit != system_next_stage.end())
+			stage = sit->second;
+
+		// Neighbors described later enroll to this IPCP instead
+		for (nit = it->neighbors.begin(); nit != it->neighbors.end(); ++nit) {
+			sit = ipcp_stage.find(nit->name_.processName);
+			if (sit != ipcp_stage.end() && sit->second >= stage)
+				stage = sit->second + 1;
+		}
+
+		ipcp_stage[it->system_name + "." + it->dif_name] = stage;
+		system_next_stage[it->system_name] = stage + 1;
+
+		if (stages.size() <= stage)
+			stages.resize(stage + 1);
+		stages[stage].push_back(&(*it));
+	}
+}
+
 netman_res_t NetworkManager::create_dif(std::map<std::string, int>& result,
 					const std::string& dif_desc)
 {
 	DIFDescriptor ddesc;
-	std::list<IPCPDescriptor>::iterator it;
-	std::map<std::string, ManagedSystem *>::iterator mit;
+	std::list<const IPCPDescriptor *>::iterator it;
+	std::map<const IPCPDescriptor *, CreateIPCPPromise *> promises;
+	std::map<const IPCPDescriptor *, CreateIPCPPromise *>::iterator pit;
 	ManagedSystem * mas;
 
 	if (dtm->parse_dif_descriptor(dif_desc, ddesc)) {
@@ -1108,45 +1135,59 @@ netman_res_t NetworkManager::create_dif(std::map<std::string, int>& result,
 		return NETMAN_FAILURE;
 	}
 
-	for ( it = ddesc.ipcps.begin(); it != ddesc.ipcps.end(); ++it) {
-		rinad::configs::ipcp_config_t ipcp_config;
-		CreateIPCPPromise promise;
+	DIFBuildPlan plan(ddesc);
+
+	LOG_INFO("Creating DIF %s: %lu IPCPs in %lu stages",
+		 ddesc.dif_name.c_str(), (unsigned long) ddesc.ipcps.size(),
+		 (unsigned long) plan.stages.size());
+
+	for (unsigned int i = 0; i < plan.stages.size(); i++) {
+		// Request the creation of all the IPCPs of the stage
+		for (it = plan.stages[i].begin(); it != plan.stages[i].end(); ++it) {
+			rinad::configs::ipcp_config_t ipcp_config;
+			CreateIPCPPromise * promise;
+
+			//1 Retrieve system from system-name, if it doesn't exist, continue
+			mas = find_system((*it)->system_name);
+			if (!mas) {
+				LOG_ERR("Could not find Managed System with name %s",
+					(*it)->system_name.c_str());
+				result[(*it)->system_name] = -1;
+				continue;
+			}
 
-		//1 Retrieve system from system-name, if it doesn't exist, continue
-		mas = NULL;
-		et->lock.lock();
-		for (mit = et->enrolled_systems.begin();
-				mit != et->enrolled_systems.end(); ++mit) {
-			if (mit->second->con.dest_.ap_name_ == it->system_name) {
-				mas = mit->second;
-				break;
+			//2 Get IPCP configuration from IPCP descriptor
+			if (dtm->__get_ipcp_config_from_desc(ipcp_config,
+							     (*it)->system_name, **it)) {
+				LOG_ERR("Error getting IPCP configuration");
+				result[(*it)->system_name] = -1;
+				continue;
 			}
-		}
-		et->lock.unlock();
 
-		if (!mas) {
-			LOG_ERR("Could not find Managed System with name %s",
-				it->system_name.c_str());
-			result[it->system_name] = -1;
-			continue;
-		}
+			//3 Create IPCP process
+			promise = new CreateIPCPPromise();
+			if (create_ipcp(promise, mas, ipcp_config) == NETMAN_FAILURE) {
+				LOG_ERR("Error while creating IPC process");
+				result[(*it)->system_name] = -1;
+				delete promise;
+				continue;
+			}
 
-		//2 Get IPCP configuration from IPCP descriptor
-		if (dtm->__get_ipcp_config_from_desc(ipcp_config,
-						     it->system_name, *it)) {
-			LOG_ERR("Error getting IPCP configuration");
-			result[it->system_name] = -1;
-			continue;
+			promises[*it] = promise;
 		}
 
-		//3 Create IPCP process and wait for result
-		if(create_ipcp(&promise, mas, ipcp_config) == NETMAN_FAILURE ||
-				promise.wait() != NETMAN_SUCCESS){
-			LOG_ERR("Error while creating IPC process");
-			result[it->system_name] = -1;
-		} else {
-			result[it->system_name] = promise.ipcp_id;
+		//4 Wait for the whole stage to complete
+		for (pit = promises.begin(); pit != promises.end(); ++pit) {
+			if (pit->second->wait() != NETMAN_SUCCESS) {
+				LOG_ERR("Error while creating IPC process");
+				result[pit->first->system_name] = -1;
+			} else {
+				result[pit->first->system_name] = pit->second->ipcp_id;
+			}
+
+			delete pit->second;
 		}
+		promises.clear();
 	}
 
 	return NETMAN_SUCCESS;
@@ -1158,8 +1199,10 @@ netman_res_t NetworkManager::destroy_dif(std::map<int, int>& result,
 	std::map<std::string, ManagedSystem *>::iterator it;
 	std::map<int, IPCPDescriptor *>::iterator cit;
 	std::map<int, int>::iterator ipcpit;
+	std::map<int, Promise *> promises;
+	std::map<int, Promise *>::iterator pit;
 	ManagedSystem * mas;
-	Promise promise;
+	Promise * promise;
 	int ipcp_id;
 
 	// 1 Get systems and IPCPs in DIFs
@@ -1188,14 +1231,29 @@ netman_res_t NetworkManager::destroy_dif(std::map<int, int>& result,
 		return NETMAN_FAILURE;
 	}
 
-	// 2 Request destruction of IPCPs
+	// 2 Request destruction of all the IPCPs, they are independent
 	for (ipcpit = result.begin(); ipcpit != result.end(); ipcpit++) {
-		if(destroy_ipcp(&promise, ipcpit->first, ipcpit->second) == NETMAN_FAILURE ||
-				promise.wait() != NETMAN_SUCCESS){
+		promise = new Promise();
+		if(destroy_ipcp(promise, ipcpit->first, ipcpit->second) == NETMAN_FAILURE) {
 			LOG_WARN("Error destroying IPCP %d at system %d",
 					ipcpit->second, ipcpit->first);
-			result[ipcpit->first] = -1;
+			ipcpit->second = -1;
+			delete promise;
+			continue;
 		}
+
+		promises[ipcpit->first] = promise;
+	}
+
+	// 3 Wait for all of them
+	for (pit = promises.begin(); pit != promises.end(); ++pit) {
+		if (pit->second->wait() != NETMAN_SUCCESS) {
+			LOG_WARN("Error destroying IPCP %d at system %d",
+					result[pit->first], pit->first);
+			result[pit->first] = -1;
+		}
+
+		delete pit->second;
 	}
 
 	return NETMAN_SUCCESS;
@@ -1204,7 +1262,6 @@ netman_res_t NetworkManager::destroy_dif(std::map<int, int>& result,
 netman_res_t NetworkManager::destroy_ipcp(Promise * promise, int system_id, int ipcp_id)
 {
 	MASystemTransState * trans;
-	std::map<std::string, ManagedSystem *>::iterator it;
 	ManagedSystem * mas;
 	rina::cdap_rib::res_info_t res;
 	rina::cdap_rib::obj_info_t obj_info;
@@ -1213,16 +1270,7 @@ netman_res_t NetworkManager::destroy_ipcp(Promise * promise, int system_id, int
         std::stringstream ss;
 
 	//1 Retrieve system from system-id, if it doesn't exist, return error
-        mas = NULL;
-	et->lock.lock();
-	for (it = et->enrolled_systems.begin();
-			it != et->enrolled_systems.end(); ++it) {
-		if (it->second->system_id == system_id) {
-			mas = it->second;
-		}
-	}
-	et->lock.unlock();
-
+	mas = find_system(system_id);
 	if (!mas) {
 		LOG_ERR("Could not find Managed System with id %d", system_id);
 		return NETMAN_FAILURE;
@@ -1267,7 +1315,6 @@ void NetworkManager::remoteDeleteResult(const rina::cdap_rib::con_handle_t &con,
 	std::stringstream ss;
 	MASystemTransState * trans;
 	ManagedSystem * mas;
-	std::map<std::string, ManagedSystem *>::iterator it;
 	std::map<int, IPCPDescriptor *>::iterator cit;
 	int ipcp_id;
 
@@ -1287,18 +1334,8 @@ void NetworkManager::remoteDeleteResult(const rina::cdap_rib::con_handle_t &con,
 
 	// Mark transaction as completed
 	if (res.code_ == rina::cdap_rib::CDAP_SUCCESS) {
-		//1 Retrieve system from system-name, if it doesn't exist, continue
-		mas = NULL;
-		et->lock.lock();
-		for (it = et->enrolled_systems.begin();
-				it != et->enrolled_systems.end(); ++it) {
-			if (it->second->system_id == trans->system_id) {
-				mas = it->second;
-				break;
-			}
-		}
-		et->lock.unlock();
-
+		//1 Retrieve system from system-id, if it doesn't exist, continue
+		mas = find_system(trans->system_id);
 		if (!mas) {
 			LOG_WARN("Could not find Managed System with id %d", trans->system_id);
 		} else {
@@ -28,7 +28,9 @@
 #ifndef NET_MANAGER_HPP
 #define NET_MANAGER_HPP
 
+#include <list>
 #include <string>
+#include <vector>
 #include <librina/cdap_v2.h>
 #include <librina/concurrency.h>
 #include <librina/console.h>
@@ -297,8 +299,13 @@ public:
 				const std::string& dif_name, int port_id);
 
 	rina::Lockable lock;
+
+	/* Managed systems indexed by name */
 	std::map<std::string, ManagedSystem *> enrolled_systems;
 
+	/* The same systems indexed by system id, once it has been assigned */
+	std::map<int, ManagedSystem *> systems_by_id;
+
 private:
 	NetworkManager * nm;
 };
@@ -355,6 +362,20 @@ private:
 	rina::Lockable lock_;
 };
 
+//
+// The IPCPs of a DIF grouped in stages that can be created concurrently.
+// An IPCP is created after the IPCPs it enrolls to that are described
+// before it, and after the previous IPCP of its system, so the number of
+// stages is the depth of the enrollment graph instead of the number of
+// IPCPs
+//
+class DIFBuildPlan {
+public:
+	DIFBuildPlan(const DIFDescriptor& dif_desc);
+
+	std::vector<std::list<const IPCPDescriptor *> > stages;
+};
+
 // Uses one thread per connected Management Agent (it is
 // ok for demonstration purposes, consider changing to
 // non-blocking I/O and a state machine approach to improve
@@ -406,7 +427,9 @@ public:
 
 private:
         void n1_flow_accepted(const char * incoming_apn, int fd);
-        int assign_system_id(void);
+        int assign_system_id(ManagedSystem * system);
+        ManagedSystem * find_system(int system_id);
+        ManagedSystem * find_system(const std::string& system_name);
         netman_res_t create_ipcp(CreateIPCPPromise * promise, ManagedSystem * mas,
         			 rinad::configs::ipcp_config_t& ipcp_config);
 
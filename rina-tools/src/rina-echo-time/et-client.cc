@@ -38,6 +38,7 @@
 #include <limits.h>
 #include <iomanip>
 #include <cerrno>
+#include <fstream>
 
 #define RINA_PREFIX "rina-echo-time"
 #include <librina/ipc-api.h>
@@ -124,14 +125,15 @@ Client::Client(const string& t_type,
                bool q, unsigned long count,
                bool registration, unsigned int size,
                int w, int g, int dw, unsigned int lw, int rt,
-	       unsigned int delay_, unsigned int loss_) :
+	       unsigned int delay_, unsigned int loss_, const string& csv) :
         Application(dif_nms, apn, api), test_type(t_type), dif_name(dif_nms.front()),
         server_name(server_apn), server_instance(server_api),
         quiet(q), echo_times(count),
         client_app_reg(registration), data_size(size), wait(w), gap(g),
         dealloc_wait(dw), lost_wait(lw), rate(rt),  delay(delay_), loss(loss_),
-	snd(0), nsdus(0), m2(0), sdus_received(0), min_rtt(LONG_MAX), max_rtt(0),
-	average_rtt(0), port_id(-1), fd(-1)
+	csv_file(csv), ring(0), snd(0), nsdus(0), m2(0), sdus_received(0),
+	min_rtt(LONG_MAX), max_rtt(0), average_rtt(0), maxtp_ns(0), port_id(-1),
+	fd(-1)
 {
 }
 
@@ -401,6 +403,7 @@ read:
 void Client::floodFlow()
 {
 	unsigned long sdus_sent = 0;
+	unsigned long untracked = 0;
 	double variance = 0, stdev = 0;
 	timespec endtp, begintp, mtp; //, mintp
 	unsigned long sn;
@@ -408,6 +411,10 @@ void Client::floodFlow()
 	double current_rtt = 0;
 	unsigned char *buffer2 = new unsigned char[max_buffer_size];
 
+	// Large enough to hold all the SDUs of the test in flight, up to 1M
+	ring = new TimestampRing(echo_times < (1UL << 20) ?
+				 echo_times : (1UL << 20));
+
 	snd = startSender();
 	cout << "Sender started" << endl;
 	while(true) {
@@ -427,15 +434,11 @@ void Client::floodFlow()
 
 		get_current_time(endtp);
 
-		lock.lock();
-		mtp = maxtp;
-		lock.unlock();
+		get_maxTP(mtp);
 		if (bytes_read <= 0) {
 			LOG_WARN("Returned 0 bytes, SDU considered lost");
 			double mtime = time_difference_in_ms(mtp, endtp);
-			lock.lock();
-			sdus_sent = nsdus;
-			lock.unlock();
+			sdus_sent = __atomic_load_n(&nsdus, __ATOMIC_ACQUIRE);
 			if (mtime > lost_wait && (sdus_sent == echo_times)) {
 				cout << "Experiment finished: " << mtime << endl;
 				break;
@@ -445,29 +448,29 @@ void Client::floodFlow()
 		}
 
 		memcpy(&sn, buffer2, sizeof(sn));
-		lock.lock();
 		sdus_received++;
-		if (m.find(sn) != m.end()) {
-			begintp = m[sn];
-			m.erase(sn);
-		}
-		lock.unlock();
-		current_rtt = time_difference_in_ms(begintp, endtp);
-		if (current_rtt < min_rtt) {
-			min_rtt = current_rtt;
-		}
-		if (current_rtt > max_rtt) {
-			max_rtt = current_rtt;
-		}
+		if (ring->take(sn, begintp)) {
+			current_rtt = time_difference_in_ms(begintp, endtp);
+			if (current_rtt < min_rtt) {
+				min_rtt = current_rtt;
+			}
+			if (current_rtt > max_rtt) {
+				max_rtt = current_rtt;
+			}
 
-		delta = current_rtt - average_rtt;
-		average_rtt = average_rtt + delta/(double)sdus_received;
-		m2 = m2 + delta*(current_rtt - average_rtt);
+			histogram.record(current_rtt > 0 ?
+					 (unsigned long) (current_rtt * 1000) : 0);
+			delta = current_rtt - average_rtt;
+			average_rtt = average_rtt +
+				delta/(double)histogram.get_count();
+			m2 = m2 + delta*(current_rtt - average_rtt);
+		} else {
+			// Duplicated, or the sender has overwritten its slot
+			untracked++;
+		}
 
 		double mtime = time_difference_in_ms(mtp, endtp);
-		lock.lock();
-		sdus_sent = nsdus;
-		lock.unlock();
+		sdus_sent = __atomic_load_n(&nsdus, __ATOMIC_ACQUIRE);
 		if (mtime > lost_wait ||
 				(sdus_sent == echo_times && sdus_sent == sdus_received)) {
 			break;
@@ -475,11 +478,9 @@ void Client::floodFlow()
 
 	}
 
-	lock.lock();
-	sdus_sent = nsdus;
-	lock.unlock();
+	sdus_sent = __atomic_load_n(&nsdus, __ATOMIC_ACQUIRE);
 
-	variance = m2/((double)sdus_received -1);
+	variance = m2/((double)histogram.get_count() -1);
 	stdev = sqrt(variance);
 
 	unsigned long rt = 0;
@@ -489,10 +490,31 @@ void Client::floodFlow()
 	     << "Minimum RTT: " << min_rtt << " ms; Maximum RTT: " << max_rtt
 			<< " ms; Average RTT:" << average_rtt
 			<< " ms; Standard deviation: " << stdev<<" ms"<<endl;
+	if (untracked)
+		cout << untracked << " SDUs without send time (ring of "
+		     << ring->size() << " entries)" << endl;
+	printLatencies();
 
 	delete [] buffer2;
 }
 
+void Client::printLatencies()
+{
+	histogram.print_percentiles(cout);
+
+	if (csv_file.empty())
+		return;
+
+	ofstream csv(csv_file.c_str());
+	if (!csv) {
+		LOG_ERR("Cannot open %s", csv_file.c_str());
+		return;
+	}
+
+	histogram.write_csv(csv);
+	LOG_INFO("RTT histogram written to %s", csv_file.c_str());
+}
+
 void Client::perfFlow()
 {
         char *buffer;
@@ -589,23 +611,28 @@ Sender * Client::startSender()
         return sender;
 }
 
-void Client::map_push(unsigned long sn, timespec tp)
+void Client::map_push(unsigned long sn, const timespec& tp)
 {
-	ScopedLock g(lock);
-        m[sn] = tp;
-
+	ring->push(sn, tp);
 }
 
 void Client::set_sdus(unsigned long n)
 {
-	ScopedLock g(lock);
-        nsdus = n;
+	__atomic_store_n(&nsdus, n, __ATOMIC_RELEASE);
 }
 
-void Client::set_maxTP(timespec tp)
+void Client::set_maxTP(const timespec& tp)
 {
-	ScopedLock g(lock);
-        maxtp = tp;
+	__atomic_store_n(&maxtp_ns, tp.tv_sec * 1000000000LL + tp.tv_nsec,
+			 __ATOMIC_RELEASE);
+}
+
+void Client::get_maxTP(timespec& tp)
+{
+	long long ns = __atomic_load_n(&maxtp_ns, __ATOMIC_ACQUIRE);
+
+	tp.tv_sec = ns / 1000000000LL;
+	tp.tv_nsec = ns % 1000000000LL;
 }
 
 void Client::cancelFloodFlow()
@@ -625,6 +652,7 @@ void Client::startCancelFloodFlowTask()
 
 Client::~Client()
 {
+	delete ring;
 }
 
 CFloodCancelFlowTimerTask::CFloodCancelFlowTimerTask(int pid, Client * cl)
@@ -714,6 +742,7 @@ int Sender::run(void)
 		memcpy(buffer, &n, sizeof(n));
 
 		get_current_time(begintp);
+		client->map_push(n, begintp);
 		ret = write(fd, buffer, data_size);
                 if (ret != (int)data_size) {
                         if (errno == EAGAIN) {
@@ -732,7 +761,6 @@ int Sender::run(void)
                         break;
                 }
 
-		client->map_push(n, begintp);
 		sdus_sent++;
 		get_current_time(maxtp);
 		client->set_maxTP(maxtp);
@@ -33,6 +33,7 @@
 #include <librina/timer.h>
 
 #include "application.h"
+#include "et-latency.h"
 
 
 class Client;
@@ -91,12 +92,13 @@ public:
                unsigned int lw,
                int rt,
                unsigned int delay,
-	       unsigned int loss);
+	       unsigned int loss,
+	       const std::string& csv_file);
        void run();
        int readTimeout(void * sdu, int maxBytes, unsigned int timout);
-       void map_push(unsigned long sn, timespec tp);
+       void map_push(unsigned long sn, const timespec& tp);
        void set_sdus(unsigned long n);
-       void set_maxTP(timespec tp);
+       void set_maxTP(const timespec& tp);
        void cancelFloodFlow();
        void startCancelFloodFlowTask();
        ~Client();
@@ -123,18 +125,22 @@ private:
         int rate;
         unsigned int delay;
         unsigned int loss;
+        std::string csv_file;
         rina::Sleep sleep_wrapper;
         Sender * startSender();
-        rina::Lockable lock;
-        std::map<unsigned long, timespec> m;
+        void get_maxTP(timespec& tp);
+        void printLatencies();
+        TimestampRing * ring;
+        LatencyHistogram histogram;
         Sender * snd;
+        // Written by the sender, read by the receiver with __atomic builtins
         unsigned long nsdus;
         double m2;
         unsigned long sdus_received;
         double min_rtt;
         double max_rtt;
         double average_rtt;
-        timespec maxtp;
+        long long maxtp_ns;
         CFloodCancelFlowTimerTask * cflood_task;
         int port_id;
         int fd;
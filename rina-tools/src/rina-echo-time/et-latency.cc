@@ -0,0 +1,190 @@
+//
+// Latency bookkeeping of the echo client
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   1. Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//   2. Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+
+#include <iomanip>
+
+#include "et-latency.h"
+
+//Class TimestampRing
+TimestampRing::TimestampRing(unsigned long min_size)
+{
+	unsigned long size = 1024;
+
+	while (size < min_size)
+		size <<= 1;
+
+	slots.resize(size);
+	for (unsigned long i = 0; i < size; i++)
+		slots[i].seq = 0;
+	mask = size - 1;
+}
+
+void TimestampRing::push(unsigned long sn, const timespec& tp)
+{
+	Slot& slot = slots[sn & mask];
+
+	// Invalidate the slot while it is rewritten, so that the reader
+	// does not take a half written timestamp
+	__atomic_store_n(&slot.seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&slot.tv_sec, tp.tv_sec, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot.tv_nsec, tp.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot.seq, sn + 1, __ATOMIC_RELEASE);
+}
+
+bool TimestampRing::take(unsigned long sn, timespec& tp)
+{
+	Slot& slot = slots[sn & mask];
+	unsigned long seq;
+
+	seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+	if (seq != sn + 1)
+		return false;
+
+	tp.tv_sec = __atomic_load_n(&slot.tv_sec, __ATOMIC_RELAXED);
+	tp.tv_nsec = __atomic_load_n(&slot.tv_nsec, __ATOMIC_RELAXED);
+
+	// Fails if the sender has reused the slot meanwhile. Each sn is
+	// stored only once, so seq cannot go back to sn + 1
+	return __atomic_compare_exchange_n(&slot.seq, &seq, 0, false,
+					   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+unsigned long TimestampRing::size() const
+{
+	return slots.size();
+}
+
+//Class LatencyHistogram
+LatencyHistogram::LatencyHistogram(unsigned long max_value_us) :
+		max_value(max_value_us), count(0), min(0), max(0), sum(0)
+{
+	counts.resize(bucket_index(max_value) + 1, 0);
+}
+
+unsigned int LatencyHistogram::bucket_index(unsigned long value) const
+{
+	unsigned int msb, shift;
+
+	msb = sizeof(unsigned long) * 8 - 1 - __builtin_clzl(value | 1);
+	shift = msb < SUB_BUCKET_BITS ? 0 : msb - (SUB_BUCKET_BITS - 1);
+
+	return (shift << (SUB_BUCKET_BITS - 1)) + (value >> shift);
+}
+
+unsigned long LatencyHistogram::bucket_value(unsigned int index) const
+{
+	unsigned int half = 1 << (SUB_BUCKET_BITS - 1);
+	unsigned int shift;
+
+	if (index < 2 * half)
+		return index;
+
+	// Middle of the range of values of the bucket
+	shift = index / half - 1;
+	return ((unsigned long) (index - shift * half) << shift) +
+		(1UL << (shift - 1));
+}
+
+void LatencyHistogram::record(unsigned long value_us)
+{
+	if (value_us > max_value)
+		value_us = max_value;
+
+	counts[bucket_index(value_us)]++;
+
+	if (count == 0 || value_us < min)
+		min = value_us;
+	if (value_us > max)
+		max = value_us;
+	sum += value_us;
+	count++;
+}
+
+unsigned long LatencyHistogram::get_count() const
+{
+	return count;
+}
+
+unsigned long LatencyHistogram::get_min() const
+{
+	return min;
+}
+
+unsigned long LatencyHistogram::get_max() const
+{
+	return max;
+}
+
+double LatencyHistogram::get_mean() const
+{
+	return count ? sum / count : 0;
+}
+
+unsigned long LatencyHistogram::get_percentile(double percentile) const
+{
+	unsigned long target, seen = 0;
+
+	if (count == 0)
+		return 0;
+
+	target = (unsigned long) (percentile / 100 * count + 0.5);
+	if (target == 0)
+		target = 1;
+
+	for (unsigned int i = 0; i < counts.size(); i++) {
+		seen += counts[i];
+		if (seen >= target)
+			return bucket_value(i) > max ? max : bucket_value(i);
+	}
+
+	return max;
+}
+
+void LatencyHistogram::print_percentiles(std::ostream& os) const
+{
+	os << "RTT percentiles (us): p50 " << get_percentile(50)
+	   << "; p90 " << get_percentile(90)
+	   << "; p99 " << get_percentile(99)
+	   << "; p99.9 " << get_percentile(99.9)
+	   << "; p99.99 " << get_percentile(99.99)
+	   << "; max " << max << std::endl;
+}
+
+void LatencyHistogram::write_csv(std::ostream& os) const
+{
+	unsigned long seen = 0;
+
+	os << "value_us,count,percentile" << std::endl;
+	for (unsigned int i = 0; i < counts.size(); i++) {
+		if (counts[i] == 0)
+			continue;
+
+		seen += counts[i];
+		os << bucket_value(i) << "," << counts[i] << ","
+		   << std::fixed << std::setprecision(4)
+		   << 100.0 * seen / count << std::endl;
+	}
+}
@@ -0,0 +1,104 @@
+//
+// Latency bookkeeping of the echo client
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   1. Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//   2. Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+
+#ifndef ET_LATENCY_HPP
+#define ET_LATENCY_HPP
+
+#include <ostream>
+#include <time.h>
+#include <vector>
+
+//
+// Send timestamps of the SDUs in flight, indexed by sequence number. Written
+// by the sender thread and read by the receiver thread without locks; a
+// timestamp is overwritten when the sender gets more than the size of the
+// ring ahead of the echoes
+//
+class TimestampRing {
+public:
+	TimestampRing(unsigned long min_size);
+
+	/// Sender side: store the send time of SDU sn
+	void push(unsigned long sn, const timespec& tp);
+
+	/// Receiver side: get and forget the send time of SDU sn. Returns
+	/// false if it is not there (duplicated, unknown or overwritten)
+	bool take(unsigned long sn, timespec& tp);
+
+	unsigned long size() const;
+
+private:
+	struct Slot {
+		// sn + 1 of the timestamp stored, 0 if the slot is empty
+		unsigned long seq;
+		long tv_sec;
+		long tv_nsec;
+	};
+
+	std::vector<Slot> slots;
+	unsigned long mask;
+};
+
+//
+// HDR-style latency histogram: buckets are linear up to 2^SUB_BUCKET_BITS
+// microseconds and logarithmic with 2^(SUB_BUCKET_BITS - 1) linear
+// sub-buckets per power of two afterwards, so that any value is recorded
+// with a relative error below 1% using a few thousand counters
+//
+class LatencyHistogram {
+public:
+	static const unsigned int SUB_BUCKET_BITS = 8;
+
+	LatencyHistogram(unsigned long max_value_us = 3600000000UL);
+
+	void record(unsigned long value_us);
+	unsigned long get_count() const;
+	unsigned long get_min() const;
+	unsigned long get_max() const;
+	double get_mean() const;
+
+	/// Smallest value that is greater or equal than percentile % of the
+	/// recorded values
+	unsigned long get_percentile(double percentile) const;
+
+	/// Print the usual percentiles in a single line
+	void print_percentiles(std::ostream& os) const;
+
+	/// Print all the non empty buckets as "value_us,count,percentile"
+	void write_csv(std::ostream& os) const;
+
+private:
+	unsigned int bucket_index(unsigned long value) const;
+	unsigned long bucket_value(unsigned int index) const;
+
+	std::vector<unsigned long> counts;
+	unsigned long max_value;
+	unsigned long count;
+	unsigned long min;
+	unsigned long max;
+	double sum;
+};
+
+#endif//ET_LATENCY_HPP
@@ -60,6 +60,7 @@ int wrapped_main(int argc, char** argv)
         unsigned int lost_wait;
         unsigned int partial_read;
         string test_type;
+        string csv_file;
         string server_apn;
         string server_api;
         string client_apn;
@@ -182,6 +183,12 @@ int wrapped_main(int argc, char** argv)
 							       false,
 							       0,
 							       "unsigned integer");
+                TCLAP::ValueArg<string> csv_arg("",
+                                                "csv",
+                                                "In flood mode, write the RTT histogram to this CSV file",
+                                                false,
+                                                "",
+                                                "string");
 
                 cmd.add(listen_arg);
                 cmd.add(count_arg);
@@ -203,6 +210,7 @@ int wrapped_main(int argc, char** argv)
                 cmd.add(delay_arg);
                 cmd.add(loss_arg);
                 cmd.add(partial_read_arg);
+                cmd.add(csv_arg);
 
                 cmd.parse(argc, argv);
 
@@ -227,6 +235,7 @@ int wrapped_main(int argc, char** argv)
                 loss = loss_arg.getValue();
 
                 partial_read = partial_read_arg.getValue();
+                csv_file = csv_arg.getValue();
 
                 if (size > Application::max_buffer_size) {
                         size = Application::max_buffer_size;
@@ -252,7 +261,8 @@ int wrapped_main(int argc, char** argv)
                 // Client mode
                 Client c(test_type, dif_names, client_apn, client_api,
                          server_apn, server_api, quiet, count,
-                         registration, size, wait, gap, dw, lost_wait, rate, delay, loss);
+                         registration, size, wait, gap, dw, lost_wait, rate, delay, loss,
+                         csv_file);
 
                 c.run();
         }
@@ -27,6 +27,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <fstream>
@@ -44,16 +45,76 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/eventfd.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <netinet/in.h>
 
 #include "fdfwd.hpp"
 
 using namespace std;
 
-FwdWorker::FwdWorker(int idx_, int verb) : idx(idx_), nfds(0), verbose(verb)
+/* Whether splice() can move data between fd and a pipe in both
+ * directions. Char devices (e.g. RINA flows and TUN) cannot, and
+ * datagram sockets would lose the message boundaries. */
+static bool
+can_splice(int fd)
 {
+    struct stat st;
+    int type;
+    socklen_t len = sizeof(type);
+
+    if (fstat(fd, &st)) {
+        return false;
+    }
+
+    if (S_ISFIFO(st.st_mode)) {
+        return true;
+    }
+
+    return S_ISSOCK(st.st_mode) &&
+           getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+           type == SOCK_STREAM;
+}
+
+FwdSession::FwdSession(FwdToken t, int cfd, int rfd, unsigned int flags)
+    : token(t), gso(flags & FWD_F_GSO), closed(false)
+{
+    /* Mapping is implicit between the two ends. */
+    ends[0].fd      = rfd;
+    ends[1].fd      = cfd;
+    ends[1].noread  = flags & FWD_F_ONEWAY;
+    ends[0].session = ends[1].session = this;
+    for (int i = 0; i < 2; i++) {
+        ends[i].nonblock = fcntl(ends[i].fd, F_GETFL) & O_NONBLOCK;
+    }
+    splice = can_splice(rfd) && can_splice(cfd);
+
+    for (int i = 0; splice && i < 2; i++) {
+        if (pipe2(ends[i].pipefd, O_NONBLOCK | O_CLOEXEC)) {
+            perror("pipe2()");
+            splice = false;
+        }
+    }
+}
+
+FwdSession::~FwdSession()
+{
+    for (int i = 0; i < 2; i++) {
+        if (ends[i].pipefd[0] >= 0) {
+            close(ends[i].pipefd[0]);
+            close(ends[i].pipefd[1]);
+        }
+    }
+}
+
+FwdWorker::FwdWorker(int idx_, int verb, bool batch)
+    : idx(idx_), bufsz(batch ? FDFWD_BATCH_BUFSZ : FDFWD_MAX_BUFSZ),
+      stopping(false), load_(0), verbose(verb)
+{
+    struct epoll_event ev;
+
     repoll_syncfd = eventfd(0, 0);
     if (repoll_syncfd < 0) {
         perror("eventfd()");
@@ -66,16 +127,58 @@ FwdWorker::FwdWorker(int idx_, int verb) : idx(idx_), nfds(0), verbose(verb)
         exit(EXIT_FAILURE);
     }
 
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1()");
+        exit(EXIT_FAILURE);
+    }
+
+    /* A NULL pointer identifies the repoll eventfd. */
+    ev.events   = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, repoll_syncfd, &ev)) {
+        perror("epoll_ctl(repoll_syncfd)");
+        exit(EXIT_FAILURE);
+    }
+
     th = std::thread(&FwdWorker::run, this);
 }
 
 FwdWorker::~FwdWorker()
 {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        eventfd_write(repoll_syncfd);
+    }
     th.join();
+
+    for (FwdSession *s : pending) {
+        close(s->ends[0].fd);
+        close(s->ends[1].fd);
+        delete s;
+    }
+    for (FwdSession *s : sessions) {
+        if (!s->closed) {
+            close(s->ends[0].fd);
+            close(s->ends[1].fd);
+        }
+        delete s;
+    }
+
+    close(epfd);
     close(repoll_syncfd);
     close(closed_syncfd);
 }
 
+unsigned int
+FwdWorker::default_count()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+
+    return n ? n : 1;
+}
+
 void
 FwdWorker::eventfd_write(int fd)
 {
@@ -103,29 +206,31 @@ FwdWorker::eventfd_drain(int fd)
 }
 
 void
-FwdWorker::submit(FwdToken token, int cfd, int rfd)
+FwdWorker::submit(FwdToken token, int cfd, int rfd, unsigned int flags)
 {
     std::lock_guard<std::mutex> guard(lock);
 
-    if (nfds >= 2 * MAX_SESSIONS) {
-        printf("too many sessions, shutting down %d <--> %d\n", cfd, rfd);
-        close(cfd);
-        close(rfd);
-        return;
-    }
-
-    /* Append two entries in the fds array. Mapping is implicit
-     * between two consecutive entries. */
-    fds[nfds++] = Fd(rfd, token);
-    fds[nfds++] = Fd(cfd, token);
-    eventfd_write(repoll_syncfd); /* trigger repoll */
+    /* The worker thread registers the new session with epoll. */
+    pending.push_back(new FwdSession(token, cfd, rfd, flags));
+    load_++;
+    eventfd_write(repoll_syncfd);
 
     if (verbose >= 1) {
-        printf("New mapping created %d <--> %d [entries=%d,%d]\n", cfd, rfd,
-               nfds - 2, nfds - 1);
+        printf("w%d: New mapping created %d <--> %d%s [sessions=%u]\n", idx,
+               cfd, rfd, pending.back()->splice ? " (splice)" : "",
+               load_.load());
     }
 }
 
+void
+FwdWorker::cancel(FwdToken token)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    cancelled.push_back(token);
+    eventfd_write(repoll_syncfd);
+}
+
 FwdToken
 FwdWorker::get_next_closed()
 {
@@ -143,21 +248,393 @@ FwdWorker::get_next_closed()
     return ret;
 }
 
-/* Called under worker lock. */
+/* Registers the submitted sessions with epoll and terminates the
+ * cancelled ones. Returns -1 if the worker has to stop. */
+int
+FwdWorker::add_pending()
+{
+    std::list<FwdSession *> added;
+    std::list<FwdToken> tokens;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        eventfd_drain(repoll_syncfd);
+        if (stopping) {
+            return -1;
+        }
+        added.swap(pending);
+        tokens.swap(cancelled);
+    }
+
+    for (FwdToken token : tokens) {
+        for (FwdSession *s : sessions) {
+            if (s->token == token) {
+                terminate(s, 0, 0);
+            }
+        }
+    }
+
+    for (FwdSession *s : added) {
+        sessions.insert(s);
+        for (int i = 0; i < 2; i++) {
+            struct epoll_event ev;
+
+            ev.events = s->ends[i].events =
+                s->ends[i].noread ? 0 : EPOLLIN;
+            ev.data.ptr = &s->ends[i];
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->ends[i].fd, &ev)) {
+                perror("epoll_ctl(ADD)");
+                terminate(s, -1, errno);
+                break;
+            }
+        }
+
+    }
+
+    return 0;
+}
+
+/* Wait for POLLOUT on an end with pending output, otherwise for POLLIN
+ * on it, but only if the mapped end does not need to flush its own
+ * output. */
+void
+FwdWorker::update_events(FwdSession *s)
+{
+    for (int i = 0; i < 2; i++) {
+        Fd &f = s->ends[i];
+        struct epoll_event ev;
+
+        ev.events = 0;
+        if (f.len) {
+            ev.events = EPOLLOUT;
+        } else if (!s->ends[i ^ 1].len && !f.noread) {
+            ev.events = EPOLLIN;
+        }
+
+        if (ev.events == f.events) {
+            continue;
+        }
+
+        ev.data.ptr = &f;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, f.fd, &ev)) {
+            perror("epoll_ctl(MOD)");
+            terminate(s, -1, errno);
+            return;
+        }
+        f.events = ev.events;
+    }
+}
+
+/* Read from end i into the output buffer (or pipe) of the mapped end.
+ * Packets are read until the buffer is full if end i is non-blocking.
+ * Returns the number of packets read or the result of the failed
+ * read. */
+int
+FwdWorker::forward_in(FwdSession *s, int i)
+{
+    Fd &in  = s->ends[i];
+    Fd &out = s->ends[i ^ 1];
+    int n   = 0;
+    int m;
+
+    assert(out.len == 0);
+    if (s->splice) {
+        m = ::splice(in.fd, NULL, out.pipefd[1], NULL, FDFWD_MAX_BUFSZ,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (m > 0) {
+            out.len = m;
+        }
+        return m;
+    }
+
+    if (!out.data) {
+        out.size = s->gso && i == 0 ? FDFWD_GSO_BUFSZ : bufsz;
+        out.data.reset(new char[out.size]);
+    }
+
+    if (s->gso && i == 0) {
+        return forward_in_gso(in, out);
+    }
+
+    do {
+        m = read(in.fd, out.data.get() + out.fill, FDFWD_MAX_BUFSZ);
+        if (m <= 0) {
+            break;
+        }
+        out.pkts.push_back(m);
+        out.fill += m;
+        out.len += m;
+        n++;
+    } while (in.nonblock && out.fill + FDFWD_MAX_BUFSZ <= out.size);
+
+    return n ? n : m;
+}
+
+/* Like forward_in(), for an end delivering packets with a virtio-net
+ * header: a single read() may return a TCP super-packet, which is stored
+ * in the output buffer as the MSS sized segments it stands for. Returns
+ * the number of packets read or the result of the failed read. */
+int
+FwdWorker::forward_in_gso(Fd &in, Fd &out)
+{
+    int n = 0;
+    int m;
+
+    if (!gso_buf) {
+        gso_buf.reset(new char[FDFWD_GSO_MAXPKT]);
+    }
+
+    do {
+        m = read(in.fd, gso_buf.get(), FDFWD_GSO_MAXPKT);
+        if (m <= 0) {
+            break;
+        }
+        if (gso_segment(out, gso_buf.get(), m) == 0 && verbose >= 1) {
+            printf("w%d: Dropped malformed packet from fd %d\n", idx,
+                   in.fd);
+        }
+        n++;
+    } while (in.nonblock && out.fill + FDFWD_GSO_MAXOUT <= out.size);
+
+    return n ? n : m;
+}
+
+static inline uint16_t
+get16(const unsigned char *p)
+{
+    uint16_t x;
+
+    memcpy(&x, p, sizeof(x));
+    return ntohs(x);
+}
+
+static inline void
+put16(unsigned char *p, uint16_t v)
+{
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+    uint32_t x;
+
+    memcpy(&x, p, sizeof(x));
+    return ntohl(x);
+}
+
+static inline void
+put32(unsigned char *p, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+/* One's complement sum of len (even) bytes, without folding. */
+static uint32_t
+csum_add(uint32_t sum, const unsigned char *p, int len)
+{
+    for (int k = 0; k < len; k += 2) {
+        sum += get16(p + k);
+    }
+
+    return sum;
+}
+
+static uint16_t
+csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return sum;
+}
+
+/* Append the packet (virtio-net header included) to the output buffer,
+ * split into segments of gso_size bytes if it is a TCP super-packet,
+ * which is what the kernel would do if TSO was off. The segments ask the
+ * receiver to compute the TCP checksum, as the super-packet did. Returns
+ * the number of packets appended, 0 if the packet had to be dropped. */
+int
+FwdWorker::gso_segment(Fd &out, const char *buf, int len)
+{
+    const unsigned char *pkt =
+        reinterpret_cast<const unsigned char *>(buf) + sizeof(VnetHdr);
+    int plen = len - (int)sizeof(VnetHdr);
+    int iphl, hlen, mss, nsegs, type;
+    uint32_t seq;
+    uint16_t ipid;
+    VnetHdr h;
+    bool v4;
+
+    if (plen < 0) {
+        return 0;
+    }
+    memcpy(&h, buf, sizeof(h));
+
+    type = h.gso_type & ~VNET_HDR_GSO_ECN;
+    if (type == VNET_HDR_GSO_NONE) {
+        memcpy(out.data.get() + out.fill, buf, len);
+        out.pkts.push_back(len);
+        out.fill += len;
+        out.len += len;
+        return 1;
+    }
+
+    /* Only TSO is enabled on the device. */
+    v4 = type == VNET_HDR_GSO_TCPV4;
+    if (v4) {
+        if (plen < 20 || (pkt[0] >> 4) != 4 || pkt[9] != IPPROTO_TCP) {
+            return 0;
+        }
+        iphl = (pkt[0] & 0xf) * 4;
+    } else if (type == VNET_HDR_GSO_TCPV6) {
+        if (plen < 40 || (pkt[0] >> 4) != 6 || pkt[6] != IPPROTO_TCP) {
+            return 0;
+        }
+        iphl = 40;
+    } else {
+        return 0;
+    }
+
+    if (plen < iphl + 20) {
+        return 0;
+    }
+    hlen = iphl + (pkt[iphl + 12] >> 4) * 4;
+    mss  = h.gso_size;
+    if (plen < hlen || mss == 0) {
+        return 0;
+    }
+
+    nsegs = plen > hlen ? (plen - hlen + mss - 1) / mss : 1;
+    if (nsegs * ((int)sizeof(VnetHdr) + hlen) + plen - hlen >
+        FDFWD_GSO_MAXOUT) {
+        return 0;
+    }
+
+    seq  = get32(pkt + iphl + 4);
+    ipid = get16(pkt + 4);
+
+    for (int k = 0; k < nsegs; k++) {
+        unsigned char *o =
+            reinterpret_cast<unsigned char *>(out.data.get() + out.fill);
+        unsigned char *ip  = o + sizeof(VnetHdr);
+        unsigned char *tcp = ip + iphl;
+        int seglen         = std::min(mss, plen - hlen - k * mss);
+        VnetHdr sh;
+        uint32_t sum;
+
+        memset(&sh, 0, sizeof(sh));
+        sh.flags       = VNET_HDR_F_NEEDS_CSUM;
+        sh.gso_type    = VNET_HDR_GSO_NONE;
+        sh.hdr_len     = hlen;
+        sh.csum_start  = iphl;
+        sh.csum_offset = 16;
+        memcpy(o, &sh, sizeof(sh));
+        memcpy(ip, pkt, hlen);
+        memcpy(ip + hlen, pkt + hlen + k * mss, seglen);
+
+        if (v4) {
+            put16(ip + 2, hlen + seglen);
+            put16(ip + 4, ipid + k);
+            put16(ip + 10, 0);
+            put16(ip + 10, ~csum_fold(csum_add(0, ip, iphl)));
+        } else {
+            put16(ip + 4, hlen - iphl + seglen);
+        }
+
+        put32(tcp + 4, seq + k * mss);
+        if (k != nsegs - 1) {
+            tcp[13] &= ~0x09; /* FIN, PSH */
+        }
+        if (k != 0) {
+            tcp[13] &= ~0x80; /* CWR */
+        }
+
+        /* The pseudo-header sum, the receiver adds the rest. */
+        sum = csum_add(0, ip + (v4 ? 12 : 8), v4 ? 8 : 32);
+        sum += IPPROTO_TCP + hlen - iphl + seglen;
+        put16(tcp + 16, csum_fold(sum));
+
+        out.pkts.push_back(sizeof(VnetHdr) + hlen + seglen);
+        out.fill += sizeof(VnetHdr) + hlen + seglen;
+        out.len += sizeof(VnetHdr) + hlen + seglen;
+    }
+
+    return nsegs;
+}
+
+/* Flush the output buffer (or pipe) of end i, packet by packet, until
+ * it is empty or end i would block. Returns the number of bytes
+ * written or the result of the failed write. */
+int
+FwdWorker::forward_out(FwdSession *s, int i)
+{
+    Fd &out = s->ends[i];
+    int n   = 0;
+    int m;
+
+    assert(out.len > 0);
+    if (s->splice) {
+        m = ::splice(out.pipefd[0], NULL, out.fd, NULL, out.len,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (m > 0) {
+            out.len -= m;
+        }
+        return m;
+    }
+
+    do {
+        m = write(out.fd, out.data.get() + out.ofs, out.pkts[out.head]);
+        if (m <= 0) {
+            break;
+        }
+        out.ofs += m;
+        out.len -= m;
+        out.pkts[out.head] -= m;
+        if (out.pkts[out.head] == 0) {
+            out.head++;
+        }
+        n += m;
+    } while (out.nonblock && out.len);
+
+    if (!out.len) {
+        out.pkts.clear();
+        out.head = out.ofs = out.fill = 0;
+    }
+
+    if (n && verbose >= 2) {
+        printf("Forwarded %d bytes %d --> %d\n", n, s->ends[i ^ 1].fd,
+               out.fd);
+    }
+
+    return n ? n : m;
+}
+
+/* Called by the worker thread only. */
 void
-FwdWorker::terminate(unsigned int i, int ret, int errcode)
+FwdWorker::terminate(FwdSession *s, int ret, int errcode)
 {
-    unsigned j;
     string how;
 
-    i &= ~(0x1);
-    j = i | 0x1;
+    if (s->closed) {
+        return;
+    }
+    closed.push_back(s);
 
-    close(fds[i].fd);
-    close(fds[j].fd);
-    fds[i].closed = fds[j].closed = true;
-    if (fds[i].token > 0) {
-        terminated.push_back(fds[i].token);
+    /* Closing is not enough to leave the epoll set if the fd has been
+     * duplicated (e.g. the TUN fd of iporinad). */
+    for (int i = 0; i < 2; i++) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s->ends[i].fd, NULL);
+        close(s->ends[i].fd);
+    }
+    s->closed = true;
+    load_--;
+    if (s->token > 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        terminated.push_back(s->token);
         eventfd_write(closed_syncfd);
     }
 
@@ -168,19 +645,19 @@ FwdWorker::terminate(unsigned int i, int ret, int errcode)
             how = "with errors";
         }
 
-        cout << "w" << idx << ": Session " << fds[i].fd << " <--> " << fds[j].fd
-             << " closed " << how << " [entries=" << i << "," << j << "]"
-             << endl;
+        cout << "w" << idx << ": Session " << s->ends[1].fd << " <--> "
+             << s->ends[0].fd << " closed " << how
+             << " [sessions=" << load_.load() << "]" << endl;
     }
 
-    /* fds entries are recovered at the beginning of the run() main loop */
+    /* The session is freed at the end of the run() loop iteration, as
+     * there may still be events for it. */
 }
 
 void
 FwdWorker::run()
 {
-    struct pollfd pollfds[1 + MAX_SESSIONS * 2];
-    struct pollfd *pfds = pollfds + 1;
+    std::vector<struct epoll_event> events(64);
 
     if (verbose >= 1) {
         printf("w%d starts\n", idx);
@@ -189,145 +666,86 @@ FwdWorker::run()
     for (;;) {
         int nrdy;
 
-        pfds[-1].fd     = repoll_syncfd;
-        pfds[-1].events = POLLIN;
-
-        /* Load the poll array with the active fd mappings, also recycling
-         * the entries of closed sessions. */
-        lock.lock();
-        for (int i = 0; i < nfds;) {
-            int j = i + 1; /* index of the mapped entry */
-
-            if (fds[i].closed) {
-                nfds -= 2;
-                if (i < nfds) {
-                    fds[i] = fds[nfds - 1];
-                    fds[j] = fds[nfds];
-                    if (verbose >= 1) {
-                        printf("Recycled entries %d,%d\n", i, j);
-                    }
-                }
+        nrdy = epoll_wait(epfd, &events[0], events.size(), -1);
+        if (nrdy < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-
-            pfds[i].fd     = fds[i].fd;
-            pfds[j].fd     = fds[j].fd;
-            pfds[i].events = pfds[j].events = 0;
-
-            /* If there is pending data in the output buffer for entry i,
-             * request POLLOUT to flush that data. Otherwise request POLLIN
-             * on the mapped entry, but only if the mapped entry does not
-             * need to flush its own output buffer. */
-            if (fds[i].len) {
-                pfds[i].events = POLLOUT;
-            } else if (!fds[j].len) {
-                pfds[j].events = POLLIN;
-            }
-
-            /* Same logic for the mapped entry. */
-            if (fds[j].len) {
-                pfds[j].events = POLLOUT;
-            } else if (!fds[i].len) {
-                pfds[i].events = POLLIN;
-            }
-
-            i += 2;
-        }
-        lock.unlock();
-
-        if (verbose >= 2) {
-            printf("w%d polls %d file descriptors\n", idx, nfds + 1);
-        }
-        nrdy = poll(pollfds, nfds + 1, -1);
-        if (nrdy < 0) {
-            perror("poll()");
+            perror("epoll_wait()");
             break;
-
-        } else if (nrdy == 0) {
-            printf("w%d: poll() timeout\n", idx);
-            continue;
         }
 
-        if (pfds[-1].revents) {
-            /* We've been requested to repoll the queue. */
-            nrdy--;
-            if (pfds[-1].revents & POLLIN) {
-                if (verbose >= 2) {
-                    printf("w%d: Mappings changed, rebuilding poll array\n",
-                           idx);
-                }
-                lock.lock();
-                eventfd_drain(repoll_syncfd);
-                lock.unlock();
+        for (int n = 0; n < nrdy; n++) {
+            Fd *f = static_cast<Fd *>(events[n].data.ptr);
+            uint32_t revents = events[n].events;
+            FwdSession *s;
+            int i, m;
 
-            } else {
-                printf("w%d: Error event %d on repoll_syncfd\n", idx,
-                       pfds[-1].revents);
+            if (!f) {
+                /* New sessions have been submitted. */
+                if (add_pending()) {
+                    goto out;
+                }
+                continue;
             }
 
-            continue;
-        }
-
-        lock.lock();
-
-        for (int i = 0, n = 0; n < nrdy && i < nfds; i++) {
-            int j;
-
-            if (!pfds[i].revents || fds[i].closed) {
-                /* No events on this fd, or the session has
-                 * been terminated by the mapped fd (in a previous
-                 * iteration of this loop). Let's skip it. */
+            s = f->session;
+            if (s->closed) {
+                /* The session has been terminated by the mapped
+                 * fd earlier in this loop. Let's skip it. */
                 continue;
             }
 
             if (verbose >= 2) {
-                printf("w%d: fd %d ready, events %d\n", idx, pfds[i].fd,
-                       pfds[i].revents);
+                printf("w%d: fd %d ready, events %u\n", idx, f->fd, revents);
             }
 
-            /* Consume the events on this fd. */
-            n++;
-
-            j = i ^ 0x1; /* index to the mapped fds entry */
-
-            if (pfds[i].revents & POLLIN) {
-                int m;
-
-                assert(fds[j].len == 0);
-                /* The output buffer for entry j is empty and, there
-                 * is data to read from the mapped entry i. Load the
-                 * output buffer with this data. */
-                m = read(fds[i].fd, fds[j].data, FDFWD_MAX_BUFSZ);
-                if (m <= 0) {
-                    terminate(i, m, errno);
-                } else {
-                    fds[j].len = m;
-                    fds[j].ofs = 0;
-                }
-
-            } else if (pfds[i].revents & POLLOUT) {
-                int m;
-
-                assert(fds[i].len > 0);
-                /* There is data in the output buffer of entry i. Try to
-                 * flush it. */
-                m = write(fds[i].fd, fds[i].data + fds[i].ofs, fds[i].len);
-                if (m <= 0) {
-                    terminate(i, m, errno);
-                } else {
-                    fds[i].ofs += m;
-                    fds[i].len -= m;
-                    if (verbose >= 2) {
-                        printf("Forwarded %d bytes %d --> %d\n", m, fds[j].fd,
-                               fds[i].fd);
+            i = f == &s->ends[0] ? 0 : 1;
+            if ((revents & EPOLLIN) && (f->events & EPOLLIN)) {
+                /* The output buffer for the mapped end is empty and
+                 * there is data to read from this end. */
+                m = forward_in(s, i);
+                if (m <= 0 && !(m < 0 && errno == EAGAIN)) {
+                    terminate(s, m, errno);
+                } else if (m > 0 && s->ends[i ^ 1].nonblock &&
+                           s->ends[i ^ 1].len) {
+                    /* Try to flush right away rather than waiting for
+                     * the next epoll_wait(). */
+                    m = forward_out(s, i ^ 1);
+                    if (m <= 0 && !(m < 0 && errno == EAGAIN)) {
+                        terminate(s, m, errno);
                     }
                 }
+            } else if ((revents & EPOLLOUT) && (f->events & EPOLLOUT)) {
+                /* There is data in the output buffer of this end,
+                 * try to flush it. */
+                m = forward_out(s, i);
+                if (m <= 0 && !(m < 0 && errno == EAGAIN)) {
+                    terminate(s, m, errno);
+                }
+            } else if (revents & (EPOLLERR | EPOLLHUP)) {
+                /* Reported even if not requested, the session would
+                 * otherwise keep the worker spinning. */
+                terminate(s, -1, EPIPE);
+            }
+
+            if (!s->closed) {
+                update_events(s);
             }
         }
 
-        lock.unlock();
-    }
+        for (FwdSession *s : closed) {
+            sessions.erase(s);
+            delete s;
+        }
+        closed.clear();
 
+        if (nrdy == (int)events.size()) {
+            /* Take more events per system call under load. */
+            events.resize(2 * events.size());
+        }
+    }
+out:
     if (verbose >= 1) {
         printf("w%d stops\n", idx);
     }
@@ -30,39 +30,120 @@
 #ifndef __FDFWD_HH__
 #define __FDFWD_HH__
 
-#define MAX_SESSIONS 16
 #define FDFWD_MAX_BUFSZ 16384
 
+/* Output buffer size of the workers that batch packets: as many
+ * packets as fit are read before flushing them. */
+#define FDFWD_BATCH_BUFSZ 65536
+
+/* Session flags. */
+#define FWD_F_ONEWAY 0x1 /* only forward from rfd to cfd */
+#define FWD_F_GSO 0x2 /* rfd packets carry a virtio-net header, TCP
+                       * super-packets are segmented before cfd */
+
+#include <atomic>
+#include <cstdint>
 #include <list>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <unordered_set>
+#include <vector>
 
 using FwdToken = unsigned int;
 
+/* The virtio-net header, in host byte order, in front of the packets of
+ * TUN devices created with IFF_VNET_HDR. <linux/virtio_net.h> cannot be
+ * included from C++. */
+struct VnetHdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+
+#define VNET_HDR_F_NEEDS_CSUM 1
+#define VNET_HDR_GSO_NONE 0
+#define VNET_HDR_GSO_TCPV4 1
+#define VNET_HDR_GSO_TCPV6 4
+#define VNET_HDR_GSO_ECN 0x80
+
+/* Largest packet read by a FWD_F_GSO session, the output buffer of its
+ * mapped end, and the largest a super-packet may grow once segmented. */
+#define FDFWD_GSO_MAXPKT (sizeof(VnetHdr) + 65535)
+#define FDFWD_GSO_BUFSZ 262144
+#define FDFWD_GSO_MAXOUT 131072
+
+struct FwdSession;
+
 struct Fd {
     int fd;
-    int len;
-    int ofs;
-    bool closed;
-    FwdToken token;
-    char data[FDFWD_MAX_BUFSZ];
+    int len; /* bytes waiting to be written to fd */
+    int ofs; /* offset of the next byte to be written */
+    int fill; /* end of the data in the output buffer */
+    int size; /* size of the output buffer */
+    bool nonblock; /* more than one read()/write() per event is safe */
+    bool noread; /* never read from fd */
+    uint32_t events; /* events currently registered with epoll */
+    FwdSession *session;
+
+    /* Output buffer, allocated on first use, and the length of the
+     * packets stored back to back in it, starting from pkts[head]. Not
+     * used by splice sessions, which keep the pending bytes in a pipe. */
+    std::unique_ptr<char[]> data;
+    std::vector<int> pkts;
+    unsigned int head;
+    int pipefd[2];
 
-    Fd(int _fd, FwdToken t) : fd(_fd), len(0), ofs(0), closed(false), token(t)
+    Fd()
+        : fd(-1), len(0), ofs(0), fill(0), size(0), nonblock(false),
+          noread(false), events(0), session(nullptr), head(0)
     {
+        pipefd[0] = pipefd[1] = -1;
     }
-    Fd() : fd(0), len(0), ofs(0), closed(false), token(0) {}
+};
+
+/* A pair of mapped file descriptors. */
+struct FwdSession {
+    FwdToken token;
+    Fd ends[2];
+    bool splice; /* both ends support splice(), bypass user space */
+    bool gso;    /* segment the packets read from rfd (FWD_F_GSO) */
+    bool closed;
+
+    FwdSession(FwdToken t, int cfd, int rfd, unsigned int flags);
+    ~FwdSession();
 };
 
 class FwdWorker {
     std::thread th;
     std::mutex lock;
     int repoll_syncfd;
+    int epfd;
     int idx;
+    int bufsz; /* size of the output buffers */
+
+    /* Sessions submitted but not yet registered by the worker thread,
+     * and tokens of the sessions to be terminated, protected by the
+     * lock. */
+    std::list<FwdSession *> pending;
+    std::list<FwdToken> cancelled;
+    bool stopping;
 
-    /* Holds the active mappings between RINA file descriptors and
-     * socket file descriptors. */
-    struct Fd fds[MAX_SESSIONS * 2];
-    int nfds;
+    /* Active sessions, and terminated ones to be freed at the end of
+     * the current run() loop iteration. Only accessed by the worker
+     * thread. */
+    std::unordered_set<FwdSession *> sessions;
+    std::vector<FwdSession *> closed;
+
+    /* Where FWD_F_GSO sessions read super-packets before segmenting
+     * them, allocated on first use. */
+    std::unique_ptr<char[]> gso_buf;
+
+    /* Number of active and pending sessions, used for load balancing. */
+    std::atomic<unsigned int> load_;
 
     /* List of tokens corresponding to terminated mappings, together
      * with an eventfd file descriptor to notify termination. */
@@ -73,16 +154,51 @@ class FwdWorker {
 
     void eventfd_write(int fd);
     void eventfd_drain(int fd);
-    void terminate(unsigned int i, int ret, int errcode);
+    int add_pending();
+    void update_events(FwdSession *s);
+    int forward_in(FwdSession *s, int i);
+    int forward_in_gso(Fd &in, Fd &out);
+    int forward_out(FwdSession *s, int i);
+    void terminate(FwdSession *s, int ret, int errcode);
 
 public:
-    FwdWorker(int idx_, int verb);
+    /* With batch set, up to FDFWD_BATCH_BUFSZ bytes are read from a
+     * non-blocking fd before flushing them. */
+    FwdWorker(int idx_, int verb, bool batch = false);
     ~FwdWorker();
 
-    void submit(FwdToken token, int cfd, int rfd);
+    void submit(FwdToken token, int cfd, int rfd, unsigned int flags = 0);
+
+    /* Terminate the sessions submitted with this token, if any. */
+    void cancel(FwdToken token);
     void run();
     FwdToken get_next_closed();
     int closed_eventfd() const { return closed_syncfd; }
+    unsigned int load() const { return load_; }
+
+    /* One worker per core. */
+    static unsigned int default_count();
+
+    /* Append a packet read from a FWD_F_GSO fd to out, segmenting it if
+     * it is a TCP super-packet. Public for test-fdfwd-gso. */
+    static int gso_segment(Fd &out, const char *buf, int len);
 };
 
+/* Returns the worker with the fewest sessions, works with plain and
+ * smart pointers. */
+template <class WorkerPtr>
+FwdWorker *
+least_loaded(const std::vector<WorkerPtr> &workers)
+{
+    FwdWorker *best = &*workers[0];
+
+    for (const auto &w : workers) {
+        if (w->load() < best->load()) {
+            best = &*w;
+        }
+    }
+
+    return best;
+}
+
 #endif /* __FDFWD_HH__ */
@@ -92,9 +92,10 @@ struct Remote {
     string app_name;
     string dif_name;
 
-    /* Name of the local tun device and associated file descriptor. */
+    /* Name of the local tun device and file descriptors of its
+     * queues. */
     string tun_name;
-    int tun_fd;
+    vector<int> tun_fds;
 
     /* IP address of the local and remote tunnel endpoint, and tunnel subnet. */
     IPAddr tun_local_addr;
@@ -110,13 +111,17 @@ struct Remote {
     /* Data file descriptor for the flow that supports the tunnel. */
     int rfd;
 
-    Remote() : tun_fd(-1), rfd(-1)
+    /* Tokens of the forwarding sessions of the tunnel, one per TUN
+     * queue. The first one is the only one reading from the flow. */
+    vector<FwdToken> tokens;
+
+    Remote() : rfd(-1)
     {
         flow_alloc_needed[IPOR_CTRL] = flow_alloc_needed[IPOR_DATA] = true;
     }
 
     Remote(const string &a, const string &d, const IPAddr &i)
-        : app_name(a), dif_name(d), tun_fd(-1), tun_subnet(i), rfd(-1)
+        : app_name(a), dif_name(d), tun_subnet(i), rfd(-1)
     {
         flow_alloc_needed[IPOR_CTRL] = flow_alloc_needed[IPOR_DATA] = true;
     }
@@ -130,8 +135,6 @@ struct Remote {
     int mss_configure() const;
 };
 
-#define NUM_WORKERS 1
-
 class IPoRINA {
     /* Control device to listen for incoming connections. */
     int rfd = -1;
@@ -163,7 +166,15 @@ public:
     /* Tun device tx queue length */
     int tx_q_len = 0;
 
+    /* Number of queues of the tun devices, 0 means one per worker */
+    int tun_queues = 0;
+
+    /* Carry a virtio-net header with every packet, so that checksums
+     * are computed by the receiving host only */
+    bool vnet_hdr = false;
+
     void start_workers();
+    unsigned int num_tun_queues() const;
     int setup();
     int main_loop();
     int parse_conf(const char *path);
@@ -199,8 +210,9 @@ struct Hello : public Obj {
     string tun_src_addr; /* IP address of the source */
     string tun_dst_addr; /* IP address of the destination */
     uint32_t num_routes; /* How many route to exchange */
+    bool vnet_hdr;       /* Packets carry a virtio-net header */
 
-    Hello() : num_routes(0) {}
+    Hello() : num_routes(0), vnet_hdr(false) {}
     Hello(const char *buf, unsigned int size);
     int serialize(char *buf, unsigned int size) const;
 };
@@ -212,6 +224,7 @@ gpb2Hello(Hello &m, const gpb::hello_msg_t &gm)
     m.tun_src_addr = gm.tun_src_addr();
     m.tun_dst_addr = gm.tun_dst_addr();
     m.num_routes   = gm.num_routes();
+    m.vnet_hdr     = gm.vnet_hdr();
 }
 
 static int
@@ -221,11 +234,13 @@ Hello2gpb(const Hello &m, gpb::hello_msg_t &gm)
     gm.set_tun_src_addr(m.tun_src_addr);
     gm.set_tun_dst_addr(m.tun_dst_addr);
     gm.set_num_routes(m.num_routes);
+    gm.set_vnet_hdr(m.vnet_hdr);
 
     return 0;
 }
 
-Hello::Hello(const char *buf, unsigned int size) : num_routes(0)
+Hello::Hello(const char *buf, unsigned int size)
+    : num_routes(0), vnet_hdr(false)
 {
     gpb::hello_msg_t gm;
 
@@ -344,14 +359,20 @@ IPoRINA::IPoRINA() : rfd(-1), verbose(0) {}
 void
 IPoRINA::start_workers()
 {
-    for (int i = 0; i < NUM_WORKERS; i++) {
+    for (unsigned int i = 0; i < FwdWorker::default_count(); i++) {
         workers.push_back(
-            std::unique_ptr<FwdWorker>(new FwdWorker(i, verbose)));
+            std::unique_ptr<FwdWorker>(new FwdWorker(i, verbose, true)));
     }
 }
 
 IPoRINA::~IPoRINA() {}
 
+unsigned int
+IPoRINA::num_tun_queues() const
+{
+    return tun_queues ? tun_queues : FwdWorker::default_count();
+}
+
 IPAddr::IPAddr(const string &_p) : repr(_p)
 {
     string p = _p;
@@ -531,6 +552,8 @@ probe_mss(int fd)
 int
 Remote::tun_alloc()
 {
+    unsigned int nq = g->num_tun_queues();
+    int flags       = IFF_TUN | IFF_NO_PI;
     char tname[IFNAMSIZ];
 
     if (tun_name != string()) {
@@ -538,15 +561,45 @@ Remote::tun_alloc()
         return 0;
     }
 
+    if (nq > 1) {
+        flags |= IFF_MULTI_QUEUE;
+    }
+    if (g->vnet_hdr) {
+        flags |= IFF_VNET_HDR;
+    }
+
+    /* The first call creates the device, the next ones attach
+     * a new queue to it. */
     tname[0] = '\0';
-    tun_fd   = os_tun_alloc(tname, IFF_TUN | IFF_NO_PI);
-    if (tun_fd < 0) {
-        cerr << "Failed to create tunnel" << endl;
-        return -1;
+    for (unsigned int q = 0; q < nq; q++) {
+        int fd = os_tun_alloc(tname, flags);
+
+        if (fd < 0) {
+            if (q == 0) {
+                cerr << "Failed to create tunnel" << endl;
+                return -1;
+            }
+            cerr << "Failed to attach queue " << q << " to " << tname
+                 << ", using " << q << " queues" << endl;
+            break;
+        }
+        tun_fds.push_back(fd);
     }
     tun_name = tname;
+
+    /* Let the kernel skip the checksum of outgoing packets, the
+     * receiving tunnel endpoint gets the header that asks for it, and
+     * hand us TCP super-packets, segmented by the forwarding workers:
+     * a single read() returns many packets. */
+    if (g->vnet_hdr &&
+        ioctl(tun_fds[0], TUNSETOFFLOAD,
+              TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0) {
+        perror("ioctl(TUNSETOFFLOAD)");
+    }
+
     if (g->verbose) {
-        cout << "Created tunnel device " << tun_name << endl;
+        cout << "Created tunnel device " << tun_name << " with "
+             << tun_fds.size() << " queues" << endl;
     }
 
     return 0;
@@ -741,6 +794,11 @@ Remote::mss_configure() const
         mss = FDFWD_MAX_BUFSZ;
     }
 
+    if (g->vnet_hdr) {
+        /* Room for the virtio-net header in front of each packet. */
+        mss -= sizeof(VnetHdr);
+    }
+
     cmdss << "ip link set mtu " << mss << " dev " << tun_name;
 
     if (execute_command(cmdss)) {
@@ -900,20 +958,57 @@ IPoRINA::setup(void)
 int
 IPoRINA::submit(Remote *r)
 {
-    int dupfd;
+    int flags;
 
-    dupfd = dup(r->tun_fd);
-    if (dupfd < 0) {
-        perror("dup(tun_fd)");
-        return dupfd;
+    /* Workers read from the flow only when there is something to
+     * read. */
+    flags = fcntl(r->rfd, F_GETFL);
+    if (flags < 0 || fcntl(r->rfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl(rfd)");
+        return -1;
     }
-    /* Duplicate the tun_fd, since FwdWorker::submit() consumes it and
-     * we want the TUN device to survive. */
-    workers[0]->submit(next_submit_token, r->rfd, dupfd);
-    r->rfd = -1; /* ownership passing, we won't need this anymore */
-    active_sessions[next_submit_token++] = r->app_name;
 
-    return 0;
+    /* One session per TUN queue, spread across the workers. All of
+     * them send to the flow, but only the first one reads from it, so
+     * that packets received from the peer are not reordered: receive
+     * does not scale with the number of queues. */
+    r->tokens.clear();
+    for (unsigned int q = 0; q < r->tun_fds.size(); q++) {
+        int tunfd, flowfd;
+
+        /* Duplicate the TUN queue fd, since FwdWorker::submit()
+         * consumes it and we want the TUN device to survive. */
+        tunfd = dup(r->tun_fds[q]);
+        if (tunfd < 0) {
+            perror("dup(tun_fd)");
+            break;
+        }
+        flags = fcntl(tunfd, F_GETFL);
+        fcntl(tunfd, F_SETFL, flags | O_NONBLOCK);
+
+        flowfd = q == r->tun_fds.size() - 1 ? r->rfd : dup(r->rfd);
+        if (flowfd < 0) {
+            perror("dup(rfd)");
+            close(tunfd);
+            break;
+        }
+        if (flowfd == r->rfd) {
+            r->rfd = -1; /* ownership passing, we won't need this anymore */
+        }
+
+        least_loaded(workers)->submit(
+            next_submit_token, flowfd, tunfd,
+            (q ? FWD_F_ONEWAY : 0) | (vnet_hdr ? FWD_F_GSO : 0));
+        r->tokens.push_back(next_submit_token);
+        active_sessions[next_submit_token++] = r->app_name;
+    }
+
+    if (r->rfd >= 0) {
+        close(r->rfd);
+        r->rfd = -1;
+    }
+
+    return r->tokens.empty() ? -1 : 0;
 }
 
 int
@@ -922,15 +1017,18 @@ IPoRINA::main_loop()
     /* Wait for incoming control/data connections from remote peers, and
      * also for terminating sessions. */
     for (;;) {
-        FwdWorker *const worker = workers[0].get();
-        struct pollfd pfd[2];
+        vector<struct pollfd> pfd(1 + workers.size());
+        bool closed = false;
         int cfd;
         int ret;
 
         pfd[0].fd     = rfd;
-        pfd[1].fd     = worker->closed_eventfd();
-        pfd[0].events = pfd[1].events = POLLIN;
-        ret = poll(pfd, sizeof(pfd) / sizeof(pfd[0]), -1);
+        pfd[0].events = POLLIN;
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            pfd[1 + i].fd     = workers[i]->closed_eventfd();
+            pfd[1 + i].events = POLLIN;
+        }
+        ret = poll(&pfd[0], pfd.size(), -1);
         if (ret < 0) {
             perror("poll(lfd)");
             return -1;
@@ -939,10 +1037,16 @@ IPoRINA::main_loop()
             continue;
         }
 
-        if (pfd[1].revents & POLLIN) {
-            /* Some sessions terminated. */
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            FwdWorker *const worker = workers[i].get();
             FwdToken token;
 
+            if (!(pfd[1 + i].revents & POLLIN)) {
+                continue;
+            }
+
+            /* Some sessions terminated. */
+            closed = true;
             while ((token = worker->get_next_closed()) != 0) {
                 if (!active_sessions.count(token) ||
                     !remotes.count(active_sessions[token])) {
@@ -950,15 +1054,32 @@ IPoRINA::main_loop()
                          << ")" << endl;
                 } else {
                     Remote &r = remotes[active_sessions[token]];
-                    cout << "Remote " << active_sessions[token]
-                         << " disconnected" << endl;
+
                     active_sessions.erase(token);
+                    if (r.tokens.empty() || r.tokens[0] != token) {
+                        /* A sending-only session, or one from a previous
+                         * connection. */
+                        continue;
+                    }
+
+                    cout << "Remote " << r.app_name << " disconnected"
+                         << endl;
+                    /* Stop the sending-only sessions, they do not read
+                     * from the flow and would not notice. */
+                    for (unsigned int j = 1; j < r.tokens.size(); j++) {
+                        for (const auto &w : workers) {
+                            w->cancel(r.tokens[j]);
+                        }
+                    }
+                    r.tokens.clear();
                     r.ip_cleanup();
                     /* Trigger flow reallocation towards the peer. */
                     r.flow_alloc_needed[IPOR_CTRL] =
                         r.flow_alloc_needed[IPOR_DATA] = true;
                 }
             }
+        }
+        if (closed) {
             continue;
         }
 
@@ -1026,6 +1147,13 @@ IPoRINA::main_loop()
         }
         hello = Hello(objbuf, objlen);
 
+        if (hello.vnet_hdr != vnet_hdr) {
+            cerr << "Remote " << remote_name << " does "
+                 << (hello.vnet_hdr ? "" : "not ")
+                 << "use virtio-net headers, check the -V option" << endl;
+            goto abor;
+        }
+
         if (remotes.count(remote_name) == 0) {
             remotes[remote_name] = Remote();
 
@@ -1204,6 +1332,7 @@ IPoRINA::connect_to_remotes()
                     hello.tun_subnet   = kv.second.tun_subnet;
                     hello.tun_src_addr = kv.second.tun_local_addr;
                     hello.tun_dst_addr = kv.second.tun_remote_addr;
+                    hello.vnet_hdr     = vnet_hdr;
                     if (cdap_obj_send(&conn, &m, 0, &hello) < 0) {
                         cerr << "Failed to send M_START(hello)" << endl;
                         goto abor;
@@ -1275,6 +1404,12 @@ usage(void)
          << endl
 	 << "   -t NUM : tunnel TUN device tx queue length (packets)"
 	 << endl
+         << "   -q NUM : number of queues of the TUN devices (default: one "
+            "per core)"
+         << endl
+         << "   -V : exchange packets with virtio-net headers (checksum "
+            "and TCP segmentation offload), peers must agree"
+         << endl
          << "   -v : be verbose" << endl;
 }
 
@@ -1285,7 +1420,7 @@ main(int argc, char **argv)
     int background       = 0;
     int opt;
 
-    while ((opt = getopt(argc, argv, "hc:vL:E:t:w")) != -1) {
+    while ((opt = getopt(argc, argv, "hc:vL:E:t:q:Vw")) != -1) {
         switch (opt) {
         case 'h':
             usage();
@@ -1323,6 +1458,18 @@ main(int argc, char **argv)
             }
             break;
 
+        case 'q':
+            g->tun_queues = atoi(optarg);
+            if (g->tun_queues < 1 || g->tun_queues > 256) {
+                cout << "    Invalid 'tun_queues' " << g->tun_queues << endl;
+                return -1;
+            }
+            break;
+
+        case 'V':
+            g->vnet_hdr = true;
+            break;
+
         case 'w':
             background = 1;
             break;
@@ -135,8 +135,6 @@ RinaName::operator=(const RinaName &other)
     return *this;
 }
 
-#define NUM_WORKERS 1
-
 struct Gateway {
     string appl_name;
 
@@ -171,7 +169,7 @@ Gateway::Gateway()
     appl_name = "rina-gw/1";
 
     /* Start workers. */
-    for (int i = 0; i < NUM_WORKERS; i++) {
+    for (unsigned int i = 0; i < FwdWorker::default_count(); i++) {
         workers.push_back(new FwdWorker(i, verbose));
     }
 }
@@ -312,7 +310,7 @@ accept_rina_flow(int fd, const InetName &inet)
     }
 
     if (ret == 0) {
-        gw->workers[0]->submit(0, cfd, rfd);
+        least_loaded(gw->workers)->submit(0, cfd, rfd);
         return 0;
     }
 
@@ -387,7 +385,7 @@ complete_flow_alloc(int wfd, int cfd)
     }
 
     set_nonblocking(rfd);
-    gw->workers[0]->submit(0, cfd, rfd);
+    least_loaded(gw->workers)->submit(0, cfd, rfd);
 
     return 0;
 }
@@ -618,7 +616,7 @@ main(int argc, char **argv)
              mit != gw->pending_conns.end(); mit++, n++) {
             if (pfd[n].revents & POLLOUT) {
                 /* TCP connection handshake completed. */
-                gw->workers[0]->submit(0, mit->first, mit->second);
+                least_loaded(gw->workers)->submit(0, mit->first, mit->second);
                 completed_conns.push_back(mit->first);
             }
         }
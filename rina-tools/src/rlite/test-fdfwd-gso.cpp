@@ -0,0 +1,303 @@
+/*
+ * Checks the segmentation of the TCP super-packets read from a TUN device
+ * with TSO enabled (FWD_F_GSO sessions).
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <netinet/in.h>
+
+#include "fdfwd.hpp"
+
+#define GSO_SIZE 1000
+#define PAYLOAD_LEN 4500
+#define NUM_SEGS ((PAYLOAD_LEN + GSO_SIZE - 1) / GSO_SIZE)
+#define TCP_HLEN 32 /* with options */
+#define IP_ID 0x1234
+#define TCP_SEQ 100
+
+using namespace std;
+
+static uint16_t
+get16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint16_t
+csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return sum;
+}
+
+static uint32_t
+csum_add(uint32_t sum, const unsigned char *p, int len)
+{
+    for (int k = 0; k < len; k += 2) {
+        sum += get16(p + k);
+    }
+
+    return sum;
+}
+
+static void
+init_out(Fd &out)
+{
+    out.size = FDFWD_GSO_BUFSZ;
+    out.data.reset(new char[out.size]);
+}
+
+/* Builds a super-packet of PAYLOAD_LEN bytes, virtio-net header
+ * included, returns its length. */
+static int
+build_super_packet(unsigned char *buf, bool v4)
+{
+    unsigned char *ip = buf + sizeof(VnetHdr);
+    int iphl          = v4 ? 20 : 40;
+    unsigned char *tcp = ip + iphl;
+    int hlen          = iphl + TCP_HLEN;
+    VnetHdr h;
+
+    memset(&h, 0, sizeof(h));
+    h.flags       = VNET_HDR_F_NEEDS_CSUM;
+    h.gso_type    = v4 ? VNET_HDR_GSO_TCPV4 : VNET_HDR_GSO_TCPV6;
+    h.gso_size    = GSO_SIZE;
+    h.hdr_len     = hlen;
+    h.csum_start  = iphl;
+    h.csum_offset = 16;
+    memcpy(buf, &h, sizeof(h));
+
+    memset(ip, 0, hlen);
+    if (v4) {
+        ip[0] = 0x45;
+        ip[4] = IP_ID >> 8;
+        ip[5] = IP_ID & 0xff;
+        ip[8] = 64;
+        ip[9] = IPPROTO_TCP;
+        ip[12] = 10, ip[15] = 1;
+        ip[16] = 10, ip[19] = 2;
+    } else {
+        ip[0] = 0x60;
+        ip[6] = IPPROTO_TCP;
+        ip[7] = 64;
+        ip[8] = 0xfe, ip[23] = 1;
+        ip[24] = 0xfe, ip[39] = 2;
+    }
+
+    tcp[7]  = TCP_SEQ;
+    tcp[12] = (TCP_HLEN / 4) << 4;
+    tcp[13] = 0x80 | 0x10 | 0x08 | 0x01; /* CWR, ACK, PSH, FIN */
+
+    for (int i = 0; i < PAYLOAD_LEN; i++) {
+        ip[hlen + i] = i * 7;
+    }
+
+    return sizeof(VnetHdr) + hlen + PAYLOAD_LEN;
+}
+
+static int
+check_segments(const Fd &out, bool v4)
+{
+    const unsigned char *o =
+        reinterpret_cast<const unsigned char *>(out.data.get());
+    int iphl = v4 ? 20 : 40;
+    int hlen = iphl + TCP_HLEN;
+    int ofs  = 0;
+
+    if (out.pkts.size() != NUM_SEGS) {
+        cout << "Expected " << NUM_SEGS << " segments, got "
+             << out.pkts.size() << endl;
+        return -1;
+    }
+
+    for (int k = 0; k < NUM_SEGS; k++) {
+        const unsigned char *ip  = o + ofs + sizeof(VnetHdr);
+        const unsigned char *tcp = ip + iphl;
+        int len    = out.pkts[k] - sizeof(VnetHdr);
+        int seglen = min(GSO_SIZE, PAYLOAD_LEN - k * GSO_SIZE);
+        uint8_t flags = 0x10; /* ACK */
+        uint32_t sum;
+        VnetHdr sh;
+
+        memcpy(&sh, o + ofs, sizeof(sh));
+        if (sh.gso_type != VNET_HDR_GSO_NONE ||
+            !(sh.flags & VNET_HDR_F_NEEDS_CSUM) || sh.csum_start != iphl ||
+            sh.csum_offset != 16) {
+            cout << "Segment " << k << ": bad virtio-net header" << endl;
+            return -1;
+        }
+
+        if (len != hlen + seglen) {
+            cout << "Segment " << k << ": length " << len << ", expected "
+                 << hlen + seglen << endl;
+            return -1;
+        }
+
+        if (v4) {
+            if (csum_fold(csum_add(0, ip, iphl)) != 0xffff) {
+                cout << "Segment " << k << ": bad IPv4 checksum" << endl;
+                return -1;
+            }
+            if (get16(ip + 2) != len || get16(ip + 4) != IP_ID + k) {
+                cout << "Segment " << k << ": bad IPv4 length or id"
+                     << endl;
+                return -1;
+            }
+        } else if (get16(ip + 4) != len - iphl) {
+            cout << "Segment " << k << ": bad IPv6 payload length" << endl;
+            return -1;
+        }
+
+        if (get32(tcp + 4) != (uint32_t)(TCP_SEQ + k * GSO_SIZE)) {
+            cout << "Segment " << k << ": bad sequence number" << endl;
+            return -1;
+        }
+
+        /* CWR only on the first segment, PSH and FIN on the last. */
+        if (k == 0) {
+            flags |= 0x80;
+        }
+        if (k == NUM_SEGS - 1) {
+            flags |= 0x08 | 0x01;
+        }
+        if (tcp[13] != flags) {
+            cout << "Segment " << k << ": bad TCP flags" << endl;
+            return -1;
+        }
+
+        /* The receiver completes the checksum, so the segment must
+         * carry the pseudo-header sum. */
+        sum = csum_add(0, ip + (v4 ? 12 : 8), v4 ? 8 : 32);
+        sum += IPPROTO_TCP + len - iphl;
+        if (get16(tcp + 16) != csum_fold(sum)) {
+            cout << "Segment " << k << ": bad pseudo-header checksum"
+                 << endl;
+            return -1;
+        }
+
+        for (int j = 0; j < seglen; j++) {
+            if (ip[hlen + j] != (unsigned char)((k * GSO_SIZE + j) * 7)) {
+                cout << "Segment " << k << ": payload mismatch at " << j
+                     << endl;
+                return -1;
+            }
+        }
+
+        ofs += out.pkts[k];
+    }
+
+    if (out.fill != ofs || out.len != ofs) {
+        cout << "Output buffer accounting mismatch" << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+test_super_packet(bool v4)
+{
+    static unsigned char buf[FDFWD_GSO_MAXPKT];
+    int len = build_super_packet(buf, v4);
+    Fd out;
+
+    init_out(out);
+    if (FwdWorker::gso_segment(out, reinterpret_cast<char *>(buf), len) !=
+        NUM_SEGS) {
+        cout << (v4 ? "IPv4" : "IPv6") << " super-packet not segmented"
+             << endl;
+        return -1;
+    }
+
+    return check_segments(out, v4);
+}
+
+/* A packet which is not a super-packet is copied as is. */
+static int
+test_plain_packet()
+{
+    static unsigned char buf[FDFWD_GSO_MAXPKT];
+    int len = build_super_packet(buf, true);
+    VnetHdr h;
+    Fd out;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(buf, &h, sizeof(h));
+    init_out(out);
+    if (FwdWorker::gso_segment(out, reinterpret_cast<char *>(buf), len) !=
+            1 ||
+        out.pkts.size() != 1 || out.pkts[0] != len ||
+        memcmp(out.data.get(), buf, len)) {
+        cout << "Plain packet not copied as is" << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* A super-packet which is not TCP is dropped. */
+static int
+test_malformed_packet()
+{
+    static unsigned char buf[FDFWD_GSO_MAXPKT];
+    int len = build_super_packet(buf, true);
+    Fd out;
+
+    buf[sizeof(VnetHdr) + 9] = IPPROTO_UDP;
+    init_out(out);
+    if (FwdWorker::gso_segment(out, reinterpret_cast<char *>(buf), len) !=
+            0 ||
+        out.fill != 0 || !out.pkts.empty()) {
+        cout << "Malformed packet not dropped" << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main()
+{
+    if (test_super_packet(true) || test_super_packet(false) ||
+        test_plain_packet() || test_malformed_packet()) {
+        cout << "test-fdfwd-gso FAILED" << endl;
+        return EXIT_FAILURE;
+    }
+
+    cout << "test-fdfwd-gso PASSED" << endl;
+
+    return EXIT_SUCCESS;
+}
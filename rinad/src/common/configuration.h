@@ -38,7 +38,8 @@ class EnrollmentInformationRequest {
  public:
         EnrollmentInformationRequest()
                         : address_(0),
-                          allowed_to_start_early_(false)
+                          allowed_to_start_early_(false),
+                          dft_sync_version_(0)
         {
         }
         ;
@@ -49,6 +50,10 @@ class EnrollmentInformationRequest {
         std::list<rina::ApplicationProcessNamingInformation> supporting_difs_;
         bool allowed_to_start_early_;
         std::string token;
+
+        /// Version of the DFT state last synchronized with the peer
+        /// (0 if none), used to send only what changed since then
+        unsigned long long dft_sync_version_;
 };
 
 /// Encapsulates all the information required to manage a Flow
@@ -936,6 +936,7 @@ void EnrollmentInformationRequestEncoder::encode(
         gpb.set_address(obj.address_);
         gpb.set_startearly(obj.allowed_to_start_early_);
         gpb.set_token(obj.token);
+        gpb.set_dftsyncversion(obj.dft_sync_version_);
 
         for (std::list<rina::ApplicationProcessNamingInformation>::const_iterator it =
                         obj.supporting_difs_.begin();
@@ -959,6 +960,7 @@ void EnrollmentInformationRequestEncoder::decode(
         des_obj.address_ = gpb.address();
         des_obj.allowed_to_start_early_ = gpb.startearly();
         des_obj.token = gpb.token();
+        des_obj.dft_sync_version_ = gpb.dftsyncversion();
 
         for (int i = 0; i < gpb.supportingdifs_size(); ++i)
         {
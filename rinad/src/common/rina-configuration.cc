@@ -97,6 +97,7 @@ string LocalConfiguration::toString() const
         ss << "\tLibrary path: " << libraryPath << endl;
         ss << "\tLog path: " << logPath << endl;
         ss << "\tConsole socket: " << consoleSocket << endl;
+        ss << "\tIPCP pool size: " << ipcpPoolSize << endl;
 
 	ss << "\tPlugins paths:" <<endl;
 	for (list<string>::const_iterator lit = pluginsPaths.begin();
@@ -172,9 +172,15 @@ struct LocalConfiguration {
 	/* The system name */
 	rina::ApplicationProcessNamingInformation system_name;
 
+	/*
+	 * Number of IPC Process daemons kept started and waiting to be
+	 * bound to a new IPC Process (0 disables the pool)
+	 */
+	unsigned int ipcpPoolSize;
+
         std::string toString() const;
 
-        LocalConfiguration() { }
+        LocalConfiguration() : ipcpPoolSize(0) { }
 };
 
 struct DIFTemplateMapping {
@@ -171,7 +171,7 @@ public:
 			return rina::UNIXConsole::CMDRETCONT;
 		}
 
-		if (IPCManager->assign_to_dif((IPCMConsole*) console, &promise, ipcp_id, dif_template, dif_name) == IPCM_FAILURE ||
+		if (IPCManager->assign_to_dif((IPCMConsole*) console, &promise, ipcp_id, args[3], dif_name) == IPCM_FAILURE ||
 				promise.wait() != IPCM_SUCCESS){
 			console->outstream << "DIF assignment failed" << endl;
 			return rina::UNIXConsole::CMDRETCONT;
@@ -192,7 +192,7 @@ public:
 	int execute(std::vector<string>& args) {
 		int ipcp_id;
 		QueryRIBPromise promise;
-		string objectClass, objectName;
+		string objectClass, objectName, page;
 
 		if (args.size() < 2) {
 			console->outstream << console->commands_map[args[0]]->usage << endl;
@@ -217,13 +217,21 @@ public:
 		}
 
 		if (IPCManager->query_rib((IPCMConsole*) console, &promise, ipcp_id,
-					  objectClass, objectName) == IPCM_FAILURE ||
-				promise.wait() != IPCM_SUCCESS) {
+					  objectClass, objectName) == IPCM_FAILURE) {
 			console->outstream << "Query RIB operation failed" << endl;
 			return rina::UNIXConsole::CMDRETCONT;
 		}
 
-		console->outstream << promise.serialized_rib << endl;
+		// Write every page to the client as soon as it arrives
+		while (promise.next_page(page)) {
+			console->outstream << page;
+			console->flush();
+		}
+
+		if (promise.ret != IPCM_SUCCESS) {
+			console->outstream << "Query RIB operation failed" << endl;
+			return rina::UNIXConsole::CMDRETCONT;
+		}
 
 		return rina::UNIXConsole::CMDRETCONT;
 	}
@@ -669,6 +677,23 @@ public:
 	}
 };
 
+class ShowIPCPCreationStatsConsoleCmd: public rina::ConsoleCmdInfo {
+public:
+	ShowIPCPCreationStatsConsoleCmd(IPCMConsole * console) :
+		rina::ConsoleCmdInfo("USAGE: show-ipcp-creation-stats", console) {};
+
+	int execute(std::vector<string>& args) {
+		if (args.size() != 1) {
+			console->outstream << console->commands_map[args[0]]->usage << endl;
+			return rina::UNIXConsole::CMDRETCONT;
+		}
+
+		console->outstream << IPCManager->get_ipcp_factory()->get_creation_stats();
+
+		return rina::UNIXConsole::CMDRETCONT;
+	}
+};
+
 class UpdateCatalogueConsoleCmd: public rina::ConsoleCmdInfo {
 public:
 	UpdateCatalogueConsoleCmd(IPCMConsole * console) :
@@ -823,8 +848,9 @@ public:
 class MapIPPrefixToFlowConsoleCmd: public rina::ConsoleCmdInfo {
 public:
 	MapIPPrefixToFlowConsoleCmd(IPCMConsole * console) :
-		rina::ConsoleCmdInfo("USAGE: map-ip-prefix-to-flow <ip_prefix> "
-				     "<port_id>", console) {};
+		rina::ConsoleCmdInfo("USAGE: map-ip-prefix-to-flow "
+				     "<ip_prefix>[,<ip_prefix>...] <port_id>",
+				     console) {};
 
 	int execute(vector<string>& args) {
 		int port_id;
@@ -873,6 +899,7 @@ IPCMConsole::IPCMConsole(const string& socket_path_) :
 	commands_map["show-dif-templates"] = new ShowDIFTemplatesConsoleCmd(this);
 	commands_map["read-ipcp-ribobj"] = new ReadIPCPRIBObjConsoleCmd(this);
 	commands_map["show-catalog"] = new ShowCatalogueConsoleCmd(this);
+	commands_map["show-ipcp-creation-stats"] = new ShowIPCPCreationStatsConsoleCmd(this);
 	commands_map["update-catalog"] = new UpdateCatalogueConsoleCmd(this);
 	commands_map["query-ma-rib"] = new QueryMARIBConsoleCmd(this);
 	commands_map["list-da-map"] = new ListDIFAllocatorMapCmd(this);
@@ -26,8 +26,10 @@
 #include <vector>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <dirent.h>
+#include <time.h>
 
 #include <librina/common.h>
 #include <librina/ipc-manager.h>
@@ -126,25 +128,82 @@ void Catalog::import()
 	}
 }
 
+int Catalog::get_plugin_info(const string& plugin_name,
+			     const string& plugin_path,
+			     list<rina::PsInfo>& result, bool *parsed)
+{
+	string manifest_path = plugin_path + "/" + plugin_name +
+			       MANIFEST_SUFFIX;
+	map<string, CatalogManifest>::iterator mit;
+	list<rina::PsInfo> policy_sets;
+	struct stat st;
+
+	if (parsed) {
+		*parsed = false;
+	}
+
+	if (stat(manifest_path.c_str(), &st)) {
+		LOG_WARN("Cannot stat manifest file %s",
+			 manifest_path.c_str());
+		return -1;
+	}
+
+	{
+		rina::ScopedLock g(manifests_lock);
+
+		mit = manifests.find(manifest_path);
+		if (mit != manifests.end() && mit->second.mtime == st.st_mtime) {
+			result = mit->second.policy_sets;
+			return 0;
+		}
+	}
+
+	// Parse out of the lock, manifests may be large
+	if (rina::plugin_get_info(plugin_name, plugin_path, policy_sets)) {
+		return -1;
+	}
+
+	rina::ScopedLock g(manifests_lock);
+
+	manifests[manifest_path].mtime = st.st_mtime;
+	manifests[manifest_path].policy_sets = policy_sets;
+	result = policy_sets;
+	if (parsed) {
+		*parsed = true;
+	}
+
+	return 0;
+}
+
 void Catalog::add_plugin(const string& plugin_name, const string& plugin_path)
 {
 	list<rina::PsInfo> new_policy_sets;
-	rina::WriteScopedLock wlock(rwlock);
+	bool parsed;
 	int ret;
 
-	if (plugins.count(plugin_name)) {
-		// Plugin already in the catalog
-		return;
-	}
-
-	ret = rina::plugin_get_info(plugin_name, plugin_path, new_policy_sets);
+	ret = get_plugin_info(plugin_name, plugin_path, new_policy_sets,
+			      &parsed);
 	if (ret) {
 		LOG_WARN("Failed to load manifest file for plugin '%s'",
 			 plugin_name.c_str());
 		return;
 	}
 
-	plugins[plugin_name] = new CatalogPlugin(plugin_name, plugin_path);
+	rina::WriteScopedLock wlock(rwlock);
+
+	if (plugins.count(plugin_name)) {
+		if (!parsed || plugins[plugin_name]->path != plugin_path) {
+			// Plugin already in the catalog and unchanged
+			return;
+		}
+
+		// The manifest changed, pick up its new policy sets
+		LOG_INFO("Catalog: manifest of plugin %s changed",
+			 plugin_name.c_str());
+	} else {
+		plugins[plugin_name] = new CatalogPlugin(plugin_name,
+							 plugin_path);
+	}
 
 	for (list<rina::PsInfo>::const_iterator ps = new_policy_sets.begin();
 					ps != new_policy_sets.end(); ps++) {
@@ -239,10 +298,63 @@ int Catalog::load(Addon *addon, unsigned int ipcp_id,
 				 pit->second.ttlPolicy);
 	}
 
+	// Find the plugins that have to be loaded, each one only once
+	map<string, Promise *> loads;
+	map<string, Promise *>::iterator lit;
+	list<Promise *> promises;
+	map<rina::PsInfo *, string> ps_plugin;
+
+	{
+		rina::ReadScopedLock rlock(rwlock);
+		CatalogPsInfo *cpsinfo;
+
+		for (list<rina::PsInfo>::iterator i =
+				required_policy_sets.begin();
+				i != required_policy_sets.end(); i++) {
+			cpsinfo = ps_lookup(*i);
+			if (!cpsinfo || cpsinfo->plugin->loaded.count(ipcp_id)) {
+				continue;
+			}
+
+			ps_plugin[&(*i)] = cpsinfo->plugin->name;
+			if (loads.count(cpsinfo->plugin->name) == 0) {
+				loads[cpsinfo->plugin->name] = new Promise();
+			}
+		}
+	}
+
+	// Plugins are independent of each other: issue all the loads
+	// first and then wait for them together, so that they proceed
+	// in parallel
+	for (lit = loads.begin(); lit != loads.end(); lit++) {
+		if (start_plugin_load(addon, ipcp_id, lit->first,
+				      lit->second)) {
+			lit->second->ret = IPCM_FAILURE;
+		}
+		promises.push_back(lit->second);
+	}
+
+	Promise::wait_all(promises);
+
+	for (lit = loads.begin(); lit != loads.end(); lit++) {
+		if (lit->second->ret != IPCM_SUCCESS) {
+			LOG_WARN("Error occurred while loading plugin '%s'",
+				 lit->first.c_str());
+		}
+	}
+
 	// Load all the policy sets in the list
 	for (list<rina::PsInfo>::iterator i=required_policy_sets.begin();
 			i != required_policy_sets.end(); i++) {
-		int ret = load_policy_set(addon, ipcp_id, *i);
+		int ret;
+
+		if (ps_plugin.count(&(*i))) {
+			ret = loads[ps_plugin[&(*i)]]->ret == IPCM_SUCCESS ?
+									0 : -1;
+		} else {
+			// Already loaded or unknown, let the lookup tell
+			ret = load_policy_set(addon, ipcp_id, *i);
+		}
 
 		if (ret) {
 			LOG_WARN("Failed to load policy-set %s",
@@ -262,6 +374,10 @@ int Catalog::load(Addon *addon, unsigned int ipcp_id,
 		}
 	}
 
+	for (lit = loads.begin(); lit != loads.end(); lit++) {
+		delete lit->second;
+	}
+
 	return 0;
 }
 
@@ -289,6 +405,14 @@ Catalog::ps_lookup(const rina::PsInfo& psinfo)
 	return cmap[psinfo.name];
 }
 
+static unsigned long catalog_time_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 int Catalog::plugin_loaded(const string& plugin_name, unsigned int ipcp_id,
 			   bool load)
 {
@@ -305,10 +429,23 @@ int Catalog::plugin_loaded(const string& plugin_name, unsigned int ipcp_id,
 
 	// Mark the plugin as (un)loaded for the specified IPCP
 	if (load) {
-		plugins[plugin_name]->loaded.insert(ipcp_id);
+		CatalogPlugin *plugin = plugins[plugin_name];
+		map<unsigned int, unsigned long>::iterator sit;
+
+		plugin->loaded.insert(ipcp_id);
+
+		sit = plugin->load_started_ms.find(ipcp_id);
+		if (sit != plugin->load_started_ms.end()) {
+			plugin->load_time_ms = catalog_time_ms() - sit->second;
+			plugin->load_started_ms.erase(sit);
+			LOG_INFO("Plugin '%s' successfully loaded in %lu ms",
+				 plugin_name.c_str(), plugin->load_time_ms);
+		}
 	} else {
 		plugins[plugin_name]->loaded.erase(ipcp_id);
 	}
+
+	return 0;
 }
 
 CatalogResource *
@@ -401,17 +538,43 @@ int Catalog::load_policy_set(Addon *addon, unsigned int ipcp_id,
 
 	// Perform the plugin loading - a blocking and possibly
 	// asynchronous operation - out of the catalog lock
-	if (IPCManager->plugin_load(addon, &promise, ipcp_id,
-			plugin_name, true) == IPCM_FAILURE ||
+	return load_plugin(addon, ipcp_id, plugin_name);
+}
+
+int Catalog::start_plugin_load(Addon *addon, unsigned int ipcp_id,
+				const string& plugin_name, Promise *promise)
+{
+	{
+		rina::WriteScopedLock wlock(rwlock);
+
+		if (plugins.count(plugin_name)) {
+			plugins[plugin_name]->load_started_ms[ipcp_id] =
+							catalog_time_ms();
+		}
+	}
+
+	// The catalog lock must not be held here, plugin_loaded() may
+	// be called before plugin_load() returns
+	if (IPCManager->plugin_load(addon, promise, ipcp_id,
+			plugin_name, true) == IPCM_FAILURE) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int Catalog::load_plugin(Addon *addon, unsigned int ipcp_id,
+			 const string& plugin_name)
+{
+	Promise promise;
+
+	if (start_plugin_load(addon, ipcp_id, plugin_name, &promise) ||
 				promise.wait() != IPCM_SUCCESS) {
 		LOG_WARN("Error occurred while loading plugin '%s'",
 			 plugin_name.c_str());
 		return -1;
 	}
 
-	LOG_INFO("Plugin '%s' successfully loaded",
-			plugin_name.c_str());
-
 	return 0;
 }
 
@@ -423,6 +586,7 @@ void Catalog::ipcp_destroyed(unsigned int ipcp_id)
 			plit = plugins.begin(); plit != plugins.end();
 								plit++) {
 		plit->second->loaded.erase(ipcp_id);
+		plit->second->load_started_ms.erase(ipcp_id);
 	}
 }
 
@@ -436,6 +600,8 @@ string Catalog::toString(const CatalogPsInfo *cps) const
 	   << endl << "    ps version: " << cps->version
 	   << endl << "    plugin: " << cps->plugin->path
 	   << "/" << cps->plugin->name
+	   << endl << "    plugin load time: " << cps->plugin->load_time_ms
+	   << " ms"
 	   << endl << "    loaded for ipcps [ ";
 	for (set<unsigned int>::iterator
 		ii = cps->plugin->loaded.begin();
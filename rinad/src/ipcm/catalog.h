@@ -48,9 +48,21 @@ struct CatalogPlugin {
 	// The IPCPs for which the plugin is already loaded ?
 	std::set<unsigned int> loaded;
 
-	CatalogPlugin() { }
+	// How long the last load of the plugin took (ms)
+	unsigned long load_time_ms;
+
+	// When the outstanding loads were issued, per IPCP (ms)
+	std::map<unsigned int, unsigned long> load_started_ms;
+
+	CatalogPlugin() : load_time_ms(0) { }
 	CatalogPlugin(const std::string& n, const std::string& p)
-			: name(n), path(p) { }
+			: name(n), path(p), load_time_ms(0) { }
+};
+
+// A parsed plugin manifest, valid while the file is not modified
+struct CatalogManifest {
+	time_t mtime;
+	std::list<rina::PsInfo> policy_sets;
 };
 
 struct CatalogPsInfo: public rina::PsInfo {
@@ -80,6 +92,8 @@ struct CatalogResource {
 				: id(_id), ps(_ps) { }
 };
 
+class Promise;
+
 class Catalog {
 public:
 	Catalog() { }
@@ -88,6 +102,17 @@ public:
 	void import();
 	void add_plugin(const std::string& plugin_name,
 		        const std::string& plugin_path);
+
+	// Like rina::plugin_get_info(), but the manifest is only parsed
+	// again if it was modified since the last call. If parsed is not
+	// NULL, it is set to whether the manifest had to be parsed
+	int get_plugin_info(const std::string& plugin_name,
+			    const std::string& plugin_path,
+			    std::list<rina::PsInfo>& result,
+			    bool *parsed = NULL);
+
+	// Load all the policy sets required by the DIF configuration. The
+	// plugins that provide them are loaded in parallel
 	int load(Addon *addon, unsigned int ipcp_id,
 			const rina::DIFConfiguration& t);
 
@@ -121,6 +146,15 @@ private:
 
 	std::string toString(const CatalogPsInfo *cps) const;
 
+	// Issue the load of a plugin for an IPCP without waiting for it;
+	// the promise completes when the plugin has been loaded
+	int start_plugin_load(Addon *addon, unsigned int ipcp_id,
+			      const std::string& plugin_name,
+			      Promise *promise);
+
+	int load_plugin(Addon *addon, unsigned int ipcp_id,
+			const std::string& plugin_name);
+
 	std::map<std::string,
 		 std::map<std::string, CatalogPsInfo*>
 		> policy_sets;
@@ -132,6 +166,10 @@ private:
 		> resources;
 
 	rina::ReadWriteLockable rwlock;
+
+	// Parsed manifests, by manifest file path
+	std::map<std::string, CatalogManifest> manifests;
+	rina::Lockable manifests_lock;
 };
 
 } // namespace rinad
@@ -191,6 +191,9 @@ void parse_local_conf(const Json::Value &         root,
 		local.logPath = std::string(DEFAULT_LOGDIR);
 	}
 
+	local.ipcpPoolSize = local_conf.get("ipcpPoolSize",
+					    local.ipcpPoolSize).asUInt();
+
 	plugins_paths = local_conf["pluginsPaths"];
 	if (plugins_paths != 0) {
 		for (unsigned int j = 0; j < plugins_paths.size();
@@ -23,12 +23,14 @@
 #include <errno.h>
 #include <poll.h>
 #include <sys/inotify.h>
+#include <time.h>
 
 #define RINA_PREFIX     "ipcm.dif-template-manager"
 #include <librina/logs.h>
 
 #include "configuration.h"
 #include "dif-template-manager.h"
+#include "dif-validator.h"
 #include "ipcm.h"
 
 using namespace std;
@@ -183,6 +185,103 @@ int DIFConfigFolderMonitor::run()
 	return 0;
 }
 
+//Class CompiledDIFTemplate
+bool CompiledDIFTemplate::lookup_ipcp_address(
+		const rina::ApplicationProcessNamingInformation& ipcp_name,
+		unsigned int& result) const
+{
+	std::map<std::pair<std::string, std::string>, unsigned int>::const_iterator it;
+
+	it = addresses.find(std::make_pair(ipcp_name.processName,
+					   ipcp_name.processInstance));
+	if (it == addresses.end())
+		return false;
+
+	result = it->second;
+	return true;
+}
+
+int compile_dif_template(const rinad::DIFTemplate& dif_template,
+			 const std::string& dif_type,
+			 const rina::ApplicationProcessNamingInformation& dif_name,
+			 CompiledDIFTemplate& result)
+{
+	rina::DIFConfiguration& dif_config = result.dif_config;
+	rina::DIFInformation dif_info;
+
+	result.dif_type = dif_type;
+
+	if (dif_type == rina::NORMAL_IPC_PROCESS) {
+		rina::EFCPConfiguration efcp_config;
+		rina::NamespaceManagerConfiguration nsm_config;
+		rina::AddressingConfiguration address_config;
+
+		efcp_config.set_data_transfer_constants(
+				dif_template.dataTransferConstants);
+		for (std::list<rina::QoSCube>::const_iterator qit =
+				dif_template.qosCubes.begin();
+				qit != dif_template.qosCubes.end(); qit++) {
+			efcp_config.add_qos_cube(new rina::QoSCube(*qit));
+		}
+
+		for (std::list<AddressPrefixConfiguration>::const_iterator ait =
+				dif_template.addressPrefixes.begin();
+				ait != dif_template.addressPrefixes.end(); ait++) {
+			rina::AddressPrefixConfiguration prefix;
+			prefix.address_prefix_ = ait->addressPrefix;
+			prefix.organization_ = ait->organization;
+			address_config.address_prefixes_.push_back(prefix);
+		}
+
+		for (std::list<rinad::KnownIPCProcessAddress>::const_iterator kit =
+				dif_template.knownIPCProcessAddresses.begin();
+				kit != dif_template.knownIPCProcessAddresses.end(); kit++) {
+			rina::StaticIPCProcessAddress static_address;
+			static_address.ap_name_ = kit->name.processName;
+			static_address.ap_instance_ = kit->name.processInstance;
+			static_address.address_ = kit->address;
+			address_config.static_address_.push_back(static_address);
+
+			//The first entry wins, as in DIFTemplate::lookup_ipcp_address
+			result.addresses.insert(std::make_pair(
+					std::make_pair(kit->name.processName,
+						       kit->name.processInstance),
+					kit->address));
+		}
+		nsm_config.addressing_configuration_ = address_config;
+		nsm_config.policy_set_ = dif_template.nsmConfiguration.policy_set_;
+
+		dif_config.efcp_configuration_ = efcp_config;
+		dif_config.nsm_configuration_ = nsm_config;
+		dif_config.rmt_configuration_ = dif_template.rmtConfiguration;
+		dif_config.fa_configuration_ = dif_template.faConfiguration;
+		dif_config.ra_configuration_ = dif_template.raConfiguration;
+		dif_config.routing_configuration_ = dif_template.routingConfiguration;
+		dif_config.sm_configuration_ = dif_template.secManConfiguration;
+		dif_config.et_configuration_ = dif_template.etConfiguration;
+	}
+
+	for (std::map<std::string, std::string>::const_iterator pit =
+			dif_template.configParameters.begin();
+			pit != dif_template.configParameters.end(); pit++) {
+		dif_config.add_parameter(
+				rina::PolicyParameter(pit->first, pit->second));
+	}
+
+	dif_info.dif_name_ = dif_name;
+	dif_info.dif_type_ = dif_type;
+	dif_info.dif_configuration_ = dif_config;
+	DIFConfigValidator validator(dif_info, dif_type);
+	if (!validator.validateConfigs()) {
+		LOG_ERR("DIF template %s is not valid for IPCPs of type %s "
+			"in DIF %s", dif_template.templateName.c_str(),
+			dif_type.c_str(), dif_name.processName.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
 //Class DIF Template Manager
 const std::string DIFTemplateManager::DEFAULT_TEMPLATE_NAME = "default.dif";
 
@@ -228,6 +327,13 @@ DIFTemplateManager::~DIFTemplateManager()
 			it != dif_templates.end(); ++it){
 		delete it->second;
 	}
+
+	for (std::map<std::pair<std::string, std::string>,
+			CompiledDIFTemplate *>::iterator it =
+			compiled_templates.begin();
+			it != compiled_templates.end(); ++it) {
+		delete it->second;
+	}
 }
 
 int DIFTemplateManager::load_initial_dif_templates()
@@ -297,6 +403,68 @@ int DIFTemplateManager::get_dif_template(const std::string& name, rinad::DIFTemp
 	}
 }
 
+static unsigned long template_time_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int DIFTemplateManager::get_compiled_dif_template(const std::string& name,
+		const rina::ApplicationProcessNamingInformation& dif_name,
+		const rina::ApplicationProcessNamingInformation& ipcp_name,
+		CompiledDIFTemplate& result)
+{
+	std::map<std::pair<std::string, std::string>,
+		 CompiledDIFTemplate *>::iterator cit;
+	std::map<std::string, rinad::DIFTemplate *>::iterator it;
+	CompiledDIFTemplate * compiled;
+	unsigned int address;
+	unsigned long start;
+
+	rina::ReadScopedLock g(templates_lock);
+	rina::ScopedLock c(compiled_lock);
+
+	cit = compiled_templates.find(std::make_pair(name,
+						     dif_name.processName));
+	if (cit != compiled_templates.end()) {
+		compiled = cit->second;
+	} else {
+		it = dif_templates.find(name);
+		if (it == dif_templates.end()) {
+			LOG_ERR("Could not find DIF template with name %s",
+				name.c_str());
+			return -1;
+		}
+
+		start = template_time_us();
+		compiled = new CompiledDIFTemplate();
+		if (compile_dif_template(*(it->second), it->second->difType,
+					 dif_name, *compiled)) {
+			delete compiled;
+			return -1;
+		}
+
+		compiled_templates[std::make_pair(name, dif_name.processName)] =
+			compiled;
+		LOG_INFO("Compiled DIF template %s for DIF %s in %lu us",
+			 name.c_str(), dif_name.processName.c_str(),
+			 template_time_us() - start);
+	}
+
+	result.dif_type = compiled->dif_type;
+	result.dif_config = compiled->dif_config;
+	result.addresses.clear();
+	if (compiled->lookup_ipcp_address(ipcp_name, address)) {
+		result.addresses[std::make_pair(ipcp_name.processName,
+						ipcp_name.processInstance)] =
+			address;
+	}
+
+	return 0;
+}
+
 void DIFTemplateManager::augment_dif_template(rinad::DIFTemplate * dif_template)
 {
 	if (!default_template || dif_template->templateName == DEFAULT_TEMPLATE_NAME ||
@@ -410,6 +578,17 @@ void DIFTemplateManager::remove_dif_template(const std::string& name)
 
 void DIFTemplateManager::internal_remove_dif_template(const std::string& name)
 {
+	std::map<std::pair<std::string, std::string>,
+		 CompiledDIFTemplate *>::iterator cit;
+
+	//Compiled with the previous version of the template, for any DIF
+	cit = compiled_templates.lower_bound(std::make_pair(name,
+							    std::string()));
+	while (cit != compiled_templates.end() && cit->first.first == name) {
+		delete cit->second;
+		compiled_templates.erase(cit++);
+	}
+
 	std::map<std::string, rinad::DIFTemplate*>::iterator it = dif_templates.find(name);
 	if (it != dif_templates.end()) {
 		dif_templates.erase(name);
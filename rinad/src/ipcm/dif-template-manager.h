@@ -55,6 +55,28 @@ private:
 	rina::Lockable lock;
 };
 
+/// A DIF template compiled into the DIF configuration that is assigned to
+/// the IPCPs of a DIF: built and validated once, only the address changes
+/// from one IPCP to another. Not modified once compiled
+struct CompiledDIFTemplate {
+	std::string dif_type;
+	rina::DIFConfiguration dif_config;
+
+	/// Addresses of the known IPCPs, by process name and instance
+	std::map<std::pair<std::string, std::string>, unsigned int> addresses;
+
+	bool lookup_ipcp_address(
+			const rina::ApplicationProcessNamingInformation& ipcp_name,
+			unsigned int& result) const;
+};
+
+/// Compile dif_template for the IPCPs of type dif_type in DIF dif_name.
+/// Returns -1 if the resulting DIF configuration is not valid
+int compile_dif_template(const rinad::DIFTemplate& dif_template,
+			 const std::string& dif_type,
+			 const rina::ApplicationProcessNamingInformation& dif_name,
+			 CompiledDIFTemplate& result);
+
 class DIFTemplateManager {
 public:
 	static const std::string DEFAULT_TEMPLATE_NAME;
@@ -67,6 +89,15 @@ public:
 	void remove_dif_template(const std::string& name);
 	void get_all_dif_templates(std::list<rinad::DIFTemplate>& dif_templates);
 
+	/// Get what is needed to assign ipcp_name to dif_name using template
+	/// name: its compiled version, compiled the first time it is used for
+	/// that DIF and every time the template changes, and the address of
+	/// ipcp_name
+	int get_compiled_dif_template(const std::string& name,
+			const rina::ApplicationProcessNamingInformation& dif_name,
+			const rina::ApplicationProcessNamingInformation& ipcp_name,
+			CompiledDIFTemplate& result);
+
 private:
 	int load_initial_dif_templates();
 	void internal_remove_dif_template(const std::string& name);
@@ -78,6 +109,13 @@ private:
 	//The current templates
 	std::map<std::string, rinad::DIFTemplate *> dif_templates;
 
+	//The templates compiled so far, by template and DIF name, dropped
+	//when the template changes. Accessed with templates_lock held for
+	//reading and compiled_lock, or with templates_lock held for writing
+	std::map<std::pair<std::string, std::string>,
+		 CompiledDIFTemplate *> compiled_templates;
+	rina::Lockable compiled_lock;
+
 	rina::ReadWriteLockable templates_lock;
 	DIFConfigFolderMonitor * monitor;
 	rinad::DIFTemplate * default_template;
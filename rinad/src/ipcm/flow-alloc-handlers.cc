@@ -207,7 +207,7 @@ void IPCManager_::join_dif_continue_flow_alloc(Promise * promise, rina::FlowRequ
         	}
 
         	if (assign_to_dif(NULL, &ipcp_promise, c_promise.ipcp_id,
-        			dif_template, dapp_name) == IPCM_FAILURE
+        			template_mapping.template_name, dapp_name) == IPCM_FAILURE
         			|| ipcp_promise.wait() != IPCM_SUCCESS) {
         		ss << "Problems assigning IPCP " << c_promise.ipcp_id
         				<< " to DIF " << dif_name << std::endl;
@@ -21,10 +21,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
  * MA  02110-1301  USA
  */
-#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <stdexcept>
-#include <stdio.h>
+#include <sstream>
 
 #define RINA_PREFIX     "ipcm.ip-vpn-manager"
 #include <librina/logs.h>
@@ -43,14 +42,14 @@ IPVPNManager::IPVPNManager()
 IPVPNManager::~IPVPNManager()
 {
 	std::map<int, rina::FlowRequestEvent>::iterator it;
-	rina::FlowRequestEvent event;
+	RTNetlinkTransaction trans;
 
-	//Remove all IP over RINA routes and set RINA devs down
+	//Remove all IP over RINA routes and set RINA devs down, all in one go
 	for (it = iporina_flows.begin(); it != iporina_flows.end(); ++it) {
-		event = it->second;
-		add_or_remove_ip_route(event.remoteApplicationName.processName,
-				       event.ipcProcessId, event.portId, false);
+		queue_flow_teardown(trans, it->second);
 	}
+
+	rtnl.commit(trans);
 }
 
 int IPVPNManager::add_registered_ip_vpn(const std::string& ip_vpn)
@@ -189,8 +188,10 @@ int IPVPNManager::get_ip_vpn_flow_info(int port_id,
 
 int IPVPNManager::map_ip_prefix_to_flow(const std::string& prefix, int port_id)
 {
-	int res = 0;
 	std::map<int, rina::FlowRequestEvent>::iterator it;
+	std::list<std::string> prefixes;
+	std::stringstream ss(prefix);
+	std::string item;
 
 	rina::ScopedLock g(lock);
 
@@ -201,14 +202,20 @@ int IPVPNManager::map_ip_prefix_to_flow(const std::string& prefix, int port_id)
 		return -1;
 	}
 
-	return add_or_remove_ip_route(prefix, it->second.ipcProcessId, port_id,
-				      true);
+	//Several prefixes can be mapped at once, separated by commas
+	while (std::getline(ss, item, ',')) {
+		if (!item.empty())
+			prefixes.push_back(item);
+	}
+
+	return add_ip_routes(prefixes, it->second.ipcProcessId, port_id);
 }
 
 int IPVPNManager::ip_vpn_flow_deallocated(int port_id, const int ipcp_id)
 {
 	int res = 0;
 	rina::FlowRequestEvent event;
+	RTNetlinkTransaction trans;
 
 	rina::ScopedLock g(lock);
 
@@ -218,9 +225,11 @@ int IPVPNManager::ip_vpn_flow_deallocated(int port_id, const int ipcp_id)
 		return res;
 	}
 
-	//Deactivate RINA device
-	res = activate_device(ipcp_id, event.portId, false);
-	if (res != 0) {
+	//Remove its routes and deactivate RINA device
+	event.ipcProcessId = ipcp_id;
+	queue_flow_teardown(trans, event);
+	flow_prefixes.erase(port_id);
+	if (rtnl.commit(trans) != 0) {
 		LOG_ERR("Problems removing entry from IP routing table");
 	}
 
@@ -265,30 +274,6 @@ int IPVPNManager::remove_flow(rina::FlowRequestEvent& event)
 	return 0;
 }
 
-std::string IPVPNManager::exec_shell_command(std::string command)
-{
-	char buffer[128];
-	std::string result = "";
-	FILE * pipe = 0;
-
-	LOG_DBG("Executing command '%s' ...", command.c_str());
-
-	pipe = popen(command.c_str(), "r");
-	if (!pipe) throw std::runtime_error("popen() failed!");
-	try {
-		while (!feof(pipe)) {
-			if (fgets(buffer, 128, pipe) != NULL)
-				result += buffer;
-		}
-	} catch (...) {
-		pclose(pipe);
-		throw;
-	}
-	pclose(pipe);
-
-	return result;
-}
-
 std::string IPVPNManager::get_rina_dev_name(const int ipcp_id,
 					    const int port_id)
 {
@@ -298,73 +283,73 @@ std::string IPVPNManager::get_rina_dev_name(const int ipcp_id,
 	return ss.str();
 }
 
-std::string IPVPNManager::get_ip_prefix_string(const std::string& input)
+int IPVPNManager::add_ip_routes(const std::list<std::string>& ip_prefixes,
+				const int ipcp_id,
+				const int port_id)
 {
-	std::string result = input;
-	std::replace(result.begin(), result.end(), '|', '/'); // replace all '|' to '/'
-
-	return result;
-}
-
-int IPVPNManager::add_or_remove_ip_route(const std::string ip_prefix,
-					 const int ipcp_id,
-					 const int port_id,
-					 bool add)
-{
-	std::stringstream ss;
-	std::string prefix;
-	std::string result;
+	std::list<std::string>::const_iterator it;
+	std::list<std::string>& mapped = flow_prefixes[port_id];
+	RTNetlinkTransaction trans;
 	std::string dev_name;
-	std::string iproute_command;
+	int res;
 
 	dev_name = get_rina_dev_name(ipcp_id, port_id);
 
-	if (add) {
-		prefix = "add ";
-	} else {
-		prefix = "delete ";
+	for (it = ip_prefixes.begin(); it != ip_prefixes.end(); ++it) {
+		if (trans.add_route(*it, dev_name, true))
+			return -1;
 	}
 
-	ss << "ip route " << prefix
-	   << get_ip_prefix_string(ip_prefix) << " dev "
-	   << dev_name;
-	iproute_command = ss.str();
+	res = rtnl.commit(trans);
+	if (res < 0)
+		return -1;
 
-	if (add) {
-		result = exec_shell_command(iproute_command);
-	} else {
-		result = exec_shell_command(iproute_command);
+	for (unsigned int i = 0; i < trans.size(); i++) {
+		if (trans.get_error(i) == 0) {
+			LOG_DBG("Executed %s", trans.get_description(i).c_str());
+		} else {
+			LOG_ERR("Problems executing %s: %s",
+				trans.get_description(i).c_str(),
+				strerror(trans.get_error(i)));
+		}
 	}
 
-	return 0;
+	//Remember the routes that made it, to remove them with the flow
+	it = ip_prefixes.begin();
+	for (unsigned int i = 0; i < trans.size(); i++, ++it) {
+		if (trans.get_error(i) == 0)
+			mapped.push_back(*it);
+	}
+
+	return res == 0 ? 0 : -1;
 }
 
-int IPVPNManager::activate_device(const int ipcp_id, int port_id, bool activate)
+void IPVPNManager::queue_flow_teardown(RTNetlinkTransaction& trans,
+				       const rina::FlowRequestEvent& event)
 {
-	std::stringstream ss;
-	std::string suffix;
-	std::string result;
+	std::map<int, std::list<std::string> >::iterator it;
+	std::list<std::string>::iterator pit;
 	std::string dev_name;
-	std::string ifconfig_command;
 
-	dev_name = get_rina_dev_name(ipcp_id, port_id);
+	dev_name = get_rina_dev_name(event.ipcProcessId, event.portId);
 
-	if (activate) {
-		suffix = " up";
-	} else {
-		suffix = " down";
+	it = flow_prefixes.find(event.portId);
+	if (it != flow_prefixes.end()) {
+		for (pit = it->second.begin(); pit != it->second.end(); ++pit)
+			trans.add_route(*pit, dev_name, false);
 	}
 
-	ss << "ifconfig " << dev_name << suffix;
-	ifconfig_command = ss.str();
+	trans.set_link_up(dev_name, false);
+}
 
-	if (activate) {
-		result = exec_shell_command(ifconfig_command);
-	} else {
-		result = exec_shell_command(ifconfig_command);
-	}
+int IPVPNManager::activate_device(const int ipcp_id, int port_id, bool activate)
+{
+	RTNetlinkTransaction trans;
 
-	return 0;
+	if (trans.set_link_up(get_rina_dev_name(ipcp_id, port_id), activate))
+		return -1;
+
+	return rtnl.commit(trans) == 0 ? 0 : -1;
 }
 
 // Class IPCManager
@@ -27,6 +27,8 @@
 
 #include <librina/concurrency.h>
 
+#include "rtnetlink.h"
+
 #define RINA_IP_FLOW_ENT_NAME "RINA_IP"
 
 namespace rinad {
@@ -48,16 +50,22 @@ private:
 	bool __ip_vpn_registered(const std::string& ip_vpn);
 	int add_flow(const rina::FlowRequestEvent& event);
 	int remove_flow(rina::FlowRequestEvent& event);
-	int add_or_remove_ip_route(const std::string ip_prefix,
-			           const int ipcp_id, int port_id, bool add);
+	int add_ip_routes(const std::list<std::string>& ip_prefixes,
+			  const int ipcp_id, int port_id);
 	int activate_device(const int ipcp_id, int port_id, bool activate);
-	std::string exec_shell_command(std::string result);
+	void queue_flow_teardown(RTNetlinkTransaction& trans,
+				 const rina::FlowRequestEvent& event);
 	std::string get_rina_dev_name(const int ipcp_id, int port_id);
-	std::string get_ip_prefix_string(const std::string& input);
 
 	std::list<std::string> reg_ip_vpns;
 	rina::Lockable lock;
 	std::map<int, rina::FlowRequestEvent> iporina_flows;
+
+	/// IP prefixes routed through each IP over RINA flow, by port-id
+	std::map<int, std::list<std::string> > flow_prefixes;
+
+	/// Programs the routes and the state of the RINA IP devices
+	RTNetlink rtnl;
 };
 
 } //namespace rinad
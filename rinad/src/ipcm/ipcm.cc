@@ -91,6 +91,7 @@ IPCManager_::IPCManager_()
           dif_template_manager(NULL),
           dif_allocator(NULL),
 	  osp_monitor(NULL),
+	  cp_monitor(NULL),
 	  ip_vpn_manager(NULL)
 {
 	rina::removedir_all("/tmp/rina");
@@ -137,6 +138,13 @@ void IPCManager_::init(const std::string& loglevel, std::string& config_file)
         LOG_DBG("       library path: %s", config.local.libraryPath.c_str());
         LOG_DBG("       log folder: %s", config.local.logPath.c_str());
 
+        // Start the standby IPC Process daemons, if configured
+        if (config.local.ipcpPoolSize > 0) {
+                ipcp_factory_.set_standby_pool_size(config.local.ipcpPoolSize);
+                LOG_DBG("       IPCP pool size: %u",
+                        config.local.ipcpPoolSize);
+        }
+
         // Load the plugins catalog
         catalog.import();
         //catalog.print();
@@ -157,6 +165,10 @@ void IPCManager_::init(const std::string& loglevel, std::string& config_file)
         osp_monitor = new OSProcessMonitor();
         osp_monitor->start();
 
+        // Initialize the monitor of the IPCM children (kernel plugins)
+        cp_monitor = new ChildProcessMonitor();
+        cp_monitor->start();
+
         // Initialize IP VPN Manager
         ip_vpn_manager = new IPVPNManager();
     } catch (rina::InitializationException& e)
@@ -493,17 +505,12 @@ void IPCManager_::pre_assign_to_dif(
     rina::WriteScopedLock writelock(ipcp->rwlock, false);
 }
 
-void IPCManager_::assign_to_dif(Addon* callee, Promise* promise,
-                                rina::DIFInformation dif_info,
-                                IPCMIPCProcess* ipcp)
+unsigned int IPCManager_::add_assign_to_dif_transaction(Addon* callee,
+        Promise* promise, IPCMIPCProcess* ipcp,
+        const rina::ApplicationProcessNamingInformation& dif_name)
 {
     std::stringstream ss;
     IPCPTransState* trans;
-    // Validate the parameters
-    DIFConfigValidator validator(dif_info, ipcp->get_type());
-    if (!validator.validateConfigs())
-        throw rina::BadConfigurationException(
-                "DIF configuration validator failed");
 
     //Create a transaction
     trans = new IPCPTransState(callee, promise, ipcp->get_id());
@@ -511,7 +518,7 @@ void IPCManager_::assign_to_dif(Addon* callee, Promise* promise,
     {
         ss
                 << "Unable to allocate memory for the transaction object. Out of memory! "
-                << dif_info.dif_name_.toString();
+                << dif_name.toString();
         FLUSH_LOG(ERR, ss);
         throw rina::AssignToDIFException();
     }
@@ -520,12 +527,30 @@ void IPCManager_::assign_to_dif(Addon* callee, Promise* promise,
     if (add_transaction_state(trans) < 0)
     {
         ss << "Unable to add transaction; out of memory? "
-                << dif_info.dif_name_.toString();
+                << dif_name.toString();
         FLUSH_LOG(ERR, ss);
         throw rina::AssignToDIFException();
     }
 
-    ipcp->assignToDIF(dif_info, trans->tid);
+    return trans->tid;
+}
+
+void IPCManager_::assign_to_dif(Addon* callee, Promise* promise,
+                                rina::DIFInformation dif_info,
+                                IPCMIPCProcess* ipcp)
+{
+    std::stringstream ss;
+    unsigned int tid;
+    // Validate the parameters
+    DIFConfigValidator validator(dif_info, ipcp->get_type());
+    if (!validator.validateConfigs())
+        throw rina::BadConfigurationException(
+                "DIF configuration validator failed");
+
+    tid = add_assign_to_dif_transaction(callee, promise, ipcp,
+                                        dif_info.dif_name_);
+
+    ipcp->assignToDIF(dif_info, tid);
 
     ss << "Requested DIF assignment of IPC process "
             << ipcp->get_name().toString() << " to DIF "
@@ -533,6 +558,43 @@ void IPCManager_::assign_to_dif(Addon* callee, Promise* promise,
     FLUSH_LOG(INFO, ss);
 }
 
+void IPCManager_::assign_to_dif(Addon* callee, Promise* promise,
+                                const CompiledDIFTemplate& compiled,
+                                const rina::ApplicationProcessNamingInformation& dif_name,
+                                IPCMIPCProcess* ipcp)
+{
+    std::stringstream ss;
+    unsigned int address = 0;
+    unsigned int tid;
+
+    // The compiled configuration has already been validated, only the
+    // parts that depend on the IPCP are left
+    if (compiled.dif_type == rina::NORMAL_IPC_PROCESS)
+    {
+        if (!compiled.lookup_ipcp_address(ipcp->get_name(), address))
+        {
+            ss << "No address for IPC process "
+                    << ipcp->get_name().toString() << " in DIF "
+                    << dif_name.toString() << std::endl;
+            FLUSH_LOG(ERR, ss);
+            throw rina::Exception();
+        }
+
+        // Load plugin catalog
+        catalog.load(callee, ipcp->get_id(), compiled.dif_config);
+    }
+
+    tid = add_assign_to_dif_transaction(callee, promise, ipcp, dif_name);
+
+    ipcp->assignToDIF(dif_name, compiled.dif_type, compiled.dif_config,
+                      address, tid);
+
+    ss << "Requested DIF assignment of IPC process "
+            << ipcp->get_name().toString() << " to DIF "
+            << dif_name.toString() << std::endl;
+    FLUSH_LOG(INFO, ss);
+}
+
 ipcm_res_t IPCManager_::assign_to_dif(
         Addon* callee, Promise* promise, const unsigned short ipcp_id,
         rina::DIFInformation& dif_info,
@@ -590,8 +652,29 @@ ipcm_res_t IPCManager_::assign_to_dif(Addon* callee,
 				      DIFTemplate& dif_template,
 				      const rina::ApplicationProcessNamingInformation& dif_name)
 {
-	rina::DIFInformation dif_info;
-	rina::DIFConfiguration dif_config;
+	return assign_template_to_dif(callee, promise, ipcp_id, &dif_template,
+				      dif_template.templateName, dif_name);
+}
+
+ipcm_res_t IPCManager_::assign_to_dif(Addon* callee,
+				      Promise* promise,
+				      const unsigned short ipcp_id,
+				      const std::string& template_name,
+				      const rina::ApplicationProcessNamingInformation& dif_name)
+{
+	return assign_template_to_dif(callee, promise, ipcp_id, NULL,
+				      template_name, dif_name);
+}
+
+ipcm_res_t IPCManager_::assign_template_to_dif(Addon* callee,
+					       Promise* promise,
+					       const unsigned short ipcp_id,
+					       DIFTemplate * dif_template,
+					       const std::string& template_name,
+					       const rina::ApplicationProcessNamingInformation& dif_name)
+{
+	CompiledDIFTemplate compiled;
+	DIFTemplate stored_template;
 	std::ostringstream ss;
 	IPCMIPCProcess* ipcp = NULL;
 
@@ -599,98 +682,31 @@ ipcm_res_t IPCManager_::assign_to_dif(Addon* callee,
 	{
 		pre_assign_to_dif(callee, dif_name, ipcp_id, ipcp);
 
-		// Fill in the DIFConfiguration object.
-		if (ipcp->get_type() == rina::NORMAL_IPC_PROCESS)
-		{
-			rina::EFCPConfiguration efcp_config;
-			rina::NamespaceManagerConfiguration nsm_config;
-			rina::AddressingConfiguration address_config;
-			unsigned int address;
-
-			//catalog.load_by_template(callee, ipcp_id, dif_template);
-			// FIll in the EFCPConfiguration object.
-			efcp_config.set_data_transfer_constants(
-					dif_template.dataTransferConstants);
-			rina::QoSCube * qosCube = 0;
-			for (std::list<rina::QoSCube>::iterator qit = dif_template.qosCubes
-					.begin(); qit != dif_template.qosCubes.end(); qit++)
-			{
-				qosCube = new rina::QoSCube(*qit);
-				if (!qosCube)
-				{
-					ss
-					<< "Unable to allocate memory for the QoSCube object. Out of memory! "
-					<< dif_name.toString();
-					FLUSH_LOG(ERR, ss);
-					throw rina::Exception();
-				}
-				efcp_config.add_qos_cube(qosCube);
-			}
-
-			for (std::list<AddressPrefixConfiguration>::iterator ait =
-					dif_template.addressPrefixes.begin();
-					ait != dif_template.addressPrefixes.end(); ait++)
-			{
-				rina::AddressPrefixConfiguration prefix;
-				prefix.address_prefix_ = ait->addressPrefix;
-				prefix.organization_ = ait->organization;
-				address_config.address_prefixes_.push_back(prefix);
-			}
-
-			for (std::list<rinad::KnownIPCProcessAddress>::iterator kit =
-					dif_template.knownIPCProcessAddresses.begin();
-					kit != dif_template.knownIPCProcessAddresses.end(); kit++)
-			{
-				rina::StaticIPCProcessAddress static_address;
-				static_address.ap_name_ = kit->name.processName;
-				static_address.ap_instance_ = kit->name.processInstance;
-				static_address.address_ = kit->address;
-				address_config.static_address_.push_back(static_address);
-			}
-			nsm_config.addressing_configuration_ = address_config;
-			nsm_config.policy_set_ = dif_template.nsmConfiguration.policy_set_;
-
-			bool found = dif_template.lookup_ipcp_address(ipcp->get_name(),
-					address);
-			if (!found)
-			{
-				ss << "No address for IPC process "
-						<< ipcp->get_name().toString() << " in DIF "
-						<< dif_name.toString() << std::endl;
-				FLUSH_LOG(ERR, ss);
-				throw rina::Exception();
-			}
-			dif_config.efcp_configuration_ = efcp_config;
-			dif_config.nsm_configuration_ = nsm_config;
-			dif_config.rmt_configuration_ = dif_template.rmtConfiguration;
-			dif_config.fa_configuration_ = dif_template.faConfiguration;
-			dif_config.ra_configuration_ = dif_template.raConfiguration;
-			dif_config.routing_configuration_ = dif_template.routingConfiguration;
-			dif_config.sm_configuration_ = dif_template.secManConfiguration;
-			dif_config.et_configuration_ = dif_template.etConfiguration;
-			dif_config.set_address(address);
-
-			dif_config.sm_configuration_ = dif_template.secManConfiguration;
-
-			// Load plugin catalog
-			catalog.load(callee, ipcp_id, dif_config);
+		if (!dif_template &&
+			dif_template_manager->get_compiled_dif_template(
+				template_name, dif_name, ipcp->get_name(),
+				compiled) != 0)
+			throw rina::BadConfigurationException(
+				"DIF template could not be compiled");
+
+		// The template may have been modified by the caller or written
+		// for another type of IPCP, compile it just for this one
+		if (!dif_template && compiled.dif_type != ipcp->get_type()) {
+			if (dif_template_manager->get_dif_template(template_name,
+								   stored_template))
+				throw rina::BadConfigurationException();
+			dif_template = &stored_template;
 		}
 
-		for (std::map<std::string, std::string>::const_iterator pit =
-				dif_template.configParameters.begin();
-				pit != dif_template.configParameters.end(); pit++)
-		{
-			dif_config.add_parameter(
-					rina::PolicyParameter(pit->first, pit->second));
+		if (dif_template) {
+			compiled = CompiledDIFTemplate();
+			if (compile_dif_template(*dif_template, ipcp->get_type(),
+						 dif_name, compiled))
+				throw rina::BadConfigurationException(
+					"DIF configuration validator failed");
 		}
 
-		// Fill in the DIFInformation object.
-		dif_info.set_dif_name(dif_name);
-		dif_info.set_dif_type(ipcp->get_type());
-		dif_info.set_dif_configuration(dif_config);
-
-		// assign to diff
-		assign_to_dif(callee, promise, dif_info, ipcp);
+		assign_to_dif(callee, promise, compiled, dif_name, ipcp);
 
 	} catch (rina::ConcurrentException& e)
 	{
@@ -1146,11 +1162,19 @@ ipcm_res_t IPCManager_::apply_configuration()
                 }
                 ipcps.push_back(c_promise.ipcp_id);
 
-                check_peer_discovery_config(dif_template, *cit);
+                // IPCPs that use the template as is share its compiled
+                // version
+                if (cit->n1difsPeerDiscovery.size() == 0)
+                    result = assign_to_dif(NULL, &promise, c_promise.ipcp_id,
+                                           template_mapping.template_name,
+                                           cit->difName);
+                else {
+                    check_peer_discovery_config(dif_template, *cit);
+                    result = assign_to_dif(NULL, &promise, c_promise.ipcp_id,
+                                           dif_template, cit->difName);
+                }
 
-                if (assign_to_dif(NULL, &promise, c_promise.ipcp_id,
-                                  dif_template, cit->difName) == IPCM_FAILURE
-                        || promise.wait() != IPCM_SUCCESS)
+                if (result == IPCM_FAILURE || promise.wait() != IPCM_SUCCESS)
                 {
                     ss << "Problems assigning IPCP " << c_promise.ipcp_id
                             << " to DIF " << cit->difName.processName
@@ -1158,21 +1182,39 @@ ipcm_res_t IPCManager_::apply_configuration()
                     FLUSH_LOG(ERR, ss);
                 }
 
+                // Registrations at the N-1 DIFs are independent, issue
+                // them all and then wait for them together
+                std::list<Promise*> reg_promises;
                 for (std::list<rina::ApplicationProcessNamingInformation>::const_iterator nit =
                         cit->difsToRegisterAt.begin();
                         nit != cit->difsToRegisterAt.end(); nit++)
                 {
+                    Promise* reg_promise = new Promise();
+
                     if (register_at_dif(NULL,
-                		    	&promise,
+                		    	reg_promise,
 					c_promise.ipcp_id,
-					*nit)
-                            == IPCM_FAILURE || promise.wait() != IPCM_SUCCESS)
+					*nit) == IPCM_FAILURE)
                     {
                         ss << "Problems registering IPCP " << c_promise.ipcp_id
                                 << " to DIF " << nit->processName << std::endl;
                         FLUSH_LOG(ERR, ss);
+                        delete reg_promise;
+                        continue;
                     }
+                    reg_promises.push_back(reg_promise);
                 }
+
+                if (Promise::wait_all(reg_promises) != IPCM_SUCCESS)
+                {
+                    ss << "Problems registering IPCP " << c_promise.ipcp_id
+                            << " to its N-1 DIFs" << std::endl;
+                    FLUSH_LOG(ERR, ss);
+                }
+
+                for (std::list<Promise*>::iterator it = reg_promises.begin();
+                        it != reg_promises.end(); ++it)
+                    delete *it;
             } catch (rina::Exception &e)
             {
                 LOG_ERR("Exception while applying configuration: %s", e.what());
@@ -1314,7 +1356,8 @@ ipcm_res_t IPCManager_::query_rib(Addon* callee, QueryRIBPromise* promise,
         //Auto release the read lock
         rina::ReadScopedLock readlock(ipcp->rwlock, false);
 
-        trans = new RIBqTransState(callee, promise, ipcp->get_id());
+        trans = new RIBqTransState(callee, promise, ipcp->get_id(),
+                                   objectClass, objectName);
         if (!trans)
         {
             ss
@@ -1331,7 +1374,8 @@ ipcm_res_t IPCManager_::query_rib(Addon* callee, QueryRIBPromise* promise,
             throw rina::Exception();
         }
 
-        ipcp->queryRIB(objectClass, objectName, 0, 0, "", trans->tid);
+        ipcp->queryRIB(objectClass, objectName, 0, 0, "", trans->tid,
+                       QUERY_RIB_PAGE_OBJS, "");
 
         ss << "Requested query RIB of IPC process "
                 << ipcp->get_name().toString() << std::endl;
@@ -1589,22 +1633,24 @@ ipcm_res_t IPCManager_::select_policy_set(Addon* callee, Promise* promise,
     return IPCM_PENDING;
 }
 
-// Returns IPCM_SUCCESS if a kernel plugin was successfully loaded/unloaded,
+// Returns IPCM_PENDING if modprobe was started for the kernel plugin,
 // IPCM_FAILURE otherwise
-ipcm_res_t IPCManager_::plugin_load_kernel(const std::string& plugin_name,
-                                           bool load)
+ipcm_res_t IPCManager_::plugin_load_kernel(IPCPpluginTransState* trans)
 {
     std::ostringstream ss;
-    ipcm_res_t result = IPCM_FAILURE;
     pid_t pid;
 
+    // Hold the lock across fork(), so that the child exit can not be
+    // handled before the pid is known
+    rina::ScopedLock g(kernel_plugin_loads_lock);
+
     pid = fork();
     if (pid < 0)
     {
         // parent, fork() failed
         ss << "Kernel plugin (un)loading: fork() failed";
         FLUSH_LOG(ERR, ss);
-        result = IPCM_FAILURE;
+        return IPCM_FAILURE;
 
     } else if (pid == 0)
     {
@@ -1617,80 +1663,96 @@ ipcm_res_t IPCManager_::plugin_load_kernel(const std::string& plugin_name,
 	// redirect stderr to stdout
 	dup2(STDOUT_FILENO, STDERR_FILENO);
 
-        if (load) {
-            execlp("modprobe", "modprobe", plugin_name.c_str(), NULL);
+        if (trans->load) {
+            execlp("modprobe", "modprobe", trans->plugin_name.c_str(),
+                   NULL);
 
         } else {
-            execlp("modprobe", "modprobe", "-r", plugin_name.c_str(), NULL);
+            execlp("modprobe", "modprobe", "-r",
+                   trans->plugin_name.c_str(), NULL);
         }
 
-        ss << "Kernel plugin (un)loading: exec() failed";
-        FLUSH_LOG(ERR, ss);
+        // Not even the logs are safe to use in the child of a
+        // multi-threaded process
+        _exit(EXIT_FAILURE);
+    }
 
-        exit (EXIT_FAILURE);
+    // parent, fork() successful. The child is reaped by the SIGCHLD
+    // handler and the transaction completed by the child process monitor
+    kernel_plugin_loads[pid] = trans->tid;
+
+    return IPCM_PENDING;
+}
+
+void IPCManager_::child_exited(pid_t pid, int status)
+{
+    if (cp_monitor)
+        cp_monitor->child_exited(pid, status);
+}
+
+void IPCManager_::child_process_exited_handler(pid_t pid, int status)
+{
+    std::ostringstream ss;
+    std::map<pid_t, int>::iterator it;
+    IPCPpluginTransState* trans;
+    int tid;
 
-    } else
     {
-        // parent, fork() successful
-        int child_status = 0;
+        rina::ScopedLock g(kernel_plugin_loads_lock);
 
-        waitpid(pid, &child_status, 0);
+        it = kernel_plugin_loads.find(pid);
+        if (it == kernel_plugin_loads.end())
+            // Not a modprobe, e.g. an IPC Process daemon
+            return;
 
-        result = child_status ? IPCM_FAILURE : IPCM_SUCCESS;
+        tid = it->second;
+        kernel_plugin_loads.erase(it);
+    }
+
+    trans = get_transaction_state<IPCPpluginTransState>(tid);
+    if (!trans)
+    {
+        ss << "Warning: unknown kernel plugin load transaction " << tid;
+        FLUSH_LOG(WARN, ss);
+        return;
     }
 
-    return result;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        catalog.plugin_loaded(trans->plugin_name, trans->ipcp_id,
+                              trans->load);
+        trans->completed(IPCM_SUCCESS);
+        remove_transaction_state(trans->tid);
+        return;
+    }
+
+    // Not a kernel module, try with the IPC Process
+    if (plugin_load_ipcp(trans) == IPCM_FAILURE)
+    {
+        trans->completed(IPCM_FAILURE);
+        remove_transaction_state(trans->tid);
+    }
 }
 
-ipcm_res_t IPCManager_::plugin_load(Addon* callee, Promise* promise,
-                                    const unsigned short ipcp_id,
-                                    const std::string& plugin_name, bool load)
+ipcm_res_t IPCManager_::plugin_load_ipcp(IPCPpluginTransState* trans)
 {
     std::ostringstream ss;
     IPCMIPCProcess *ipcp;
-    IPCPpluginTransState* trans;
 
-    try
+    ipcp = lookup_ipcp_by_id(trans->ipcp_id);
+    if (!ipcp)
     {
-        //First try to see if its a kernel module
-        if (plugin_load_kernel(plugin_name, load) == IPCM_SUCCESS)
-        {
-            promise->ret = IPCM_SUCCESS;
-            catalog.plugin_loaded(plugin_name, ipcp_id, load);
-
-            return IPCM_SUCCESS;
-        }
-
-        ipcp = lookup_ipcp_by_id(ipcp_id);
-
-        if (!ipcp)
-        {
-            ss << "Invalid IPCP id " << ipcp_id;
-            FLUSH_LOG(ERR, ss);
-            throw rina::Exception();
-        }
+        ss << "Invalid IPCP id " << trans->ipcp_id;
+        FLUSH_LOG(ERR, ss);
+        return IPCM_FAILURE;
+    }
 
+    try
+    {
         //Auto release the read lock
         rina::ReadScopedLock readlock(ipcp->rwlock, false);
 
-        trans = new IPCPpluginTransState(callee, promise, ipcp->get_id(),
-                                         plugin_name, load);
-        if (!trans)
-        {
-            ss
-                    << "Unable to allocate memory for the transaction object. Out of memory! ";
-            FLUSH_LOG(ERR, ss);
-            throw rina::Exception();
-        }
-
-        //Store transaction
-        if (add_transaction_state(trans) < 0)
-        {
-            ss << "Unable to add transaction; out of memory? ";
-            FLUSH_LOG(ERR, ss);
-            throw rina::Exception();
-        }
-        ipcp->pluginLoad(plugin_name, load, trans->tid);
+        ipcp->pluginLoad(trans->plugin_name, trans->load, trans->tid);
 
         ss << "Issued plugin-load to IPC process "
                 << ipcp->get_name().toString() << std::endl;
@@ -1718,10 +1780,47 @@ ipcm_res_t IPCManager_::plugin_load(Addon* callee, Promise* promise,
     return IPCM_PENDING;
 }
 
+ipcm_res_t IPCManager_::plugin_load(Addon* callee, Promise* promise,
+                                    const unsigned short ipcp_id,
+                                    const std::string& plugin_name, bool load)
+{
+    std::ostringstream ss;
+    IPCPpluginTransState* trans;
+
+    trans = new IPCPpluginTransState(callee, promise, ipcp_id,
+                                     plugin_name, load);
+    if (!trans)
+    {
+        ss << "Unable to allocate memory for the transaction object. "
+              "Out of memory! ";
+        FLUSH_LOG(ERR, ss);
+        return IPCM_FAILURE;
+    }
+
+    //Store transaction
+    if (add_transaction_state(trans) < 0)
+    {
+        ss << "Unable to add transaction; out of memory? ";
+        FLUSH_LOG(ERR, ss);
+        delete trans;
+        return IPCM_FAILURE;
+    }
+
+    //First try to see if its a kernel module; if modprobe can not
+    //even be started go straight to the IPC Process
+    if (plugin_load_kernel(trans) == IPCM_PENDING ||
+                    plugin_load_ipcp(trans) == IPCM_PENDING)
+        return IPCM_PENDING;
+
+    remove_transaction_state(trans->tid);
+
+    return IPCM_FAILURE;
+}
+
 ipcm_res_t IPCManager_::plugin_get_info(const std::string& plugin_name,
                                         std::list<rina::PsInfo>& result)
 {
-    int ret = rina::plugin_get_info(plugin_name, IPCPPLUGINSDIR, result);
+    int ret = catalog.get_plugin_info(plugin_name, IPCPPLUGINSDIR, result);
 
     return ret ? IPCM_FAILURE : IPCM_SUCCESS;
 }
@@ -1873,48 +1972,199 @@ ipcm_res_t IPCManager_::unregister_app_from_ipcp(Addon* callee,
 //
 ipcm_res_t Promise::wait(void)
 {
-    unsigned int i;
-    // Due to the async nature of the API, notifications (signal)
-    // the transaction can well end before the thread is waiting
-    // in the condition variable. As apposed to sempahores
-    // pthread_cond don't keep the "credit"
-    for (i = 0;
-            i < PROMISE_TIMEOUT_S * (_PROMISE_1_SEC_NSEC / PROMISE_RETRY_NSEC);
-            ++i)
-    {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += PROMISE_TIMEOUT_S;
+
+    return wait_until(deadline);
+}
+
+ipcm_res_t Promise::wait_until(const struct timespec& deadline)
+{
+    struct timespec now;
+    long sec, nsec;
+
+    // Waiting on the predicate under the lock: a completion that
+    // happens before the waiter gets here is not lost
+    wait_cond.lock();
+    while (ret == IPCM_PENDING)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sec = deadline.tv_sec - now.tv_sec;
+        nsec = deadline.tv_nsec - now.tv_nsec;
+        if (nsec < 0)
+        {
+            sec--;
+            nsec += _PROMISE_1_SEC_NSEC;
+        }
+        if (sec < 0)
+            break;
+
         try
         {
-            if (ret != IPCM_PENDING)
-                return ret;
-            wait_cond.timedwait(0, PROMISE_RETRY_NSEC);
-        } catch (...)
+            wait_cond.timedwait(sec, nsec);
+        } catch (rina::ConcurrentException& e)
         {
         };
     }
 
+    if (ret != IPCM_PENDING)
+    {
+        wait_cond.unlock();
+        return ret;
+    }
+    wait_cond.unlock();
+
+    return expire();
+}
+
+ipcm_res_t Promise::expire(void)
+{
+    TransactionState* t;
+
+    wait_cond.lock();
+    t = trans;
+    wait_cond.unlock();
+
     //hard timeout expired
-    if (!trans->abort())
+    if (t && !t->abort())
         //The transaction ended at the very last second
         return ret;
     ret = IPCM_FAILURE;
     return ret;
 }
 
-ipcm_res_t Promise::timed_wait(const unsigned int seconds)
+void QueryRIBPromise::push_page(const std::string& page)
+{
+    wait_cond.lock();
+    pages.push_back(page);
+    wait_cond.broadcast();
+    wait_cond.unlock();
+}
+
+bool QueryRIBPromise::next_page(std::string& page)
 {
+    struct timespec deadline, now;
+    long sec, nsec;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += PROMISE_TIMEOUT_S;
+
+    // Pages queued before the completion are handed out first
+    wait_cond.lock();
+    while (pages.empty() && ret == IPCM_PENDING)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sec = deadline.tv_sec - now.tv_sec;
+        nsec = deadline.tv_nsec - now.tv_nsec;
+        if (nsec < 0)
+        {
+            sec--;
+            nsec += _PROMISE_1_SEC_NSEC;
+        }
+        if (sec < 0)
+            break;
+
+        try
+        {
+            wait_cond.timedwait(sec, nsec);
+        } catch (rina::ConcurrentException& e)
+        {
+        };
+    }
+
+    if (!pages.empty())
+    {
+        page = pages.front();
+        pages.pop_front();
+        wait_cond.unlock();
+        return true;
+    }
 
     if (ret != IPCM_PENDING)
-        return ret;
-    try
     {
-        wait_cond.timedwait(seconds, 0);
-    } catch (rina::ConcurrentException& e)
+        wait_cond.unlock();
+        return false;
+    }
+    wait_cond.unlock();
+
+    //No page within the timeout, give up on the rest of the query
+    if (expire() == IPCM_SUCCESS)
+        //Completed at the very last second, maybe with a last page
+        return next_page(page);
+
+    return false;
+}
+
+void Promise::complete(ipcm_res_t _ret)
+{
+    callback_t callback;
+    void* arg;
+
+    wait_cond.lock();
+    ret = _ret;
+    callback = cb;
+    arg = cb_arg;
+    cb = NULL;
+    wait_cond.broadcast();
+    wait_cond.unlock();
+
+    if (callback)
+        callback(this, arg);
+}
+
+void Promise::then(callback_t callback, void* arg)
+{
+    wait_cond.lock();
+    if (ret == IPCM_PENDING)
     {
-        if (ret != IPCM_PENDING)
-            return ret;
-        return IPCM_PENDING;
-    };
-    return ret;
+        cb = callback;
+        cb_arg = arg;
+        wait_cond.unlock();
+        return;
+    }
+    wait_cond.unlock();
+
+    callback(this, arg);
+}
+
+ipcm_res_t Promise::wait_all(const std::list<Promise*>& promises)
+{
+    struct timespec deadline;
+    std::list<Promise*>::const_iterator it;
+    ipcm_res_t res = IPCM_SUCCESS;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += PROMISE_TIMEOUT_S;
+
+    for (it = promises.begin(); it != promises.end(); ++it)
+    {
+        if ((*it)->wait_until(deadline) != IPCM_SUCCESS)
+            res = IPCM_FAILURE;
+    }
+
+    return res;
+}
+
+ipcm_res_t Promise::timed_wait(const unsigned int seconds)
+{
+    ipcm_res_t res;
+
+    wait_cond.lock();
+    if (ret == IPCM_PENDING)
+    {
+        try
+        {
+            wait_cond.timedwait(seconds, 0);
+        } catch (rina::ConcurrentException& e)
+        {
+        };
+    }
+    res = ret;
+    wait_cond.unlock();
+
+    return res;
 }
 
 //
@@ -2128,6 +2378,16 @@ void IPCManager_::io_loop()
         		delete osp_monitor;
         	}
 
+        	if (cp_monitor) {
+        		ChildProcessMonitor * cpm = cp_monitor;
+
+        		cp_monitor = NULL;
+        		cpm->do_stop();
+        		cpm->join(&status);
+
+        		delete cpm;
+        	}
+
         	stop_cond.signal();
         	break;
         }
@@ -26,7 +26,9 @@
 
 #include <assert.h>
 #include <cstdlib>
+#include <ctime>
 #include <iostream>
+#include <list>
 #include <map>
 #include <vector>
 #include <utility>
@@ -51,7 +53,6 @@
 
 //Constants
 #define PROMISE_TIMEOUT_S 8
-#define PROMISE_RETRY_NSEC 10000000 //10ms
 #define _PROMISE_1_SEC_NSEC 1000000000
 
 namespace rinad {
@@ -75,6 +76,7 @@ typedef enum ipcm_res{
 
 //fwd decl
 class TransactionState;
+class IPCPpluginTransState;
 
 //
 // Promise base class
@@ -82,20 +84,25 @@ class TransactionState;
 class Promise {
 
 public:
+	//
+	// Continuation, invoked once with the promise and the user argument
+	//
+	typedef void (*callback_t)(Promise* promise, void* arg);
 
+	Promise() : ret(IPCM_PENDING), trans(NULL), cb(NULL), cb_arg(NULL){};
 	virtual ~Promise(){};
 
 	//
-	// Wait (blocking)
+	// Wait (blocking) until the promise is completed or
+	// PROMISE_TIMEOUT_S expires
 	//
 	ipcm_res_t wait(void);
 
 	//
-	// Signal the condition
+	// Complete the promise: set the return code, wake up the waiters
+	// and run the continuation, if any
 	//
-	inline void signal(void){
-		wait_cond.signal();
-	}
+	void complete(ipcm_res_t _ret);
 
 	//
 	// Timed wait (blocking)
@@ -105,6 +112,19 @@ public:
 	//
 	ipcm_res_t timed_wait(const unsigned int seconds);
 
+	//
+	// Set the continuation. It runs in the thread that completes the
+	// promise (the IPCM event loop), or right away if the promise has
+	// already been completed, so it must not block
+	//
+	void then(callback_t callback, void* arg);
+
+	//
+	// Wait for all the promises, sharing a single PROMISE_TIMEOUT_S
+	// deadline. Returns IPCM_SUCCESS only if all of them succeeded
+	//
+	static ipcm_res_t wait_all(const std::list<Promise*>& promises);
+
 	//
 	// Return code
 	//
@@ -114,10 +134,20 @@ protected:
 	//Protect setting of trans
 	friend class TransactionState;
 
+	//Wait until the absolute (CLOCK_MONOTONIC) deadline
+	ipcm_res_t wait_until(const struct timespec& deadline);
+
+	//Abort the transaction after a hard timeout, with wait_cond unlocked
+	ipcm_res_t expire(void);
+
 	//Transaction back reference
 	TransactionState* trans;
 
-	//Condition variable
+	//Continuation
+	callback_t cb;
+	void* cb_arg;
+
+	//Condition variable, also protects ret and the continuation
 	rina::ConditionVariable wait_cond;
 };
 
@@ -137,7 +167,21 @@ public:
 class QueryRIBPromise : public Promise {
 
 public:
-	std::string serialized_rib;
+	//
+	// Queue a formatted page of the RIB and wake up the reader
+	//
+	void push_page(const std::string& page);
+
+	//
+	// Wait (blocking) for the next page, up to PROMISE_TIMEOUT_S per
+	// page. Returns false once all the pages have been consumed and
+	// the query is over, or on timeout; ret tells which
+	//
+	bool next_page(std::string& page);
+
+private:
+	//Pages received and not yet consumed
+	std::list<std::string> pages;
 };
 
 //
@@ -167,7 +211,8 @@ public:
 	}
 
 	//
-	// This method and signals any existing set complete flag
+	// This method completes the promise, if any, unless the
+	// transaction was already finalised (e.g. aborted by a timeout)
 	//
 	void completed(ipcm_res_t _ret){
 		rina::ScopedLock slock(mutex);
@@ -178,8 +223,8 @@ public:
 		if(!promise)
 			return;
 
-		promise->ret = _ret;
-		promise->signal();
+		finalised = true;
+		promise->complete(_ret);
 	}
 
 	//Promise
@@ -368,6 +413,16 @@ public:
 			rinad::DIFTemplate& dif_template,
 			const rina::ApplicationProcessNamingInformation&
 				difName);
+	//
+	// Same as above, using the compiled version of the template called
+	// template_name, which is built and validated once and shared by all
+	// the IPCPs assigned with it. Use it when the template is not modified
+	//
+	ipcm_res_t assign_to_dif(Addon* callee, Promise* promise,
+			const unsigned short ipcp_id,
+			const std::string& template_name,
+			const rina::ApplicationProcessNamingInformation&
+				difName);
 	ipcm_res_t assign_to_dif(Addon* callee, Promise* promise,
 		const unsigned short ipcp_id, rina::DIFInformation &dif_info,
 		const rina::ApplicationProcessNamingInformation &dif_name);
@@ -621,6 +676,13 @@ public:
 
 	void os_process_finalized_handler(pid_t pid);
 
+	// Called from the SIGCHLD handler with the exit status of a
+	// reaped child, async-signal-safe
+	void child_exited(pid_t pid, int status);
+
+	// Completes the kernel plugin (un)load run by child @pid, if any
+	void child_process_exited_handler(pid_t pid, int status);
+
 	ipcm_res_t flow_allocation_requested_event_handler(Promise * promise, rina::FlowRequestEvent* event);
 
 	void join_dif_continue_flow_alloc(Promise * promise, rina::FlowRequestEvent& event,
@@ -639,6 +701,9 @@ public:
         //The OS process Monitor
         OSProcessMonitor * osp_monitor;
 
+        //The monitor of the children of the IPCM (modprobe)
+        ChildProcessMonitor * cp_monitor;
+
         //Catalog of policies
         Catalog catalog;
 
@@ -811,14 +876,24 @@ protected:
 	//
 	// Load kernel space policy plugin
 	//
-	// @param plugin_name Name of the kernel module containing the
-	//		      plugin to be loaded
-	// @param load        True if the plugin is to be loaded,
-	//                    false if the plugin is to be unloaded.
-	// @ret IPCM_SUCCESS when load/unload is successful, otherwise
+	// Runs modprobe on the kernel module containing the plugin of
+	// @trans, without waiting for it. The transaction is completed by
+	// child_process_exited_handler() once modprobe has been reaped.
+	//
+	// @ret IPCM_PENDING when modprobe was started, otherwise
+	//	IPCM_FAILURE
+	ipcm_res_t plugin_load_kernel(IPCPpluginTransState* trans);
+
+	//
+	// Load user space policy plugin in the IPCP of @trans
+	//
+	// @ret IPCM_PENDING when the request was issued, otherwise
 	//	IPCM_FAILURE
-	ipcm_res_t plugin_load_kernel(const std::string& plugin_name,
-				      bool load);
+	ipcm_res_t plugin_load_ipcp(IPCPpluginTransState* trans);
+
+	// Transaction ids of the running modprobe children, by pid
+	std::map<pid_t, int> kernel_plugin_loads;
+	rina::Lockable kernel_plugin_loads_lock;
 
 	/*
 	* Get the transaction state. Template parameter is the type of the
@@ -963,6 +1038,18 @@ private:
 			const unsigned short ipcp_id, IPCMIPCProcess*& ipcp);
 	void assign_to_dif(Addon* callee, Promise *promise,
 			rina::DIFInformation dif_info, IPCMIPCProcess* ipcp);
+	void assign_to_dif(Addon* callee, Promise *promise,
+			const CompiledDIFTemplate& compiled,
+			const rina::ApplicationProcessNamingInformation& dif_name,
+			IPCMIPCProcess* ipcp);
+	ipcm_res_t assign_template_to_dif(Addon* callee, Promise* promise,
+			const unsigned short ipcp_id,
+			rinad::DIFTemplate * dif_template,
+			const std::string& template_name,
+			const rina::ApplicationProcessNamingInformation& dif_name);
+	unsigned int add_assign_to_dif_transaction(Addon* callee,
+			Promise *promise, IPCMIPCProcess* ipcp,
+			const rina::ApplicationProcessNamingInformation& dif_name);
 	// Store a delegated object waiting for the response
 	int store_delegated_obj(int port, int invoke_id,
 			rina::rib::DelegationObj* obj);
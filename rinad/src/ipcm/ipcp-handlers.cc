@@ -53,6 +53,8 @@ void IPCManager_::ipc_process_daemon_initialized_event_handler(rina::IPCProcessD
 	SyscallTransState* trans = NULL;
 	bool trans_completed = false;
 	rina::Sleep sleep;
+	unsigned long latency;
+	bool prespawned;
 
 	//There can be race condition between the caller and us (notification)
 	for(i=0; i<IPCP_DAEMON_INIT_RETRIES; ++i){
@@ -99,6 +101,8 @@ void IPCManager_::ipc_process_daemon_initialized_event_handler(rina::IPCProcessD
 
 		//Initialize
 		ipcp->setInitialized();
+		latency = ipcp_factory_.record_ready_latency(ipcp);
+		prespawned = ipcp->prespawned;
 
 		if (ipcp->kernel_ready) {
 			trans_completed = true;
@@ -106,7 +110,8 @@ void IPCManager_::ipc_process_daemon_initialized_event_handler(rina::IPCProcessD
 	}
 
 	ss << "IPC process daemon initialized [id = " <<
-		e->ipcProcessId<< "]" << endl;
+		e->ipcProcessId<< "] in " << latency << " ms" <<
+		(prespawned ? " (prespawned)" : "") << endl;
 	FLUSH_LOG(INFO, ss);
 
 	if (!trans_completed) {
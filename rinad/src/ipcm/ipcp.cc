@@ -22,6 +22,7 @@
  */
 
 #include <cstdlib>
+#include <ctime>
 #include <iostream>
 #include <map>
 #include <vector>
@@ -42,6 +43,14 @@ using namespace std;
 
 namespace rinad {
 
+static unsigned long monotonic_time_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 //
 // IPCM IPCP process class
 //
@@ -50,6 +59,8 @@ IPCMIPCProcess::IPCMIPCProcess() {
 	proxy_ = NULL;
 	state_ = IPCM_IPCP_CREATED;
 	kernel_ready = false;
+	create_time_ms = monotonic_time_ms();
+	prespawned = false;
 }
 
 IPCMIPCProcess::~IPCMIPCProcess() throw(){
@@ -61,6 +72,8 @@ IPCMIPCProcess::IPCMIPCProcess(rina::IPCProcessProxy* ipcp_proxy)
 	state_ = IPCM_IPCP_CREATED;
 	proxy_ = ipcp_proxy;
 	kernel_ready = false;
+	create_time_ms = monotonic_time_ms();
+	prespawned = false;
 }
 
 /** Return the information of a registration request */
@@ -215,6 +228,30 @@ void IPCMIPCProcess::assignToDIF(const rina::DIFInformation& difInformation,
 	}
 }
 
+void IPCMIPCProcess::assignToDIF(
+		const rina::ApplicationProcessNamingInformation& difName,
+		const std::string& difType,
+		const rina::DIFConfiguration& difConfiguration,
+		unsigned int address, unsigned int opaque)
+{
+	if (state_ != IPCM_IPCP_INITIALIZED) {
+		throw rina::AssignToDIFException(
+				"IPC Process not yet initialized");
+	}
+
+	state_ = IPCM_IPCP_ASSIGN_TO_DIF_IN_PROGRESS;
+	dif_name_ = difName;
+
+	try {
+        	proxy_->assignToDIF(difName, difType, difConfiguration,
+        			    address, opaque);
+	}catch (rina::Exception &e){
+		rina::WriteScopedLock writelock(rwlock);
+		state_ = IPCM_IPCP_INITIALIZED;
+		throw e;
+	}
+}
+
 void IPCMIPCProcess::assignToDIFResult(bool success)
 {
 	if (state_ != IPCM_IPCP_ASSIGN_TO_DIF_IN_PROGRESS)
@@ -522,9 +559,11 @@ rina::FlowInformation IPCMIPCProcess::flowDeallocated(int flowPortId)
 void IPCMIPCProcess::queryRIB(const std::string& objectClass,
 		const std::string& objectName, unsigned long objectInstance,
 		unsigned int scope, const std::string& filter,
-		unsigned int opaque)
+		unsigned int opaque, unsigned int pageSize,
+		const std::string& cursor)
 {
-	proxy_->queryRIB(objectClass, objectName, objectInstance, scope, filter, opaque);
+	proxy_->queryRIB(objectClass, objectName, objectInstance, scope, filter,
+			 opaque, pageSize, cursor);
 }
 
 void IPCMIPCProcess::setPolicySetParam(const std::string& path,
@@ -574,6 +613,7 @@ IPCMIPCProcess * IPCMIPCProcessFactory::create(
 	rina::IPCProcessProxy * ipcp_proxy = 0;
 	IPCMIPCProcess * ipcp = 0;
 	unsigned short id;
+	unsigned int hits;
 
 	rina::WriteScopedLock writelock(rwlock);
 
@@ -582,6 +622,7 @@ IPCMIPCProcess * IPCMIPCProcessFactory::create(
 		if (ipcProcesses.find(id) == ipcProcesses.end())
 			break;
 	}
+	hits = proxy_factory_.get_standby_hits();
 	try {
 		ipcp_proxy = proxy_factory_.create(ipcProcessName, difType,
 									  id);
@@ -590,6 +631,7 @@ IPCMIPCProcess * IPCMIPCProcessFactory::create(
 	}
 
 	ipcp = new IPCMIPCProcess(ipcp_proxy);
+	ipcp->prespawned = proxy_factory_.get_standby_hits() != hits;
 
 	//Acquire lock to prevent any race condition
 	ipcp->rwlock.writelock();
@@ -709,5 +751,47 @@ void IPCMIPCProcessFactory::get_local_dif_names(std::list<std::string>& result)
 
 }
 
+void IPCMIPCProcessFactory::set_standby_pool_size(unsigned int size)
+{
+	proxy_factory_.set_standby_pool_size(size);
+}
+
+unsigned long IPCMIPCProcessFactory::record_ready_latency(IPCMIPCProcess * ipcp)
+{
+	unsigned long latency = monotonic_time_ms() - ipcp->create_time_ms;
+	ReadyLatencyStats * stats;
+
+	rina::ScopedLock g(stats_lock);
+
+	stats = ipcp->prespawned ? &prespawned_stats : &cold_stats;
+	stats->count++;
+	stats->total_ms += latency;
+	if (latency > stats->max_ms)
+		stats->max_ms = latency;
+
+	return latency;
+}
+
+std::string IPCMIPCProcessFactory::get_creation_stats()
+{
+	std::stringstream ss;
+
+	rina::ScopedLock g(stats_lock);
+
+	ss << "IPCP pool size: " << proxy_factory_.get_standby_pool_size()
+	   << ", hits: " << proxy_factory_.get_standby_hits()
+	   << ", misses: " << proxy_factory_.get_standby_misses() << endl;
+	ss << "Create-to-ready latency (count / avg ms / max ms):" << endl;
+	ss << "    Prespawned: " << prespawned_stats.count << " / "
+	   << (prespawned_stats.count ?
+		prespawned_stats.total_ms / prespawned_stats.count : 0)
+	   << " / " << prespawned_stats.max_ms << endl;
+	ss << "    Cold start: " << cold_stats.count << " / "
+	   << (cold_stats.count ? cold_stats.total_ms / cold_stats.count : 0)
+	   << " / " << cold_stats.max_ms << endl;
+
+	return ss.str();
+}
+
 
 } //namespace rinad
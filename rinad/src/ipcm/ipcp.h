@@ -73,6 +73,12 @@ public:
 
 	bool kernel_ready;
 
+	/** Monotonic time at which the IPC Process was created (ms) */
+	unsigned long create_time_ms;
+
+	/** True if the IPC Process was bound to a standby daemon */
+	bool prespawned;
+
 	//Constructors and destructurs
 
 	IPCMIPCProcess();
@@ -141,6 +147,25 @@ public:
 	void assignToDIF(
 			const rina::DIFInformation& difInformation, unsigned int opaque);
 
+	/**
+	 * Same as above, with a DIF configuration shared by all the IPCPs
+	 * of the DIF
+	 * This method is NOT thread safe and must be called with the writelock
+	 * acquired
+	 *
+	 * @param difName The name of the DIF
+	 * @param difType The type of the DIF
+	 * @param difConfiguration The configuration of the DIF
+	 * @param address The address of this IPC Process in the DIF
+	 * @param opaque an opaque identifier to correlate requests and responses
+	 * @throws AssignToDIFException if an error happens during the process
+	 */
+	void assignToDIF(
+			const rina::ApplicationProcessNamingInformation& difName,
+			const std::string& difType,
+			const rina::DIFConfiguration& difConfiguration,
+			unsigned int address, unsigned int opaque);
+
 	/**
 	 * Update the internal data structures based on the result of the assignToDIF
 	 * operation
@@ -379,12 +404,17 @@ public:
 	 * @param filter An expression evaluated for each object, to determine
 	 * wether the object should be returned by the query
 	 * @param opaque an opaque identifier to correlate requests and responses
+	 * @param pageSize maximum number of objects in each response (0 means
+	 * no limit)
+	 * @param cursor name of the last object of the previous page, empty to
+	 * get the first one
 	 * @throws QueryRIBException
 	 */
 	void queryRIB(const std::string& objectClass,
 			const std::string& objectName, unsigned long objectInstance,
 			unsigned int scope, const std::string& filter,
-			unsigned int opaque);
+			unsigned int opaque, unsigned int pageSize = 0,
+			const std::string& cursor = std::string());
 
 	/**
 	 * Invoked by the IPC Manager to change a parameter value in a subcomponent
@@ -558,10 +588,41 @@ public:
     /// Returns the names of the DIFs local IPCPs are assigned to
     void get_local_dif_names(std::list<std::string>& result);
 
+    /**
+     * Keep size IPC Process daemons started and waiting to be bound to a
+     * new IPC Process, see rina::IPCProcessFactory::set_standby_pool_size
+     */
+    void set_standby_pool_size(unsigned int size);
+
+    /**
+     * Account for the time an IPC Process took from its creation until its
+     * daemon reported it was initialized. Returns that time in ms.
+     */
+    unsigned long record_ready_latency(IPCMIPCProcess * ipcp);
+
+    /// Returns the IPC Process creation statistics in human readable form
+    std::string get_creation_stats();
+
 private:
+	struct ReadyLatencyStats {
+		unsigned int count;
+		unsigned long total_ms;
+		unsigned long max_ms;
+
+		ReadyLatencyStats() : count(0), total_ms(0), max_ms(0) { }
+	};
+
 	//The underlying IPC Process Factory
 	rina::IPCProcessFactory proxy_factory_;
 
+	/** Create-to-ready latency of IPCPs bound to standby daemons */
+	ReadyLatencyStats prespawned_stats;
+
+	/** Create-to-ready latency of IPCPs started from scratch */
+	ReadyLatencyStats cold_stats;
+
+	rina::Lockable stats_lock;
+
 	/** The current IPC Processes in the system*/
 	std::map<unsigned short, IPCMIPCProcess*> ipcProcesses;
 };
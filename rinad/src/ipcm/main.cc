@@ -53,7 +53,7 @@ using namespace TCLAP;
 
 void handler(int signum)
 {
-	int pid, saved_errno;
+	int pid, status, saved_errno;
 
 	switch(signum){
 		case SIGSEGV:
@@ -70,9 +70,10 @@ void handler(int signum)
 			break;
 		case SIGCHLD:
 			saved_errno = errno;
-			while (pid = waitpid(WAIT_ANY, NULL, WNOHANG), pid > 0) {
-				LOG_DBG("Child IPC Process Daemon %d died, removed from process table",
+			while (pid = waitpid(WAIT_ANY, &status, WNOHANG), pid > 0) {
+				LOG_DBG("Child process %d died, removed from process table",
 					pid);
+				rinad::IPCManager->child_exited(pid, status);
 			}
 			errno = saved_errno;
 			break;
@@ -42,6 +42,17 @@ using namespace std;
 
 namespace rinad {
 
+bool RIBqTransState::push_page(const std::string& page)
+{
+	rina::ScopedLock slock(mutex);
+
+	if(finalised || !promise)
+		return false;
+
+	get_promise<QueryRIBPromise>()->push_page(page);
+	return true;
+}
+
 void IPCManager_::query_rib_response_event_handler(rina::QueryRIBResponseEvent *e)
 {
 	ostringstream ss;
@@ -79,20 +90,6 @@ void IPCManager_::query_rib_response_event_handler(rina::QueryRIBResponseEvent *
 	//Auto release the read lock
 	rina::ReadScopedLock readlock(ipcp->rwlock, false);
 
-	ss << "Query RIB operation completed for IPC "
-		<< "process " << ipcp->get_name().toString() << endl;
-	FLUSH_LOG(DBG, ss);
-
-	for (lit = e->ribObjects.begin(); lit != e->ribObjects.end();
-			++lit) {
-		ss << "Name: " << lit->name_ <<
-			"; Class: "<< lit->class_;
-		ss << "; Instance: "<< lit->instance_ << endl;
-		ss << "Value: " << lit->displayable_value_ <<endl;
-		ss << "" << endl;
-	}
-
-	//Set query RIB response
 	QueryRIBPromise* promise = trans->get_promise<QueryRIBPromise>();
 
 	if(!promise){
@@ -102,8 +99,45 @@ void IPCManager_::query_rib_response_event_handler(rina::QueryRIBResponseEvent *
 		return;
 	}
 
+	//Format this page only, previous ones are already in the promise
+	ostringstream page;
+	for (lit = e->ribObjects.begin(); lit != e->ribObjects.end();
+			++lit) {
+		page << "Name: " << lit->name_ <<
+			"; Class: "<< lit->class_;
+		page << "; Instance: "<< lit->instance_ << endl;
+		page << "Value: " << lit->displayable_value_ <<endl;
+		page << "" << endl;
+	}
+	if(!trans->push_page(page.str())){
+		//The reader gave up waiting, stop querying
+		remove_transaction_state(trans->tid);
+		return;
+	}
+
+	//Partial page, ask for the objects after the last one received
+	if(e->more && !e->ribObjects.empty()){
+		try {
+			ipcp->queryRIB(trans->object_class, trans->object_name,
+				       0, 0, "", trans->tid, QUERY_RIB_PAGE_OBJS,
+				       e->ribObjects.back().name_);
+			return;
+		} catch (rina::Exception& ex) {
+			ss << "Could not request the next Query RIB page of "
+				<< "IPC process " << ipcp->get_name().toString()
+				<< ": " << ex.what() << endl;
+			FLUSH_LOG(ERR, ss);
+			trans->completed(IPCM_FAILURE);
+			remove_transaction_state(trans->tid);
+			return;
+		}
+	}
+
+	ss << "Query RIB operation completed for IPC "
+		<< "process " << ipcp->get_name().toString() << endl;
+	FLUSH_LOG(DBG, ss);
+
 	//Mark as completed
-	promise->serialized_rib = ss.str();
 	trans->completed(IPCM_SUCCESS);
 	remove_transaction_state(trans->tid);
 
@@ -37,18 +37,33 @@
 
 namespace rinad {
 
+//Maximum number of RIB objects requested per Query RIB response page
+#define QUERY_RIB_PAGE_OBJS 1000
+
 /**
 * RIB query transaction state
 */
 class RIBqTransState: public IPCPTransState{
 
 public:
-	RIBqTransState(Addon* callee, Promise* _promise, int _ipcp_id)
-				:IPCPTransState(callee, _promise, _ipcp_id){}
+	RIBqTransState(Addon* callee, Promise* _promise, int _ipcp_id,
+		       const std::string& _object_class,
+		       const std::string& _object_name)
+				:IPCPTransState(callee, _promise, _ipcp_id),
+				 object_class(_object_class),
+				 object_name(_object_name){}
 	virtual ~RIBqTransState(){};
 
-	//Output result
-	std::string result;
+	//
+	// Hand a formatted page over to the promise, unless the
+	// transaction was already finalised (e.g. the reader timed out
+	// and the promise may be gone)
+	//
+	bool push_page(const std::string& page);
+
+	//Filters of the query, to request the following pages
+	std::string object_class;
+	std::string object_name;
 };
 
 }//rinad namespace
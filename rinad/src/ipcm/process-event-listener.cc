@@ -20,6 +20,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -222,4 +223,89 @@ int OSProcessMonitor::run()
 	return 0;
 }
 
+//Class ChildProcessMonitor
+struct child_exit {
+	pid_t pid;
+	int status;
+};
+
+ChildProcessMonitor::ChildProcessMonitor()
+		: rina::SimpleThread(std::string("child-process-monitor"), false)
+{
+	stop = false;
+	if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC)) {
+		LOG_ERR("Could not create the child exit pipe: %s",
+			strerror(errno));
+		pipe_fds[0] = pipe_fds[1] = -1;
+	}
+}
+
+ChildProcessMonitor::~ChildProcessMonitor() throw()
+{
+	if (pipe_fds[0] >= 0) {
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+	}
+}
+
+void ChildProcessMonitor::do_stop()
+{
+	rina::ScopedLock g(lock);
+	stop = true;
+}
+
+bool ChildProcessMonitor::has_to_stop()
+{
+	rina::ScopedLock g(lock);
+	return stop;
+}
+
+void ChildProcessMonitor::child_exited(pid_t pid, int status)
+{
+	struct child_exit ce;
+	ssize_t n;
+
+	if (pipe_fds[1] < 0)
+		return;
+
+	ce.pid = pid;
+	ce.status = status;
+
+	// Writes smaller than PIPE_BUF are atomic; if the pipe is full
+	// the notification is lost and the waiter times out
+	n = write(pipe_fds[1], &ce, sizeof(ce));
+	(void)n;
+}
+
+int ChildProcessMonitor::run()
+{
+	struct child_exit ce;
+	struct pollfd fds[1];
+	int pollnum;
+
+	if (pipe_fds[0] < 0)
+		return -1;
+
+	LOG_DBG("Child process monitor started");
+
+	fds[0].fd = pipe_fds[0];
+	fds[0].events = POLLIN;
+
+	while (!has_to_stop()) {
+		pollnum = poll(fds, 1, 500);
+		if (pollnum <= 0 || !(fds[0].revents & POLLIN)) {
+			continue;
+		}
+
+		while (read(pipe_fds[0], &ce, sizeof(ce)) == sizeof(ce)) {
+			IPCManager->child_process_exited_handler(ce.pid,
+								 ce.status);
+		}
+	}
+
+	LOG_DBG("Child process monitor stopped");
+
+	return 0;
+}
+
 } //namespace rinad
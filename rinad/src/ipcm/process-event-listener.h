@@ -22,6 +22,8 @@
 #ifndef __PROCESS_EVENT_LISTENER_H__
 #define __PROCESS_EVENT_LISTENER_H__
 
+#include <sys/types.h>
+
 #include <librina/concurrency.h>
 
 namespace rinad {
@@ -45,6 +47,28 @@ private:
 	int nl_sock;
 };
 
+/// Hands the exit status of the children of the IPC Manager (e.g. the
+/// modprobe processes loading kernel plugins) over to the IPC Manager.
+/// Children are reaped by the SIGCHLD handler, which cannot do more than
+/// writing the status to a pipe; this thread reads it from there.
+class ChildProcessMonitor: public rina::SimpleThread {
+public:
+	ChildProcessMonitor();
+	~ChildProcessMonitor() throw();
+	void do_stop();
+	int run();
+
+	/// Called from the SIGCHLD handler, async-signal-safe
+	void child_exited(pid_t pid, int status);
+
+private:
+	bool has_to_stop();
+
+	bool stop;
+	rina::Lockable lock;
+	int pipe_fds[2];
+};
+
 } //namespace rinad
 
 #endif  /* __PROCESS_EVENT_LISTENER_H__ */
@@ -0,0 +1,386 @@
+/*
+ * rtnetlink client used by the IPC Manager to program the IP routes,
+ * addresses and link state of the RINA IP devices
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define RINA_PREFIX     "ipcm.rtnetlink"
+#include <librina/logs.h>
+
+#include "rtnetlink.h"
+
+// Maximum number of requests per sendmsg(), keeps the acks of a batch
+// well within the socket receive buffer
+#define RTNL_BATCH_MAX		128
+
+// Maximum time to wait for the acks of a batch (s)
+#define RTNL_ACK_TIMEOUT	2
+
+// Room for the largest request we build
+#define RTNL_MSG_MAX		256
+
+namespace rinad {
+
+struct rtnl_request {
+	struct nlmsghdr hdr;
+	char payload[RTNL_MSG_MAX];
+};
+
+static void rtnl_add_attr(struct nlmsghdr * hdr, unsigned short type,
+			  const void * data, unsigned short len)
+{
+	struct rtattr * rta;
+
+	rta = (struct rtattr *) (((char *) hdr) + NLMSG_ALIGN(hdr->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+// Parses "address[/len]" (or "address[|len]"), the length defaults to
+// the full address
+static int rtnl_parse_prefix(const std::string& input, unsigned char * family,
+			     unsigned char * addr, unsigned char * addr_len,
+			     unsigned char * prefix_len)
+{
+	std::string prefix = input;
+	std::string::size_type pos;
+	std::string address;
+	int max_len;
+	char * end;
+	long len;
+
+	std::replace(prefix.begin(), prefix.end(), '|', '/');
+	pos = prefix.find('/');
+	address = prefix.substr(0, pos);
+
+	if (inet_pton(AF_INET, address.c_str(), addr) == 1) {
+		*family = AF_INET;
+		*addr_len = 4;
+		max_len = 32;
+	} else if (inet_pton(AF_INET6, address.c_str(), addr) == 1) {
+		*family = AF_INET6;
+		*addr_len = 16;
+		max_len = 128;
+	} else {
+		return -1;
+	}
+
+	if (pos == std::string::npos) {
+		*prefix_len = max_len;
+		return 0;
+	}
+
+	len = strtol(prefix.c_str() + pos + 1, &end, 10);
+	if (*end != '\0' || end == prefix.c_str() + pos + 1 ||
+			len < 0 || len > max_len)
+		return -1;
+	*prefix_len = len;
+
+	return 0;
+}
+
+//Class RTNetlinkTransaction
+RTNetlinkTransaction::RTNetlinkTransaction()
+{
+}
+
+int RTNetlinkTransaction::add_msg(const void * msg, unsigned int len,
+				  const std::string& description)
+{
+	unsigned int offset = buffer.size();
+
+	buffer.resize(offset + NLMSG_ALIGN(len));
+	memcpy(&buffer[offset], msg, len);
+	offsets.push_back(offset);
+	descriptions.push_back(description);
+	errors.push_back(0);
+
+	return 0;
+}
+
+int RTNetlinkTransaction::add_route(const std::string& prefix,
+				    const std::string& dev, bool add)
+{
+	struct rtnl_request req;
+	struct rtmsg * rtm;
+	unsigned char family, addr_len, prefix_len;
+	unsigned char addr[16];
+	int ifindex;
+
+	if (rtnl_parse_prefix(prefix, &family, addr, &addr_len, &prefix_len)) {
+		LOG_ERR("Invalid IP prefix %s", prefix.c_str());
+		return -1;
+	}
+
+	ifindex = if_nametoindex(dev.c_str());
+	if (!ifindex) {
+		LOG_ERR("Unknown network device %s", dev.c_str());
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.hdr.nlmsg_type = add ? RTM_NEWROUTE : RTM_DELROUTE;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	if (add)
+		req.hdr.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
+	rtm = (struct rtmsg *) NLMSG_DATA(&req.hdr);
+	rtm->rtm_family = family;
+	rtm->rtm_dst_len = prefix_len;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	rtm->rtm_protocol = RTPROT_BOOT;
+	rtm->rtm_scope = add ? RT_SCOPE_LINK : RT_SCOPE_NOWHERE;
+	rtm->rtm_type = RTN_UNICAST;
+
+	rtnl_add_attr(&req.hdr, RTA_DST, addr, addr_len);
+	rtnl_add_attr(&req.hdr, RTA_OIF, &ifindex, sizeof(ifindex));
+
+	return add_msg(&req, req.hdr.nlmsg_len, std::string("route ") +
+		       (add ? "add " : "delete ") + prefix + " dev " + dev);
+}
+
+int RTNetlinkTransaction::add_address(const std::string& prefix,
+				      const std::string& dev, bool add)
+{
+	struct rtnl_request req;
+	struct ifaddrmsg * ifa;
+	unsigned char family, addr_len, prefix_len;
+	unsigned char addr[16];
+	int ifindex;
+
+	if (rtnl_parse_prefix(prefix, &family, addr, &addr_len, &prefix_len)) {
+		LOG_ERR("Invalid IP address %s", prefix.c_str());
+		return -1;
+	}
+
+	ifindex = if_nametoindex(dev.c_str());
+	if (!ifindex) {
+		LOG_ERR("Unknown network device %s", dev.c_str());
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.hdr.nlmsg_type = add ? RTM_NEWADDR : RTM_DELADDR;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	if (add)
+		req.hdr.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
+	ifa = (struct ifaddrmsg *) NLMSG_DATA(&req.hdr);
+	ifa->ifa_family = family;
+	ifa->ifa_prefixlen = prefix_len;
+	ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa->ifa_index = ifindex;
+
+	rtnl_add_attr(&req.hdr, IFA_LOCAL, addr, addr_len);
+	rtnl_add_attr(&req.hdr, IFA_ADDRESS, addr, addr_len);
+
+	return add_msg(&req, req.hdr.nlmsg_len, std::string("address ") +
+		       (add ? "add " : "delete ") + prefix + " dev " + dev);
+}
+
+int RTNetlinkTransaction::set_link_up(const std::string& dev, bool up)
+{
+	struct rtnl_request req;
+	struct ifinfomsg * ifi;
+	int ifindex;
+
+	ifindex = if_nametoindex(dev.c_str());
+	if (!ifindex) {
+		LOG_ERR("Unknown network device %s", dev.c_str());
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.hdr.nlmsg_type = RTM_NEWLINK;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+
+	ifi = (struct ifinfomsg *) NLMSG_DATA(&req.hdr);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = ifindex;
+	ifi->ifi_flags = up ? IFF_UP : 0;
+	ifi->ifi_change = IFF_UP;
+
+	return add_msg(&req, req.hdr.nlmsg_len, std::string("link set ") +
+		       dev + (up ? " up" : " down"));
+}
+
+unsigned int RTNetlinkTransaction::size() const
+{
+	return offsets.size();
+}
+
+int RTNetlinkTransaction::get_error(unsigned int i) const
+{
+	return errors[i];
+}
+
+const std::string& RTNetlinkTransaction::get_description(unsigned int i) const
+{
+	return descriptions[i];
+}
+
+//Class RTNetlink
+RTNetlink::RTNetlink()
+{
+	fd = -1;
+	seq = time(NULL);
+}
+
+RTNetlink::~RTNetlink()
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+int RTNetlink::open_socket()
+{
+	struct sockaddr_nl local;
+	struct timeval tv;
+
+	if (fd >= 0)
+		return 0;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		LOG_ERR("Problems opening rtnetlink socket: %s",
+			strerror(errno));
+		return -1;
+	}
+
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	tv.tv_sec = RTNL_ACK_TIMEOUT;
+	tv.tv_usec = 0;
+	if (bind(fd, (struct sockaddr *) &local, sizeof(local)) ||
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+				   sizeof(tv))) {
+		LOG_ERR("Problems setting up rtnetlink socket: %s",
+			strerror(errno));
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+int RTNetlink::send_batch(RTNetlinkTransaction& trans, unsigned int first,
+			  unsigned int last)
+{
+	struct sockaddr_nl kernel;
+	struct nlmsghdr * hdr;
+	struct nlmsgerr * err;
+	unsigned int base = seq;
+	unsigned int pending = last - first;
+	unsigned int end, i;
+	char buf[8192];
+	int n;
+
+	end = last < trans.size() ? trans.offsets[last] : trans.buffer.size();
+	for (i = first; i < last; i++) {
+		hdr = (struct nlmsghdr *) &trans.buffer[trans.offsets[i]];
+		hdr->nlmsg_seq = seq++;
+	}
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+	if (sendto(fd, &trans.buffer[trans.offsets[first]],
+		   end - trans.offsets[first], 0, (struct sockaddr *) &kernel,
+		   sizeof(kernel)) < 0) {
+		LOG_ERR("Problems sending rtnetlink requests: %s",
+			strerror(errno));
+		return -1;
+	}
+
+	while (pending > 0) {
+		n = recv(fd, buf, sizeof(buf), 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERR("Problems receiving rtnetlink acks: %s",
+				strerror(errno));
+			return -1;
+		}
+
+		for (hdr = (struct nlmsghdr *) buf; NLMSG_OK(hdr, n);
+				hdr = NLMSG_NEXT(hdr, n)) {
+			if (hdr->nlmsg_type != NLMSG_ERROR ||
+					hdr->nlmsg_seq - base >= last - first)
+				continue;
+
+			err = (struct nlmsgerr *) NLMSG_DATA(hdr);
+			trans.errors[first + hdr->nlmsg_seq - base] = -err->error;
+			pending--;
+		}
+	}
+
+	return 0;
+}
+
+int RTNetlink::commit(RTNetlinkTransaction& trans)
+{
+	unsigned int first, last;
+	int failed = 0;
+
+	if (trans.size() == 0)
+		return 0;
+
+	if (open_socket())
+		return -1;
+
+	for (first = 0; first < trans.size(); first = last) {
+		last = std::min(first + RTNL_BATCH_MAX, trans.size());
+		if (send_batch(trans, first, last)) {
+			//The socket may hold stale acks now, start afresh
+			close(fd);
+			fd = -1;
+			return -1;
+		}
+	}
+
+	for (unsigned int i = 0; i < trans.size(); i++) {
+		if (trans.errors[i] == 0)
+			continue;
+
+		failed++;
+		LOG_DBG("rtnetlink request '%s' failed: %s",
+			trans.descriptions[i].c_str(),
+			strerror(trans.errors[i]));
+	}
+
+	return failed;
+}
+
+} //namespace rinad
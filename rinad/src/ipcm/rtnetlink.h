@@ -0,0 +1,102 @@
+/*
+ * rtnetlink client used by the IPC Manager to program the IP routes,
+ * addresses and link state of the RINA IP devices
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#ifndef __RTNETLINK_H__
+#define __RTNETLINK_H__
+
+#include <string>
+#include <vector>
+
+namespace rinad {
+
+/**
+ * A set of rtnetlink requests that are sent to the kernel together and
+ * acknowledged one by one. Requests are queued with the add_* and
+ * set_* methods and executed with RTNetlink::commit()
+ */
+class RTNetlinkTransaction {
+public:
+	RTNetlinkTransaction();
+
+	/// Queue the addition or removal of a route to prefix through dev.
+	/// Prefixes are "address[/len]", '|' is accepted instead of '/'
+	int add_route(const std::string& prefix, const std::string& dev,
+		      bool add);
+
+	/// Queue the addition or removal of address/len to dev
+	int add_address(const std::string& prefix, const std::string& dev,
+			bool add);
+
+	/// Queue setting dev administratively up or down
+	int set_link_up(const std::string& dev, bool up);
+
+	/// Number of requests in the transaction
+	unsigned int size() const;
+
+	/// Result of the i-th request after commit: 0 or a positive errno
+	int get_error(unsigned int i) const;
+
+	/// Human readable description of the i-th request
+	const std::string& get_description(unsigned int i) const;
+
+private:
+	friend class RTNetlink;
+
+	int add_msg(const void * msg, unsigned int len,
+		    const std::string& description);
+
+	/// Queued messages, back to back and NLMSG_ALIGNed
+	std::vector<char> buffer;
+
+	/// Offset of each message in buffer
+	std::vector<unsigned int> offsets;
+
+	std::vector<std::string> descriptions;
+	std::vector<int> errors;
+};
+
+/**
+ * An rtnetlink socket. Not thread safe, callers serialize the access
+ */
+class RTNetlink {
+public:
+	RTNetlink();
+	~RTNetlink();
+
+	/**
+	 * Send all the requests of trans and wait for their acks. Requests
+	 * are sent in batches of up to RTNL_BATCH_MAX messages per sendmsg().
+	 * Returns the number of requests that failed, or -1 if there were
+	 * problems talking to the kernel
+	 */
+	int commit(RTNetlinkTransaction& trans);
+
+private:
+	int open_socket();
+	int send_batch(RTNetlinkTransaction& trans, unsigned int first,
+		       unsigned int last);
+
+	int fd;
+	unsigned int seq;
+};
+
+} //namespace rinad
+
+#endif  /* __RTNETLINK_H__ */
@@ -0,0 +1,151 @@
+//
+// rtnetlink client test, runs in its own network namespace
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+// MA  02110-1301  USA
+//
+
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <sched.h>
+
+#include "rtnetlink.h"
+
+// Number of routes added and removed, more than a single batch
+#define NUM_ROUTES 300
+
+// Exit code that makes automake skip the test
+#define TEST_SKIPPED 77
+
+using namespace rinad;
+
+static unsigned long now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::string route_prefix(int i)
+{
+	std::stringstream ss;
+
+	ss << "10." << 100 + i / 256 << "." << i % 256 << ".0|24";
+	return ss.str();
+}
+
+int test_link_and_address(RTNetlink& rtnl)
+{
+	RTNetlinkTransaction trans;
+
+	if (trans.set_link_up("lo", true) ||
+			trans.add_address("10.77.0.1/24", "lo", true)) {
+		std::cout << "Problems queueing requests" << std::endl;
+		return -1;
+	}
+
+	if (rtnl.commit(trans) != 0) {
+		std::cout << "Problems setting up lo" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+int test_batched_routes(RTNetlink& rtnl)
+{
+	RTNetlinkTransaction add, again, del;
+	unsigned long t0, t_add, t_del;
+
+	for (int i = 0; i < NUM_ROUTES; i++) {
+		add.add_route(route_prefix(i), "lo", true);
+		del.add_route(route_prefix(i), "lo", false);
+	}
+
+	t0 = now_us();
+	if (rtnl.commit(add) != 0) {
+		std::cout << "Problems adding routes" << std::endl;
+		return -1;
+	}
+	t_add = now_us() - t0;
+
+	//The routes are there, adding one again must fail on its own
+	again.add_route("10.200.0.0/16", "lo", true);
+	again.add_route(route_prefix(7), "lo", true);
+	if (rtnl.commit(again) != 1 || again.get_error(0) != 0 ||
+			again.get_error(1) != EEXIST) {
+		std::cout << "Expected only the duplicated route to fail"
+			  << std::endl;
+		return -1;
+	}
+
+	t0 = now_us();
+	if (rtnl.commit(del) != 0) {
+		std::cout << "Problems removing routes" << std::endl;
+		return -1;
+	}
+	t_del = now_us() - t0;
+
+	std::cout << NUM_ROUTES << " routes added in " << t_add
+		  << " us, removed in " << t_del << " us" << std::endl;
+
+	//Now they are gone
+	if (rtnl.commit(del) != NUM_ROUTES || del.get_error(0) != ESRCH) {
+		std::cout << "Removed routes are still there" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+int test_invalid_requests()
+{
+	RTNetlinkTransaction trans;
+
+	if (trans.add_route("10.0.0.0/33", "lo", true) == 0 ||
+			trans.add_route("10.0.0.x", "lo", true) == 0 ||
+			trans.add_route("10.0.0.0/8", "rina.1.1", true) == 0 ||
+			trans.size() != 0) {
+		std::cout << "Invalid requests were queued" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+int main()
+{
+	RTNetlink rtnl;
+
+	std::cout << "TESTING RTNETLINK CLIENT\n";
+
+	if (unshare(CLONE_NEWNET)) {
+		std::cout << "Cannot create a network namespace, skipping\n";
+		return TEST_SKIPPED;
+	}
+
+	if (test_link_and_address(rtnl) || test_batched_routes(rtnl) ||
+			test_invalid_requests()) {
+		std::cout << "rtnetlink client test failed\n";
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "rtnetlink client tests passed\n";
+	return EXIT_SUCCESS;
+}
@@ -23,9 +23,13 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <dirent.h>
+#include <dlfcn.h>
 
 #include <cstdlib>
 #include <sstream>
+#include <string>
+#include <vector>
 
 //No ipcp module
 #include "ipcp-logging.h"
@@ -114,6 +118,84 @@ void sighandler_sigint(int signum)
 }
 
 
+//Identity and arguments of a standby IPCP once it has been bound
+static std::vector<std::string> standby_args;
+static char * standby_argv[9];
+
+//Map and resolve the policy plugins while the IPCP is idle, so that
+//loading them once the IPCP is in a DIF is just a reference count bump
+static void standby_preload_plugins()
+{
+	struct dirent * dirp;
+	std::string name;
+	DIR * dp;
+
+	dp = opendir(PLUGINSDIR);
+	if (!dp)
+		return;
+
+	while ((dirp = readdir(dp)) != 0) {
+		name = dirp->d_name;
+		if (name.size() < 4 ||
+				name.compare(name.size() - 3, 3, ".so") != 0)
+			continue;
+
+		//The handle is deliberately leaked to keep the plugin mapped
+		if (!dlopen((std::string(PLUGINSDIR) + "/" + name).c_str(),
+			    RTLD_NOW))
+			LOG_IPCP_WARN("Cannot preload plugin %s: %s",
+				      name.c_str(), dlerror());
+	}
+
+	closedir(dp);
+}
+
+//A standby IPCP is started by the IPC Manager ahead of time as
+//"ipcp --standby <log-level>" and then blocks until the IPC Manager
+//writes its name, instance, id, IPCM port, log file and type on stdin,
+//one per line. Then argv is rewritten as if the IPCP had been started
+//with those arguments.
+static void standby_wait(int & argc, char ** & argv)
+{
+	std::string log_level = argv[2];
+	std::string buffer;
+	std::string::size_type pos;
+	char chunk[512];
+	ssize_t n;
+
+	standby_preload_plugins();
+
+	standby_args.push_back(argv[0]);
+	while (standby_args.size() < 8) {
+		pos = buffer.find('\n');
+		if (pos != std::string::npos) {
+			standby_args.push_back(buffer.substr(0, pos));
+			buffer.erase(0, pos + 1);
+			//The log level is not part of the binding
+			if (standby_args.size() == 5)
+				standby_args.push_back(log_level);
+			continue;
+		}
+
+		n = read(STDIN_FILENO, chunk, sizeof(chunk));
+		if (n <= 0)
+			//The IPC Manager is gone or no longer needs us. Skip
+			//the static destructors of the preloaded plugins, the
+			//IPCP never got to use them.
+			_exit(EXIT_SUCCESS);
+		buffer.append(chunk, n);
+	}
+
+	close(STDIN_FILENO);
+
+	for (unsigned int i = 0; i < standby_args.size(); i++)
+		standby_argv[i] = const_cast<char *>(standby_args[i].c_str());
+	standby_argv[standby_args.size()] = 0;
+
+	argc = standby_args.size();
+	argv = standby_argv;
+}
+
 int main(int argc, char * argv[])
 {
 	int retval;
@@ -125,6 +207,9 @@ int main(int argc, char * argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (argc == 3 && std::string(argv[1]) == "--standby")
+		standby_wait(argc, argv);
+
 	if (argc != 8) {
 		LOG_IPCP_ERR("Wrong number of arguments: expected 8, got %d", argc);
 		return EXIT_FAILURE;
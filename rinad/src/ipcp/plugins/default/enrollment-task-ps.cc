@@ -23,8 +23,11 @@
 #define IPCP_MODULE "enrollment-task-ps-default"
 #include "../../ipcp-logging.h"
 #include <string>
+#include <map>
+#include <sstream>
 #include <climits>
 #include <assert.h>
+#include <time.h>
 
 #include "ipcp/ipc-process.h"
 #include "ipcp/enrollment-task.h"
@@ -34,6 +37,263 @@
 
 namespace rinad {
 
+/// DFT synchronization state and enrollment metrics shared by all the
+/// enrollment state machines of the IPC Process. The enroller remembers, for
+/// each peer, the DFT version the peer confirmed and the entries (key and
+/// seqnum) the peer may hold since then; the enrollee remembers the last
+/// version it got from each enroller and presents it when it re-enrolls, so
+/// that only what changed since then has to be sent again.
+class EnrollmentSyncState {
+public:
+	static const unsigned int MAX_DFT_ENTRIES_PER_MESSAGE_DEFAULT = 100;
+
+	EnrollmentSyncState();
+
+	/// Copies into base the entries the peer may hold if it is in sync
+	/// with version and incremental sync is enabled. Returns false if a
+	/// full sync is required
+	bool get_snapshot(const std::string& peer,
+			  unsigned long long version,
+			  std::map<std::string, unsigned int>& base);
+
+	/// Returns a new version to hand out with a DFT state
+	unsigned long long next_snapshot_version();
+
+	/// The peer confirmed it got the DFT state with version, make it the
+	/// base of its next incremental sync
+	void commit_snapshot(const std::string& peer,
+			     unsigned long long version,
+			     const std::map<std::string, unsigned int>& snapshot);
+
+	/// The session with the peer is over. While connected it got the
+	/// entries sent during the enrollment and the DFT updates propagated
+	/// by the namespace manager, whether it completed the enrollment or
+	/// not, so add them to its base. Entries already in the base stay,
+	/// so that their deletion is sent if the peer missed it
+	void peer_disconnected(const std::string& peer,
+			       const std::map<std::string, unsigned int>& entries);
+
+	/// Enrollee side, last version obtained from peer (0 if none)
+	unsigned long long get_peer_version(const std::string& peer);
+	void set_peer_version(const std::string& peer,
+			      unsigned long long version);
+
+	/// Update metrics
+	void dft_sent(unsigned int entries, unsigned int deletions,
+		      unsigned int messages, bool incremental);
+	void enrollment_completed(unsigned long duration_ms);
+
+	std::string toString();
+
+	unsigned int get_max_dft_entries_per_msg();
+	void set_max_dft_entries_per_msg(unsigned int max_entries);
+	bool is_incremental_dft_sync();
+	void set_incremental_dft_sync(bool incremental);
+
+private:
+	rina::Lockable lock;
+	unsigned int max_dft_entries_per_msg;
+	bool incremental_dft_sync;
+
+	struct dft_snapshot {
+		unsigned long long version;
+		std::map<std::string, unsigned int> entries;
+	};
+
+	unsigned long long next_version;
+	std::map<std::string, dft_snapshot> sent_snapshots;
+	std::map<std::string, unsigned long long> received_versions;
+
+	unsigned int enrollments;
+	unsigned long last_duration_ms;
+	unsigned long max_duration_ms;
+	unsigned long long total_duration_ms;
+	unsigned int full_syncs;
+	unsigned int incremental_syncs;
+	unsigned long long dft_entries_sent;
+	unsigned long long dft_deletions_sent;
+	unsigned long long dft_messages_sent;
+};
+
+static unsigned long enrollment_time_ms()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+EnrollmentSyncState::EnrollmentSyncState()
+{
+	max_dft_entries_per_msg = MAX_DFT_ENTRIES_PER_MESSAGE_DEFAULT;
+	incremental_dft_sync = true;
+	enrollments = 0;
+	last_duration_ms = 0;
+	max_duration_ms = 0;
+	total_duration_ms = 0;
+	full_syncs = 0;
+	incremental_syncs = 0;
+	dft_entries_sent = 0;
+	dft_deletions_sent = 0;
+	dft_messages_sent = 0;
+
+	//Seed with the time, so that versions handed out before an IPCP
+	//restart are not mistaken for new ones
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	next_version = ((unsigned long long) now.tv_sec) << 20;
+}
+
+bool EnrollmentSyncState::get_snapshot(const std::string& peer,
+				       unsigned long long version,
+				       std::map<std::string, unsigned int>& base)
+{
+	rina::ScopedLock g(lock);
+	std::map<std::string, dft_snapshot>::iterator it;
+
+	if (!incremental_dft_sync || version == 0)
+		return false;
+
+	it = sent_snapshots.find(peer);
+	if (it == sent_snapshots.end() || it->second.version != version)
+		return false;
+
+	base = it->second.entries;
+
+	return true;
+}
+
+unsigned long long EnrollmentSyncState::next_snapshot_version()
+{
+	rina::ScopedLock g(lock);
+
+	return ++next_version;
+}
+
+void EnrollmentSyncState::commit_snapshot(const std::string& peer,
+					  unsigned long long version,
+					  const std::map<std::string, unsigned int>& snapshot)
+{
+	rina::ScopedLock g(lock);
+	dft_snapshot& snap = sent_snapshots[peer];
+
+	snap.version = version;
+	snap.entries = snapshot;
+}
+
+void EnrollmentSyncState::peer_disconnected(const std::string& peer,
+					    const std::map<std::string, unsigned int>& entries)
+{
+	rina::ScopedLock g(lock);
+	std::map<std::string, dft_snapshot>::iterator it;
+	std::map<std::string, unsigned int>::const_iterator ent_it;
+
+	//Without a base the peer gets a full sync anyway
+	it = sent_snapshots.find(peer);
+	if (it == sent_snapshots.end())
+		return;
+
+	for (ent_it = entries.begin(); ent_it != entries.end(); ++ent_it)
+		it->second.entries[ent_it->first] = ent_it->second;
+}
+
+unsigned long long EnrollmentSyncState::get_peer_version(const std::string& peer)
+{
+	rina::ScopedLock g(lock);
+	std::map<std::string, unsigned long long>::iterator it;
+
+	it = received_versions.find(peer);
+	if (it == received_versions.end())
+		return 0;
+
+	return it->second;
+}
+
+void EnrollmentSyncState::set_peer_version(const std::string& peer,
+					   unsigned long long version)
+{
+	rina::ScopedLock g(lock);
+
+	if (version == 0)
+		received_versions.erase(peer);
+	else
+		received_versions[peer] = version;
+}
+
+void EnrollmentSyncState::dft_sent(unsigned int entries, unsigned int deletions,
+				   unsigned int messages, bool incremental)
+{
+	rina::ScopedLock g(lock);
+
+	if (incremental)
+		incremental_syncs++;
+	else
+		full_syncs++;
+	dft_entries_sent += entries;
+	dft_deletions_sent += deletions;
+	dft_messages_sent += messages;
+}
+
+void EnrollmentSyncState::enrollment_completed(unsigned long duration_ms)
+{
+	rina::ScopedLock g(lock);
+
+	enrollments++;
+	last_duration_ms = duration_ms;
+	total_duration_ms += duration_ms;
+	if (duration_ms > max_duration_ms)
+		max_duration_ms = duration_ms;
+}
+
+std::string EnrollmentSyncState::toString()
+{
+	rina::ScopedLock g(lock);
+	std::stringstream ss;
+
+	ss << "Enrollments completed: " << enrollments;
+	ss << "; Last duration (ms): " << last_duration_ms;
+	ss << "; Max duration (ms): " << max_duration_ms;
+	ss << "; Avg duration (ms): "
+	   << (enrollments ? total_duration_ms / enrollments : 0) << std::endl;
+	ss << "DFT syncs sent: full " << full_syncs
+	   << ", incremental " << incremental_syncs;
+	ss << "; DFT entries sent: " << dft_entries_sent;
+	ss << "; DFT deletions sent: " << dft_deletions_sent;
+	ss << "; DFT messages sent: " << dft_messages_sent << std::endl;
+	ss << "Max DFT entries per message: " << max_dft_entries_per_msg;
+	ss << "; Incremental DFT sync: " << incremental_dft_sync;
+
+	return ss.str();
+}
+
+unsigned int EnrollmentSyncState::get_max_dft_entries_per_msg()
+{
+	rina::ScopedLock g(lock);
+
+	return max_dft_entries_per_msg;
+}
+
+void EnrollmentSyncState::set_max_dft_entries_per_msg(unsigned int max_entries)
+{
+	rina::ScopedLock g(lock);
+
+	max_dft_entries_per_msg = max_entries;
+}
+
+bool EnrollmentSyncState::is_incremental_dft_sync()
+{
+	rina::ScopedLock g(lock);
+
+	return incremental_dft_sync;
+}
+
+void EnrollmentSyncState::set_incremental_dft_sync(bool incremental)
+{
+	rina::ScopedLock g(lock);
+
+	incremental_dft_sync = incremental;
+}
+
 /// The base class that contains the common aspects of both
 /// enrollment state machines: the enroller side and the enrolle
 /// side
@@ -79,17 +339,25 @@ protected:
 				   const rina::ApplicationProcessNamingInformation& remote_naming_info,
 				   int timeout,
 				   const rina::ApplicationProcessNamingInformation& supporting_dif_name,
-				   rina::Timer * timer);
-
-	/// Sends all the DIF dynamic information
-	void sendDIFDynamicInformation();
+				   rina::Timer * timer,
+				   EnrollmentSyncState * sync_state);
 
 	/// Send the entries in the DFT (if any)
 	void sendDFTEntries();
 
+	/// Send a list of DFT entries, split in as many M_CREATEs as
+	/// required to honour the maximum number of entries per message.
+	/// Returns the number of messages sent
+	unsigned int sendDFTEntries(const std::list<rina::DirectoryForwardingTableEntry>& entries);
+
+	/// Log and record the time it took to complete the enrollment
+	void recordEnrollmentTime();
+
 	IPCProcess * ipc_process_;
 	IPCPSecurityManager * sec_man_;
 	std::string token;
+	EnrollmentSyncState * sync_state_;
+	unsigned long start_time_ms_;
 };
 
 //Class BaseEnrollmentStateMachine
@@ -159,12 +427,15 @@ BaseEnrollmentStateMachine::BaseEnrollmentStateMachine(IPCProcess * ipc_process,
 						       const rina::ApplicationProcessNamingInformation& remote_naming_info,
 						       int timeout,
 						       const rina::ApplicationProcessNamingInformation& supporting_dif_name,
-						       rina::Timer * timer) :
+						       rina::Timer * timer,
+						       EnrollmentSyncState * sync_state) :
 				IEnrollmentStateMachine(ipc_process, remote_naming_info,
 						timeout, supporting_dif_name, timer)
 {
 	ipc_process_ = ipc_process;
 	sec_man_ = ipc_process->security_manager_;
+	sync_state_ = sync_state;
+	start_time_ms_ = enrollment_time_ms();
 }
 
 void BaseEnrollmentStateMachine::operational_status_start(int invoke_id,
@@ -172,15 +443,6 @@ void BaseEnrollmentStateMachine::operational_status_start(int invoke_id,
 {
 }
 
-void BaseEnrollmentStateMachine::sendDIFDynamicInformation()
-{
-	//Send DirectoryForwardingTableEntries
-	sendDFTEntries();
-
-	//Send neighbors (including myself)
-	sendNeighbors();
-}
-
 void BaseEnrollmentStateMachine::sendDFTEntries()
 {
 	std::list<rina::DirectoryForwardingTableEntry> dftEntries =
@@ -191,24 +453,61 @@ void BaseEnrollmentStateMachine::sendDFTEntries()
 		return;
 	}
 
-	try {
-		encoders::DFTEListEncoder encoder;
-		rina::cdap_rib::obj_info_t obj;
-		obj.class_ = DFTRIBObj::class_name;
-		obj.name_ = DFTRIBObj::object_name;
-		encoder.encode(dftEntries, obj.value_);
-		rina::cdap_rib::filt_info_t filt;
-		rina::cdap_rib::flags_t flags;
+	sync_state_->dft_sent(dftEntries.size(), 0,
+			      sendDFTEntries(dftEntries), false);
+}
 
-		rib_daemon_->getProxy()->remote_create(con,
-						       obj,
-						       flags,
-						       filt,
-						       NULL);
-	} catch (rina::Exception &e) {
-		LOG_IPCP_ERR("Problems sending DFT entries: %s",
-			     e.what());
+unsigned int BaseEnrollmentStateMachine::sendDFTEntries(const std::list<rina::DirectoryForwardingTableEntry>& entries)
+{
+	std::list<rina::DirectoryForwardingTableEntry> chunk;
+	std::list<rina::DirectoryForwardingTableEntry>::const_iterator it;
+	unsigned int max_entries = sync_state_->get_max_dft_entries_per_msg();
+	unsigned int messages = 0;
+
+	it = entries.begin();
+	while (it != entries.end()) {
+		chunk.push_back(*it);
+		++it;
+
+		//A maximum of 0 means no limit
+		if (it != entries.end() &&
+				(max_entries == 0 || chunk.size() < max_entries))
+			continue;
+
+		try {
+			encoders::DFTEListEncoder encoder;
+			rina::cdap_rib::obj_info_t obj;
+			obj.class_ = DFTRIBObj::class_name;
+			obj.name_ = DFTRIBObj::object_name;
+			encoder.encode(chunk, obj.value_);
+			rina::cdap_rib::filt_info_t filt;
+			rina::cdap_rib::flags_t flags;
+
+			rib_daemon_->getProxy()->remote_create(con,
+							       obj,
+							       flags,
+							       filt,
+							       NULL);
+			messages++;
+		} catch (rina::Exception &e) {
+			LOG_IPCP_ERR("Problems sending DFT entries: %s",
+				     e.what());
+		}
+
+		chunk.clear();
 	}
+
+	return messages;
+}
+
+void BaseEnrollmentStateMachine::recordEnrollmentTime()
+{
+	unsigned long duration = enrollment_time_ms() - start_time_ms_;
+
+	sync_state_->enrollment_completed(duration);
+	LOG_IPCP_INFO("Enrollment with %s completed in %lu ms",
+		      remote_peer_.name_.getProcessNamePlusInstance().c_str(),
+		      duration);
 }
 
 /// Handles the operations related to the "daf.management.enrollment" objects
@@ -246,6 +545,24 @@ private:
 	IPCPEnrollmentTask * enrollment_task_;
 };
 
+/// Shows the enrollment metrics and DFT synchronization counters
+class EnrollmentStatsRIBObject: public IPCPRIBObj {
+public:
+	EnrollmentStatsRIBObject(IPCProcess * ipc_process,
+				 EnrollmentSyncState * sync_state);
+	const std::string& get_class() const {
+		return class_name;
+	};
+
+	const std::string get_displayable_value() const;
+
+	const static std::string class_name;
+	const static std::string object_name;
+
+private:
+	EnrollmentSyncState * sync_state_;
+};
+
 /// The state machine of the party that wants to
 /// become a new member of the DIF.
 class EnrolleeStateMachine: public BaseEnrollmentStateMachine {
@@ -253,7 +570,8 @@ public:
 	EnrolleeStateMachine(IPCProcess * ipc_process,
 			    const rina::ApplicationProcessNamingInformation& remote_naming_info,
 			    int timeout,
-			    rina::Timer * timer);
+			    rina::Timer * timer,
+			    EnrollmentSyncState * sync_state);
 	~EnrolleeStateMachine() { };
 
 	/// Called by the DIFMembersSetObject to initiate the enrollment sequence
@@ -324,22 +642,26 @@ private:
 	bool allowed_to_start_early_;
 	int stop_request_invoke_id_;
 	int start_request_invoke_id;
+	unsigned long long dft_sync_version_;
 };
 
 // Class EnrolleeStateMachine
 EnrolleeStateMachine::EnrolleeStateMachine(IPCProcess * ipc_process,
 					   const rina::ApplicationProcessNamingInformation& remote_naming_info,
-					   int timeout, rina::Timer * timer):
+					   int timeout, rina::Timer * timer,
+					   EnrollmentSyncState * sync_state):
 		BaseEnrollmentStateMachine(ipc_process,
 					   remote_naming_info,
 					   timeout,
-					   rina::ApplicationProcessNamingInformation(), timer)
+					   rina::ApplicationProcessNamingInformation(), timer,
+					   sync_state)
 {
 	was_dif_member_before_enrollment_ = false;
 	last_scheduled_task_ = 0;
 	allowed_to_start_early_ = false;
 	stop_request_invoke_id_ = 0;
 	start_request_invoke_id = 0;
+	dft_sync_version_ = 0;
 }
 
 void EnrolleeStateMachine::initiateEnrollment(const rina::EnrollmentRequest& enrollmentRequest,
@@ -499,6 +821,10 @@ void EnrolleeStateMachine::connectResponse(int result,
 		if (ipc_process_->get_address() != 0) {
 			was_dif_member_before_enrollment_ = true;
 			eiRequest.address_ = ipc_process_->get_address();
+
+			//Tell the enroller what we already got from it
+			eiRequest.dft_sync_version_ =
+				sync_state_->get_peer_version(remote_peer_.name_.getProcessNamePlusInstance());
 		} else {
 			rina::DIFInformation difInformation;
 			difInformation.dif_name_ = enr_request.event_.dafName;
@@ -600,6 +926,7 @@ void EnrolleeStateMachine::stop(const configs::EnrollmentInformationRequest& eiR
 	allowed_to_start_early_ = eiRequest.allowed_to_start_early_;
 	stop_request_invoke_id_ = invoke_id;
 	token = eiRequest.token;
+	dft_sync_version_ = eiRequest.dft_sync_version_;
 
 	LOG_IPCP_DBG("Allowed to start early: %d \n Token: %s",
 		     allowed_to_start_early_,
@@ -746,6 +1073,12 @@ void EnrolleeStateMachine::enrollmentCompleted()
 	//Send DirectoryForwardingTableEntries
 	sendDFTEntries();
 
+	//Remember the DFT version we are in sync with, to present it if we
+	//have to re-enroll with the same peer
+	sync_state_->set_peer_version(remote_peer_.name_.getProcessNamePlusInstance(),
+				      dft_sync_version_);
+	recordEnrollmentTime();
+
 	enrollment_task_->enrollmentCompleted(remote_peer_, true,
 					      enr_request.event_.prepare_for_handover,
 					      enr_request.event_.disc_neigh_name);
@@ -979,8 +1312,9 @@ public:
 			     const rina::ApplicationProcessNamingInformation& remote_naming_info,
 			     int timeout,
 			     const rina::ApplicationProcessNamingInformation& supporting_dif_name,
-			     rina::Timer * timer);
-	~EnrollerStateMachine() { };
+			     rina::Timer * timer,
+			     EnrollmentSyncState * sync_state);
+	~EnrollerStateMachine();
 
 	/// An M_CONNECT message has been received.  Handle the transition from the
 	/// NULL to the WAIT_START_ENROLLMENT state.
@@ -1044,10 +1378,27 @@ private:
         /// the IPC process that is enrolling to me
         void sendDIFStaticInformation();
 
+        /// Send the DFT to the IPC process that is enrolling to me. If it
+        /// presents the version of the last DFT state it got from me (and
+        /// full_sync is false) send only the entries that changed since then
+        /// and the deletions of the ones that are gone. Returns the version
+        /// of the state sent, which is committed once the peer completes
+        /// the enrollment
+        unsigned long long sendDFTState(unsigned long long peer_version,
+        				bool full_sync);
+
         void enrollmentCompleted();
 
+        /// Key and seqnum of the DFT entries
+        void getDFTSnapshot(std::map<std::string, unsigned int>& snapshot);
+
 	INamespaceManager * namespace_manager_;
 	int connect_message_invoke_id_;
+
+	/// DFT state handed out to the peer, not committed until the peer
+	/// confirms the enrollment
+	unsigned long long dft_version_;
+	std::map<std::string, unsigned int> dft_snapshot_;
 };
 
 //Class EnrollerStateMachine
@@ -1055,16 +1406,48 @@ EnrollerStateMachine::EnrollerStateMachine(IPCProcess * ipc_process,
 					   const rina::ApplicationProcessNamingInformation& remote_naming_info,
 					   int timeout,
 					   const rina::ApplicationProcessNamingInformation& supporting_dif_name,
-					   rina::Timer * timer):
+					   rina::Timer * timer,
+					   EnrollmentSyncState * sync_state):
 		BaseEnrollmentStateMachine(ipc_process,
 					   remote_naming_info,
 					   timeout,
 					   supporting_dif_name,
-					   timer)
+					   timer,
+					   sync_state)
 {
 	namespace_manager_ = ipc_process->namespace_manager_;
 	enroller_ = true;
 	connect_message_invoke_id_ = 0;
+	dft_version_ = 0;
+}
+
+EnrollerStateMachine::~EnrollerStateMachine()
+{
+	std::map<std::string, unsigned int> current;
+	std::map<std::string, unsigned int>::const_iterator it;
+
+	//No DFT state handed out in this session
+	if (dft_version_ == 0)
+		return;
+
+	//Last contact with the peer, it may hold what it got from us in
+	//this session and every DFT update propagated until now
+	getDFTSnapshot(current);
+	for (it = dft_snapshot_.begin(); it != dft_snapshot_.end(); ++it)
+		current.insert(*it);
+
+	sync_state_->peer_disconnected(remote_peer_.name_.getProcessNamePlusInstance(),
+				       current);
+}
+
+void EnrollerStateMachine::getDFTSnapshot(std::map<std::string, unsigned int>& snapshot)
+{
+	std::list<rina::DirectoryForwardingTableEntry> entries =
+			namespace_manager_->getDFTEntries();
+	std::list<rina::DirectoryForwardingTableEntry>::const_iterator it;
+
+	for (it = entries.begin(); it != entries.end(); ++it)
+		snapshot[it->getKey()] = it->seqnum_;
 }
 
 void EnrollerStateMachine::connect(const rina::cdap::CDAPMessage& message,
@@ -1303,6 +1686,84 @@ void EnrollerStateMachine::sendDIFStaticInformation()
 	}
 }
 
+unsigned long long EnrollerStateMachine::sendDFTState(unsigned long long peer_version,
+						     bool full_sync)
+{
+	std::list<rina::DirectoryForwardingTableEntry> entries =
+			namespace_manager_->getDFTEntries();
+	std::list<rina::DirectoryForwardingTableEntry> to_send;
+	std::list<rina::DirectoryForwardingTableEntry>::const_iterator it;
+	std::list<std::string> to_delete;
+	std::list<std::string>::const_iterator del_it;
+	std::map<std::string, unsigned int> snapshot;
+	std::map<std::string, unsigned int>::const_iterator snap_it;
+	std::map<std::string, unsigned int> last;
+	std::string peer = remote_peer_.name_.getProcessNamePlusInstance();
+	unsigned int my_address = ipc_process_->get_address();
+	unsigned int messages;
+	bool incremental;
+
+	for (it = entries.begin(); it != entries.end(); ++it)
+		snapshot[it->getKey()] = it->seqnum_;
+
+	incremental = !full_sync &&
+		sync_state_->get_snapshot(peer, peer_version, last);
+
+	for (it = entries.begin(); it != entries.end(); ++it) {
+		//The peer drops the entries pointing to me when it loses
+		//connectivity with me, always send them
+		if (incremental && it->address_ != my_address) {
+			snap_it = last.find(it->getKey());
+			if (snap_it != last.end() && snap_it->second == it->seqnum_)
+				continue;
+		}
+
+		to_send.push_back(*it);
+	}
+
+	if (incremental) {
+		for (snap_it = last.begin(); snap_it != last.end(); ++snap_it) {
+			if (snapshot.find(snap_it->first) == snapshot.end())
+				to_delete.push_back(snap_it->first);
+		}
+	}
+
+	dft_snapshot_ = snapshot;
+	dft_version_ = sync_state_->next_snapshot_version();
+
+	messages = sendDFTEntries(to_send);
+
+	for (del_it = to_delete.begin(); del_it != to_delete.end(); ++del_it) {
+		try {
+			rina::cdap_rib::obj_info_t obj;
+			obj.class_ = DFTEntryRIBObj::class_name;
+			obj.name_ = DFTEntryRIBObj::object_name_prefix + *del_it;
+			rina::cdap_rib::flags_t flags;
+			rina::cdap_rib::filt_info_t filt;
+
+			rib_daemon_->getProxy()->remote_delete(con,
+							       obj,
+							       flags,
+							       filt,
+							       NULL);
+			messages++;
+		} catch (rina::Exception &e) {
+			LOG_IPCP_ERR("Problems sending DFT entry deletion: %s",
+				     e.what());
+		}
+	}
+
+	sync_state_->dft_sent(to_send.size(), to_delete.size(),
+			      messages, incremental);
+
+	LOG_IPCP_DBG("Sent %s DFT state to %s: %u entries, %u deletions in %u messages",
+		     incremental ? "incremental" : "full",
+		     peer.c_str(), (unsigned int) to_send.size(),
+		     (unsigned int) to_delete.size(), messages);
+
+	return dft_version_;
+}
+
 void EnrollerStateMachine::start(configs::EnrollmentInformationRequest& eiRequest,
 				 int invoke_id,
 				 const rina::cdap_rib::con_handle_t &con_handle)
@@ -1401,7 +1862,10 @@ void EnrollerStateMachine::start(configs::EnrollmentInformationRequest& eiReques
 		sendDIFStaticInformation();
 	}
 
-	sendDIFDynamicInformation();
+	//Send DirectoryForwardingTableEntries and neighbors (including myself)
+	eiRequest.dft_sync_version_ = sendDFTState(eiRequest.dft_sync_version_,
+						   requiresInitialization);
+	sendNeighbors();
 
 	int temp = std::rand();
 	ss << temp;
@@ -1594,8 +2058,14 @@ void EnrollerStateMachine::enrollmentCompleted()
 {
 	state_ = STATE_ENROLLED;
 
+	//The peer has the DFT state sent during this enrollment
+	sync_state_->commit_snapshot(remote_peer_.name_.getProcessNamePlusInstance(),
+				     dft_version_, dft_snapshot_);
+
 	createOrUpdateNeighborInformation(true);
 
+	recordEnrollmentTime();
+
 	enrollment_task_->enrollmentCompleted(remote_peer_, false, false,
 					      rina::ApplicationProcessNamingInformation());
 }
@@ -1681,8 +2151,27 @@ void EnrollmentRIBObject::sendErrorMessage(unsigned int port_id)
 	}
 }
 
+//Class EnrollmentStatsRIBObject
+const std::string EnrollmentStatsRIBObject::class_name = "EnrollmentStats";
+const std::string EnrollmentStatsRIBObject::object_name = "/difm/enr/stats";
+
+EnrollmentStatsRIBObject::EnrollmentStatsRIBObject(IPCProcess * ipc_process,
+						   EnrollmentSyncState * sync_state) :
+	IPCPRIBObj(ipc_process, class_name)
+{
+	sync_state_ = sync_state;
+}
+
+const std::string EnrollmentStatsRIBObject::get_displayable_value() const
+{
+	return sync_state_->toString();
+}
+
 class EnrollmentTaskPs: public IPCPEnrollmentTaskPS {
 public:
+	static const std::string MAX_DFT_ENTRIES_PER_MESSAGE;
+	static const std::string INCREMENTAL_DFT_SYNC;
+
 	EnrollmentTaskPs(IPCProcess * ipcp_);
         virtual ~EnrollmentTaskPs() {};
         void connect_received(const rina::cdap::CDAPMessage& cdapMessage,
@@ -1716,8 +2205,12 @@ private:
         rina::IPCResourceManager * irm;
         IPCPRIBDaemon * rib_daemon;
         rina::Timer timer;
+        EnrollmentSyncState sync_state;
 };
 
+const std::string EnrollmentTaskPs::MAX_DFT_ENTRIES_PER_MESSAGE = "maxDFTEntriesPerMessage";
+const std::string EnrollmentTaskPs::INCREMENTAL_DFT_SYNC = "incrementalDFTSync";
+
 EnrollmentTaskPs::EnrollmentTaskPs(IPCProcess * ipcp_) :
 		ipcp(ipcp_), et (ipcp_->enrollment_task_), timeout(0),
 		irm(ipcp->resource_allocator_->get_n_minus_one_flow_manager()),
@@ -1736,6 +2229,9 @@ void EnrollmentTaskPs::populate_rib()
 		tmp = new EnrollmentRIBObject(ipcp);
 		rib_daemon->addObjRIB(EnrollmentRIBObject::object_name, &tmp);
 
+		tmp = new EnrollmentStatsRIBObject(ipcp, &sync_state);
+		rib_daemon->addObjRIB(EnrollmentStatsRIBObject::object_name, &tmp);
+
 		tmp = new NeighborsRIBObj(ipcp);
 		rib_daemon->addObjRIB(NeighborsRIBObj::object_name, &tmp);
 		rib_daemon->getProxy()->addCreateCallbackSchema(vers,
@@ -1930,12 +2426,14 @@ IEnrollmentStateMachine * EnrollmentTaskPs::createEnrollmentStateMachine(const r
 		if (enrollee){
 			stateMachine = new EnrolleeStateMachine(ipcp,
 								apNamingInfo,
-								timeout, &timer);
+								timeout, &timer,
+								&sync_state);
 		}else{
 			stateMachine = new EnrollerStateMachine(ipcp,
 								apNamingInfo,
 								timeout,
-								supportingDifName, &timer);
+								supportingDifName, &timer,
+								&sync_state);
 		}
 
 		et->add_enrollment_state_machine(portId, stateMachine);
@@ -1952,11 +2450,47 @@ void EnrollmentTaskPs::set_dif_configuration(const rina::DIFConfiguration& dif_c
 {
 	rina::PolicyConfig psconf = dif_configuration.et_configuration_.policy_set_;
 	timeout = psconf.get_param_value_as_int(EnrollmentTask::ENROLL_TIMEOUT_IN_MS);
+
+	// Maximum DFT entries per M_CREATE sent during enrollment
+	try {
+		sync_state.set_max_dft_entries_per_msg(
+			psconf.get_param_value_as_uint(MAX_DFT_ENTRIES_PER_MESSAGE));
+	} catch (rina::Exception &e) {
+		sync_state.set_max_dft_entries_per_msg(
+			EnrollmentSyncState::MAX_DFT_ENTRIES_PER_MESSAGE_DEFAULT);
+	}
+
+	// Only send what changed to re-enrolling members
+	try {
+		sync_state.set_incremental_dft_sync(
+			psconf.get_param_value_as_bool(INCREMENTAL_DFT_SYNC));
+	} catch (rina::Exception &e) {
+		sync_state.set_incremental_dft_sync(true);
+	}
 }
 
 int EnrollmentTaskPs::set_policy_set_param(const std::string& name,
                                             const std::string& value)
 {
+	if (name == MAX_DFT_ENTRIES_PER_MESSAGE) {
+		std::stringstream ss(value);
+		unsigned int max_entries;
+
+		if (!(ss >> max_entries)) {
+			LOG_IPCP_ERR("Invalid value for %s: %s",
+				     name.c_str(), value.c_str());
+			return -1;
+		}
+
+		sync_state.set_max_dft_entries_per_msg(max_entries);
+		return 0;
+	}
+
+	if (name == INCREMENTAL_DFT_SYNC) {
+		sync_state.set_incremental_dft_sync(value == "true");
+		return 0;
+	}
+
         LOG_IPCP_DBG("No policy-set-specific parameters to set (%s, %s)",
                         name.c_str(), value.c_str());
         return -1;
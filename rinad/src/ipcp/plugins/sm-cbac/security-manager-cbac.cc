@@ -68,6 +68,11 @@ int getTimeMs()
         return (int) time_seconds * 1000 + (int) (time_.tv_usec / 1000);
 }
 
+int getTokenExpiry(const Token_t &token)
+{
+        return token.token_exp * 3600 * 1000 + FIRST_TIME_RCV_TOKEN; //token.issued_time;
+}
+
 void get_NewApplicationProcessNamingInfo_t(
                 const rina::ApplicationProcessNamingInformation &name,
                 rina::messages::applicationProcessNamingInfo_t &gpb)
@@ -690,6 +695,81 @@ bool ProfileParser::getAuthPolicyName(std::string fileName, std::string& name)
 }
 
 
+//----------------------
+
+/***
+ * class CapabilityMatcher
+ * **/
+
+// Decisions remembered per token, forgotten all at once when exceeded
+#define MAX_CAP_DECISIONS 1024
+
+void CapabilityMatcher::compile(const std::list<Capability_t> & capList)
+{
+        all = false;
+        resources.clear();
+        decisions.clear();
+        caps = capList;
+
+        for (std::list<Capability_t>::iterator it = caps.begin();
+                        it != caps.end(); ++it) {
+                if (it->compare("all", "all"))
+                        all = true;
+                resources[it->operation].insert(it->ressource);
+        }
+}
+
+// The object is granted if it contains a resource granted for the exact
+// operation, or if it is part of a resource granted for an operation
+// containing oper
+bool CapabilityMatcher::lookup(const std::string & obj_name,
+                               const std::string & oper) const
+{
+        std::map<std::string, std::set<std::string> >::const_iterator op;
+        std::set<std::string>::const_iterator res;
+        std::list<Capability_t>::const_iterator it;
+
+        op = resources.find(oper);
+        if (op != resources.end()) {
+                for (res = op->second.begin(); res != op->second.end();
+                                ++res) {
+                        if (obj_name.find(*res) != std::string::npos)
+                                return true;
+                }
+        }
+
+        for (it = caps.begin(); it != caps.end(); ++it) {
+                if (it->ressource.find(obj_name) != std::string::npos &&
+                    it->operation.find(oper) != std::string::npos)
+                        return true;
+        }
+
+        return false;
+}
+
+bool CapabilityMatcher::match(const std::string & obj_name,
+                              const std::string & oper)
+{
+        std::map<std::string, bool>::iterator it;
+        std::string key;
+        bool result;
+
+        if (all)
+                return true;
+
+        key = oper + "|" + obj_name;
+        it = decisions.find(key);
+        if (it != decisions.end())
+                return it->second;
+
+        result = lookup(obj_name, oper);
+        if (decisions.size() >= MAX_CAP_DECISIONS)
+                decisions.clear();
+        decisions[key] = result;
+
+        return result;
+}
+
 //----------------------
 
 /*** 
@@ -848,6 +928,14 @@ SecurityManagerCBACPs::SecurityManagerCBACPs(IPCPSecurityManager * dm_)
                        my_ipcp_name.c_str());
 }
 
+SecurityManagerCBACPs::~SecurityManagerCBACPs()
+{
+        for (std::map<std::string, RSA *>::iterator it = issuer_keys.begin();
+                        it != issuer_keys.end(); ++it) {
+                RSA_free(it->second);
+        }
+}
+
 int SecurityManagerCBACPs::loadProfilesByName(const rina::ApplicationProcessNamingInformation &ipcpProfileHolder,
 					      IPCPProfile_t &requestedIPCPProfile,
                                               const rina::ApplicationProcessNamingInformation &difProfileHolder,
@@ -1011,8 +1099,16 @@ RSA* SecurityManagerCBACPs::loadTokenGeneratorPublicKey(const std::string& token
 {
         BIO * keystore;
         std::stringstream ss;
-        //Read peer public key from keystore
+        std::map<std::string, RSA *>::iterator it;
+
         ss << keyStorePath << "/" << tokenGenIpcpName;
+
+        rina::ScopedLock g(lock);
+        it = issuer_keys.find(ss.str());
+        if (it != issuer_keys.end())
+                return it->second;
+
+        //Read peer public key from keystore
         keystore =  BIO_new_file(ss.str().c_str(), "r");
         if (!keystore) {
                 LOG_ERR("Problems opening keystore file at: %s",
@@ -1027,6 +1123,9 @@ RSA* SecurityManagerCBACPs::loadTokenGeneratorPublicKey(const std::string& token
                         ss.str().c_str(), ERR_error_string(ERR_get_error(), NULL));
                 return NULL;
         }
+
+        // Owned by the cache from now on
+        issuer_keys[ss.str()] = token_generator_pub_key;
         return token_generator_pub_key;
 }
 
@@ -1286,7 +1385,7 @@ int SecurityManagerCBACPs::checkTokenValidity(const TokenPlusSignature_t &tokenS
         }
         
         //4. check expiration time
-        int until = token.token_exp * 3600 * 1000 + FIRST_TIME_RCV_TOKEN; //token.issued_time;
+        int until = cbac_helpers::getTokenExpiry(token);
         if(until >= now) {
                 ss << "\n\t 4. Token has not expired yet, continue token validation"<< endl;
                 LOG_IPCP_DBG("%s", ss.str().c_str());
@@ -1372,6 +1471,38 @@ void SecurityManagerCBACPs::checkRIBOperation(const rina::cdap_rib::auth_policy_
                 return;
         }
         
+        std::string raw;
+        std::string oper = cbac_helpers::opcodeToString(opcode);
+        std::map<int, VerifiedToken_t>::iterator it;
+        int now = cbac_helpers::getTimeMs();
+
+        if (auth.options.size_ > 0)
+                raw.assign((const char *) auth.options.message_,
+                           auth.options.size_);
+
+        //reuse the token validated before in this security context, as
+        //long as it is the same one and has not expired
+        {
+                rina::ScopedLock g(lock);
+
+                it = verified_tokens.find(con.port_id);
+                if (it != verified_tokens.end() && it->second.raw == raw &&
+                    it->second.keystore_path == my_sc->keystore_path &&
+                    it->second.until >= now &&
+                    (requestor == std::string() ||
+                     it->second.requestor == requestor)) {
+                        if (it->second.capabilities.match(obj_name, oper)) {
+                                LOG_IPCP_DBG("Request is included in requestor capability; Grant access");
+                                res.code_ = rina::cdap_rib::CDAP_SUCCESS;
+                                return;
+                        }
+
+                        LOG_IPCP_ERR("Request in NOT in requestor capability; Deny request");
+                        res.code_ = rina::cdap_rib::CDAP_ERROR;
+                        return;
+                }
+        }
+
         //get token
         TokenPlusSignature_t tokenSign;
         deserializeTokenPlusSign(auth.options, tokenSign);
@@ -1382,24 +1513,24 @@ void SecurityManagerCBACPs::checkRIBOperation(const rina::cdap_rib::auth_policy_
         
         if (checkTokenValidity(tokenSign, requestor, my_sc->keystore_path) < 0){
                 LOG_IPCP_ERR("Invalid Token, Deny request ");
+                rina::ScopedLock g(lock);
+                verified_tokens.erase(con.port_id);
                 res.code_ = rina::cdap_rib::CDAP_ERROR;
                 return; 
         }
         
-        Token_t token = tokenSign.token;
-        std::list<Capability_t> tokenCapList = token.token_cap;
-            
-        for(std::list<Capability_t>::iterator it = tokenCapList.begin();
-                it != tokenCapList.end(); ++it) {
-                if (it->compare(obj_name, cbac_helpers::opcodeToString(opcode)) ||
-                    it->compare("all", "all") ||
-                    (it->operation == cbac_helpers::opcodeToString(opcode) 
-                        //s1.find(s2) != std::string::npos
-                        and (obj_name.find(it->ressource) != std::string::npos))){
-                        LOG_IPCP_INFO("Request is included in requestor capability; Grant access");
-                        res.code_ = rina::cdap_rib::CDAP_SUCCESS;
-                        return;
-                }
+        rina::ScopedLock g(lock);
+        VerifiedToken_t & verified = verified_tokens[con.port_id];
+        verified.raw = raw;
+        verified.requestor = requestor;
+        verified.keystore_path = my_sc->keystore_path;
+        verified.until = cbac_helpers::getTokenExpiry(tokenSign.token);
+        verified.capabilities.compile(tokenSign.token.token_cap);
+
+        if (verified.capabilities.match(obj_name, oper)) {
+                LOG_IPCP_INFO("Request is included in requestor capability; Grant access");
+                res.code_ = rina::cdap_rib::CDAP_SUCCESS;
+                return;
         }
         
         LOG_IPCP_ERR("Request in NOT in requestor capability; Deny request");
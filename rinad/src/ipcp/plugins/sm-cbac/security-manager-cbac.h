@@ -25,6 +25,8 @@
 #include <fstream>
 #include <sstream>
 #include <list>
+#include <map>
+#include <set>
 #include "ipcp/components.h"
 #include <librina/json/json.h>
 // #include <librina/timer.h>
@@ -179,6 +181,38 @@ typedef struct TokenPlusSignature{
 
 //------------------------
 
+/* The capabilities of a token, grouped by operation so that RIB operations
+ * are granted without searching every capability each time */
+class CapabilityMatcher {
+public:
+        CapabilityMatcher() : all(false) {};
+        void compile(const std::list<Capability_t> & capList);
+        bool match(const std::string & obj_name, const std::string & oper);
+private:
+        bool lookup(const std::string & obj_name,
+                    const std::string & oper) const;
+
+        /// The token grants "all" the operations on "all" the objects
+        bool all;
+        /// Resources granted, by operation
+        std::map<std::string, std::set<std::string> > resources;
+        std::list<Capability_t> caps;
+        /// Decisions already taken, by operation and object name
+        std::map<std::string, bool> decisions;
+};
+
+/* A token that passed validation, until it expires */
+typedef struct VerifiedToken {
+        /// Serialized token plus signature, as received
+        std::string raw;
+        std::string requestor;
+        std::string keystore_path;
+        int until;
+        CapabilityMatcher capabilities;
+} VerifiedToken_t;
+
+//------------------------
+
 
 class ProfileParser {
 public:
@@ -265,7 +299,7 @@ public:
         bool acceptFlow(const configs::Flow& newFlow);
         int set_policy_set_param(const std::string& name,
                         	 const std::string& value);
-        virtual ~SecurityManagerCBACPs() {}
+        virtual ~SecurityManagerCBACPs();
         
 private:
         // Data model of the security manager component.
@@ -282,6 +316,10 @@ private:
         rina::ser_obj_t my_token;
         //std::map<rina::cdap_rib::con_handle_t, TokenPlusSignature_t*> token_sign_per_ipcp;
         rina::Lockable lock;
+        /// Validated tokens, by port-id of the security context
+        std::map<int, VerifiedToken_t> verified_tokens;
+        /// Public keys of the token generators, by keystore file
+        std::map<std::string, RSA *> issuer_keys;
         int generateTokenForTokenGenerator(rina::cdap_rib::auth_policy_t &, const rina::cdap_rib::con_handle_t &);
 };
 
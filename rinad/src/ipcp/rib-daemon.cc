@@ -639,15 +639,20 @@ void IPCPRIBDaemonImpl::nMinusOneFlowAllocated(rina::NMinusOneFlowAllocatedEvent
 
 void IPCPRIBDaemonImpl::processQueryRIBRequestEvent(const rina::QueryRIBRequestEvent& event)
 {
+	bool more;
+
 	std::list<rina::rib::RIBObjectData> result = ribd->get_rib_objects_data(
 		rib,
 		event.getObjectClass(),
-		event.getObjectName());
+		event.getObjectName(),
+		event.getCursor(),
+		event.getPageSize(),
+		QUERY_RIB_MAX_PAGE_BYTES,
+		more);
 
 	try {
-		rina::extendedIPCManager->queryRIBResponse(event,
-							   0,
-							   result);
+		rina::extendedIPCManager->queryRIBResponse(event, 0, result,
+							   more);
 	} catch (rina::Exception &e) {
 		LOG_IPCP_ERR("Problems sending query RIB response to IPC Manager: %s",
 			     e.what());
@@ -31,6 +31,10 @@
 
 namespace rinad {
 
+/// Bound on the size of the objects returned in a Query RIB response,
+/// keeps each page well below the maximum control message size
+#define QUERY_RIB_MAX_PAGE_BYTES (256 * 1024)
+
 /// Reads sdus from the Kernel IPC Process, and
 /// passes them to the RIB Daemon
 class ManagementSDUReaderData {
@@ -334,6 +334,7 @@ bool test_enrollment_information_request() {
 	request.supporting_difs_.push_back(name1);
 	request.supporting_difs_.push_back(name2);
 	request.address_ = 141234;
+	request.dft_sync_version_ = 1ULL << 40;
 
 	encoder.encode(request, encoded_obj);
 	encoder.decode(encoded_obj, recovered_obj);
@@ -342,6 +343,10 @@ bool test_enrollment_information_request() {
 		return false;
 	}
 
+	if (request.dft_sync_version_ != recovered_obj.dft_sync_version_) {
+		return false;
+	}
+
 	if (request.supporting_difs_.size() != recovered_obj.supporting_difs_.size()) {
 		return false;
 	}
@@ -0,0 +1,120 @@
+#!/bin/bash
+
+#
+# rina-device-perf.sh
+#
+# IP over RINA throughput test of the rina device: allocates an IP VPN flow
+# between two VPNs registered to a single normal IPC Process
+# (conf/ipcmanager.conf-rina-device), moves the two rina devices of the flow
+# into their own network namespaces and runs iperf3 between them, with one
+# and with several parallel TCP streams.
+#
+
+ME="rina-device-perf"
+
+PREFIX="/usr/local/irati"
+DURATION="10"
+STREAMS="1 4"
+CONF_DIR="$(cd "$(dirname "$0")" && pwd)/conf"
+NS_A="rina-dev-a"
+NS_B="rina-dev-b"
+
+function dump_help() {
+    echo "$ME [OPTIONS...]"
+    echo " "
+    echo "Options:"
+    echo "  -p, --prefix [PATH]     IRATI installation prefix (default $PREFIX)"
+    echo "  -t, --time [NUMBER]     duration of each test in seconds"
+    echo "  -P, --parallel [LIST]   parallel TCP streams to test (default \"$STREAMS\")"
+    echo "  -h, --help              print this help, then exit"
+}
+
+while test $# -gt 0; do
+    case "$1" in
+        -h|--help)
+            dump_help
+            exit 0
+            ;;
+        -p|--prefix)
+            PREFIX="$2"
+            shift
+            ;;
+        -t|--time)
+            DURATION="$2"
+            shift
+            ;;
+        -P|--parallel)
+            STREAMS="$2"
+            shift
+            ;;
+        *)
+            echo "$ME: Unknown option '$1'"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+BIN="$PREFIX/bin"
+CTL="$BIN/irati-ctl --unix-socket $PREFIX/var/run/ipcm-console.sock"
+WORK_DIR=$(mktemp -d) || exit 1
+
+function cleanup() {
+    [ -n "$SERVER_PID" ] && kill $SERVER_PID 2>/dev/null
+    [ -n "$IPCM_PID" ] && kill $IPCM_PID 2>/dev/null
+    wait 2>/dev/null
+    ip netns del $NS_A 2>/dev/null
+    ip netns del $NS_B 2>/dev/null
+    rm -rf $WORK_DIR
+}
+trap cleanup EXIT
+
+which iperf3 > /dev/null || { echo "$ME: iperf3 not found"; exit 1; }
+modprobe normal-ipcp || { echo "$ME: Cannot load normal-ipcp"; exit 1; }
+
+# The IPCM looks for the DIF templates next to its configuration file
+cp $CONF_DIR/ipcmanager.conf-rina-device $CONF_DIR/default.dif $WORK_DIR
+sed -i "s|/usr/local/irati|$PREFIX|g" $WORK_DIR/ipcmanager.conf-rina-device
+
+$BIN/ipcm -c $WORK_DIR/ipcmanager.conf-rina-device > $WORK_DIR/ipcm.log 2>&1 &
+IPCM_PID=$!
+sleep 3
+
+# Both ends of the flow are local: the KFA creates a rina device for each
+# of the two port-ids
+$CTL register-ip-vpn vpn.a normal.DIF
+$CTL register-ip-vpn vpn.b normal.DIF
+$CTL allocate-ip-vpn-flow vpn.a vpn.b normal.DIF
+sleep 1
+
+DEVS=$(ip -o link show | sed -n 's/^[0-9]*: \(rina\.[0-9]*\.[0-9]*\)[:@].*/\1/p')
+set -- $DEVS
+if [ $# -ne 2 ]; then
+    echo "$ME: Expected two rina devices, found '$DEVS'"
+    exit 1
+fi
+
+ip netns add $NS_A || exit 1
+ip netns add $NS_B || exit 1
+ip link set $1 netns $NS_A || exit 1
+ip link set $2 netns $NS_B || exit 1
+ip netns exec $NS_A ip addr add 10.100.0.1 peer 10.100.0.2 dev $1
+ip netns exec $NS_B ip addr add 10.100.0.2 peer 10.100.0.1 dev $2
+ip netns exec $NS_A ip link set $1 up
+ip netns exec $NS_B ip link set $2 up
+
+ip netns exec $NS_A iperf3 -s > $WORK_DIR/server.log 2>&1 &
+SERVER_PID=$!
+sleep 1
+
+RET=0
+for N in $STREAMS; do
+    echo "== $N TCP stream(s)"
+    ip netns exec $NS_B iperf3 -c 10.100.0.1 -t $DURATION -P $N || RET=1
+done
+
+# Packets dropped by the rina devices, on both sides
+ip netns exec $NS_A ip -s link show $1
+ip netns exec $NS_B ip -s link show $2
+
+exit $RET
@@ -0,0 +1,112 @@
+#!/bin/bash
+
+#
+# shim-eth-vlan-perf.sh
+#
+# Throughput test of the shim-eth-vlan over a veth pair: brings up two shim
+# IPC Processes on VLAN 100 of the two ends of the pair
+# (conf/ipcmanager.conf-ethvlan-veth) and runs rinaperf between them, with
+# GRO off and on at the receiving end. With GRO on, veth receives in NAPI
+# context (kernels 5.13 and later) and the shim gets the frames in lists.
+#
+# The IPC Manager tells DIFs apart by name while the shim takes the VLAN id
+# from it, so the two shims are in DIFs "100" and "0100": the same VLAN.
+# Both veth ends stay in the initial network namespace: the shim only
+# looks up interfaces there, so they cannot be moved to their own ones.
+#
+
+ME="shim-eth-vlan-perf"
+
+PREFIX="/usr/local/irati"
+DURATION="10"
+SDU_SIZES="64 512 1400"
+CONF_DIR="$(cd "$(dirname "$0")" && pwd)/conf"
+IF_A="veth-a"
+IF_B="veth-b"
+VLAN="100"
+
+function dump_help() {
+    echo "$ME [OPTIONS...]"
+    echo " "
+    echo "Options:"
+    echo "  -p, --prefix [PATH]     IRATI installation prefix (default $PREFIX)"
+    echo "  -t, --time [NUMBER]     duration of each test in seconds"
+    echo "  -s, --sizes [LIST]      SDU sizes to test (default \"$SDU_SIZES\")"
+    echo "  -h, --help              print this help, then exit"
+}
+
+while test $# -gt 0; do
+    case "$1" in
+        -h|--help)
+            dump_help
+            exit 0
+            ;;
+        -p|--prefix)
+            PREFIX="$2"
+            shift
+            ;;
+        -t|--time)
+            DURATION="$2"
+            shift
+            ;;
+        -s|--sizes)
+            SDU_SIZES="$2"
+            shift
+            ;;
+        *)
+            echo "$ME: Unknown option '$1'"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+BIN="$PREFIX/bin"
+WORK_DIR=$(mktemp -d) || exit 1
+
+function cleanup() {
+    [ -n "$SERVER_PID" ] && kill $SERVER_PID 2>/dev/null
+    [ -n "$IPCM_PID" ] && kill $IPCM_PID 2>/dev/null
+    wait 2>/dev/null
+    ip link del $IF_A 2>/dev/null
+    rm -rf $WORK_DIR
+}
+trap cleanup EXIT
+
+which ethtool > /dev/null || { echo "$ME: ethtool not found"; exit 1; }
+modprobe shim-eth-vlan || { echo "$ME: Cannot load shim-eth-vlan"; exit 1; }
+
+ip link add $IF_A type veth peer name $IF_B || exit 1
+for IF in $IF_A $IF_B; do
+    ip link add link $IF name $IF.$VLAN type vlan id $VLAN || exit 1
+    ip link set $IF up
+    ip link set $IF.$VLAN up
+done
+
+# The IPCM looks for the DIF templates next to its configuration file
+cp $CONF_DIR/ipcmanager.conf-ethvlan-veth \
+   $CONF_DIR/shim-eth-vlan-veth-a.dif \
+   $CONF_DIR/shim-eth-vlan-veth-b.dif $WORK_DIR
+sed -i "s|/usr/local/irati|$PREFIX|g" $WORK_DIR/ipcmanager.conf-ethvlan-veth
+
+$BIN/ipcm -c $WORK_DIR/ipcmanager.conf-ethvlan-veth > $WORK_DIR/ipcm.log 2>&1 &
+IPCM_PID=$!
+sleep 3
+
+$BIN/rinaperf -l -d $VLAN > $WORK_DIR/server.log 2>&1 &
+SERVER_PID=$!
+sleep 1
+
+RET=0
+for GRO in off on; do
+    ethtool -K $IF_A gro $GRO || RET=1
+    for SIZE in $SDU_SIZES; do
+        echo "== GRO $GRO, $SIZE bytes SDUs"
+        $BIN/rinaperf -d 0$VLAN -t perf -s $SIZE -D $DURATION || RET=1
+    done
+done
+
+# Frames dropped on the receive side
+ip -s link show $IF_A.$VLAN
+
+exit $RET
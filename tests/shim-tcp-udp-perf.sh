@@ -0,0 +1,90 @@
+#!/bin/bash
+
+#
+# shim-tcp-udp-perf.sh
+#
+# Loopback throughput test of the shim-tcp-udp: brings up two shim IPC
+# Processes on 127.0.0.1 and 127.0.0.2 (conf/ipcmanager.conf-tcpudp-loopback)
+# and runs rinaperf between them, over UDP and over TCP flows.
+#
+
+ME="shim-tcp-udp-perf"
+
+PREFIX="/usr/local/irati"
+DURATION="10"
+SDU_SIZES="64 512 1400"
+CONF_DIR="$(cd "$(dirname "$0")" && pwd)/conf"
+
+function dump_help() {
+    echo "$ME [OPTIONS...]"
+    echo " "
+    echo "Options:"
+    echo "  -p, --prefix [PATH]     IRATI installation prefix (default $PREFIX)"
+    echo "  -t, --time [NUMBER]     duration of each test in seconds"
+    echo "  -s, --sizes [LIST]      SDU sizes to test (default \"$SDU_SIZES\")"
+    echo "  -h, --help              print this help, then exit"
+}
+
+while test $# -gt 0; do
+    case "$1" in
+        -h|--help)
+            dump_help
+            exit 0
+            ;;
+        -p|--prefix)
+            PREFIX="$2"
+            shift
+            ;;
+        -t|--time)
+            DURATION="$2"
+            shift
+            ;;
+        -s|--sizes)
+            SDU_SIZES="$2"
+            shift
+            ;;
+        *)
+            echo "$ME: Unknown option '$1'"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+BIN="$PREFIX/bin"
+WORK_DIR=$(mktemp -d) || exit 1
+
+function cleanup() {
+    [ -n "$SERVER_PID" ] && kill $SERVER_PID 2>/dev/null
+    [ -n "$IPCM_PID" ] && kill $IPCM_PID 2>/dev/null
+    wait 2>/dev/null
+    rm -rf $WORK_DIR
+}
+trap cleanup EXIT
+
+modprobe shim-tcp-udp || { echo "$ME: Cannot load shim-tcp-udp"; exit 1; }
+
+# The IPCM looks for the DIF templates next to its configuration file
+cp $CONF_DIR/ipcmanager.conf-tcpudp-loopback \
+   $CONF_DIR/shim-tcp-udp-lo1.dif \
+   $CONF_DIR/shim-tcp-udp-lo2.dif $WORK_DIR
+sed -i "s|/usr/local/irati|$PREFIX|g" $WORK_DIR/ipcmanager.conf-tcpudp-loopback
+
+$BIN/ipcm -c $WORK_DIR/ipcmanager.conf-tcpudp-loopback > $WORK_DIR/ipcm.log 2>&1 &
+IPCM_PID=$!
+sleep 3
+
+$BIN/rinaperf -l -d lo1.DIF > $WORK_DIR/server.log 2>&1 &
+SERVER_PID=$!
+sleep 1
+
+RET=0
+for GAP in -1 0; do
+    if [ "$GAP" == "0" ]; then KIND="tcp"; else KIND="udp"; fi
+    for SIZE in $SDU_SIZES; do
+        echo "== $KIND flow, $SIZE bytes SDUs"
+        $BIN/rinaperf -d lo2.DIF -t perf -g $GAP -s $SIZE -D $DURATION || RET=1
+    done
+done
+
+exit $RET